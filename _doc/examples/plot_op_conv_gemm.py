@@ -0,0 +1,81 @@
+"""
+.. _l-example-conv-gemm:
+
+Matrix multiplication behind Conv
+=================================
+
+Operators Conv and ConvTranspose compute a matrix multiplication
+*alpha op(A) op(B) + beta C* for every image and group. The
+reference implementation computes one dot product per coefficient
+of the result. The blocked implementation packs panels of *A* and
+*B* so that they stay in cache and computes tiles of *C* with a
+register-tiled microkernel (scalar code, AVX2 + FMA or AVX-512).
+The script measures both in GFLOP/s and compares them to
+:epkg:`numpy`.
+
+.. contents::
+    :local:
+
+Benchmark
++++++++++
+
+An instruction set the CPU does not support raises
+an exception and is skipped. The reference implementation
+is only measured on small matrices.
+"""
+from time import perf_counter
+import numpy
+import pandas
+import matplotlib.pyplot as plt
+from mlprodict.onnxrt.ops_cpu.op_conv_ import (  # pylint: disable=E0611,E0401
+    gemm_float, gemm_double)
+
+
+def measure(fct, A, B, C, transA, transB, impl, repeat):
+    begin = perf_counter()
+    for _ in range(repeat):
+        fct(A, B, C, transA, transB, 1, 0, impl)
+    return (perf_counter() - begin) / repeat
+
+
+fcts = {'float32': (numpy.float32, gemm_float),
+        'float64': (numpy.float64, gemm_double)}
+obs = []
+for dtype, (cl, fct) in fcts.items():
+    for n in [32, 64, 128, 256, 512, 1024]:
+        A = numpy.random.randn(n, n).astype(cl)
+        B = numpy.random.randn(n, n).astype(cl)
+        C = numpy.zeros((n, n), dtype=cl)
+        repeat = max(2, 2 ** 27 // n ** 3)
+        for transA, transB in [(False, False), (True, False),
+                               (False, True), (True, True)]:
+            for impl in ['naive', 'scalar', 'avx2', 'avx512']:
+                if impl == 'naive' and n > 256:
+                    continue
+                try:
+                    t = measure(fct, A, B, C, transA, transB, impl, repeat)
+                except ValueError:
+                    continue
+                obs.append(dict(dtype=dtype, n=n, trans="%d%d" % (transA, transB),
+                                impl=impl, gflops=2 * n ** 3 / t * 1e-9))
+        begin = perf_counter()
+        for _ in range(repeat):
+            A @ B
+        t = (perf_counter() - begin) / repeat
+        obs.append(dict(dtype=dtype, n=n, trans="00", impl='numpy',
+                        gflops=2 * n ** 3 / t * 1e-9))
+
+df = pandas.DataFrame(obs)
+piv = df.pivot_table(index=['dtype', 'trans', 'n'],
+                     columns='impl', values='gflops')
+print(piv)
+
+#####################################
+# GFLOP/s
+# +++++++
+
+fig, ax = plt.subplots(1, 2, figsize=(12, 4))
+for i, dtype in enumerate(fcts):
+    piv.loc[dtype, '00'].plot(ax=ax[i], logx=True, logy=True,
+                             title="GFLOP/s - %s - A B" % dtype)
+plt.show()
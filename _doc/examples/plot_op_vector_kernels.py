@@ -0,0 +1,60 @@
+"""
+.. _l-example-vector-kernels:
+
+Vector kernels and instruction sets
+===================================
+
+The dot product is implemented for three instruction sets:
+scalar code, AVX2 + FMA and AVX-512. The best one the CPU
+supports is selected when the module is loaded, every runtime
+using it (SVM for example) benefits from it. The script measures
+the kernel for vectors of length 4 to 4096 in float32 and float64.
+
+.. contents::
+    :local:
+
+Instruction set
++++++++++++++++
+"""
+import pandas
+import matplotlib.pyplot as plt
+from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import (  # pylint: disable=E0611,E0401
+    vector_kernels_isa, benchmark_vector_kernel_float,
+    benchmark_vector_kernel_double)
+
+print(vector_kernels_isa())
+
+#####################################
+# Benchmark
+# +++++++++
+#
+# An instruction set the CPU does not support raises
+# an exception and is skipped.
+
+fcts = {'float32': benchmark_vector_kernel_float,
+        'float64': benchmark_vector_kernel_double}
+sizes = [4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096]
+obs = []
+for dtype, fct in fcts.items():
+    for isa in ['scalar', 'avx2', 'avx512']:
+        for size in sizes:
+            try:
+                t = fct('dot', size, max(100, 2000000 // size), isa)
+            except ValueError:
+                continue
+            obs.append(dict(dtype=dtype, isa=isa, size=size, time=t))
+
+df = pandas.DataFrame(obs)
+piv = df.pivot_table(index=['dtype', 'size'], columns='isa', values='time')
+print(piv)
+
+#####################################
+# Speed-up compared to scalar code
+# ++++++++++++++++++++++++++++++++
+
+fig, ax = plt.subplots(1, 2, figsize=(10, 4))
+for i, dtype in enumerate(fcts):
+    sub = piv.loc[dtype]
+    speedup = sub.divide(sub['scalar'], axis=0).rdiv(1)
+    speedup.plot(ax=ax[i], logx=True, title="dot - %s" % dtype)
+plt.show()
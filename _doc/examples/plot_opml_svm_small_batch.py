@@ -0,0 +1,67 @@
+"""
+.. _l-example-svm-small-batch:
+
+SVMClassifier on small batches
+==============================
+
+The runtime for SVMClassifier computes every row with
+scratch buffers (kernels, scores, votes, probabilities)
+allocated once when the model is loaded, one set per thread.
+The per-row path does no heap allocation, which matters
+for small batches and when many threads compute rows
+in parallel. The script measures the throughput for batches
+of 1 to 1000 rows and compares it to :epkg:`onnxruntime`.
+
+.. contents::
+    :local:
+
+Model
++++++
+"""
+from time import perf_counter
+import numpy
+import pandas
+import matplotlib.pyplot as plt
+from sklearn.datasets import make_classification
+from sklearn.svm import SVC
+from mlprodict.onnx_conv import to_onnx
+from mlprodict.onnxrt import OnnxInference
+
+X, y = make_classification(
+    4000, n_features=20, n_informative=10, n_classes=5, random_state=0)
+X = X.astype(numpy.float32)
+model = SVC(probability=True)
+model.fit(X[:2000], y[:2000])
+onx = to_onnx(model, X[:1])
+Xt = X[2000:]
+
+#####################################
+# Throughput
+# ++++++++++
+
+runtimes = {'python': 'python', 'onnxruntime': 'onnxruntime1'}
+obs = []
+for name, rt in runtimes.items():
+    oinf = OnnxInference(onx, runtime=rt)
+    for n in [1, 2, 5, 10, 20, 50, 100, 1000]:
+        x = Xt[:n]
+        repeat = max(10, 2000 // n)
+        begin = perf_counter()
+        for _ in range(repeat):
+            oinf.run({'X': x})
+        duration = (perf_counter() - begin) / repeat
+        obs.append(dict(runtime=name, N=n, time=duration,
+                        rows_per_s=n / duration))
+
+df = pandas.DataFrame(obs)
+piv = df.pivot_table(index='N', columns='runtime', values='rows_per_s')
+print(piv)
+
+#####################################
+# Graph
+# +++++
+
+ax = piv.plot(logx=True, logy=True,
+              title="SVMClassifier throughput (rows/s)\n%d support vectors" %
+              model.support_vectors_.shape[0])
+plt.show()
@@ -0,0 +1,84 @@
+"""
+.. _l-example-tree-ensemble-bfloat16:
+
+TreeEnsemble with bfloat16 storage
+==================================
+
+Big forests do not fit in cache and their evaluation is
+bounded by the memory bandwidth. The runtime for
+TreeEnsembleRegressor can store thresholds and leaf values
+as *bfloat16* (runtime version 10, float only): the computation
+reads nodes of 8 bytes instead of 28. A threshold which is not
+a *bfloat16* is truncated, a value falling between the
+threshold and its truncation is compared to the exact threshold
+stored aside, every comparison gives the same result as the
+float model. The original nodes are kept for the other
+computations, the memory used by the model grows.
+Leaf values are rounded to *bfloat16* and summed as floats,
+the predictions change slightly. The script measures
+the difference and the speedup.
+
+.. contents::
+    :local:
+
+Model
++++++
+"""
+from time import perf_counter
+import numpy
+import pandas
+import matplotlib.pyplot as plt
+from sklearn.datasets import make_regression
+from sklearn.ensemble import RandomForestRegressor
+from mlprodict.onnx_conv import to_onnx
+from mlprodict.onnxrt import OnnxInference
+
+n_estimators, max_depth = 200, 12
+X, y = make_regression(20000, n_features=50, random_state=0)
+X = X.astype(numpy.float32)
+model = RandomForestRegressor(
+    n_estimators=n_estimators, max_depth=max_depth, n_jobs=-1)
+model.fit(X[:10000], y[:10000])
+onx = to_onnx(model, X[:1])
+Xt = X[10000:]
+
+#####################################
+# Accuracy and latency
+# ++++++++++++++++++++
+
+versions = {4: 'float', 10: 'bfloat16'}
+preds = {}
+obs = []
+for v, name in versions.items():
+    oinf = OnnxInference(onx, runtime='python')
+    oinf.sequence_[0].ops_._init(numpy.float32, v)  # pylint: disable=W0212
+    if v == 10:
+        assert oinf.sequence_[0].ops_.rt_.bfloat16_
+    preds[name] = oinf.run({'X': Xt})['variable'].ravel()
+    for n in [1, 10, 100, 1000, 10000]:
+        x = Xt[:n]
+        repeat = max(5, 1000 // n)
+        begin = perf_counter()
+        for _ in range(repeat):
+            oinf.run({'X': x})
+        duration = (perf_counter() - begin) / repeat
+        obs.append(dict(storage=name, N=n, time=duration))
+
+diff = numpy.abs(preds['float'] - preds['bfloat16'])
+print("max absolute difference: %g" % diff.max())
+print("max relative difference: %g" % (
+    diff / numpy.abs(preds['float']).clip(1e-5)).max())
+
+df = pandas.DataFrame(obs)
+piv = df.pivot_table(index='N', columns='storage', values='time')
+piv['speedup'] = piv['float'] / piv['bfloat16']
+print(piv)
+
+#####################################
+# Graph
+# +++++
+
+ax = piv[['float', 'bfloat16']].plot(
+    logx=True, logy=True,
+    title="Latency (s)\n%d trees, depth %d" % (n_estimators, max_depth))
+plt.show()
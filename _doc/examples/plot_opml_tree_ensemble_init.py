@@ -0,0 +1,96 @@
+"""
+.. _l-example-tree-ensemble-init:
+
+Loading time of TreeEnsemble
+============================
+
+The runtime for TreeEnsembleRegressor receives the trees
+as flat lists of nodes identified by *(tree_id, node_id)*.
+It links every node to its children and its leaves to their
+weights with a dense index built once, the loading time
+is linear in the number of nodes. The script measures
+it for forests of 1.000, 10.000 and 100.000 trees.
+
+.. contents::
+    :local:
+
+Random forests
+++++++++++++++
+"""
+from time import perf_counter
+import numpy
+import pandas
+import matplotlib.pyplot as plt
+from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import (  # pylint: disable=E0611
+    RuntimeTreeEnsembleRegressorPFloat)
+
+
+def random_forest(n_trees, depth=5, n_features=10, seed=0):
+    """
+    Returns the attributes of a forest of complete trees
+    following ONNX specifications.
+    """
+    rnd = numpy.random.RandomState(seed)
+    n_nodes = 2 ** (depth + 1) - 1
+    n_leaves = 2 ** depth
+    nodeids = numpy.arange(n_nodes, dtype=numpy.int64)
+    is_leaf = nodeids >= n_nodes - n_leaves
+    truenodeids = numpy.where(is_leaf, 0, nodeids * 2 + 1)
+    falsenodeids = numpy.where(is_leaf, 0, nodeids * 2 + 2)
+    modes = ['LEAF' if b else 'BRANCH_LEQ' for b in is_leaf]
+
+    atts = dict(
+        aggregate_function='SUM',
+        base_values=numpy.array([0], dtype=numpy.float32),
+        n_targets=1,
+        nodes_falsenodeids=numpy.tile(falsenodeids, n_trees),
+        nodes_featureids=rnd.randint(
+            0, n_features, n_nodes * n_trees).astype(numpy.int64),
+        nodes_hitrates=numpy.array([], dtype=numpy.float32),
+        nodes_missing_value_tracks_true=numpy.array([], dtype=numpy.int64),
+        nodes_modes=modes * n_trees,
+        nodes_nodeids=numpy.tile(nodeids, n_trees),
+        nodes_treeids=numpy.repeat(
+            numpy.arange(n_trees, dtype=numpy.int64), n_nodes),
+        nodes_truenodeids=numpy.tile(truenodeids, n_trees),
+        nodes_values=rnd.randn(n_nodes * n_trees).astype(numpy.float32),
+        post_transform='NONE',
+        target_ids=numpy.zeros(n_leaves * n_trees, dtype=numpy.int64),
+        target_nodeids=numpy.tile(nodeids[is_leaf], n_trees),
+        target_treeids=numpy.repeat(
+            numpy.arange(n_trees, dtype=numpy.int64), n_leaves),
+        target_weights=rnd.randn(n_leaves * n_trees).astype(numpy.float32))
+    return atts
+
+
+#####################################
+# Benchmark
+# +++++++++
+
+layouts = {0: 'pointers', 1: 'arrays', 2: 'packed'}
+obs = []
+for n_trees in [1000, 10000, 100000]:
+    atts = random_forest(n_trees)
+    args = list(atts.values())
+    for array_structure, name in layouts.items():
+        repeat = max(1, 10000 // n_trees)
+        begin = perf_counter()
+        for _ in range(repeat):
+            rt = RuntimeTreeEnsembleRegressorPFloat(
+                60, 20, array_structure, array_structure > 0)
+            rt.init(*args)
+        duration = (perf_counter() - begin) / repeat
+        obs.append(dict(layout=name, n_trees=n_trees,
+                        n_nodes=len(atts['nodes_treeids']), time=duration))
+
+df = pandas.DataFrame(obs)
+df['time_per_node_ns'] = df['time'] / df['n_nodes'] * 1e9
+piv = df.pivot_table(index='n_trees', columns='layout', values='time')
+print(df)
+
+#####################################
+# Graph
+# +++++
+
+ax = piv.plot(logx=True, logy=True, title="Loading time (s)")
+plt.show()
@@ -0,0 +1,94 @@
+"""
+.. _l-example-tree-ensemble-layout:
+
+Memory layout of TreeEnsemble nodes
+===================================
+
+The runtime for TreeEnsembleRegressor can store the trees
+in three different ways depending on *array_structure*:
+
+* *0*: an array of structures, every node holds its weights
+  and pointers to its children (runtime version 1),
+* *1*: a structure of arrays (runtime version 3),
+* *2*: compact nodes, only the feature index, the threshold, the mode and
+  the children offsets remain in the node, the leaves weights are stored
+  in a separate table, every tree is stored in depth-first order
+  (runtime version 4).
+
+The script compares the memory footprint and the latency of
+every layout on a large gradient boosting model.
+
+.. contents::
+    :local:
+
+Model
++++++
+"""
+from time import perf_counter
+import numpy
+import pandas
+import matplotlib.pyplot as plt
+from sklearn.datasets import make_regression
+from sklearn.ensemble import GradientBoostingRegressor
+from mlprodict.onnx_conv import to_onnx
+from mlprodict.onnxrt import OnnxInference
+
+n_estimators, max_depth = 500, 10
+X, y = make_regression(20000, n_features=20, random_state=0)
+X = X.astype(numpy.float32)
+model = GradientBoostingRegressor(
+    n_estimators=n_estimators, max_depth=max_depth, random_state=0)
+model.fit(X[:10000], y[:10000])
+onx = to_onnx(model, X[:1])
+
+#####################################
+# Memory
+# ++++++
+
+versions = {1: 'pointers', 3: 'arrays', 4: 'packed'}
+oinfs = {}
+for v in versions:
+    oinf = OnnxInference(onx, runtime='python')
+    oinf.sequence_[0].ops_._init(numpy.float32, v)  # pylint: disable=W0212
+    oinfs[v] = oinf
+
+mem = pandas.DataFrame([
+    dict(layout=name,
+         size=oinfs[v].sequence_[0].ops_.rt_.__sizeof__())
+    for v, name in versions.items()])
+mem['size_MB'] = mem['size'] / 2 ** 20
+print(mem)
+
+#####################################
+# Latency
+# +++++++
+
+expected = model.predict(X[10000:]).astype(numpy.float32)
+obs = []
+for v, name in versions.items():
+    got = oinfs[v].run({'X': X[10000:]})['variable'].ravel()
+    numpy.testing.assert_allclose(expected, got, atol=1e-3)
+    for n in [1, 10, 100, 1000, 10000]:
+        x = X[10000:10000 + n]
+        repeat = max(5, 1000 // n)
+        begin = perf_counter()
+        for _ in range(repeat):
+            oinfs[v].run({'X': x})
+        duration = (perf_counter() - begin) / repeat
+        obs.append(dict(layout=name, N=n, time=duration))
+
+df = pandas.DataFrame(obs)
+piv = df.pivot(index='N', columns='layout', values='time')
+print(piv)
+
+#####################################
+# Graph
+# +++++
+
+fig, ax = plt.subplots(1, 2, figsize=(12, 4))
+mem.set_index('layout')['size_MB'].plot.bar(
+    ax=ax[0], title="Memory (MB)\n%d trees, depth %d" % (
+        n_estimators, max_depth))
+piv.plot(ax=ax[1], logx=True, logy=True, title="Latency (s)")
+
+plt.show()
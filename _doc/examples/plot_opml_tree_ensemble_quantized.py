@@ -0,0 +1,82 @@
+"""
+.. _l-example-tree-ensemble-quantized:
+
+Quantized thresholds in TreeEnsemble
+====================================
+
+Models trained on histograms (:epkg:`lightgbm`,
+:epkg:`scikit-learn`'s *HistGradientBoosting*) only compare
+every feature to a small set of distinct thresholds.
+The runtime for TreeEnsembleRegressor can take advantage of that
+(runtime version 6): every observation is binned once per feature
+into a *uint8* or *uint16* index and the trees compare small integers
+instead of floats. The predictions are the same as the ones
+produced by the compact layout (runtime version 4).
+
+.. contents::
+    :local:
+
+Model
++++++
+"""
+from time import perf_counter
+import numpy
+import pandas
+import matplotlib.pyplot as plt
+from sklearn.datasets import make_regression
+from sklearn.ensemble import GradientBoostingRegressor
+from mlprodict.onnx_conv import to_onnx
+from mlprodict.onnxrt import OnnxInference
+
+n_estimators, max_depth = 300, 8
+X, y = make_regression(20000, n_features=20, random_state=0)
+# Features take at most 64 distinct values.
+X = numpy.round(X * 8) / 8
+model = GradientBoostingRegressor(
+    n_estimators=n_estimators, max_depth=max_depth, random_state=0)
+model.fit(X[:10000], y[:10000])
+
+#####################################
+# Latency
+# +++++++
+
+versions = {4: 'packed', 6: 'quantized'}
+obs = []
+for dtype in [numpy.float32, numpy.float64]:
+    onx = to_onnx(model, X[:1].astype(dtype))
+    Xt = X[10000:].astype(dtype)
+    expected = None
+    for v, name in versions.items():
+        oinf = OnnxInference(onx, runtime='python')
+        oinf.sequence_[0].ops_._init(dtype, v)  # pylint: disable=W0212
+        got = oinf.run({'X': Xt})['variable']
+        if expected is None:
+            expected = got
+        else:
+            assert oinf.sequence_[0].ops_.rt_.quantized_
+            numpy.testing.assert_array_equal(expected, got)
+        for n in [1, 10, 100, 1000, 10000]:
+            x = Xt[:n]
+            repeat = max(5, 1000 // n)
+            begin = perf_counter()
+            for _ in range(repeat):
+                oinf.run({'X': x})
+            duration = (perf_counter() - begin) / repeat
+            obs.append(dict(layout=name, dtype=dtype.__name__,
+                            N=n, time=duration))
+
+df = pandas.DataFrame(obs)
+piv = df.pivot_table(index='N', columns=['dtype', 'layout'], values='time')
+print(piv)
+
+#####################################
+# Graph
+# +++++
+
+fig, ax = plt.subplots(1, 2, figsize=(12, 4))
+for i, dtype in enumerate(['float32', 'float64']):
+    piv[dtype].plot(ax=ax[i], logx=True, logy=True,
+                    title="Latency (s) - %s\n%d trees, depth %d" % (
+                        dtype, n_estimators, max_depth))
+
+plt.show()
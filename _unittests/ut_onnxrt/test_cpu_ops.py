@@ -12,6 +12,10 @@ from skl2onnx.algebra.onnx_ops import (  # pylint: disable=E0611
     OnnxConv)
 from mlprodict.onnx_conv import to_onnx
 from mlprodict.onnxrt.ops_cpu.op_conv import Conv
+from mlprodict.onnxrt.ops_cpu.op_conv_ import (  # pylint: disable=E0611,E0401
+    gemm_float, gemm_double, ConvFloat)
+from mlprodict.onnxrt.ops_cpu.op_max_pool_ import (  # pylint: disable=E0611,E0401
+    MaxPoolFloat)
 from mlprodict.onnx_tools.onnx2py_helper import _var_as_dict
 from mlprodict.onnxrt import OnnxInference
 from mlprodict.testing.test_utils.tests_helper import fit_multilabel_classification_model
@@ -156,6 +160,122 @@ class TestCpuOps(ExtTestCase):
                             ii, diff[ii], gotrt['Y'].ravel()[ii], got['Y'].ravel()[ii]))
             self.assertEqualArray(gotrt['Y'], got['Y'], decimal=5)
 
+    @ignore_warnings((DeprecationWarning, FutureWarning))
+    def test_cpu_conv_batch_group_bias(self):
+        # many (image, group) pairs, computed in parallel
+        x = numpy.random.rand(17, 8, 9, 7).astype(numpy.float32)
+        W = numpy.random.rand(12, 4, 3, 3).astype(numpy.float32)
+        B = numpy.random.rand(12).astype(numpy.float32)
+
+        onx = OnnxConv(
+            'X', 'W', 'B', output_names=['Y'],
+            auto_pad='NOTSET', group=2, dilations=[1, 1],
+            kernel_shape=[3, 3], pads=[1, 0, 1, 0], strides=[1, 2],
+            op_version=TARGET_OPSET)
+        model_def = onx.to_onnx({'X': x, 'W': W, 'B': B},
+                                target_opset=TARGET_OPSET)
+        oinf = OnnxInference(model_def)
+        oinfrt = OnnxInference(model_def, runtime='onnxruntime1')
+        for n in [1, 2, 17]:
+            feeds = {'X': x[:n], 'W': W, 'B': B}
+            got = oinf.run(feeds)
+            gotrt = oinfrt.run(feeds)
+            self.assertEqualArray(gotrt['Y'], got['Y'], decimal=4)
+
+    def test_cpu_conv_algorithms(self):
+        # 1x1 kernels (direct gemm), 3x3 kernels (winograd) and others (im2col)
+        for C, M, k, pads, group in [(16, 24, 1, [0, 0, 0, 0], 1),
+                                     (16, 24, 1, [1, 0, 1, 0], 1),
+                                     (16, 24, 3, [1, 1, 1, 1], 1),
+                                     (32, 16, 3, [0, 1, 2, 0], 2),
+                                     (8, 8, 3, [0, 0, 0, 0], 1),
+                                     (96, 96, 3, [1, 1, 1, 1], 1)]:
+            x = numpy.random.rand(3, C, 13, 11).astype(numpy.float32)
+            W = numpy.random.rand(M, C // group, k, k).astype(numpy.float32)
+            B = numpy.random.rand(M).astype(numpy.float32)
+            onx = OnnxConv(
+                'X', 'W', 'B', output_names=['Y'],
+                auto_pad='NOTSET', group=group, dilations=[1, 1],
+                kernel_shape=[k, k], pads=pads, strides=[1, 1],
+                op_version=TARGET_OPSET)
+            model_def = onx.to_onnx({'X': x, 'W': W, 'B': B},
+                                    target_opset=TARGET_OPSET)
+            oinf = OnnxInference(model_def)
+            oinfrt = OnnxInference(model_def, runtime='onnxruntime1')
+            feeds = {'X': x, 'W': W, 'B': B}
+            got = oinf.run(feeds)
+            gotrt = oinfrt.run(feeds)
+            self.assertEqualArray(gotrt['Y'], got['Y'], decimal=3)
+
+    def test_cpu_conv_maxpool_nhwc(self):
+        # channels last, compared to channels first
+        for shape, k, pads, strides, group in [
+                ((2, 8, 9, 7), [3, 3], [1, 1, 1, 1], [1, 1], 1),
+                ((2, 8, 9, 7), [3, 3], [0, 1, 1, 0], [2, 1], 2),
+                ((2, 8, 9, 7), [1, 1], [0, 0, 0, 0], [1, 1], 1),
+                ((2, 8, 17), [3], [1, 2], [2], 1),
+                ((2, 8, 17), [1], [0, 0], [1], 2),
+                ((1, 8, 5, 6, 7), [3, 2, 3], [1, 0, 1, 1, 1, 0], [1, 2, 1], 2),
+                # several blocks of output positions per image
+                ((1, 64, 6, 6, 6), [3, 3, 3], [1, 1, 1, 1, 1, 1], [1, 1, 1], 1)]:
+            rank = len(k)
+            # NCHW -> NHWC
+            perm = (0, ) + tuple(range(2, rank + 2)) + (1, )
+            x = numpy.random.rand(*shape).astype(numpy.float32)
+            W = numpy.random.rand(12, shape[1] // group, *k).astype(numpy.float32)
+            B = numpy.random.rand(12).astype(numpy.float32)
+            args = ('NOTSET', numpy.array([1] * rank, dtype=numpy.int64), group,
+                    numpy.array(k, dtype=numpy.int64),
+                    numpy.array(pads, dtype=numpy.int64),
+                    numpy.array(strides, dtype=numpy.int64))
+            rt, rt_nhwc = ConvFloat(), ConvFloat()
+            rt.init(*args)
+            rt_nhwc.init(*args)
+            rt_nhwc.set_channels_last(True)
+            exp = rt.compute(x, W, B).transpose(perm)
+            got = rt_nhwc.compute(x.transpose(perm), W, B)
+            self.assertEqualArray(exp, got, decimal=3)
+
+            xt = x.transpose(perm).copy()
+            for storage_order in [0, 1]:
+                args = ('NOTSET', numpy.array([1] * rank, dtype=numpy.int64),
+                        0, storage_order,
+                        numpy.array(k, dtype=numpy.int64),
+                        numpy.array(pads, dtype=numpy.int64),
+                        numpy.array(strides, dtype=numpy.int64))
+                rt, rt_nhwc = MaxPoolFloat(), MaxPoolFloat()
+                rt.init(*args)
+                rt_nhwc.init(*args)
+                rt_nhwc.set_channels_last(True)
+                exp, _ = rt.compute(x)
+                got, ind = rt_nhwc.compute(xt)
+                self.assertEqualArray(exp.transpose(perm), got)
+                # storage_order=1 indexes the spatial axes in reverse order
+                layout = xt if storage_order == 0 else xt.transpose(
+                    (0, ) + tuple(range(rank, 0, -1)) + (rank + 1, ))
+                self.assertEqualArray(layout.ravel()[ind], got)
+
+    def test_cpu_gemm(self):
+        for cl, fct, dec in [(numpy.float32, gemm_float, 3),
+                             (numpy.float64, gemm_double, 10)]:
+            for M, N, K in [(1, 1, 1), (5, 7, 3), (13, 33, 17), (97, 130, 300)]:
+                A = numpy.random.randn(M, K).astype(cl)
+                B = numpy.random.randn(K, N).astype(cl)
+                C = numpy.random.randn(M, N).astype(cl)
+                exp = A @ B * 0.5 + C * 2
+                for transA in [False, True]:
+                    for transB in [False, True]:
+                        a = A.T.copy() if transA else A
+                        b = B.T.copy() if transB else B
+                        for impl in ['naive', '', 'scalar']:
+                            got = fct(a, b, C, transA, transB, 0.5, 2, impl)
+                            self.assertEqualArray(exp, got, decimal=dec)
+                        # beta=0 ignores C
+                        got = fct(a, b, C * numpy.nan, transA, transB, 1, 0)
+                        self.assertEqualArray(A @ B, got, decimal=dec)
+            self.assertRaise(lambda: fct(A, A, C), ValueError)  # pylint: disable=W0640
+            self.assertRaise(lambda: fct(A, B, C, impl='sse'), ValueError)  # pylint: disable=W0640
+
     @ignore_warnings((DeprecationWarning, FutureWarning))
     def test_slice_bug(self):
 
@@ -1986,7 +1986,30 @@ class TestOnnxrtPythonRuntime(ExtTestCase):  # pylint: disable=R0904
             got = oinf.run({'X': x, 'W': W, 'B': B})
             ys.append(got['Y'])
         self.assertEqual(len(ys), 2)
-        # self.assertEqualArray(ys[0], ys[1])
+        self.assertEqualArray(ys[0], ys[1], decimal=3)
+
+    @wraplog()
+    def test_onnxt_runtime_conv_transpose_group_stride(self):
+        # every phase of the output (position modulo strides) is computed
+        # separately, in parallel over images, groups and tiles
+        x = numpy.random.rand(3, 4, 7, 6).astype(numpy.float32)
+        W = numpy.random.rand(4, 3, 3, 2).astype(numpy.float32)
+        B = numpy.random.rand(6).astype(numpy.float32)
+        for strides, dilations, pads in [([2, 3], [1, 1], [1, 0, 1, 1]),
+                                         ([3, 2], [2, 1], [0, 1, 2, 0]),
+                                         ([1, 1], [1, 2], [1, 1, 1, 1])]:
+            onx = OnnxConvTranspose(
+                'X', 'W', 'B', output_names=['Y'], group=2,
+                kernel_shape=[3, 2], pads=pads, strides=strides,
+                dilations=dilations, op_version=TARGET_OPSET)
+            model_def = onx.to_onnx({'X': x, 'W': W, 'B': B},
+                                    target_opset=TARGET_OPSET)
+            ys = []
+            for rt in ['python', 'onnxruntime1']:
+                oinf = OnnxInference(model_def, runtime=rt)
+                got = oinf.run({'X': x, 'W': W, 'B': B})
+                ys.append(got['Y'])
+            self.assertEqualArray(ys[0], ys[1], decimal=4)
 
     @wraplog()
     def test_onnxt_runtime_conv_transpose_1d(self):
@@ -11,7 +11,10 @@ from skl2onnx.common.data_types import FloatTensorType
 from skl2onnx import __version__ as skl2onnx_version
 from mlprodict.onnxrt import OnnxInference
 from mlprodict.onnxrt.ops_cpu.op_array_feature_extractor import _array_feature_extrator, sizeof_dtype
-from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import array_feature_extractor_double  # pylint: disable=E0611,E0401
+from mlprodict.onnxrt.ops_cpu._op_onnx_numpy import (  # pylint: disable=E0611,E0401
+    array_feature_extractor_double, vector_kernels_isa,
+    benchmark_vector_kernel_float, benchmark_vector_kernel_double,
+    compute_vector_kernel_float, compute_vector_kernel_double)
 from mlprodict import get_ir_version, __max_supported_opset__ as TARGET_OPSET
 
 
@@ -157,6 +160,41 @@ class TestOnnxrtPythonRuntime(ExtTestCase):
         self.assertEqual(sizeof_dtype(numpy.int64), 8)
         self.assertRaise(lambda: sizeof_dtype(numpy.int8), ValueError)
 
+    def test_vector_kernels(self):
+        isa = vector_kernels_isa()
+        self.assertIn(isa, ('scalar', 'avx2', 'avx512'))
+        for fct in [benchmark_vector_kernel_float,
+                    benchmark_vector_kernel_double]:
+            for size in [1, 7, 33, 100]:
+                self.assertGreater(fct('dot', size, 5, 'scalar'), 0)
+                self.assertGreater(fct('dot', size, 5, isa), 0)
+            self.assertRaise(lambda: fct('dot', 4, 1, 'sse'), ValueError)
+            self.assertRaise(lambda: fct('axpy', 4, 1, 'scalar'), ValueError)
+
+    def test_vector_kernels_output(self):
+        isa = vector_kernels_isa()
+        isas = {'scalar': ['scalar'], 'avx2': ['scalar', 'avx2'],
+                'avx512': ['scalar', 'avx2', 'avx512']}[isa]
+        rnd = numpy.random.RandomState(0)
+        for dtype, fct, decimal in [
+                (numpy.float32, compute_vector_kernel_float, 3),
+                (numpy.float64, compute_vector_kernel_double, 10)]:
+            for size in [1, 7, 33, 100]:
+                x = rnd.randn(size).astype(dtype)
+                y = rnd.randn(size).astype(dtype)
+                expected = numpy.array([x @ y]).astype(dtype)
+                for name in isas:
+                    with self.subTest(dtype=dtype, size=size, isa=name):
+                        got = fct('dot', x, y, name)
+                        self.assertEqual(got.dtype, dtype)
+                        self.assertEqualArray(expected, got, decimal=decimal)
+                        self.assertEqualArray(
+                            fct('dot', x, y, 'scalar'), got, decimal=decimal)
+            self.assertRaise(
+                lambda: fct('dot', x, y[:-1], 'scalar'), ValueError)
+            self.assertRaise(
+                lambda: fct('axpy', x, y, 'scalar'), ValueError)
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -5,7 +5,7 @@ import unittest
 from logging import getLogger
 import warnings
 import numpy
-from sklearn.datasets import load_iris
+from sklearn.datasets import load_iris, make_classification
 from sklearn.model_selection import train_test_split
 from sklearn.svm import SVR, SVC, LinearSVC, OneClassSVM
 from sklearn.exceptions import ConvergenceWarning
@@ -236,6 +236,125 @@ class TestOnnxrtPythonRuntimeMlSVM(ExtTestCase):
         self.assertEqualArray(lexp, y['output_label'], decimal=5)
         self.assertEqualArray(lprob, got, decimal=5)
 
+    def test_onnxrt_python_SVC_proba_many_classes(self):
+        # probabilities are estimated by batches of rows, the number
+        # of rows is not a multiple of the batch size
+        X, y = make_classification(
+            600, n_features=10, n_informative=8, n_classes=12,
+            n_clusters_per_class=1, random_state=0)
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        clr = SVC(probability=True)
+        clr.fit(X_train, y_train)
+        for dtype in [numpy.float32, numpy.float64]:
+            with self.subTest(dtype=dtype):
+                model_def = to_onnx(clr, X_train.astype(dtype))
+                oinf = OnnxInference(model_def)
+                for n in [1, 17, X_test.shape[0]]:
+                    y = oinf.run({'X': X_test[:n].astype(dtype)})
+                    got = y['output_probability'].values
+                    self.assertEqualArray(clr.predict(X_test[:n]), y['output_label'])
+                    self.assertEqualArray(clr.predict_proba(X_test[:n]), got, decimal=4)
+
+    def test_onnxrt_python_svm_kernel_block(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for kernel in ['linear', 'sigmoid', 'rbf', 'poly']:
+            for model in [SVR(kernel=kernel), SVC(kernel=kernel, probability=True)]:
+                for dtype in [numpy.float32, numpy.float64]:
+                    with self.subTest(kernel=kernel, model=model.__class__.__name__,
+                                      dtype=dtype):
+                        model.fit(X_train, y_train)
+                        model_def = to_onnx(model, X_train.astype(dtype))
+                        oinf = OnnxInference(model_def)
+                        rt = [node.ops_.rt_ for node in oinf.sequence_
+                              if hasattr(node.ops_, 'rt_')][0]
+                        x = X_test.astype(dtype)
+                        rt.kernel_block_rows_ = 0
+                        exp = rt.compute(x)
+                        for block in [1, 5, 32]:
+                            rt.kernel_block_rows_ = block
+                            got = rt.compute(x)
+                            if isinstance(exp, tuple):
+                                self.assertEqualArray(exp[0], got[0])
+                                self.assertEqualArray(exp[1], got[1], decimal=4)
+                            else:
+                                self.assertEqualArray(exp, got, decimal=4)
+
+    def test_onnxrt_python_svm_kernel_block_unscaled(self):
+        # Large features, small distances: |x|^2 + |sv|^2 - 2 <x, sv>
+        # cancels out in float.
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X = X + numpy.array([[1e4, 2e4, 3e4, 4e4]])
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for model in [SVR(kernel='rbf'), SVC(kernel='rbf', probability=True)]:
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(model=model.__class__.__name__, dtype=dtype):
+                    model_def = to_onnx(model, X_train.astype(dtype))
+                    oinf = OnnxInference(model_def)
+                    rt = [node.ops_.rt_ for node in oinf.sequence_
+                          if hasattr(node.ops_, 'rt_')][0]
+                    x = X_test.astype(dtype)
+                    rt.kernel_block_rows_ = 0
+                    exp = rt.compute(x)
+                    rt.kernel_block_rows_ = 32
+                    got = rt.compute(x)
+                    if isinstance(exp, tuple):
+                        self.assertEqualArray(exp[0], got[0])
+                        self.assertEqualArray(exp[1], got[1], decimal=4)
+                    else:
+                        self.assertEqualArray(exp, got, decimal=4)
+
+    def test_onnxrt_python_svm_linear_folded(self):
+        X, y = make_classification(
+            300, n_features=8, n_informative=6, n_classes=3,
+            random_state=0)
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for model in [SVR(kernel='linear'), SVC(kernel='linear'),
+                      SVC(kernel='linear', probability=True)]:
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(model=model, dtype=dtype):
+                    model_def = to_onnx(model, X_train.astype(dtype))
+                    oinf = OnnxInference(model_def)
+                    rt = [node.ops_.rt_ for node in oinf.sequence_
+                          if hasattr(node.ops_, 'rt_')][0]
+                    self.assertGreater(rt.linear_count_, 0)
+                    y = oinf.run({'X': X_test.astype(dtype)})
+                    if isinstance(model, SVR):
+                        self.assertEqualArray(
+                            model.predict(X_test), y['variable'].ravel(), decimal=4)
+                        continue
+                    self.assertEqualArray(model.predict(X_test), y['output_label'])
+                    if model.probability:
+                        self.assertEqualArray(
+                            model.predict_proba(X_test),
+                            y['output_probability'].values, decimal=4)
+
+    def test_onnxrt_python_svm_csr(self):
+        from scipy.sparse import random as sparse_random
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, _, y_train, __ = train_test_split(X, y, random_state=11)
+        xs = sparse_random(50, 4, density=0.4, format='csr', random_state=0)
+        for kernel in ['linear', 'sigmoid', 'rbf', 'poly']:
+            for model in [SVR(kernel=kernel), SVC(kernel=kernel, probability=True)]:
+                with self.subTest(kernel=kernel, model=model.__class__.__name__):
+                    model.fit(X_train, y_train)
+                    model_def = to_onnx(model, X_train.astype(numpy.float32))
+                    oinf = OnnxInference(model_def)
+                    rt = [node.ops_.rt_ for node in oinf.sequence_
+                          if hasattr(node.ops_, 'rt_')][0]
+                    x = xs.astype(numpy.float32)
+                    exp = rt.compute(x.toarray())
+                    got = rt.compute_csr(x.data, x.indices, x.indptr, x.shape[1])
+                    if isinstance(exp, tuple):
+                        self.assertEqualArray(exp[0], got[0])
+                        exp, got = exp[1], got[1]
+                    self.assertEqualArray(exp, got, decimal=4)
+
     @ignore_warnings(category=(FutureWarning, UserWarning, ConvergenceWarning, RuntimeWarning))
     def test_onnxrt_python_one_class_svm(self):
         X = numpy.array([[0, 1, 2], [44, 36, 18],
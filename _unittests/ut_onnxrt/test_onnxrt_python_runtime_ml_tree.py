@@ -2,18 +2,21 @@
 """
 @brief      test log(time=10s)
 """
+import os
+import struct
+import threading
 import unittest
 from logging import getLogger
 import numpy
 import pandas
 import sklearn
-from sklearn.datasets import load_iris
+from sklearn.datasets import load_iris, make_classification, make_regression
 from sklearn.model_selection import train_test_split
 from sklearn.ensemble import (
     RandomForestClassifier, RandomForestRegressor,
     GradientBoostingClassifier, GradientBoostingRegressor)
 from sklearn.tree import DecisionTreeClassifier, DecisionTreeRegressor
-from pyquickhelper.pycode import ExtTestCase, ignore_warnings
+from pyquickhelper.pycode import ExtTestCase, ignore_warnings, get_temp_folder
 from pyquickhelper.texthelper import compare_module_version
 import skl2onnx
 from mlprodict.onnx_conv import to_onnx
@@ -564,6 +567,745 @@ class TestOnnxrtPythonRuntimeMlTree(ExtTestCase):
                 for b in [False, True]:
                     test_tree_regressor_multitarget_max(*(conf + [b, True]))
 
+    @ignore_warnings((FutureWarning, DeprecationWarning))
+    def test_cpp_packed(self):
+        from mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_p_ import (  # pylint: disable=E0611,E0401
+            test_tree_regressor_multitarget_average,
+            test_tree_regressor_multitarget_sum,
+            test_tree_regressor_multitarget_min,
+            test_tree_regressor_multitarget_max)
+        confs = [[100, 100, 2, False, True],
+                 [100, 100, 2, False, False],
+                 [2, 2, 2, False, True],
+                 [2, 2, 2, False, False],
+                 [2, 2, 2, True, True],
+                 [2, 2, 2, True, False]]
+        for fct in [test_tree_regressor_multitarget_average,
+                    test_tree_regressor_multitarget_sum,
+                    test_tree_regressor_multitarget_min,
+                    test_tree_regressor_multitarget_max]:
+            for conf in confs:
+                with self.subTest(fct=fct.__name__, conf=tuple(conf)):
+                    fct(*(conf + [True, True]))
+
+    @ignore_warnings((FutureWarning, DeprecationWarning))
+    def test_quickscorer(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for cls in [GradientBoostingRegressor, RandomForestRegressor,
+                    RandomForestClassifier]:
+            model = cls(n_estimators=20, max_depth=5)
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    options = ({id(model): {'zipmap': False}}
+                               if cls is RandomForestClassifier else None)
+                    model_def = to_onnx(
+                        model, X_train.astype(dtype), options=options)
+                    oinf = OnnxInference(model_def)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 5)
+                    self.assertTrue(
+                        oinf.sequence_[0].ops_.rt_.quickscorer_)
+                    X_nan = X_test.astype(dtype)
+                    X_nan[::3, 1] = numpy.nan
+                    for x in [X_test.astype(dtype), X_nan]:
+                        oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                            dtype, 4)
+                        exp = oinf.run({'X': x})
+                        oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                            dtype, 5)
+                        got = oinf.run({'X': x})
+                        for k in exp:
+                            self.assertEqualArray(exp[k], got[k])
+
+                    # switched after init, the nodes are built or released,
+                    # the packed layout (version 4) no longer has the nodes
+                    x = X_nan
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 1)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    exp = oinf.run({'X': x})
+                    rt.quickscorer_ = True
+                    self.assertTrue(rt.quickscorer_)
+                    got = oinf.run({'X': x})
+                    for k in exp:
+                        self.assertEqualArray(exp[k], got[k])
+                    rt.quickscorer_ = False
+                    self.assertFalse(rt.quickscorer_)
+                    got = oinf.run({'X': x})
+                    for k in exp:
+                        self.assertEqualArray(exp[k], got[k])
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    rt.quickscorer_ = True
+                    self.assertFalse(rt.quickscorer_)
+                    got = oinf.run({'X': x})
+                    for k in exp:
+                        self.assertEqualArray(exp[k], got[k])
+
+    @ignore_warnings((FutureWarning, DeprecationWarning))
+    def test_avx2(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = numpy.vstack([X_test] * 3).astype(numpy.float32)
+        X_test[::5, 2] = numpy.nan
+        for cls in [GradientBoostingRegressor, RandomForestRegressor,
+                    RandomForestClassifier]:
+            model = cls(n_estimators=20)
+            model.fit(X_train, y_train)
+            with self.subTest(cls=cls.__name__):
+                options = ({id(model): {'zipmap': False}}
+                           if cls is RandomForestClassifier else None)
+                model_def = to_onnx(
+                    model, X_train.astype(numpy.float32), options=options)
+                oinf = OnnxInference(model_def)
+                oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                    numpy.float32, 4)
+                rt = oinf.sequence_[0].ops_.rt_
+                got = oinf.run({'X': X_test})
+                rt.avx2_ = False
+                exp = oinf.run({'X': X_test})
+                for k in exp:
+                    self.assertEqualArray(exp[k], got[k])
+                # switched on again, the model is checked again
+                rt.avx2_ = True
+                got = oinf.run({'X': X_test})
+                for k in exp:
+                    self.assertEqualArray(exp[k], got[k])
+                # not available without the packed layout
+                oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                    numpy.float32, 1)
+                rt = oinf.sequence_[0].ops_.rt_
+                rt.avx2_ = True
+                self.assertFalse(rt.avx2_)
+                got = oinf.run({'X': X_test})
+                for k in exp:
+                    self.assertEqualArray(exp[k], got[k])
+
+    @ignore_warnings((FutureWarning, DeprecationWarning))
+    def test_complete_trees(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = numpy.vstack([X_test] * 3)
+        X_test[::5, 2] = numpy.nan
+        model = GradientBoostingRegressor(n_estimators=20, max_depth=4)
+        model.fit(X_train, y_train)
+        for dtype in [numpy.float32, numpy.float64]:
+            with self.subTest(dtype=dtype):
+                model_def = to_onnx(model, X_train.astype(dtype))
+                oinf = OnnxInference(model_def)
+                oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                    dtype, 1)
+                exp = oinf.run({'X': X_test.astype(dtype)})['variable']
+                oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                    dtype, 3)
+                self.assertEqual(
+                    oinf.sequence_[0].ops_.rt_.complete_tree_ratio_, 1.5)
+                for n in [1, 10, X_test.shape[0]]:
+                    got = oinf.run(
+                        {'X': X_test[:n].astype(dtype)})['variable']
+                    self.assertEqualArray(exp[:n], got)
+
+    @ignore_warnings((FutureWarning, DeprecationWarning))
+    def test_quantized(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = numpy.vstack([X_test] * 5)
+        X_test[::5, 2] = numpy.nan
+        for cls in [GradientBoostingRegressor, RandomForestRegressor,
+                    RandomForestClassifier]:
+            model = cls(n_estimators=20, max_depth=5)
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    options = ({id(model): {'zipmap': False}}
+                               if cls is RandomForestClassifier else None)
+                    model_def = to_onnx(
+                        model, X_train.astype(dtype), options=options)
+                    oinf = OnnxInference(model_def)
+                    x = X_test.astype(dtype)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    oinf.sequence_[0].ops_.rt_.avx2_ = False
+                    exp = oinf.run({'X': x})
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 6)
+                    self.assertTrue(oinf.sequence_[0].ops_.rt_.quantized_)
+                    for n in [1, 10, x.shape[0]]:
+                        got = oinf.run({'X': x[:n]})
+                        for k in exp:
+                            self.assertEqualArray(exp[k][:n], got[k])
+
+    def test_save_load_binary(self):
+        temp = get_temp_folder(__file__, "temp_save_load_binary")
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        loaded = {}
+        for cls in [GradientBoostingRegressor, RandomForestClassifier]:
+            model = cls(n_estimators=20, max_depth=5)
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    options = ({id(model): {'zipmap': False}}
+                               if cls is RandomForestClassifier else None)
+                    model_def = to_onnx(
+                        model, X_train.astype(dtype), options=options)
+                    oinf = OnnxInference(model_def)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    x = X_test.astype(dtype)
+                    exp = rt.compute(x)
+                    name = os.path.join(
+                        temp, "%s_%s.bin" % (cls.__name__, dtype.__name__))
+                    rt.save_binary(name)
+                    rt2 = rt.__class__(60, 20, 2, True)
+                    rt2.load_binary(name)
+                    got = rt2.compute(x)
+                    if isinstance(exp, tuple):
+                        for e, g in zip(exp, got):
+                            self.assertEqualArray(e, g)
+                    else:
+                        self.assertEqualArray(exp, got)
+                    rt1 = rt.__class__(60, 20, 1, True)
+                    self.assertRaise(lambda: rt1.load_binary(name),  # pylint: disable=W0640
+                                     ValueError)
+                    loaded.setdefault(dtype, []).append((rt2, x, got, name))
+
+        # A file saved by another kind of model is rejected
+        # and leaves the loaded model unchanged.
+        for dtype, items in loaded.items():
+            (reg, x, exp_reg, name_reg), (cl, _, exp_cl, name_cl) = items
+            with self.subTest(dtype=dtype):
+                self.assertRaise(lambda: cl.load_binary(name_reg),  # pylint: disable=W0640
+                                 ValueError, "classifier")
+                self.assertRaise(lambda: reg.load_binary(name_cl),  # pylint: disable=W0640
+                                 ValueError, "regressor")
+                self.assertEqualArray(exp_reg, reg.compute(x))
+                for e, g in zip(exp_cl, cl.compute(x)):
+                    self.assertEqualArray(e, g)
+
+    def test_load_binary_corrupted(self):
+        temp = get_temp_folder(__file__, "temp_load_binary_corrupted")
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        model = GradientBoostingRegressor(n_estimators=5, max_depth=3)
+        model.fit(X, y)
+        for dtype in [numpy.float32, numpy.float64]:
+            model_def = to_onnx(model, X.astype(dtype))
+            oinf = OnnxInference(model_def)
+            oinf.sequence_[0].ops_._init(dtype, 4)  # pylint: disable=W0212
+            rt = oinf.sequence_[0].ops_.rt_
+            name = os.path.join(temp, "model_%s.bin" % dtype.__name__)
+            rt.save_binary(name)
+            with open(name, "rb") as f:
+                content = f.read()
+            # header: sizes at 16, counts and offsets of every section at 64
+            sizeof_ntype, _, sizeof_node = struct.unpack_from("III", content, 16)
+            n_targets = struct.unpack_from("q", content, 48)[0]
+            (_, _, n_roots, root_offset, n_nodes, node_offset,
+             _, weight_offset) = struct.unpack_from("8Q", content, 64)
+
+            def corrupted(offset, fmt, value):
+                data = bytearray(content)
+                struct.pack_into(fmt, data, offset, value)
+                bad = os.path.join(temp, "bad_%s.bin" % dtype.__name__)
+                with open(bad, "wb") as f:
+                    f.write(data)
+                return bad
+
+            # node layout: value, feature_id, truenode, falsenode, weights_begin, ...
+            truenode = node_offset + sizeof_ntype + 4
+            cases = [
+                ("truenode", corrupted(truenode, "I", 0)),
+                ("falsenode", corrupted(truenode + 4, "I", n_nodes)),
+                ("weights_end", corrupted(
+                    node_offset + (n_nodes - 1) * sizeof_node + sizeof_ntype + 16,
+                    "I", 2 ** 20)),
+                ("class", corrupted(weight_offset, "q", n_targets)),
+                ("root_id", corrupted(
+                    root_offset + 8 * (n_roots - 1), "Q", n_nodes)),
+                ("n_targets", corrupted(48, "q", 0))]
+            for case, bad in cases:
+                with self.subTest(dtype=dtype, case=case):
+                    rt2 = rt.__class__(60, 20, 2, True)
+                    self.assertRaise(lambda: rt2.load_binary(bad),  # pylint: disable=W0640
+                                     ValueError, "corrupted")
+
+    def test_tiled(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = numpy.vstack([X_test] * 20)
+        for cls in [GradientBoostingRegressor, RandomForestRegressor,
+                    RandomForestClassifier]:
+            model = cls(n_estimators=40, max_depth=5)
+            model.fit(X_train, numpy.vstack([y_train, y_train]).T
+                      if cls is RandomForestRegressor else y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    options = ({id(model): {'zipmap': False}}
+                               if cls is RandomForestClassifier else None)
+                    model_def = to_onnx(
+                        model, X_train.astype(dtype), options=options)
+                    oinf = OnnxInference(model_def)
+                    x = X_test.astype(dtype)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    exp = oinf.run({'X': x})
+                    for cache in [2 ** 12, 2 ** 20]:
+                        oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                            dtype, 7)
+                        oinf.sequence_[0].ops_.rt_.tile_cache_size_ = cache
+                        for n in [1, 10, x.shape[0]]:
+                            got = oinf.run({'X': x[:n]})
+                            for k in exp:
+                                self.assertEqualArray(
+                                    exp[k][:n], got[k], decimal=4)
+
+                    # A runtime without any tree cannot average.
+                    rt = oinf.sequence_[0].ops_.rt_.__class__(60, 20, 2, True)
+                    rt.tile_cache_size_ = 2 ** 20
+                    self.assertRaise(lambda: rt.compute(x),  # pylint: disable=W0640
+                                     ValueError, "no tree")
+
+    def test_calibrate(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for cls in [GradientBoostingRegressor, RandomForestClassifier]:
+            model = cls(n_estimators=20, max_depth=5)
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    options = ({id(model): {'zipmap': False}}
+                               if cls is RandomForestClassifier else None)
+                    model_def = to_onnx(
+                        model, X_train.astype(dtype), options=options)
+                    oinf = OnnxInference(model_def)
+                    x = X_test.astype(dtype)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    exp = oinf.run({'X': x})
+                    rt = oinf.sequence_[0].ops_.rt_
+                    self.assertEqual(rt.schedule_, [])
+                    schedule = rt.calibrate([1, 10, 100], 2)
+                    self.assertEqual(len(schedule), 3)
+                    self.assertEqual([s[0] for s in schedule], [1, 10, 100])
+                    self.assertEqual(rt.schedule_, schedule)
+                    for n in [1, 10, x.shape[0]]:
+                        got = oinf.run({'X': x[:n]})
+                        for k in exp:
+                            self.assertEqualArray(
+                                exp[k][:n], got[k], decimal=4)
+
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    oinf.sequence_[0].ops_.rt_.schedule_ = schedule
+                    self.assertEqual(
+                        oinf.sequence_[0].ops_.rt_.schedule_, schedule)
+                    got = oinf.run({'X': x})
+                    for k in exp:
+                        self.assertEqualArray(exp[k], got[k], decimal=4)
+                    self.assertRaise(
+                        lambda: rt.calibrate([10, 1], 2), ValueError)
+
+    def test_cascade(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        y = (y == 2).astype(numpy.int64)
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        X_test = numpy.vstack([X_test] * 20)
+        for cls in [GradientBoostingClassifier, RandomForestClassifier]:
+            model = cls(n_estimators=40, max_depth=3)
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    model_def = to_onnx(
+                        model, X_train.astype(dtype),
+                        options={id(model): {'zipmap': False}})
+                    oinf = OnnxInference(model_def)
+                    x = X_test.astype(dtype)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    exp = oinf.run({'X': x})
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 8)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    if cls is RandomForestClassifier:
+                        # two weights per leaf
+                        self.assertFalse(rt.cascade_)
+                        continue
+                    self.assertTrue(rt.cascade_)
+                    for n in [1, 10, x.shape[0]]:
+                        # the operator keeps exact probabilities
+                        got = oinf.run({'X': x[:n]})
+                        for k in exp:
+                            self.assertEqualArray(exp[k][:n], got[k])
+                        label, evaluated, retired = rt.compute_label(x[:n])
+                        self.assertEqualArray(exp['output_label'][:n], label)
+                        self.assertLesser(evaluated, n * 40, True)
+                        self.assertEqual(len(retired), 5)
+
+    def test_lookup(self):
+        rnd = numpy.random.RandomState(0)
+        X = rnd.randint(0, 4, size=(500, 4)).astype(numpy.float64)
+        y = X[:, 0] * 2 - X[:, 1] + (X[:, 2] == 1) * 3 + rnd.randn(500) / 10
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        # values outside the codes follow the usual path
+        X_test = numpy.vstack([X_test, X_test + 0.3, X_test * -1, X_test * 5])
+        for cls in [RandomForestRegressor, RandomForestClassifier]:
+            model = cls(n_estimators=10, max_depth=4)
+            model.fit(X_train, y_train if cls is RandomForestRegressor
+                      else (y_train > 2).astype(numpy.int64))
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    options = ({id(model): {'zipmap': False}}
+                               if cls is RandomForestClassifier else None)
+                    model_def = to_onnx(
+                        model, X_train.astype(dtype), options=options)
+                    oinf = OnnxInference(model_def)
+                    x = X_test.astype(dtype)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    exp = oinf.run({'X': x})
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 9)
+                    self.assertTrue(oinf.sequence_[0].ops_.rt_.lookup_)
+                    for n in [1, 10, x.shape[0]]:
+                        got = oinf.run({'X': x[:n]})
+                        for k in exp:
+                            self.assertEqualArray(exp[k][:n], got[k])
+
+                    # switched after init, the tables are built again
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    rt.avx2_ = False
+                    rt.lookup_ = True
+                    self.assertTrue(rt.lookup_)
+                    rt.lookup_max_cardinality_ = 1
+                    self.assertFalse(rt.lookup_)
+                    rt.lookup_max_cardinality_ = 16
+                    rt.lookup_ = True
+                    self.assertTrue(rt.lookup_)
+                    rt.lookup_max_size_ = 4096
+                    self.assertTrue(rt.lookup_)
+                    got = oinf.run({'X': x})
+                    for k in exp:
+                        self.assertEqualArray(exp[k], got[k])
+                    # no lookup without the packed layout
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 1)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    rt.lookup_ = True
+                    self.assertFalse(rt.lookup_)
+                    got = oinf.run({'X': x})
+                    for k in exp:
+                        self.assertEqualArray(exp[k], got[k])
+
+    def test_bfloat16(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        for cls in [GradientBoostingRegressor, RandomForestRegressor]:
+            model = cls(n_estimators=40, max_depth=5)
+            model.fit(X_train, y_train)
+            for dtype in [numpy.float32, numpy.float64]:
+                with self.subTest(cls=cls.__name__, dtype=dtype):
+                    model_def = to_onnx(model, X_train.astype(dtype))
+                    oinf = OnnxInference(model_def)
+                    x = X_test.astype(dtype)
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    exp = oinf.run({'X': x})['variable']
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 10)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    self.assertEqual(rt.bfloat16_, dtype == numpy.float32)
+                    got = oinf.run({'X': x})['variable']
+                    # leaf values lose 16 bits of precision
+                    self.assertEqualArray(exp, got, decimal=1)
+                    rt.bfloat16_ = False
+                    self.assertFalse(rt.bfloat16_)
+                    got = oinf.run({'X': x})['variable']
+                    self.assertEqualArray(exp, got)
+
+                    # switched after init, the bfloat16 nodes are built
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 4)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    rt.bfloat16_ = True
+                    self.assertEqual(rt.bfloat16_, dtype == numpy.float32)
+                    got = oinf.run({'X': x})['variable']
+                    self.assertEqualArray(exp, got, decimal=1)
+                    # not without the packed layout
+                    oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
+                        dtype, 1)
+                    rt = oinf.sequence_[0].ops_.rt_
+                    rt.bfloat16_ = True
+                    self.assertFalse(rt.bfloat16_)
+                    got = oinf.run({'X': x})['variable']
+                    self.assertEqualArray(exp, got, decimal=5)
+
+    def test_append_trees(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        model = GradientBoostingRegressor(
+            n_estimators=20, max_depth=4, warm_start=True, random_state=0)
+        model.fit(X_train, y_train)
+        model20 = to_onnx(model, X_train.astype(numpy.float32))
+        model.set_params(n_estimators=40)
+        model.fit(X_train, y_train)
+        model40 = to_onnx(model, X_train.astype(numpy.float32))
+        node_atts = ['nodes_falsenodeids', 'nodes_featureids', 'nodes_hitrates',
+                     'nodes_missing_value_tracks_true', 'nodes_modes',
+                     'nodes_nodeids', 'nodes_treeids', 'nodes_truenodeids',
+                     'nodes_values']
+        target_atts = ['target_ids', 'target_nodeids', 'target_treeids',
+                       'target_weights']
+
+        for dtype in [numpy.float32, numpy.float64]:
+            x = X_test.astype(dtype)
+            for version in [1, 2, 4]:
+                with self.subTest(dtype=dtype, version=version):
+                    oinf40 = OnnxInference(model40)
+                    op40 = oinf40.sequence_[0].ops_
+                    op40._init(dtype, version)  # pylint: disable=W0212
+                    exp = oinf40.run({'X': x})['variable']
+
+                    # trees 20 to 39 are the new ones
+                    atts = {k: op40._get_typed_attributes(k)  # pylint: disable=W0212
+                            for k in node_atts + target_atts}
+                    keep = numpy.array(atts['nodes_treeids']) >= 20
+                    keep_target = numpy.array(atts['target_treeids']) >= 20
+                    args = []
+                    for k in node_atts:
+                        v = atts[k]
+                        if len(v) == 0:
+                            args.append(v)
+                        elif k == 'nodes_modes':
+                            args.append([m for m, b in zip(v, keep) if b])
+                        else:
+                            args.append(numpy.array(v)[keep])
+                    args.extend(numpy.array(atts[k])[keep_target]
+                                for k in target_atts)
+
+                    oinf = OnnxInference(model20)
+                    op = oinf.sequence_[0].ops_
+                    op._init(dtype, version)  # pylint: disable=W0212
+                    before = oinf.run({'X': x})['variable']
+                    op.rt_.append_trees(*args)
+                    got = oinf.run({'X': x})['variable']
+                    self.assertEqualArray(exp, got, decimal=4)
+                    self.assertRaise(lambda: self.assertEqualArray(
+                        before, got, decimal=4), AssertionError)
+
+    @staticmethod
+    def _appended_trees(op, first_tree, node_atts, weight_atts):
+        # ONNX attributes of the trees >= first_tree in alphabetical order
+        atts = {k: op._get_typed_attributes(k)  # pylint: disable=W0212
+                for k in node_atts + weight_atts}
+        keep = numpy.array(atts['nodes_treeids']) >= first_tree
+        keep_weight = numpy.array(atts[weight_atts[2]]) >= first_tree
+        args = {}
+        for k in node_atts:
+            v = atts[k]
+            if len(v) == 0:
+                args[k] = v
+            elif k == 'nodes_modes':
+                args[k] = [m for m, b in zip(v, keep) if b]
+            else:
+                args[k] = numpy.array(v)[keep]
+        for k in weight_atts:
+            args[k] = numpy.array(atts[k])[keep_weight]
+        return [args[k] for k in sorted(args)]
+
+    def test_append_trees_classifier(self):
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        X_train, X_test, y_train, _ = train_test_split(X, y, random_state=11)
+        model = GradientBoostingClassifier(
+            n_estimators=10, max_depth=3, warm_start=True, random_state=0)
+        model.fit(X_train, y_train)
+        options = {id(model): {'zipmap': False}}
+        model10 = to_onnx(model, X_train.astype(numpy.float32), options=options)
+        n_trees = model.estimators_.size
+        model.set_params(n_estimators=20)
+        model.fit(X_train, y_train)
+        model20 = to_onnx(model, X_train.astype(numpy.float32), options=options)
+        node_atts = ['nodes_falsenodeids', 'nodes_featureids', 'nodes_hitrates',
+                     'nodes_missing_value_tracks_true', 'nodes_modes',
+                     'nodes_nodeids', 'nodes_treeids', 'nodes_truenodeids',
+                     'nodes_values']
+        class_atts = ['class_ids', 'class_nodeids', 'class_treeids',
+                      'class_weights']
+
+        for dtype in [numpy.float32, numpy.float64]:
+            x = X_test.astype(dtype)
+            for version in [1, 2, 4]:
+                with self.subTest(dtype=dtype, version=version):
+                    oinf20 = OnnxInference(model20)
+                    op20 = oinf20.sequence_[0].ops_
+                    op20._init(dtype, version)  # pylint: disable=W0212
+                    exp = op20.rt_.compute(x)
+                    args = self._appended_trees(
+                        op20, n_trees, node_atts, class_atts)
+
+                    oinf = OnnxInference(model10)
+                    op = oinf.sequence_[0].ops_
+                    op._init(dtype, version)  # pylint: disable=W0212
+                    op.rt_.append_trees(*args)
+                    got = op.rt_.compute(x)
+                    self.assertEqualArray(exp[0], got[0])
+                    self.assertEqualArray(exp[1], got[1], decimal=4)
+
+    def test_append_trees_concurrent(self):
+        # predictions computed while trees are appended come
+        # either from the model before or from the model after
+        iris = load_iris()
+        X, y = iris.data, iris.target
+        model = GradientBoostingRegressor(
+            n_estimators=20, max_depth=4, warm_start=True, random_state=0)
+        model.fit(X, y)
+        model20 = to_onnx(model, X.astype(numpy.float32))
+        model.set_params(n_estimators=40)
+        model.fit(X, y)
+        model40 = to_onnx(model, X.astype(numpy.float32))
+        node_atts = ['nodes_falsenodeids', 'nodes_featureids', 'nodes_hitrates',
+                     'nodes_missing_value_tracks_true', 'nodes_modes',
+                     'nodes_nodeids', 'nodes_treeids', 'nodes_truenodeids',
+                     'nodes_values']
+        target_atts = ['target_ids', 'target_nodeids', 'target_treeids',
+                       'target_weights']
+        x = numpy.vstack([X] * 20).astype(numpy.float32)
+
+        for version in [1, 2, 4]:
+            with self.subTest(version=version):
+                oinf40 = OnnxInference(model40)
+                op40 = oinf40.sequence_[0].ops_
+                op40._init(numpy.float32, version)  # pylint: disable=W0212
+                after = op40.rt_.compute(x)
+                args = self._appended_trees(op40, 20, node_atts, target_atts)
+                oinf = OnnxInference(model20)
+                op = oinf.sequence_[0].ops_
+                op._init(numpy.float32, version)  # pylint: disable=W0212
+                before = op.rt_.compute(x)
+
+                results = []
+
+                def run(rt=op.rt_, results=results):
+                    for _ in range(20):
+                        results.append(rt.compute(x))
+
+                threads = [threading.Thread(target=run) for _ in range(3)]
+                for th in threads:
+                    th.start()
+                op.rt_.append_trees(*args)
+                for th in threads:
+                    th.join()
+                self.assertEqual(len(results), 60)
+                for res in results:
+                    if numpy.abs(res - before).max() > 1e-4:
+                        self.assertEqualArray(after, res, decimal=4)
+                self.assertEqualArray(after, op.rt_.compute(x), decimal=4)
+
+    @ignore_warnings((FutureWarning, DeprecationWarning))
+    def test_dense_weights(self):
+        # one dense row of weights per leaf (array_structure=2),
+        # compared to the sparse weights of the first runtime
+        X, y = make_regression(300, 10, n_targets=20, random_state=0)
+        model = RandomForestRegressor(
+            n_estimators=20, max_depth=6, random_state=0)
+        model.fit(X, y / 100)
+        Xc, yc = make_classification(
+            300, 10, n_informative=8, n_classes=12, random_state=0)
+        model_cl = RandomForestClassifier(
+            n_estimators=20, max_depth=6, random_state=0)
+        model_cl.fit(Xc, yc)
+
+        cases = []
+        for agg in ['AVERAGE', 'SUM', 'MIN', 'MAX']:
+            model_def = to_onnx(model, X.astype(numpy.float32))
+            for att in model_def.graph.node[0].attribute:
+                if att.name == 'aggregate_function':
+                    att.s = agg.encode('ascii')
+            cases.append((agg, model_def, X))
+        cases.append(('classifier', to_onnx(
+            model_cl, Xc.astype(numpy.float32),
+            options={id(model_cl): {'zipmap': False}}), Xc))
+
+        for name, model_def, x in cases:
+            for dtype, decimal in [(numpy.float32, 3), (numpy.float64, 8)]:
+                with self.subTest(case=name, dtype=dtype):
+                    xd = x.astype(dtype)
+                    oinf = OnnxInference(model_def)
+                    op = oinf.sequence_[0].ops_
+                    op._init(dtype, 1)  # pylint: disable=W0212
+                    exp = oinf.run({'X': xd})
+                    for version in [4, 7]:
+                        op._init(dtype, version)  # pylint: disable=W0212
+                        self.assertTrue(op.rt_.dense_weights_)
+                        for n in [1, 10, xd.shape[0]]:
+                            got = oinf.run({'X': xd[:n]})
+                            for k in exp:
+                                self.assertEqualArray(
+                                    exp[k][:n], got[k], decimal=decimal)
+
+    def test_compute_csr(self):
+        from scipy.sparse import random as sparse_random
+        from scipy.sparse import csr_matrix, hstack as scipy_hstack
+        X = sparse_random(300, 20, density=0.1, format='csr',
+                          random_state=0).toarray()
+        y = X @ numpy.arange(20) + (X[:, 3] > 0.5)
+        model = GradientBoostingRegressor(
+            n_estimators=20, max_depth=4, random_state=0)
+        model.fit(X, y)
+        model_def = to_onnx(model, X.astype(numpy.float32))
+
+        for dtype in [numpy.float32, numpy.float64]:
+            xs = sparse_random(100, 20, density=0.1, format='csr',
+                               random_state=1, dtype=dtype)
+            for version in [1, 2, 4]:
+                with self.subTest(dtype=dtype, version=version):
+                    oinf = OnnxInference(model_def)
+                    op = oinf.sequence_[0].ops_
+                    op._init(dtype, version)  # pylint: disable=W0212
+                    exp = op.rt_.compute(xs.toarray())
+                    got = op.rt_.compute_csr(
+                        xs.data, xs.indices, xs.indptr, xs.shape[1])
+                    self.assertEqualArray(exp, got, decimal=5)
+                    op.rt_.csr_buffer_size_ = 1
+                    got = op.rt_.compute_csr(
+                        xs.data, xs.indices, xs.indptr, xs.shape[1])
+                    self.assertEqualArray(exp, got, decimal=5)
+                    got = op._run(xs)[0]  # pylint: disable=W0212
+                    self.assertEqualArray(exp.ravel(), got.ravel(), decimal=5)
+                    self.assertRaise(
+                        lambda: op.rt_.compute_csr(  # pylint: disable=W0640
+                            xs.data, xs.indices, xs.indptr, 5),
+                        ValueError)
+                    # valid indices but fewer columns than the trees use
+                    narrow = xs[:, :5].tocsr()
+                    self.assertRaise(
+                        lambda: op.rt_.compute_csr(  # pylint: disable=W0640
+                            narrow.data, narrow.indices, narrow.indptr, 5),
+                        ValueError, "at least")
+                    # additional columns are ignored
+                    wide = scipy_hstack(
+                        [xs, csr_matrix((xs.shape[0], 3), dtype=dtype)]).tocsr()
+                    got = op.rt_.compute_csr(
+                        wide.data, wide.indices, wide.indptr, wide.shape[1])
+                    self.assertEqualArray(exp, got, decimal=5)
+
     def common_test_onnxrt_python_tree_ensemble_runtime_version(self, dtype, multi=False):
         iris = load_iris()
         X, y = iris.data, iris.target
@@ -594,7 +1336,7 @@ class TestOnnxrtPythonRuntimeMlTree(ExtTestCase):
             self.assertEqualArray(lexp, y['variable'], decimal=decimal[dtype])
 
         # other runtime
-        for rv in [0, 1, 2, 3]:
+        for rv in [0, 1, 2, 3, 4, 5, 6, 7]:
             with self.subTest(runtime_version=rv):
                 oinf.sequence_[0].ops_._init(  # pylint: disable=W0212
                     dtype, rv)
@@ -674,7 +1416,7 @@ class TestOnnxrtPythonRuntimeMlTree(ExtTestCase):
                     lexp, y['probabilities'], decimal=decimal[dtype])
 
         # other runtime
-        for rv in [0, 1, 2, 3]:
+        for rv in [0, 1, 2, 3, 4, 5, 6, 7]:
             if single_cls and rv == 0:
                 continue
             with self.subTest(runtime_version=rv):
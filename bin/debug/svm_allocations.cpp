@@ -0,0 +1,112 @@
+// Counts the heap allocations made by RuntimeSVMClassifier::compute
+// once the workspaces exist. The per-row path must not allocate, the
+// count must not depend on the number of rows.
+//
+// Build and run from this folder (Linux, numpy must be importable):
+//
+//   g++ -std=c++11 -O2 -fopenmp -DUSE_OPENMP
+//       $(python -m pybind11 --includes) -I../../mlprodict/onnxrt/ops_cpu
+//       svm_allocations.cpp ../../mlprodict/onnxrt/ops_cpu/op_common_.cpp
+//       ../../mlprodict/onnxrt/ops_cpu/op_common_num_.cpp
+//       $(python3-config --ldflags --embed) -o svm_allocations
+//   ./svm_allocations
+
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <random>
+#include <pybind11/embed.h>
+#include "op_svm_classifier_.cpp"
+
+
+static std::atomic<int64_t> n_allocations(0);
+
+
+void* operator new(size_t size) {
+    ++n_allocations;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+
+template<typename NTYPE>
+py::array_t<NTYPE, py::array::c_style | py::array::forcecast> to_array(
+        const std::vector<NTYPE>& values) {
+    return py::array_t<NTYPE, py::array::c_style | py::array::forcecast>(
+        std::vector<ssize_t>{(ssize_t)values.size()}, values.data());
+}
+
+
+// Returns the number of allocations of the second call to compute,
+// the first one creates the thread pool and the workspaces.
+template<typename NTYPE>
+int64_t count_allocations(const RuntimeSVMClassifier<NTYPE>& rt, int64_t n_rows,
+                          int64_t n_features, std::mt19937& gen) {
+    std::uniform_real_distribution<double> U(-1, 1);
+    std::vector<NTYPE> X(n_rows * n_features);
+    for (auto it = X.begin(); it != X.end(); ++it)
+        *it = (NTYPE)U(gen);
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> x(
+        std::vector<ssize_t>{(ssize_t)n_rows, (ssize_t)n_features}, X.data());
+    rt.compute(x);
+    int64_t before = n_allocations;
+    py::tuple res = rt.compute(x);
+    return n_allocations - before;
+}
+
+
+// 4 classes, RBF kernel, probabilities.
+template<typename NTYPE>
+int check(int omp_N, int64_t kernel_block_rows, std::mt19937& gen) {
+    std::uniform_real_distribution<double> U(-1, 1);
+    int64_t n_features = 9, n_classes = 4, n_vectors = 14;
+    std::vector<int64_t> labels{0, 1, 2, 3}, vectors_per_class{2, 3, 4, 5};
+    std::vector<NTYPE> support_vectors(n_vectors * n_features);
+    std::vector<NTYPE> coefficients((n_classes - 1) * n_vectors);
+    std::vector<NTYPE> rho(6), prob_a(6), prob_b(6);
+    std::vector<NTYPE> kernel_params{(NTYPE)0.4, (NTYPE)0.1, (NTYPE)3};
+    for (auto* v : {&support_vectors, &coefficients, &rho, &prob_a, &prob_b})
+        for (auto it = v->begin(); it != v->end(); ++it)
+            *it = (NTYPE)U(gen);
+
+    RuntimeSVMClassifier<NTYPE> rt(omp_N);
+    rt.kernel_block_rows_ = kernel_block_rows;
+    rt.init(to_array(labels), std::vector<std::string>(), to_array(coefficients),
+            to_array(kernel_params), "RBF", "NONE", to_array(prob_a), to_array(prob_b),
+            to_array(rho), to_array(support_vectors), to_array(vectors_per_class));
+
+    int64_t expected = count_allocations(rt, 1, n_features, gen);
+    int failures = 0;
+    for (int64_t n_rows : {1, 10, 100, 1000}) {
+        int64_t count = count_allocations(rt, n_rows, n_features, gen);
+        printf("%s omp_N=%d kernel_block_rows=%d rows=%d: %d allocations\n",
+               sizeof(NTYPE) == 4 ? "float" : "double", omp_N, (int)kernel_block_rows,
+               (int)n_rows, (int)count);
+        if (count != expected)
+            ++failures;
+    }
+    return failures;
+}
+
+
+int main() {
+    py::scoped_interpreter guard;
+    std::mt19937 gen(0);
+    int failures = 0;
+    for (int omp_N : {1 << 30, 1}) {
+        for (int64_t kernel_block_rows : {0, 32}) {
+            failures += check<float>(omp_N, kernel_block_rows, gen);
+            failures += check<double>(omp_N, kernel_block_rows, gen);
+        }
+    }
+    printf("failures: %d\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -27,6 +27,8 @@ namespace py = pybind11;
 #endif
 
 #include "op_common_.hpp"
+#include "op_common_num_.hpp"
+#include <chrono>
 
 
 /////////////////////////////////////////////
@@ -397,6 +399,93 @@ py::array_t<int64_t> topk_element_fetch_int64(
 /////////////////////////////////////////////
 
 
+/////////////////////////////////////////////
+// begin: vector kernels
+/////////////////////////////////////////////
+
+
+std::string vector_kernels_isa_str() {
+    return to_str(vector_kernels_isa());
+}
+
+
+template <typename NTYPE>
+double benchmark_vector_kernel(const std::string& kernel, int64_t size,
+                               int64_t repeat, const std::string& isa) {
+    const VectorKernels<NTYPE>& k = get_vector_kernels<NTYPE>(to_VECTOR_ISA(isa));
+    if (size <= 0 || repeat <= 0)
+        throw std::invalid_argument(MakeString(
+            "size=", size, " and repeat=", repeat, " must be positive."));
+    std::vector<NTYPE> x(size), y(size);
+    for (int64_t i = 0; i < size; ++i) {
+        x[i] = (NTYPE)(i % 7) / 7;
+        y[i] = (NTYPE)(i % 5) / 5;
+    }
+    // The result is accumulated so that no call can be removed.
+    volatile NTYPE res = 0;
+    auto begin = std::chrono::high_resolution_clock::now();
+    if (kernel.compare("dot") == 0) {
+        for (int64_t r = 0; r < repeat; ++r)
+            res = res + k.dot(x.data(), y.data(), (size_t)size);
+    }
+    else
+        throw std::invalid_argument(MakeString("Unexpected kernel '", kernel, "'."));
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(end - begin).count() / repeat;
+}
+
+
+template <typename NTYPE>
+py::array_t<NTYPE> compute_vector_kernel(
+        const std::string& kernel,
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> x,
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> y,
+        const std::string& isa) {
+    const VectorKernels<NTYPE>& k = get_vector_kernels<NTYPE>(to_VECTOR_ISA(isa));
+    if (x.ndim() != 1 || y.ndim() != 1 || x.shape(0) != y.shape(0))
+        throw std::invalid_argument("x and y must be vectors of the same length.");
+    if (kernel.compare("dot") != 0)
+        throw std::invalid_argument(MakeString("Unexpected kernel '", kernel, "'."));
+    NTYPE res = k.dot(x.data(), y.data(), (size_t)x.shape(0));
+    return py::array_t<NTYPE>(1, &res);
+}
+
+
+py::array_t<float> compute_vector_kernel_float(
+        const std::string& kernel,
+        py::array_t<float, py::array::c_style | py::array::forcecast> x,
+        py::array_t<float, py::array::c_style | py::array::forcecast> y,
+        const std::string& isa) {
+    return compute_vector_kernel<float>(kernel, x, y, isa);
+}
+
+
+py::array_t<double> compute_vector_kernel_double(
+        const std::string& kernel,
+        py::array_t<double, py::array::c_style | py::array::forcecast> x,
+        py::array_t<double, py::array::c_style | py::array::forcecast> y,
+        const std::string& isa) {
+    return compute_vector_kernel<double>(kernel, x, y, isa);
+}
+
+
+double benchmark_vector_kernel_float(const std::string& kernel, int64_t size,
+                                     int64_t repeat, const std::string& isa) {
+    return benchmark_vector_kernel<float>(kernel, size, repeat, isa);
+}
+
+
+double benchmark_vector_kernel_double(const std::string& kernel, int64_t size,
+                                      int64_t repeat, const std::string& isa) {
+    return benchmark_vector_kernel<double>(kernel, size, repeat, isa);
+}
+
+
+/////////////////////////////////////////////
+// end: vector kernels
+/////////////////////////////////////////////
+
+
 #ifndef SKIP_PYTHON
 
 PYBIND11_MODULE(_op_onnx_numpy, m) {
@@ -459,6 +548,33 @@ on each row (= last dimension for a multi dimension array).)pbdoc");
     m.def("topk_element_fetch_int64", &topk_element_fetch_int64,
             R"pbdoc(Fetches the top k element knowing their indices
 on each row (= last dimension for a multi dimension array).)pbdoc");
+
+    m.def("vector_kernels_isa", &vector_kernels_isa_str,
+            R"pbdoc(Returns the instruction set (`scalar`, `avx2`, `avx512`)
+selected when the module was loaded for the vector kernels
+(dot product).)pbdoc");
+    m.def("benchmark_vector_kernel_float", &benchmark_vector_kernel_float,
+            py::arg("kernel"), py::arg("size"), py::arg("repeat"), py::arg("isa"),
+            R"pbdoc(Measures the average time of one call to a vector kernel
+(`dot`) for float32 vectors
+of length *size* with instruction set *isa* (`scalar`, `avx2`, `avx512`).
+It raises an exception if the CPU does not support *isa*.)pbdoc");
+    m.def("benchmark_vector_kernel_double", &benchmark_vector_kernel_double,
+            py::arg("kernel"), py::arg("size"), py::arg("repeat"), py::arg("isa"),
+            R"pbdoc(Measures the average time of one call to a vector kernel
+(`dot`) for float64 vectors
+of length *size* with instruction set *isa* (`scalar`, `avx2`, `avx512`).
+It raises an exception if the CPU does not support *isa*.)pbdoc");
+    m.def("compute_vector_kernel_float", &compute_vector_kernel_float,
+            py::arg("kernel"), py::arg("x"), py::arg("y"), py::arg("isa"),
+            R"pbdoc(Calls a vector kernel with instruction set *isa* on float32
+vectors *x* and *y*: `dot` returns an array of one element.
+It raises an exception if the CPU does not support *isa*.)pbdoc");
+    m.def("compute_vector_kernel_double", &compute_vector_kernel_double,
+            py::arg("kernel"), py::arg("x"), py::arg("y"), py::arg("isa"),
+            R"pbdoc(Calls a vector kernel with instruction set *isa* on float64
+vectors *x* and *y*: `dot` returns an array of one element.
+It raises an exception if the CPU does not support *isa*.)pbdoc");
 }
 
 #endif
@@ -5,6 +5,20 @@
 #include "op_common_.hpp"
 #include <string.h> // memcpy
 #include <stdlib.h> // realloc
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+#if defined(_WIN32) || defined(WIN32)
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 POST_EVAL_TRANSFORM to_POST_EVAL_TRANSFORM(const std::string& value) {
@@ -136,3 +150,124 @@ void debug_print(const std::string& msg, int64_t value) {
 void debug_print(const std::string& msg, size_t value) {
     debug_print_(msg.c_str(), value);
 }
+
+
+bool _cpu_supports_avx2() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    // OSXSAVE, AVX, FMA
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 ||
+            (info[2] & (1 << 12)) == 0)
+        return false;
+    // The OS saves the YMM registers.
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+
+bool cpu_supports_avx2() {
+    static bool avx2 = _cpu_supports_avx2();
+    return avx2;
+}
+
+
+bool _cpu_supports_avx512() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    if (!cpu_supports_avx2())
+        return false;
+    int info[4];
+    __cpuidex(info, 7, 0);
+    // AVX512F
+    if ((info[1] & (1 << 16)) == 0)
+        return false;
+    // The OS saves the opmask and ZMM registers.
+    return (_xgetbv(0) & 0xe6) == 0xe6;
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    // The AVX512 kernels call the AVX2 ones for short vectors.
+    return cpu_supports_avx2() && __builtin_cpu_supports("avx512f");
+#else
+    return false;
+#endif
+}
+
+
+bool cpu_supports_avx512() {
+    static bool avx512 = _cpu_supports_avx512();
+    return avx512;
+}
+
+
+MemoryMappedFile::MemoryMappedFile(const std::string& filename) {
+    data_ = nullptr;
+    size_ = 0;
+    file_ = nullptr;
+    mapping_ = nullptr;
+#if defined(_WIN32) || defined(WIN32)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::invalid_argument(MakeString("Unable to open file '", filename, "'."));
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        throw std::invalid_argument(MakeString("Unable to map empty file '", filename, "'."));
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL) {
+        CloseHandle(file);
+        throw std::invalid_argument(MakeString("Unable to map file '", filename, "'."));
+    }
+    data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data_ == NULL) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::invalid_argument(MakeString("Unable to map file '", filename, "'."));
+    }
+    size_ = (size_t)size.QuadPart;
+    file_ = file;
+    mapping_ = mapping;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::invalid_argument(MakeString("Unable to open file '", filename, "'."));
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        throw std::invalid_argument(MakeString("Unable to map empty file '", filename, "'."));
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping remains valid once the file is closed.
+    close(fd);
+    if (data == MAP_FAILED)
+        throw std::invalid_argument(MakeString("Unable to map file '", filename, "'."));
+    data_ = data;
+    size_ = (size_t)st.st_size;
+#endif
+}
+
+
+MemoryMappedFile::~MemoryMappedFile() {
+#if defined(_WIN32) || defined(WIN32)
+    if (data_ != nullptr)
+        UnmapViewOfFile(data_);
+    if (mapping_ != nullptr)
+        CloseHandle((HANDLE)mapping_);
+    if (file_ != nullptr)
+        CloseHandle((HANDLE)file_);
+#else
+    if (data_ != nullptr)
+        munmap(data_, size_);
+#endif
+}
@@ -7,8 +7,10 @@
 #include <iterator>
 #include <iostream> // cout
 #include <sstream>
+#include <memory>
 #include <math.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 
 #if defined(_WIN32) || defined(WIN32)
 
@@ -116,6 +118,31 @@ enum class AutoPadType {
 AutoPadType to_AutoPadType(const std::string& value);
 
 
+// Instruction sets detected at runtime, the extensions are compiled
+// without any architecture flag, a kernel compiled for a specific
+// instruction set is only called if the CPU supports it.
+bool cpu_supports_avx2();
+bool cpu_supports_avx512();
+
+
+// Read-only memory mapping of a file, processes mapping the same file
+// share the same pages.
+class MemoryMappedFile {
+    public:
+        MemoryMappedFile(const std::string& filename);
+        ~MemoryMappedFile();
+        inline const char* data() const { return (const char*)data_; }
+        inline size_t size() const { return size_; }
+    private:
+        MemoryMappedFile(const MemoryMappedFile&);
+        MemoryMappedFile& operator=(const MemoryMappedFile&);
+        void* data_;
+        size_t size_;
+        void* file_;
+        void* mapping_;
+};
+
+
 
 static inline float ErfInv(float x) {
     float sgn = x < 0 ? -1.0f : 1.0f;
@@ -470,3 +497,34 @@ inline std::string MakeString(const Args&... args) {
     MakeStringInternal(ss, args...);
     return std::string(ss.str());
 }
+
+
+// Checks a sparse matrix in CSR format and returns its number of rows.
+template<typename NTYPE>
+int64_t check_csr(
+        const pybind11::array_t<NTYPE, pybind11::array::c_style | pybind11::array::forcecast>& data,
+        const pybind11::array_t<int64_t, pybind11::array::c_style | pybind11::array::forcecast>& indices,
+        const pybind11::array_t<int64_t, pybind11::array::c_style | pybind11::array::forcecast>& indptr,
+        int64_t n_features) {
+    if (indptr.size() == 0)
+        throw std::invalid_argument("indptr cannot be empty.");
+    if (data.size() != indices.size())
+        throw std::invalid_argument(MakeString(
+            "data and indices must have the same size (", data.size(),
+            " != ", indices.size(), ")."));
+    int64_t N = (int64_t)indptr.size() - 1;
+    const int64_t* ptr = indptr.data(0);
+    if (ptr[0] != 0 || ptr[N] != (int64_t)data.size())
+        throw std::invalid_argument("indptr must start with 0 and end with the number of values.");
+    for (int64_t i = 0; i < N; ++i) {
+        if (ptr[i + 1] < ptr[i])
+            throw std::invalid_argument(MakeString("indptr is not sorted at row ", i, "."));
+    }
+    const int64_t* ind = indices.data(0);
+    for (pybind11::ssize_t k = 0; k < indices.size(); ++k) {
+        if (ind[k] < 0 || ind[k] >= n_features)
+            throw std::invalid_argument(MakeString(
+                "Column index ", ind[k], " is out of range [0, ", n_features, ")."));
+    }
+    return N;
+}
@@ -1,100 +1,605 @@
-
 #if !defined(_CRT_SECURE_NO_WARNINGS)
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 #include "op_common_num_.hpp"
+#include "op_common_.hpp"
+#include <stdexcept>
 
+#if USE_OPENMP
+#include <omp.h>
+#endif
 
-#include <xmmintrin.h>
-#include <emmintrin.h>
-
-
-#define BYNF 16
 
+// The extensions are compiled without any architecture flag,
+// AVX2 and AVX512 kernels are compiled with a function attribute
+// and only selected if the CPU supports them.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define NUM_X86_KERNELS
+#include <immintrin.h>
+#endif
 
-// Optimisation are disabled. The debug version works
-// but the release does not.
-// It requires further investigation.
-#if defined(_WIN32) || defined(WIN32)
-//#pragma optimize( "", off )
+#if defined(NUM_X86_KERNELS) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_NUM_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_NUM_AVX512 __attribute__((target("avx512f")))
 #else
-//#pragma GCC push_options
-//#pragma GCC optimize ("O0")
-//         works: gcc -pthread -Wno-unused-result -Wsign-compare -DNDEBUG -g -fwrapv -O3 -Wall -g -fstack-protector --param=ssp-buffer-size=4 -Wformat -Werror=format-security -fPIC -fopenmp
-// does not work: gcc -pthread -Wno-unused-result -Wsign-compare -DNDEBUG -g -fwrapv -O3 -Wall -fPIC -fopenmp
+#define TARGET_NUM_AVX2
+#define TARGET_NUM_AVX512
 #endif
-float vector_dot_product_pointer16_sse(const float *p1, const float *p2, size_t size) {
-    float sum = 0;
-    size_t i = 0;
-#if 0
-    // Compilers do some optimisation and this code fails at _mm_store_ps.
-    if (size >= BYNF) {
-        float r[4];
-        size_t size_ = size - size % BYNF;
-        __m128 r1 = _mm_setzero_ps();
-        for (; i != size_; i += 4, p1 += 4, p2 += 4) {
-            r1 = _mm_add_ps(r1, _mm_mul_ps(_mm_load_ps(p1), _mm_load_ps(p2)));
-        }
-        _mm_store_ps(r, r1);
-        sum += r[0] + r[1] + r[2] + r[3];
-    }
-#endif
-    size -= i;
+
+
+/////////////////////////////////////////////
+// scalar
+/////////////////////////////////////////////
+
+
+template <typename NTYPE>
+static NTYPE dot_scalar(const NTYPE *p1, const NTYPE *p2, size_t size) {
+    NTYPE sum = 0;
     for (; size > 0; ++p1, ++p2, --size)
         sum += *p1 * *p2;
     return sum;
 }
-#if defined(_WIN32) || defined(WIN32)
-//#pragma optimize( "", on )
-#else
-// #pragma GCC pop_options
+
+
+#if defined(NUM_X86_KERNELS)
+
+/////////////////////////////////////////////
+// AVX2 + FMA
+/////////////////////////////////////////////
+
+
+TARGET_NUM_AVX2
+static inline float hsum_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+
+TARGET_NUM_AVX2
+static inline double hsum_avx2(__m256d v) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    s = _mm_add_sd(s, _mm_unpackhi_pd(s, s));
+    return _mm_cvtsd_f64(s);
+}
+
+
+TARGET_NUM_AVX2
+static float dot_avx2(const float *p1, const float *p2, size_t size) {
+    __m256 r1 = _mm256_setzero_ps();
+    __m256 r2 = _mm256_setzero_ps();
+    for (; size >= 16; size -= 16, p1 += 16, p2 += 16) {
+        r1 = _mm256_fmadd_ps(_mm256_loadu_ps(p1), _mm256_loadu_ps(p2), r1);
+        r2 = _mm256_fmadd_ps(_mm256_loadu_ps(p1 + 8), _mm256_loadu_ps(p2 + 8), r2);
+    }
+    if (size >= 8) {
+        r1 = _mm256_fmadd_ps(_mm256_loadu_ps(p1), _mm256_loadu_ps(p2), r1);
+        size -= 8, p1 += 8, p2 += 8;
+    }
+    return hsum_avx2(_mm256_add_ps(r1, r2)) + dot_scalar(p1, p2, size);
+}
+
+
+TARGET_NUM_AVX2
+static double dot_avx2(const double *p1, const double *p2, size_t size) {
+    __m256d r1 = _mm256_setzero_pd();
+    __m256d r2 = _mm256_setzero_pd();
+    for (; size >= 8; size -= 8, p1 += 8, p2 += 8) {
+        r1 = _mm256_fmadd_pd(_mm256_loadu_pd(p1), _mm256_loadu_pd(p2), r1);
+        r2 = _mm256_fmadd_pd(_mm256_loadu_pd(p1 + 4), _mm256_loadu_pd(p2 + 4), r2);
+    }
+    if (size >= 4) {
+        r1 = _mm256_fmadd_pd(_mm256_loadu_pd(p1), _mm256_loadu_pd(p2), r1);
+        size -= 4, p1 += 4, p2 += 4;
+    }
+    return hsum_avx2(_mm256_add_pd(r1, r2)) + dot_scalar(p1, p2, size);
+}
+
+
+/////////////////////////////////////////////
+// AVX512F, tails use masked loads and stores,
+// short vectors go to AVX2, the final reduction
+// costs more than the computation
+/////////////////////////////////////////////
+
+#define AVX512_MIN_SIZE 32
+
+
+TARGET_NUM_AVX512
+static float dot_avx512(const float *p1, const float *p2, size_t size) {
+    if (size < AVX512_MIN_SIZE)
+        return dot_avx2(p1, p2, size);
+    __m512 r1 = _mm512_setzero_ps();
+    __m512 r2 = _mm512_setzero_ps();
+    for (; size >= 32; size -= 32, p1 += 32, p2 += 32) {
+        r1 = _mm512_fmadd_ps(_mm512_loadu_ps(p1), _mm512_loadu_ps(p2), r1);
+        r2 = _mm512_fmadd_ps(_mm512_loadu_ps(p1 + 16), _mm512_loadu_ps(p2 + 16), r2);
+    }
+    if (size >= 16) {
+        r1 = _mm512_fmadd_ps(_mm512_loadu_ps(p1), _mm512_loadu_ps(p2), r1);
+        size -= 16, p1 += 16, p2 += 16;
+    }
+    if (size > 0) {
+        __mmask16 m = (__mmask16)((1u << size) - 1);
+        r2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, p1), _mm512_maskz_loadu_ps(m, p2), r2);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(r1, r2));
+}
+
+
+TARGET_NUM_AVX512
+static double dot_avx512(const double *p1, const double *p2, size_t size) {
+    if (size < AVX512_MIN_SIZE)
+        return dot_avx2(p1, p2, size);
+    __m512d r1 = _mm512_setzero_pd();
+    __m512d r2 = _mm512_setzero_pd();
+    for (; size >= 16; size -= 16, p1 += 16, p2 += 16) {
+        r1 = _mm512_fmadd_pd(_mm512_loadu_pd(p1), _mm512_loadu_pd(p2), r1);
+        r2 = _mm512_fmadd_pd(_mm512_loadu_pd(p1 + 8), _mm512_loadu_pd(p2 + 8), r2);
+    }
+    if (size >= 8) {
+        r1 = _mm512_fmadd_pd(_mm512_loadu_pd(p1), _mm512_loadu_pd(p2), r1);
+        size -= 8, p1 += 8, p2 += 8;
+    }
+    if (size > 0) {
+        __mmask8 m = (__mmask8)((1u << size) - 1);
+        r2 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, p1), _mm512_maskz_loadu_pd(m, p2), r2);
+    }
+    return _mm512_reduce_add_pd(_mm512_add_pd(r1, r2));
+}
+
 #endif
 
 
-#define BYND 8
+/////////////////////////////////////////////
+// dispatch
+/////////////////////////////////////////////
 
 
-#if defined(_WIN32) || defined(WIN32)
-//#pragma optimize( "", off )
-#else
-//#pragma GCC push_options
-//#pragma GCC optimize ("O0")
+const char* to_str(VECTOR_ISA isa) {
+    switch (isa) {
+        case VECTOR_ISA::SCALAR: return "scalar";
+        case VECTOR_ISA::AVX2: return "avx2";
+        case VECTOR_ISA::AVX512: return "avx512";
+    }
+    return "?";
+}
+
+
+VECTOR_ISA to_VECTOR_ISA(const std::string& value) {
+    if (value.compare("scalar") == 0) return VECTOR_ISA::SCALAR;
+    if (value.compare("avx2") == 0) return VECTOR_ISA::AVX2;
+    if (value.compare("avx512") == 0) return VECTOR_ISA::AVX512;
+    throw std::invalid_argument(MakeString("Unexpected instruction set '", value, "'."));
+}
+
+
+bool vector_kernels_available(VECTOR_ISA isa) {
+    switch (isa) {
+        case VECTOR_ISA::SCALAR: return true;
+#if defined(NUM_X86_KERNELS)
+        case VECTOR_ISA::AVX2: return cpu_supports_avx2();
+        case VECTOR_ISA::AVX512: return cpu_supports_avx512();
 #endif
-double vector_dot_product_pointer16_sse(const double *p1, const double *p2, size_t size) {
-    double sum = 0;
-    size_t i = 0;
-#if 0
-    // Compilers do some optimisation and this code fails at _mm_store_ps.
-    if (size >= BYND) {
-        double r[2];
-        size_t size_ = size - size % BYND;
-        __m128d r1 = _mm_setzero_pd();
-        for (; i != size_; i += 2, p1 += 2, p2 += 2) {
-            r1 = _mm_add_pd(r1, _mm_mul_pd(_mm_load_pd(p1), _mm_load_pd(p2)));
-        }
-        _mm_store_pd(r, r1);
-        sum += r[0] + r[1];
+        default: return false;
     }
-#endif    
-    size -= i;
-    for (; size > 0; ++p1, ++p2, --size)
-        sum += *p1 * *p2;
-    return sum;
 }
-#if defined(_WIN32) || defined(WIN32)
-// #pragma optimize( "", on )
-#else
-// #pragma GCC pop_options
+
+
+static VECTOR_ISA _vector_kernels_isa() {
+    if (vector_kernels_available(VECTOR_ISA::AVX512))
+        return VECTOR_ISA::AVX512;
+    if (vector_kernels_available(VECTOR_ISA::AVX2))
+        return VECTOR_ISA::AVX2;
+    return VECTOR_ISA::SCALAR;
+}
+
+
+VECTOR_ISA vector_kernels_isa() {
+    static VECTOR_ISA isa = _vector_kernels_isa();
+    return isa;
+}
+
+
+template <typename NTYPE>
+static VectorKernels<NTYPE> make_vector_kernels(VECTOR_ISA isa) {
+    VectorKernels<NTYPE> k;
+    k.dot = dot_scalar<NTYPE>;
+#if defined(NUM_X86_KERNELS)
+    switch (isa) {
+        case VECTOR_ISA::AVX2:
+            k.dot = dot_avx2;
+            break;
+        case VECTOR_ISA::AVX512:
+            k.dot = dot_avx512;
+            break;
+        default:
+            break;
+    }
 #endif
+    return k;
+}
+
+
+template <typename NTYPE>
+const VectorKernels<NTYPE>& get_vector_kernels(VECTOR_ISA isa) {
+    static const VectorKernels<NTYPE> kernels[3] = {
+        make_vector_kernels<NTYPE>(VECTOR_ISA::SCALAR),
+        make_vector_kernels<NTYPE>(VECTOR_ISA::AVX2),
+        make_vector_kernels<NTYPE>(VECTOR_ISA::AVX512)
+    };
+    if (!vector_kernels_available(isa))
+        throw std::invalid_argument(MakeString(
+            "The CPU does not support instruction set '", to_str(isa), "'."));
+    return kernels[(int)isa];
+}
+
+template const VectorKernels<float>& get_vector_kernels(VECTOR_ISA isa);
+template const VectorKernels<double>& get_vector_kernels(VECTOR_ISA isa);
+
+
+// Kernels selected when the module is loaded.
+static const VectorKernels<float>& best_kernels_float = get_vector_kernels<float>(vector_kernels_isa());
+static const VectorKernels<double>& best_kernels_double = get_vector_kernels<double>(vector_kernels_isa());
+
+
+float vector_dot_product_pointer16_sse(const float *p1, const float *p2, size_t size) {
+    return best_kernels_float.dot(p1, p2, size);
+}
+
+
+double vector_dot_product_pointer16_sse(const double *p1, const double *p2, size_t size) {
+    return best_kernels_double.dot(p1, p2, size);
+}
 
 
 template <>
 float vector_dot_product_pointer_sse(const float *p1, const float *p2, size_t size) {
-    return vector_dot_product_pointer16_sse(p1, p2, size);
+    return best_kernels_float.dot(p1, p2, size);
 }
 
 template <>
 double vector_dot_product_pointer_sse(const double *p1, const double *p2, size_t size) {
-    return vector_dot_product_pointer16_sse(p1, p2, size);
+    return best_kernels_double.dot(p1, p2, size);
+}
+
+
+/////////////////////////////////////////////
+// gemm
+/////////////////////////////////////////////
+
+// Block sizes: a packed panel of A (GEMM_MC x GEMM_KC) stays in L2,
+// a packed panel of B (GEMM_KC x GEMM_NC) in L3. GEMM_MC and GEMM_NC
+// are multiples of every microkernel size.
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 1024
+// Largest tile of a microkernel (mr x nr).
+#define GEMM_MAX_TILE 192
+
+// A microkernel computes c += alpha a b for a tile of mr x nr elements,
+// a is a packed panel of kc x mr elements, b a packed panel of kc x nr.
+template <typename NTYPE>
+struct GemmKernel {
+    size_t mr;
+    size_t nr;
+    void (*kernel)(size_t kc, const NTYPE* a, const NTYPE* b,
+                   NTYPE alpha, NTYPE* c, size_t ldc);
+};
+
+
+template <typename NTYPE>
+static void gemm_kernel_scalar(size_t kc, const NTYPE* a, const NTYPE* b,
+                               NTYPE alpha, NTYPE* c, size_t ldc) {
+    NTYPE acc[16] = {0};
+    size_t i, j;
+    for (; kc > 0; --kc, a += 4, b += 4) {
+        for (i = 0; i < 4; ++i)
+            for (j = 0; j < 4; ++j)
+                acc[i * 4 + j] += a[i] * b[j];
+    }
+    for (i = 0; i < 4; ++i, c += ldc)
+        for (j = 0; j < 4; ++j)
+            c[j] += alpha * acc[i * 4 + j];
+}
+
+
+#if defined(NUM_X86_KERNELS)
+
+// One row of the tile, two registers wide.
+#define GEMM_FMA_ROW(FMA, BCAST, i) \
+    va = BCAST(a + i); \
+    c##i##0 = FMA(va, vb0, c##i##0); \
+    c##i##1 = FMA(va, vb1, c##i##1);
+
+#define GEMM_STORE_ROW(FMA, LOAD, STORE, w, i) \
+    STORE(c + i * ldc, FMA(valpha, c##i##0, LOAD(c + i * ldc))); \
+    STORE(c + i * ldc + w, FMA(valpha, c##i##1, LOAD(c + i * ldc + w)));
+
+#define GEMM_KERNEL_6x2(REG, ZERO, LOAD, STORE, BCAST, SET1, FMA, w) \
+    REG c00 = ZERO(), c01 = ZERO(), c10 = ZERO(), c11 = ZERO(); \
+    REG c20 = ZERO(), c21 = ZERO(), c30 = ZERO(), c31 = ZERO(); \
+    REG c40 = ZERO(), c41 = ZERO(), c50 = ZERO(), c51 = ZERO(); \
+    REG va, vb0, vb1; \
+    for (; kc > 0; --kc, a += 6, b += 2 * w) { \
+        vb0 = LOAD(b); \
+        vb1 = LOAD(b + w); \
+        GEMM_FMA_ROW(FMA, BCAST, 0) \
+        GEMM_FMA_ROW(FMA, BCAST, 1) \
+        GEMM_FMA_ROW(FMA, BCAST, 2) \
+        GEMM_FMA_ROW(FMA, BCAST, 3) \
+        GEMM_FMA_ROW(FMA, BCAST, 4) \
+        GEMM_FMA_ROW(FMA, BCAST, 5) \
+    } \
+    REG valpha = SET1(alpha); \
+    GEMM_STORE_ROW(FMA, LOAD, STORE, w, 0) \
+    GEMM_STORE_ROW(FMA, LOAD, STORE, w, 1) \
+    GEMM_STORE_ROW(FMA, LOAD, STORE, w, 2) \
+    GEMM_STORE_ROW(FMA, LOAD, STORE, w, 3) \
+    GEMM_STORE_ROW(FMA, LOAD, STORE, w, 4) \
+    GEMM_STORE_ROW(FMA, LOAD, STORE, w, 5)
+
+#define GEMM_BCAST512_PS(p) _mm512_set1_ps(*(p))
+#define GEMM_BCAST512_PD(p) _mm512_set1_pd(*(p))
+
+
+// 6 x 16 tile, 12 accumulators.
+TARGET_NUM_AVX2
+static void gemm_kernel_avx2(size_t kc, const float* a, const float* b,
+                             float alpha, float* c, size_t ldc) {
+    GEMM_KERNEL_6x2(__m256, _mm256_setzero_ps, _mm256_loadu_ps, _mm256_storeu_ps,
+                    _mm256_broadcast_ss, _mm256_set1_ps, _mm256_fmadd_ps, 8)
+}
+
+
+// 6 x 8 tile.
+TARGET_NUM_AVX2
+static void gemm_kernel_avx2(size_t kc, const double* a, const double* b,
+                             double alpha, double* c, size_t ldc) {
+    GEMM_KERNEL_6x2(__m256d, _mm256_setzero_pd, _mm256_loadu_pd, _mm256_storeu_pd,
+                    _mm256_broadcast_sd, _mm256_set1_pd, _mm256_fmadd_pd, 4)
+}
+
+
+// 6 x 32 tile.
+TARGET_NUM_AVX512
+static void gemm_kernel_avx512(size_t kc, const float* a, const float* b,
+                               float alpha, float* c, size_t ldc) {
+    GEMM_KERNEL_6x2(__m512, _mm512_setzero_ps, _mm512_loadu_ps, _mm512_storeu_ps,
+                    GEMM_BCAST512_PS, _mm512_set1_ps, _mm512_fmadd_ps, 16)
+}
+
+
+// 6 x 16 tile.
+TARGET_NUM_AVX512
+static void gemm_kernel_avx512(size_t kc, const double* a, const double* b,
+                               double alpha, double* c, size_t ldc) {
+    GEMM_KERNEL_6x2(__m512d, _mm512_setzero_pd, _mm512_loadu_pd, _mm512_storeu_pd,
+                    GEMM_BCAST512_PD, _mm512_set1_pd, _mm512_fmadd_pd, 8)
+}
+
+#undef GEMM_BCAST512_PS
+#undef GEMM_BCAST512_PD
+#undef GEMM_KERNEL_6x2
+#undef GEMM_STORE_ROW
+#undef GEMM_FMA_ROW
+
+#endif
+
+
+template <typename NTYPE>
+static GemmKernel<NTYPE> make_gemm_kernel(VECTOR_ISA isa) {
+    GemmKernel<NTYPE> k;
+    k.mr = 4;
+    k.nr = 4;
+    k.kernel = gemm_kernel_scalar<NTYPE>;
+#if defined(NUM_X86_KERNELS)
+    switch (isa) {
+        case VECTOR_ISA::AVX2:
+            k.mr = 6;
+            k.nr = 32 / sizeof(NTYPE) * 2;
+            k.kernel = gemm_kernel_avx2;
+            break;
+        case VECTOR_ISA::AVX512:
+            k.mr = 6;
+            k.nr = 64 / sizeof(NTYPE) * 2;
+            k.kernel = gemm_kernel_avx512;
+            break;
+        default:
+            break;
+    }
+#endif
+    return k;
+}
+
+
+template <typename NTYPE>
+static const GemmKernel<NTYPE>& get_gemm_kernel(VECTOR_ISA isa) {
+    static const GemmKernel<NTYPE> kernels[3] = {
+        make_gemm_kernel<NTYPE>(VECTOR_ISA::SCALAR),
+        make_gemm_kernel<NTYPE>(VECTOR_ISA::AVX2),
+        make_gemm_kernel<NTYPE>(VECTOR_ISA::AVX512)
+    };
+    if (!vector_kernels_available(isa))
+        throw std::invalid_argument(MakeString(
+            "The CPU does not support instruction set '", to_str(isa), "'."));
+    return kernels[(int)isa];
+}
+
+
+// Copies op(A)[i0:i0+mc, p0:p0+kc] into panels of mr rows,
+// the last panel is padded with zeros. The source is read
+// contiguously in both cases.
+template <typename NTYPE>
+static void gemm_pack_a(bool transA, size_t M, size_t K, const NTYPE* A,
+                        size_t i0, size_t mc, size_t p0, size_t kc,
+                        size_t mr, NTYPE* dest) {
+    size_t ir, i, p, m;
+    for (ir = 0; ir < mc; ir += mr, dest += kc * mr) {
+        m = std::min(mr, mc - ir);
+        if (transA) {
+            for (p = 0; p < kc; ++p) {
+                const NTYPE* src = A + (p0 + p) * M + i0 + ir;
+                for (i = 0; i < m; ++i)
+                    dest[p * mr + i] = src[i];
+            }
+        }
+        else {
+            for (i = 0; i < m; ++i) {
+                const NTYPE* src = A + (i0 + ir + i) * K + p0;
+                for (p = 0; p < kc; ++p)
+                    dest[p * mr + i] = src[p];
+            }
+        }
+        if (m < mr) {
+            for (p = 0; p < kc; ++p)
+                for (i = m; i < mr; ++i)
+                    dest[p * mr + i] = 0;
+        }
+    }
+}
+
+
+// Copies op(B)[p0:p0+kc, j0:j0+nc] into panels of nr columns,
+// the last panel is padded with zeros.
+template <typename NTYPE>
+static void gemm_pack_b(bool transB, size_t N, size_t K, const NTYPE* B,
+                        size_t p0, size_t kc, size_t j0, size_t nc,
+                        size_t nr, NTYPE* dest) {
+    size_t jr, j, p, n;
+    for (jr = 0; jr < nc; jr += nr, dest += kc * nr) {
+        n = std::min(nr, nc - jr);
+        if (transB) {
+            for (j = 0; j < n; ++j) {
+                const NTYPE* src = B + (j0 + jr + j) * K + p0;
+                for (p = 0; p < kc; ++p)
+                    dest[p * nr + j] = src[p];
+            }
+        }
+        else {
+            for (p = 0; p < kc; ++p) {
+                const NTYPE* src = B + (p0 + p) * N + j0 + jr;
+                for (j = 0; j < n; ++j)
+                    dest[p * nr + j] = src[j];
+            }
+        }
+        if (n < nr) {
+            for (p = 0; p < kc; ++p)
+                for (j = n; j < nr; ++j)
+                    dest[p * nr + j] = 0;
+        }
+    }
 }
 
+
+// Computes columns [j_begin, j_end[ of C.
+template <typename NTYPE>
+static void gemm_blocked_columns(const GemmKernel<NTYPE>& k,
+                                 bool transA, bool transB, size_t M, size_t N, size_t K,
+                                 NTYPE alpha, const NTYPE* A, const NTYPE* B, NTYPE beta,
+                                 NTYPE* C, size_t j_begin, size_t j_end) {
+    size_t i, j;
+    NTYPE* pc;
+    if (beta != 1) {
+        for (i = 0; i < M; ++i) {
+            pc = C + i * N;
+            for (j = j_begin; j < j_end; ++j)
+                pc[j] = beta == 0 ? 0 : pc[j] * beta;
+        }
+    }
+    if (alpha == 0 || K == 0 || j_begin >= j_end)
+        return;
+
+    const size_t mr = k.mr, nr = k.nr;
+    const size_t max_kc = std::min((size_t)GEMM_KC, K);
+    const size_t max_nc = std::min((size_t)GEMM_NC, (j_end - j_begin + nr - 1) / nr * nr);
+    const size_t max_mc = std::min((size_t)GEMM_MC, (M + mr - 1) / mr * mr);
+    // Every thread keeps its packing buffers between two calls,
+    // small products would otherwise spend most of the time allocating.
+    static thread_local std::vector<NTYPE> packed_a;
+    static thread_local std::vector<NTYPE> packed_b;
+    if (packed_a.size() < max_mc * max_kc)
+        packed_a.resize(max_mc * max_kc);
+    if (packed_b.size() < max_nc * max_kc)
+        packed_b.resize(max_nc * max_kc);
+    NTYPE edge[GEMM_MAX_TILE];
+
+    size_t jc, pc0, ic, jr, ir, nc, kc, mc, n, m;
+    for (jc = j_begin; jc < j_end; jc += GEMM_NC) {
+        nc = std::min((size_t)GEMM_NC, j_end - jc);
+        for (pc0 = 0; pc0 < K; pc0 += GEMM_KC) {
+            kc = std::min((size_t)GEMM_KC, K - pc0);
+            gemm_pack_b(transB, N, K, B, pc0, kc, jc, nc, nr, packed_b.data());
+            for (ic = 0; ic < M; ic += GEMM_MC) {
+                mc = std::min((size_t)GEMM_MC, M - ic);
+                gemm_pack_a(transA, M, K, A, ic, mc, pc0, kc, mr, packed_a.data());
+                for (jr = 0; jr < nc; jr += nr) {
+                    n = std::min(nr, nc - jr);
+                    for (ir = 0; ir < mc; ir += mr) {
+                        m = std::min(mr, mc - ir);
+                        pc = C + (ic + ir) * N + jc + jr;
+                        if (m == mr && n == nr) {
+                            k.kernel(kc, packed_a.data() + ir * kc, packed_b.data() + jr * kc,
+                                     alpha, pc, N);
+                            continue;
+                        }
+                        // Partial tile, computed in a buffer.
+                        std::fill(edge, edge + mr * nr, (NTYPE)0);
+                        k.kernel(kc, packed_a.data() + ir * kc, packed_b.data() + jr * kc,
+                                 alpha, edge, nr);
+                        for (i = 0; i < m; ++i, pc += N)
+                            for (j = 0; j < n; ++j)
+                                pc[j] += edge[i * nr + j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+template <typename NTYPE>
+void gemm_blocked(bool transA, bool transB, size_t M, size_t N, size_t K,
+                  NTYPE alpha, const NTYPE* A, const NTYPE* B, NTYPE beta, NTYPE* C,
+                  VECTOR_ISA isa) {
+    const GemmKernel<NTYPE>& k = get_gemm_kernel<NTYPE>(isa);
+#if USE_OPENMP
+    // Every thread computes a range of column panels, it packs its own
+    // copy of A, which costs M K per thread against M N K / threads.
+    int64_t n_panels = (int64_t)((N + k.nr - 1) / k.nr);
+    int64_t n_threads = omp_in_parallel() ? 1 : (int64_t)omp_get_max_threads();
+    if ((double)M * (double)N * (double)K < 1e6)
+        n_threads = 1;
+    n_threads = std::min(n_threads, n_panels / 4);
+    if (n_threads > 1) {
+        int64_t per_thread = (n_panels + n_threads - 1) / n_threads;
+        #pragma omp parallel for num_threads(n_threads)
+        for (int64_t t = 0; t < n_threads; ++t) {
+            size_t j_begin = std::min(N, (size_t)(t * per_thread) * k.nr);
+            size_t j_end = std::min(N, (size_t)((t + 1) * per_thread) * k.nr);
+            gemm_blocked_columns(k, transA, transB, M, N, K, alpha, A, B, beta, C,
+                                 j_begin, j_end);
+        }
+        return;
+    }
+#endif
+    gemm_blocked_columns(k, transA, transB, M, N, K, alpha, A, B, beta, C, 0, N);
+}
+
+
+template <typename NTYPE>
+void gemm_blocked(bool transA, bool transB, size_t M, size_t N, size_t K,
+                  NTYPE alpha, const NTYPE* A, const NTYPE* B, NTYPE beta, NTYPE* C) {
+    gemm_blocked(transA, transB, M, N, K, alpha, A, B, beta, C, vector_kernels_isa());
+}
+
+
+template void gemm_blocked(bool, bool, size_t, size_t, size_t, float,
+                           const float*, const float*, float, float*, VECTOR_ISA);
+template void gemm_blocked(bool, bool, size_t, size_t, size_t, double,
+                           const double*, const double*, double, double*, VECTOR_ISA);
+template void gemm_blocked(bool, bool, size_t, size_t, size_t, float,
+                           const float*, const float*, float, float*);
+template void gemm_blocked(bool, bool, size_t, size_t, size_t, double,
+                           const double*, const double*, double, double*);
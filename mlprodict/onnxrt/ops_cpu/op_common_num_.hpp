@@ -2,12 +2,52 @@
 
 #include <cmath>
 #include <vector>
+#include <string>
 #include <stdio.h>
 
 
+// Instruction sets the vector kernels are compiled for, the best one
+// the CPU supports is selected when the module is loaded.
+enum class VECTOR_ISA {
+    SCALAR = 0,
+    AVX2 = 1,     // AVX2 + FMA
+    AVX512 = 2,   // AVX512F
+};
+
+VECTOR_ISA vector_kernels_isa();
+const char* to_str(VECTOR_ISA isa);
+VECTOR_ISA to_VECTOR_ISA(const std::string& value);
+bool vector_kernels_available(VECTOR_ISA isa);
+
+
+// Kernels for one instruction set.
+template <typename NTYPE>
+struct VectorKernels {
+    NTYPE (*dot)(const NTYPE* p1, const NTYPE* p2, size_t size);
+};
+
+// Throws an exception if the CPU does not support the instruction set.
+template <typename NTYPE>
+const VectorKernels<NTYPE>& get_vector_kernels(VECTOR_ISA isa);
+
+
 float vector_dot_product_pointer16_sse(const float *p1, const float *p2, size_t size);
 
 double vector_dot_product_pointer16_sse(const double *p1, const double *p2, size_t size);
 
 template <typename NTYPE>
 NTYPE vector_dot_product_pointer_sse(const NTYPE *p1, const NTYPE *p2, size_t size);
+
+// C = alpha op(A) op(B) + beta C, all matrices are row major,
+// op(A) is M x K, op(B) is K x N. The product is blocked and packed
+// (panels of MC x KC for A, KC x NC for B), a register-tiled
+// microkernel computes every tile of C. The function is parallelized
+// over column panels of C unless it is called from a parallel region.
+template <typename NTYPE>
+void gemm_blocked(bool transA, bool transB, size_t M, size_t N, size_t K,
+                  NTYPE alpha, const NTYPE* A, const NTYPE* B, NTYPE beta, NTYPE* C,
+                  VECTOR_ISA isa);
+
+template <typename NTYPE>
+void gemm_blocked(bool transA, bool transB, size_t M, size_t N, size_t K,
+                  NTYPE alpha, const NTYPE* A, const NTYPE* B, NTYPE beta, NTYPE* C);
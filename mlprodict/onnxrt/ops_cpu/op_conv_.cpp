@@ -20,6 +20,25 @@ namespace py = pybind11;
 #endif
 
 #include "op_conv_matrices_.hpp"
+#include <mutex>
+
+
+// Winograd needs enough channels to make the transforms worth it,
+// im2col + gemm is faster beyond the upper bound.
+#define CONV_WINOGRAD_MIN_CHANNELS 8
+#define CONV_WINOGRAD_MAX_CHANNELS 64
+// Upper bound for the Winograd buffers of a thread (number of elements).
+#define CONV_WINOGRAD_BUFFER 262144
+// Upper bound for the im2col buffer of a thread in NHWC mode.
+#define CONV_NHWC_BUFFER 262144
+
+
+// How Conv computes the output.
+enum class ConvAlgorithm {
+    IM2COL = 0,     // im2col + gemm
+    GEMM_1x1 = 1,   // 1x1 kernel, no stride, no padding: gemm on the input
+    WINOGRAD = 2,   // 3x3 kernel, no stride, no dilation, 2D: Winograd F(2x2, 3x3)
+};
 
 
 template <typename T>
@@ -29,6 +48,10 @@ class Conv : public ConvPoolCommon {
 
         Conv();
 
+        // Input and output are NHWC (channels last) instead of NCHW,
+        // the weights keep the ONNX layout.
+        void set_channels_last(bool channels_last);
+
         py::array_t<T> compute(py::array_t<T, py::array::c_style | py::array::forcecast> X,
                                py::array_t<T, py::array::c_style | py::array::forcecast> W,
                                py::array_t<T, py::array::c_style | py::array::forcecast> B) const;
@@ -48,10 +71,129 @@ class Conv : public ConvPoolCommon {
                               const std::vector<int64_t>& x_dims,
                               const std::vector<int64_t>& y_dims,
                               const std::vector<int64_t>& w_dims) const;
+
+        void compute_gil_free_nhwc(py::array_t<T, py::array::c_style | py::array::forcecast> X,
+                                   py::array_t<T, py::array::c_style | py::array::forcecast> W,
+                                   py::array_t<T, py::array::c_style | py::array::forcecast> B,
+                                   py::array_t<T, py::array::c_style | py::array::forcecast>& Y,
+                                   const std::vector<int64_t>& input_shape,
+                                   const std::vector<int64_t>& output_shape,
+                                   const std::vector<int64_t>& kernel_shape,
+                                   const std::vector<int64_t>& pads,
+                                   const std::vector<int64_t>& dilations,
+                                   const std::vector<int64_t>& strides,
+                                   const std::vector<int64_t>& x_dims,
+                                   const std::vector<int64_t>& w_dims) const;
+
+        void compute_winograd(const T* Xdata, const T* Wdata, const T* Bdata, T* Ydata,
+                              int64_t N, int64_t C, int64_t M,
+                              const std::vector<int64_t>& input_shape,
+                              const std::vector<int64_t>& output_shape,
+                              const std::vector<int64_t>& pads) const;
+
+        ConvAlgorithm select_algorithm(int64_t C, int64_t M,
+                                       const std::vector<int64_t>& kernel_shape,
+                                       const std::vector<int64_t>& pads,
+                                       const std::vector<int64_t>& dilations,
+                                       const std::vector<int64_t>& strides) const;
+
+        // Runs fct(buffer, task) for every task, in parallel if there are
+        // enough tasks, every thread gets a buffer of buffer_size elements.
+        template <typename F>
+        void compute_tasks(int64_t n_tasks, int64_t buffer_size, F&& fct) const;
+
+        // A thread takes a buffer for the duration of a call,
+        // buffers are kept between two calls.
+        std::vector<T> acquire_col_buffer(int64_t size) const;
+        void release_col_buffer(std::vector<T>& buffer) const;
+
+    private:
+
+        bool channels_last_;
+
+        // buffers not used by any thread
+        mutable std::mutex col_buffers_mutex_;
+        mutable std::vector<std::vector<T>> col_buffers_;
 };
 
 template<typename T>
 Conv<T>::Conv() : ConvPoolCommon() {
+    channels_last_ = false;
+}
+
+
+template<typename T>
+void Conv<T>::set_channels_last(bool channels_last) {
+    channels_last_ = channels_last;
+}
+
+
+template<typename T>
+std::vector<T> Conv<T>::acquire_col_buffer(int64_t size) const {
+    std::vector<T> buffer;
+    {
+        std::lock_guard<std::mutex> lock(col_buffers_mutex_);
+        if (!col_buffers_.empty()) {
+            buffer = std::move(col_buffers_.back());
+            col_buffers_.pop_back();
+        }
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+
+template<typename T>
+void Conv<T>::release_col_buffer(std::vector<T>& buffer) const {
+    std::lock_guard<std::mutex> lock(col_buffers_mutex_);
+    col_buffers_.push_back(std::move(buffer));
+}
+
+
+template<typename T>
+ConvAlgorithm Conv<T>::select_algorithm(int64_t C, int64_t M,
+                                        const std::vector<int64_t>& kernel_shape,
+                                        const std::vector<int64_t>& pads,
+                                        const std::vector<int64_t>& dilations,
+                                        const std::vector<int64_t>& strides) const {
+    bool ones = true;
+    for (size_t i = 0; i < kernel_shape.size(); ++i)
+        ones &= kernel_shape[i] == 1 && strides[i] == 1;
+    for (size_t i = 0; i < pads.size(); ++i)
+        ones &= pads[i] == 0;
+    if (ones)
+        return ConvAlgorithm::GEMM_1x1;
+    if (kernel_shape.size() == 2 && kernel_shape[0] == 3 && kernel_shape[1] == 3 &&
+            strides[0] == 1 && strides[1] == 1 && dilations[0] == 1 && dilations[1] == 1 &&
+            C / group_ >= CONV_WINOGRAD_MIN_CHANNELS && C / group_ <= CONV_WINOGRAD_MAX_CHANNELS &&
+            M / group_ >= CONV_WINOGRAD_MIN_CHANNELS && M / group_ <= CONV_WINOGRAD_MAX_CHANNELS)
+        return ConvAlgorithm::WINOGRAD;
+    return ConvAlgorithm::IM2COL;
+}
+
+
+template<typename T>
+template<typename F>
+void Conv<T>::compute_tasks(int64_t n_tasks, int64_t buffer_size, F&& fct) const {
+#if USE_OPENMP
+    // Tasks are distributed over threads if there are enough of them,
+    // otherwise gemm is parallelized.
+    if (n_tasks > 1 && n_tasks >= (int64_t)omp_get_max_threads()) {
+        #pragma omp parallel
+        {
+            std::vector<T> buffer = acquire_col_buffer(buffer_size);
+            #pragma omp for schedule(dynamic)
+            for (int64_t task = 0; task < n_tasks; ++task)
+                fct(buffer.data(), task);
+            release_col_buffer(buffer);
+        }
+        return;
+    }
+#endif
+    std::vector<T> buffer = acquire_col_buffer(buffer_size);
+    for (int64_t task = 0; task < n_tasks; ++task)
+        fct(buffer.data(), task);
+    release_col_buffer(buffer);
 }
 
 
@@ -86,19 +228,30 @@ py::array_t<T> Conv<T>::compute(py::array_t<T, py::array::c_style | py::array::f
 
     std::vector<int64_t> y_dims;
     y_dims.insert(y_dims.begin(), {N, M});
-    std::vector<int64_t> input_shape(x_dims.begin() + 2, x_dims.end());
+    std::vector<int64_t> input_shape(x_dims.begin() + (channels_last_ ? 1 : 2),
+                                     x_dims.end() - (channels_last_ ? 1 : 0));
     infer_output_shape(input_shape, kernel_shape, strides, dilations, pads, y_dims, false);
     std::vector<int64_t> output_shape(y_dims.begin() + 2, y_dims.end());
+    if (channels_last_) {
+        y_dims.erase(y_dims.begin() + 1);
+        y_dims.push_back(M);
+    }
 
     // py::array::ShapeContainer shape(y_dims);
     // auto total_size = flattened_dimension(y_dims);
     py::array_t<T, py::array::c_style | py::array::forcecast> Y(y_dims);
     {
         py::gil_scoped_release release;
-        compute_gil_free(X, W, B, Y,
-                         input_shape, output_shape,
-                         kernel_shape, pads, dilations, strides,
-                         x_dims, y_dims, w_dims);
+        if (channels_last_)
+            compute_gil_free_nhwc(X, W, B, Y,
+                                  input_shape, output_shape,
+                                  kernel_shape, pads, dilations, strides,
+                                  x_dims, w_dims);
+        else
+            compute_gil_free(X, W, B, Y,
+                             input_shape, output_shape,
+                             kernel_shape, pads, dilations, strides,
+                             x_dims, y_dims, w_dims);
     }
     return Y;
 }
@@ -130,7 +283,6 @@ void Conv<T>::compute_gil_free(
             
     const int64_t input_image_size = flattened_dimension(input_shape);
     const int64_t output_image_size = flattened_dimension(output_shape);
-    const int64_t y_size = flattened_dimension(y_dims);
     const int64_t kernel_size = flattened_dimension(kernel_shape);
     const int64_t X_offset = C / group_ * input_image_size;
     const int64_t Y_offset = flattened_dimension(y_dims) / y_dims[0] / group_;
@@ -138,15 +290,48 @@ void Conv<T>::compute_gil_free(
     const int64_t kernel_dim = C / group_ * kernel_size;
     const int64_t col_buffer_size = kernel_dim * output_image_size;
 
-    std::vector<T> _col_data(col_buffer_size);
-    auto col_buffer_data = &_col_data[0];
- 
     const T* Xdata = X.data(0);
     T* Ydata = (T*)Y.data(0);
-    T* yptr;
-    size_t k2;
-
-    std::fill(Ydata, Ydata + y_size, (T)0);
+    const T* Wdata = W.data(0);
+    const T* Bdata = b_dims.size() != 0 && b_dims[0] != 0 ? B.data(0) : nullptr;
+
+    const int64_t C_group = C / group_;
+    const int64_t M_group = M / group_;
+
+    // Adds the bias of a group to its output channels.
+    auto add_bias = [&](T* ydata, int64_t group_id) {
+        if (Bdata == nullptr)
+            return;
+        const T* ptrb = Bdata + group_id * M_group;
+        T* yptr;
+        int64_t k, k2;
+        for (k = 0; k < M_group; ++k, ++ptrb) {
+            yptr = ydata + output_image_size * k;
+            for (k2 = 0; k2 < output_image_size; ++k2, ++yptr)
+                *yptr += *ptrb;
+        }
+    };
+
+    switch (select_algorithm(C, M, kernel_shape, pads, dilations, strides)) {
+        case ConvAlgorithm::GEMM_1x1:
+            // The input of a group is already the matrix im2col would build.
+            compute_tasks(N * group_, 0, [&](T*, int64_t task) {
+                int64_t group_id = task % group_;
+                T* ydata = Ydata + task * Y_offset;
+                gemm<T>(false, false,
+                        (size_t)M_group, (size_t)output_image_size, (size_t)C_group,
+                        (T)1, Wdata + group_id * W_offset, Xdata + task * X_offset,
+                        (T)0, ydata);
+                add_bias(ydata, group_id);
+            });
+            return;
+        case ConvAlgorithm::WINOGRAD:
+            compute_winograd(Xdata, Wdata, Bdata, Ydata, N, C, M,
+                             input_shape, output_shape, pads);
+            return;
+        default:
+            break;
+    }
 
     std::vector<int64_t> image_shape(x_dims.begin() + 1, x_dims.end());
     std::vector<int64_t> col_buffer_shape{kernel_dim};
@@ -155,67 +340,269 @@ void Conv<T>::compute_gil_free(
 
     const size_t kernel_rank = kernel_shape.size();
 
-    for (int image_id = 0; image_id < N; ++image_id) {
-        for (int group_id = 0; group_id < group_; ++group_id) {
-            if (kernel_rank == 2) {
-                Im2col_NCHW<T>(
-                    Xdata + group_id * X_offset,
-                    C / group_,
+    // One task is one image and one group, every task writes
+    // its own part of Y.
+    compute_tasks(N * group_, col_buffer_size, [&](T* col_buffer_data, int64_t task) {
+        int64_t group_id = task % group_;
+        const T* xdata = Xdata + task * X_offset;
+        T* ydata = Ydata + task * Y_offset;
+
+        if (kernel_rank == 2) {
+            Im2col_NCHW<T>(
+                xdata,
+                C_group,
+                input_shape[0], input_shape[1],
+                kernel_shape[0], kernel_shape[1],
+                dilations[0], dilations[1],
+                pads[0], pads[1], pads[2], pads[3],
+                strides[0], strides[1],
+                col_buffer_data);
+        }
+        else {
+            Im2colNd_NCHW<T>(
+                xdata,
+                &image_shape[0],
+                col_buffer_shape.data(),
+                C * input_image_size,
+                col_buffer_size,
+                &kernel_shape[0],
+                strides.data(),
+                &dilations[0],
+                &pads[0],
+                static_cast<int>(kernel_shape.size()),
+                col_buffer_data);
+        }
+
+        // C := alpha*op(A)*op(B) + beta*C
+        // void cblas_sgemm (const CBLAS_LAYOUT Layout,
+        //              const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
+        //              const MKL_INT m, const MKL_INT n, const MKL_INT k,
+        //              const float alpha, const float *a, const MKL_INT lda,
+        //              const float *b, const MKL_INT ldb, const float beta,
+        //              float *c, const MKL_INT ldc);
+        gemm<T>(
+            false,
+            false,
+            (size_t)M_group,  // m
+            (size_t)(output_image_size),  // n
+            (size_t)kernel_dim,  // k
+            (T)1, // alpha
+            Wdata + group_id * W_offset, // *a
+            (const T*)col_buffer_data, // *b
+            (T)0,  // beta
+            ydata // *c
+        );
+        add_bias(ydata, group_id);
+    });
+}
+
+
+template<typename T>
+void Conv<T>::compute_gil_free_nhwc(
+        py::array_t<T, py::array::c_style | py::array::forcecast> X,
+        py::array_t<T, py::array::c_style | py::array::forcecast> W,
+        py::array_t<T, py::array::c_style | py::array::forcecast> B,
+        py::array_t<T, py::array::c_style | py::array::forcecast>& Y,
+        const std::vector<int64_t>& input_shape,
+        const std::vector<int64_t>& output_shape,
+        const std::vector<int64_t>& kernel_shape,
+        const std::vector<int64_t>& pads,
+        const std::vector<int64_t>& dilations,
+        const std::vector<int64_t>& strides,
+        const std::vector<int64_t>& x_dims,
+        const std::vector<int64_t>& w_dims
+        ) const {
+
+    std::vector<int64_t> b_dims;
+    arrayshape2vector(b_dims, B);
+
+    const int64_t N = x_dims[0];
+    const int64_t C = x_dims[x_dims.size() - 1];
+    const int64_t M = w_dims[0];
+    const int64_t C_group = C / group_;
+    const int64_t M_group = M / group_;
+
+    const int64_t input_image_size = flattened_dimension(input_shape);
+    const int64_t output_image_size = flattened_dimension(output_shape);
+    const int64_t kernel_size = flattened_dimension(kernel_shape);
+    const int64_t kernel_dim = C_group * kernel_size;
+    const size_t kernel_rank = kernel_shape.size();
+
+    const T* Xdata = X.data(0);
+    T* Ydata = (T*)Y.data(0);
+    const T* Wdata = W.data(0);
+    const T* Bdata = b_dims.size() != 0 && b_dims[0] != 0 ? B.data(0) : nullptr;
+
+    // Im2col_NHWC orders a row by kernel position then channel,
+    // the weights are reordered into [group][kernel_dim][M_group].
+    std::vector<T> reordered_W(group_ * kernel_dim * M_group);
+    for (int64_t g = 0; g < group_; ++g)
+        for (int64_t m = 0; m < M_group; ++m)
+            for (int64_t c = 0; c < C_group; ++c)
+                for (int64_t k = 0; k < kernel_size; ++k)
+                    reordered_W[(g * kernel_dim + k * C_group + c) * M_group + m] =
+                        Wdata[((g * M_group + m) * C_group + c) * kernel_size + k];
+
+    // The input of a 1x1 convolution is already the im2col matrix.
+    const bool pointwise = group_ == 1 && select_algorithm(
+        C, M, kernel_shape, pads, dilations, strides) == ConvAlgorithm::GEMM_1x1;
+
+    // Output positions are processed by blocks, one task is one image
+    // and one block, the im2col buffer of a thread stays bounded.
+    const int64_t block = std::max((int64_t)1, std::min(
+        output_image_size, CONV_NHWC_BUFFER / kernel_dim));
+    const int64_t n_blocks = (output_image_size + block - 1) / block;
+    const int64_t col_size = pointwise ? 0 : block * kernel_dim;
+    const int64_t out_size = group_ > 1 ? block * M_group : 0;
+
+    compute_tasks(N * n_blocks, col_size + out_size, [&](T* buffer, int64_t task) {
+        int64_t image_id = task / n_blocks;
+        int64_t output_start = (task % n_blocks) * block;
+        int64_t output_count = std::min(block, output_image_size - output_start);
+        const T* xdata = Xdata + image_id * input_image_size * C;
+        T* ydata = Ydata + (image_id * output_image_size + output_start) * M;
+        T* col_buffer_data = buffer;
+        const T* gemm_input = col_buffer_data;
+        // With several groups, the output of a group is not contiguous.
+        T* gemm_output = group_ > 1 ? buffer + col_size : ydata;
+        int64_t i, m;
+
+        for (int64_t group_id = 0; group_id < group_; ++group_id) {
+            const T* group_input_data = xdata + group_id * C_group;
+            if (pointwise) {
+                gemm_input = xdata + output_start * C;
+            }
+            else if (kernel_rank == 2) {
+                Im2col_NHWC<T>(
+                    group_input_data, C_group, C,
                     input_shape[0], input_shape[1],
                     kernel_shape[0], kernel_shape[1],
                     dilations[0], dilations[1],
-                    pads[0], pads[1], pads[2], pads[3],
+                    pads[0], pads[1],
                     strides[0], strides[1],
-                    col_buffer_data);
+                    output_shape[1],
+                    output_start, output_count,
+                    col_buffer_data, (T)0);
+            }
+            else if (kernel_rank == 1) {
+                Im2col_NHWC<T>(
+                    group_input_data, C_group, C,
+                    1, input_shape[0],
+                    1, kernel_shape[0],
+                    1, dilations[0],
+                    0, pads[0],
+                    1, strides[0],
+                    output_shape[0],
+                    output_start, output_count,
+                    col_buffer_data, (T)0);
             }
             else {
-                Im2colNd_NCHW<T>(
-                    Xdata + group_id * X_offset,
-                    &image_shape[0],
-                    col_buffer_shape.data(),
-                    C * input_image_size,
-                    col_buffer_size,
-                    &kernel_shape[0],
-                    strides.data(),
-                    &dilations[0],
-                    &pads[0],
-                    static_cast<int>(kernel_shape.size()),
-                    col_buffer_data);
+                Im2col_NCHW<T>(
+                    group_input_data, C_group, C,
+                    input_shape.data(), output_shape.data(), kernel_shape.data(),
+                    strides.data(), dilations.data(), pads.data(),
+                    static_cast<ptrdiff_t>(kernel_rank),
+                    output_start, output_count,
+                    col_buffer_data, (T)0);
             }
-           
-            // C := alpha*op(A)*op(B) + beta*C
-            // void cblas_sgemm (const CBLAS_LAYOUT Layout,
-            //              const CBLAS_TRANSPOSE transa, const CBLAS_TRANSPOSE transb,
-            //              const MKL_INT m, const MKL_INT n, const MKL_INT k,
-            //              const float alpha, const float *a, const MKL_INT lda,
-            //              const float *b, const MKL_INT ldb, const float beta,
-            //              float *c, const MKL_INT ldc);
-            gemm<T>(
-                false,
-                false,
-                (size_t)(M / group_),  // m
-                (size_t)(output_image_size),  // n
-                (size_t)kernel_dim,  // k
-                (T)1, // alpha
-                (const T*)W.data(0) + group_id * W_offset, // *a
-                (const T*)col_buffer_data, // *b
-                (T)0,  // beta
-                (T*)Ydata + group_id * Y_offset // *c
-            );
-        }
 
-        if (b_dims.size() != 0 && b_dims[0] != 0) {
-            const T* ptrb = B.data(0);
-            for(size_t k = 0; k < (size_t)M; ++k, ++ptrb) {
-                yptr = Ydata + output_image_size * k;
-                for(k2 = 0; k2 < (size_t)output_image_size; ++k2, ++yptr)
-                    *yptr += *ptrb;
+            gemm<T>(false, false,
+                    (size_t)output_count, (size_t)M_group, (size_t)kernel_dim,
+                    (T)1, gemm_input,
+                    reordered_W.data() + group_id * kernel_dim * M_group,
+                    (T)0, gemm_output);
+
+            if (group_ > 1) {
+                for (i = 0; i < output_count; ++i)
+                    std::copy(gemm_output + i * M_group, gemm_output + (i + 1) * M_group,
+                              ydata + i * M + group_id * M_group);
             }
         }
 
-        Xdata += X_offset * group_;
-        Ydata += Y_offset * group_;
-    }    
+        if (Bdata != nullptr) {
+            T* yptr = ydata;
+            for (i = 0; i < output_count; ++i)
+                for (m = 0; m < M; ++m, ++yptr)
+                    *yptr += Bdata[m];
+        }
+    });
+}
+
+
+template<typename T>
+void Conv<T>::compute_winograd(const T* Xdata, const T* Wdata, const T* Bdata, T* Ydata,
+                               int64_t N, int64_t C, int64_t M,
+                               const std::vector<int64_t>& input_shape,
+                               const std::vector<int64_t>& output_shape,
+                               const std::vector<int64_t>& pads) const {
+    const int64_t C_group = C / group_;
+    const int64_t M_group = M / group_;
+    const int64_t height = input_shape[0], width = input_shape[1];
+    const int64_t out_height = output_shape[0], out_width = output_shape[1];
+    const int64_t tiles_h = (out_height + 1) / 2, tiles_w = (out_width + 1) / 2;
+    const int64_t n_tiles = tiles_h * tiles_w;
+
+    // Transformed filters, [group][16][M_group][C_group].
+    const int64_t u_stride = M_group * C_group;
+    std::vector<T> U(group_ * 16 * u_stride);
+    for (int64_t g = 0; g < group_; ++g)
+        for (int64_t m = 0; m < M_group; ++m)
+            for (int64_t c = 0; c < C_group; ++c)
+                WinogradF23TransformFilter(
+                    Wdata + ((g * M_group + m) * C_group + c) * 9,
+                    U.data() + g * 16 * u_stride + m * C_group + c, u_stride);
+
+    // Tiles are processed by blocks so that the buffers of a thread,
+    // V [16][C_group][block] and P [16][M_group][block], stay bounded.
+    int64_t block = CONV_WINOGRAD_BUFFER / (16 * (C_group + M_group));
+    block = std::max((int64_t)16, std::min(block, n_tiles));
+    const int64_t n_blocks = (n_tiles + block - 1) / block;
+    const int64_t rows_size = 8 * (2 * std::min(block, tiles_w) + 2);
+
+    // One task is one image, one group and one block of tiles.
+    compute_tasks(N * group_ * n_blocks, 16 * (C_group + M_group) * block + rows_size,
+                  [&](T* buffer, int64_t task) {
+        int64_t image_group = task / n_blocks;
+        int64_t group_id = image_group % group_;
+        int64_t t_begin = (task % n_blocks) * block;
+        int64_t t_end = std::min(n_tiles, t_begin + block);
+        int64_t nb = t_end - t_begin;
+        const T* xdata = Xdata + image_group * C_group * height * width;
+        T* ydata = Ydata + image_group * M_group * out_height * out_width;
+        T* V = buffer;
+        T* P = V + 16 * C_group * nb;
+        T* rows = P + 16 * M_group * nb;
+        int64_t c, m, t, th, tw_begin, tw_end, pos;
+
+        // The block is split into rows of tiles.
+        for (t = t_begin; t < t_end; t += tw_end - tw_begin) {
+            th = t / tiles_w;
+            tw_begin = t % tiles_w;
+            tw_end = std::min(tiles_w, tw_begin + t_end - t);
+            for (c = 0; c < C_group; ++c)
+                WinogradF23TransformInputRow(
+                    xdata + c * height * width, height, width, pads[0], pads[1],
+                    th, tw_begin, tw_end, rows, V + c * nb + t - t_begin, C_group * nb);
+        }
+
+        const T* u = U.data() + group_id * 16 * u_stride;
+        for (pos = 0; pos < 16; ++pos)
+            gemm<T>(false, false, (size_t)M_group, (size_t)nb, (size_t)C_group,
+                    (T)1, u + pos * u_stride, V + pos * C_group * nb,
+                    (T)0, P + pos * M_group * nb);
+
+        for (t = t_begin; t < t_end; t += tw_end - tw_begin) {
+            th = t / tiles_w;
+            tw_begin = t % tiles_w;
+            tw_end = std::min(tiles_w, tw_begin + t_end - t);
+            for (m = 0; m < M_group; ++m)
+                WinogradF23TransformOutputRow(
+                    P + m * nb + t - t_begin, M_group * nb,
+                    Bdata == nullptr ? (T)0 : Bdata[group_id * M_group + m],
+                    ydata + m * out_height * out_width, out_height, out_width,
+                    th, tw_begin, tw_end, rows);
+        }
+    });
 }
 
 
@@ -231,6 +618,44 @@ class ConvDouble : public Conv<double> {
 };
 
 
+// Returns alpha op(A) op(B) + beta C, *impl* is 'naive' for the reference
+// implementation, an instruction set for the blocked one or empty for
+// the best one.
+template <typename T>
+py::array_t<T> gemm_dot(py::array_t<T, py::array::c_style | py::array::forcecast> A,
+                        py::array_t<T, py::array::c_style | py::array::forcecast> B,
+                        py::array_t<T, py::array::c_style | py::array::forcecast> C,
+                        bool transA, bool transB, T alpha, T beta,
+                        const std::string& impl) {
+    if (A.ndim() != 2 || B.ndim() != 2 || C.ndim() != 2)
+        throw std::invalid_argument("A, B, C must be matrices.");
+    size_t M = (size_t)(transA ? A.shape(1) : A.shape(0));
+    size_t K = (size_t)(transA ? A.shape(0) : A.shape(1));
+    size_t N = (size_t)(transB ? B.shape(0) : B.shape(1));
+    if ((size_t)(transB ? B.shape(1) : B.shape(0)) != K ||
+            (size_t)C.shape(0) != M || (size_t)C.shape(1) != N)
+        throw std::invalid_argument(MakeString(
+            "Dimension mismatch, op(A) is ", M, "x", K, ", op(B) is ",
+            (transB ? B.shape(1) : B.shape(0)), "x", N, ", C is ",
+            C.shape(0), "x", C.shape(1), "."));
+    std::vector<int64_t> y_dims{(int64_t)M, (int64_t)N};
+    py::array_t<T, py::array::c_style | py::array::forcecast> Y(y_dims);
+    T* y = (T*)Y.data(0);
+    std::copy(C.data(0), C.data(0) + M * N, y);
+    {
+        py::gil_scoped_release release;
+        if (impl.compare("naive") == 0)
+            gemm_naive<T>(transA, transB, M, N, K, alpha, A.data(0), B.data(0), beta, y);
+        else if (impl.empty())
+            gemm_blocked<T>(transA, transB, M, N, K, alpha, A.data(0), B.data(0), beta, y);
+        else
+            gemm_blocked<T>(transA, transB, M, N, K, alpha, A.data(0), B.data(0), beta, y,
+                            to_VECTOR_ISA(impl));
+    }
+    return Y;
+}
+
+
 #ifndef SKIP_PYTHON
 
 PYBIND11_MODULE(op_conv_, m) {
@@ -252,6 +677,8 @@ in :epkg:`onnxruntime`. Supports float only.)pbdoc");
     clf.def(py::init<>());
     clf.def("init", &ConvFloat::init,
             "Initializes the runtime with the ONNX attributes.");
+    clf.def("set_channels_last", &ConvFloat::set_channels_last,
+            "Switches input and output to NHWC (channels last).", py::arg("channels_last"));
     clf.def("compute", &ConvFloat::compute,
             "Computes the output for operator Conv.");
 
@@ -263,8 +690,27 @@ in :epkg:`onnxruntime`. Supports double only.)pbdoc");
     cld.def(py::init<>());
     cld.def("init", &ConvDouble::init,
             "Initializes the runtime with the ONNX attributes.");
+    cld.def("set_channels_last", &ConvDouble::set_channels_last,
+            "Switches input and output to NHWC (channels last).", py::arg("channels_last"));
     cld.def("compute", &ConvDouble::compute,
             "Computes the output for operator Conv.");
+
+    m.def("gemm_float", &gemm_dot<float>,
+          R"pbdoc(Returns *alpha op(A) op(B) + beta C* (float),
+*impl* is `'naive'` for the reference implementation, an instruction set
+(`'scalar'`, `'avx2'`, `'avx512'`) for the blocked one or empty for
+the one used by operator Conv.)pbdoc",
+          py::arg("A"), py::arg("B"), py::arg("C"), py::arg("transA") = false,
+          py::arg("transB") = false, py::arg("alpha") = 1.f, py::arg("beta") = 0.f,
+          py::arg("impl") = "");
+    m.def("gemm_double", &gemm_dot<double>,
+          R"pbdoc(Returns *alpha op(A) op(B) + beta C* (double),
+*impl* is `'naive'` for the reference implementation, an instruction set
+(`'scalar'`, `'avx2'`, `'avx512'`) for the blocked one or empty for
+the one used by operator Conv.)pbdoc",
+          py::arg("A"), py::arg("B"), py::arg("C"), py::arg("transA") = false,
+          py::arg("transB") = false, py::arg("alpha") = 1., py::arg("beta") = 0.,
+          py::arg("impl") = "");
 }
 
 #endif
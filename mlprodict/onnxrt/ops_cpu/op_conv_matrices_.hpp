@@ -8,6 +8,7 @@
 #endif
 
 #include "op_common_.hpp"
+#include "op_common_num_.hpp"
 #define is_a_ge_zero_and_a_lt_b(a, b) (static_cast<uint64_t>(a) < static_cast<uint64_t>(b))
 
 
@@ -144,68 +145,39 @@ void QConvDepthwise(const T** Input, TI InputZeroPoint, const TF* Filter,
 }
 
 
+// Reference implementation, C = alpha op(A) op(B) + beta C,
+// one dot product per element of C.
+template <typename NTYPE>
+void gemm_naive(bool transA, bool transB,
+                size_t M, size_t N, size_t K, NTYPE alpha,
+                const NTYPE* A, const NTYPE* B, NTYPE beta, NTYPE* C) {
+    // Strides of op(A) along rows, op(A) along k, op(B) along k, op(B) along columns.
+    const size_t sai = transA ? 1 : K, sak = transA ? M : 1;
+    const size_t sbk = transB ? 1 : N, sbj = transB ? K : 1;
+    NTYPE* begin;
+    NTYPE val;
+    size_t i, j, k;
+    const NTYPE* pA, * pB;
+    for (i = 0, begin = C; i < M; ++i) {
+        for (j = 0; j < N; ++j, ++begin) {
+            val = 0;
+            pA = A + i * sai;
+            pB = B + j * sbj;
+            for (k = K; k > 0; --k, pA += sak, pB += sbk)
+                val += *pA * *pB;
+            *begin = (beta == 0 ? 0 : *begin * beta) + val * alpha;
+        }
+    }
+}
+
+
 // The function adds value to C, assuming this array
-// was initialized.
+// was initialized (unless beta is null).
 template <typename NTYPE>
 void gemm(bool transA, bool transB,
           size_t M, size_t N, size_t K, NTYPE alpha,
           const NTYPE* A, const NTYPE* B, NTYPE beta, NTYPE* C) {
-
-    if (transA) {
-        if (transB) {
-        }
-        else {
-            // a A B + b C, dimension = M * N
-            NTYPE* begin;
-            NTYPE val;
-            NTYPE val0;
-            size_t i, j, k, maxc = 0;
-            const NTYPE* pA, * pB;
-            for (i = 0, begin = C; i < M; ++i) {
-                for (j = 0; j < N; ++j, ++begin) {
-                    val0 = *begin * beta;
-                    val = 0;
-                    pA = A + i;
-                    pB = B + j;
-                    for (k = K; k > 0; --k, pA += K, pB += N)
-                        val += *pA * *pB;
-                    *begin = val0 + val * alpha;
-                    maxc = maxc > (size_t)(begin - C) ? maxc : (size_t)(begin - C);
-                    if (maxc > M * N)
-                        throw std::invalid_argument("gemm10: maxc > M * N");
-                }
-            }
-            return;
-        }
-    }
-    else {
-        if (transB) {
-        }
-        else {
-            // a A B + b C, dimension = M * N
-            NTYPE* begin;
-            NTYPE val;
-            NTYPE val0;
-            size_t i, j, k, maxc = 0;
-            const NTYPE* pA, * pB;
-            for (i = 0, begin = C; i < M; ++i) {
-                for (j = 0; j < N; ++j, ++begin) {
-                    val0 = *begin * beta;
-                    val = 0;
-                    pA = A + i * K;
-                    pB = B + j;
-                    for (k = K; k > 0; --k, ++pA, pB += N)
-                        val += *pA * *pB;
-                    *begin = val0 + val * alpha;
-                    maxc = maxc > (size_t)(begin - C) ? maxc : (size_t)(begin - C);
-                    if (maxc > M * N)
-                        throw std::invalid_argument("gemm00: maxc > M * N");
-                }
-            }
-            return;
-        }
-    }
-    throw std::invalid_argument("Not implemented for transposed matrices (Gemm<T>).");
+    gemm_blocked<NTYPE>(transA, transB, M, N, K, alpha, A, B, beta, C);
 }
 
 
@@ -475,14 +447,20 @@ void Im2col_NCHW(const T* data_im, int64_t group_channels, int64_t input_channel
                  const int64_t* im_shape,
                  const int64_t* output_shape, const int64_t* kernel_shape, const int64_t* stride,
                  const int64_t* dilation, const int64_t* pad, ptrdiff_t rank,
+                 int64_t output_start, int64_t output_count,
                  T* data_col, T padding_value) {
     // iterate dimensions on output image shape (without Batch and Channel)
     std::vector<int64_t> d_output(rank, 0);
     // inner iterate dimensions on kernel shape (without output channel and input channel)
     std::vector<int64_t> d_kernel(rank, 0);
 
-    // Loop over spatial axes along the output image shape
-    do {
+    // Skip ahead to the starting output index.
+    for (ptrdiff_t d_i = rank - 1; d_i >= 0; --d_i) {
+        d_output[d_i] = output_start % output_shape[d_i];
+        output_start /= output_shape[d_i];
+    }
+
+    while (output_count--) {
         // Loop over spatial axes in reverse order to choose an index on kernel dimensions
         do {
             // Loop over spatial axes in forward order to compute the indices in the image
@@ -504,7 +482,24 @@ void Im2col_NCHW(const T* data_im, int64_t group_channels, int64_t input_channel
                 data_col = std::copy_n(data_im + index_im, group_channels, data_col);
             }
         } while (NextPosition(rank, kernel_shape, d_kernel.data()));
-    } while (NextPosition(rank, output_shape, d_output.data()));
+        // Loop over spatial axes along the output image shape
+        NextPosition(rank, output_shape, d_output.data());
+    }
+}
+
+
+template <typename T>
+void Im2col_NCHW(const T* data_im, int64_t group_channels, int64_t input_channels,
+                 const int64_t* im_shape,
+                 const int64_t* output_shape, const int64_t* kernel_shape, const int64_t* stride,
+                 const int64_t* dilation, const int64_t* pad, ptrdiff_t rank,
+                 T* data_col, T padding_value) {
+    int64_t output_size = 1;
+    for (ptrdiff_t d_i = 0; d_i < rank; ++d_i)
+        output_size *= output_shape[d_i];
+    Im2col_NCHW(data_im, group_channels, input_channels, im_shape,
+                output_shape, kernel_shape, stride, dilation, pad, rank,
+                (int64_t)0, output_size, data_col, padding_value);
 }
 
 
@@ -688,6 +683,118 @@ void Im2col_NHWC(const T* data_im,
 }
 
 
+// Winograd F(2x2, 3x3): a 2x2 output tile is computed from a 4x4 input
+// tile with 16 multiplications instead of 36. Filters and input tiles are
+// transformed, multiplied position by position (one gemm per position
+// over the channels) and the result is transformed back.
+// Every transform reads or writes its 16 positions with a stride,
+// input and output tiles are transformed by rows of tiles.
+
+// u = G g G^T, g is a 3x3 filter.
+template <typename T>
+void WinogradF23TransformFilter(const T* g, T* u, int64_t stride) {
+    T tmp[4][3];  // G g
+    for (int j = 0; j < 3; ++j) {
+        tmp[0][j] = g[j];
+        tmp[1][j] = (g[j] + g[3 + j] + g[6 + j]) * (T)0.5;
+        tmp[2][j] = (g[j] - g[3 + j] + g[6 + j]) * (T)0.5;
+        tmp[3][j] = g[6 + j];
+    }
+    for (int i = 0; i < 4; ++i) {
+        u[(i * 4) * stride] = tmp[i][0];
+        u[(i * 4 + 1) * stride] = (tmp[i][0] + tmp[i][1] + tmp[i][2]) * (T)0.5;
+        u[(i * 4 + 2) * stride] = (tmp[i][0] - tmp[i][1] + tmp[i][2]) * (T)0.5;
+        u[(i * 4 + 3) * stride] = tmp[i][2];
+    }
+}
+
+
+// v = B^T d B for the tiles [tw_begin, tw_end[ of tile row th, tile tw
+// starts at (2 th - pad_h, 2 tw - pad_w) in an image of height x width,
+// pixels outside the image are null (padding). Position pos of tile tw
+// goes to v[pos * stride + tw - tw_begin]. rows is a buffer of
+// 8 * (2 * (tw_end - tw_begin) + 2) elements.
+template <typename T>
+void WinogradF23TransformInputRow(const T* image, int64_t height, int64_t width,
+                                  int64_t pad_h, int64_t pad_w, int64_t th,
+                                  int64_t tw_begin, int64_t tw_end,
+                                  T* rows, T* v, int64_t stride) {
+    const int64_t n = tw_end - tw_begin;
+    const int64_t length = 2 * n + 2;
+    const int64_t w0 = 2 * tw_begin - pad_w;
+    int64_t i, k, x_begin, x_end;
+    T* d = rows;  // 4 input rows
+    T* t = rows + 4 * length;  // B^T d
+    for (i = 0; i < 4; ++i) {
+        T* row = d + i * length;
+        int64_t h = 2 * th - pad_h + i;
+        if (!is_a_ge_zero_and_a_lt_b(h, height)) {
+            std::fill(row, row + length, (T)0);
+            continue;
+        }
+        x_begin = std::min(length, std::max((int64_t)0, -w0));
+        x_end = std::max(x_begin, std::min(length, width - w0));
+        std::fill(row, row + x_begin, (T)0);
+        std::copy(image + h * width + w0 + x_begin, image + h * width + w0 + x_end, row + x_begin);
+        std::fill(row + x_end, row + length, (T)0);
+    }
+    const T* d0 = d, * d1 = d + length, * d2 = d + 2 * length, * d3 = d + 3 * length;
+    T* t0 = t, * t1 = t + length, * t2 = t + 2 * length, * t3 = t + 3 * length;
+    for (k = 0; k < length; ++k) {
+        t0[k] = d0[k] - d2[k];
+        t1[k] = d1[k] + d2[k];
+        t2[k] = d2[k] - d1[k];
+        t3[k] = d1[k] - d3[k];
+    }
+    for (i = 0; i < 4; ++i) {
+        const T* ti = t + i * length;
+        T* v0 = v + (i * 4) * stride, * v1 = v0 + stride, * v2 = v1 + stride, * v3 = v2 + stride;
+        for (k = 0; k < n; ++k) {
+            v0[k] = ti[2 * k] - ti[2 * k + 2];
+            v1[k] = ti[2 * k + 1] + ti[2 * k + 2];
+            v2[k] = ti[2 * k + 2] - ti[2 * k + 1];
+            v3[k] = ti[2 * k + 1] - ti[2 * k + 3];
+        }
+    }
+}
+
+
+// y = A^T m A + bias for the tiles [tw_begin, tw_end[ of tile row th,
+// position pos of tile tw is m[pos * stride + tw - tw_begin], tile tw is
+// written at (2 th, 2 tw) in an output of height x width, values outside
+// the output are dropped. rows is a buffer of 4 * (tw_end - tw_begin) elements.
+template <typename T>
+void WinogradF23TransformOutputRow(const T* m, int64_t stride, T bias,
+                                   T* output, int64_t height, int64_t width,
+                                   int64_t th, int64_t tw_begin, int64_t tw_end,
+                                   T* rows) {
+    const int64_t n = tw_end - tw_begin;
+    T* y0 = rows, * y1 = rows + 2 * n;
+    int64_t j, k;
+    T a0, a1, a2, a3, b0, b1, b2, b3;
+    for (k = 0; k < n; ++k) {
+        // A^T m, two rows of 4 values
+        a0 = m[k] + m[4 * stride + k] + m[8 * stride + k];
+        a1 = m[stride + k] + m[5 * stride + k] + m[9 * stride + k];
+        a2 = m[2 * stride + k] + m[6 * stride + k] + m[10 * stride + k];
+        a3 = m[3 * stride + k] + m[7 * stride + k] + m[11 * stride + k];
+        b0 = m[4 * stride + k] - m[8 * stride + k] - m[12 * stride + k];
+        b1 = m[5 * stride + k] - m[9 * stride + k] - m[13 * stride + k];
+        b2 = m[6 * stride + k] - m[10 * stride + k] - m[14 * stride + k];
+        b3 = m[7 * stride + k] - m[11 * stride + k] - m[15 * stride + k];
+        y0[2 * k] = a0 + a1 + a2 + bias;
+        y0[2 * k + 1] = a1 - a2 - a3 + bias;
+        y1[2 * k] = b0 + b1 + b2 + bias;
+        y1[2 * k + 1] = b1 - b2 - b3 + bias;
+    }
+    const int64_t w0 = 2 * tw_begin;
+    const int64_t count = std::min(2 * n, width - w0);
+    for (j = 0; j < 2 && 2 * th + j < height; ++j)
+        std::copy(rows + j * 2 * n, rows + j * 2 * n + count,
+                  output + (2 * th + j) * width + w0);
+}
+
+
 void ComputePadAndOutputShape(int64_t in_dim, int64_t stride,
                               int64_t kernel, int64_t dilation,
                               AutoPadType pad_type, int64_t* pad_head,
@@ -22,6 +22,51 @@ namespace py = pybind11;
 #include "op_conv_matrices_.hpp"
 
 
+// Upper bound for the buffers of a thread (number of elements).
+#define CONV_TRANSPOSE_BUFFER 262144
+
+
+// Outputs sharing the same position modulo the strides (a phase) receive
+// the contributions of the same kernel positions, a phase is a convolution
+// with stride 1 over the input and a subset of the kernel.
+struct ConvTransposePhase {
+    std::vector<int64_t> offset;   // first output, per dimension
+    std::vector<int64_t> shape;    // number of outputs, per dimension
+    int64_t size;                  // number of outputs
+    std::vector<int64_t> kernel;   // kernel positions contributing to the phase
+    std::vector<int64_t> base;     // input position of the first output, [kernel][rank]
+    int64_t tile;                  // number of outputs computed by a task
+    int64_t weight_offset;         // reordered weights of the phase
+};
+
+
+// Splits outputs [start, start + count) of a phase into runs along
+// the last dimension, calls fct(j, done, run) for every run, j is the
+// position of the first output of the run.
+template <typename F>
+void ConvTransposeRuns(const std::vector<int64_t>& shape, int64_t start, int64_t count,
+                       std::vector<int64_t>& j, F&& fct) {
+    const size_t last = shape.size() - 1;
+    for (size_t d = shape.size(); d-- > 0; ) {
+        j[d] = start % shape[d];
+        start /= shape[d];
+    }
+    for (int64_t done = 0, run; done < count; done += run) {
+        run = std::min(count - done, shape[last] - j[last]);
+        fct(j, done, run);
+        j[last] += run;
+        if (j[last] == shape[last]) {
+            j[last] = 0;
+            for (size_t d = last; d-- > 0; ) {
+                if (++j[d] < shape[d])
+                    break;
+                j[d] = 0;
+            }
+        }
+    }
+}
+
+
 template <typename T>
 class ConvTranspose : ConvPoolCommon {
     
@@ -62,7 +107,6 @@ class ConvTranspose : ConvPoolCommon {
                               const std::vector<int64_t>& dilations,
                               const std::vector<int64_t>& strides,
                               const std::vector<int64_t>& x_dims,
-                              const std::vector<int64_t>& y_dims,
                               const std::vector<int64_t>& w_dims) const;
 
         void infer_output_shape(const std::vector<int64_t>& x_dims,
@@ -168,7 +212,7 @@ py::array_t<T> ConvTranspose<T>::compute(py::array_t<T, py::array::c_style | py:
         compute_gil_free(X, W, B, Y,
                          input_shape, output_shape,
                          kernel_shape, pads, dilations, strides,
-                         x_dims, y_dims, w_dims);
+                         x_dims, w_dims);
     }
     return Y;
 }
@@ -240,7 +284,6 @@ void ConvTranspose<T>::compute_gil_free(
         const std::vector<int64_t>& dilations,
         const std::vector<int64_t>& strides,
         const std::vector<int64_t>& x_dims,
-        const std::vector<int64_t>& y_dims,
         const std::vector<int64_t>& w_dims
         ) const {
 
@@ -249,87 +292,168 @@ void ConvTranspose<T>::compute_gil_free(
 
     const int64_t N = x_dims[0];
     const int64_t C = x_dims[1];
-    // const int64_t num_input_channels = C;
-    const int64_t num_output_channels = w_dims[1] * group_;
-    // const int64_t M = w_dims[0];
-
-    const int64_t input_shape_size = flattened_dimension(input_shape);
-    const int64_t output_image_size = flattened_dimension(y_dims, 2);
-    // const int64_t output_shape_size = flattened_dimension(output_shape);
-    const int64_t y_size = flattened_dimension(y_dims);
-    const int64_t kernel_size = flattened_dimension(kernel_shape);
-    const int64_t X_offset = C / group_ * input_shape_size;
-    const int64_t Y_offset = flattened_dimension(y_dims) / y_dims[0] / group_;
-    const int64_t W_offset = flattened_dimension(w_dims) / group_;
-    const int64_t kernel_dim = num_output_channels / group_ * kernel_size;
-
-    std::vector<int64_t> col_buffer_shape{kernel_dim};
-    col_buffer_shape.insert(col_buffer_shape.end(), input_shape.begin(),
-                            input_shape.end());
-    int64_t col_buffer_size = flattened_dimension(col_buffer_shape);
+    const int64_t C_group = C / group_;
+    const int64_t M_group = w_dims[1];
+    const size_t rank = kernel_shape.size();
+    const size_t last = rank - 1;
 
+    const int64_t input_image_size = flattened_dimension(input_shape);
+    const int64_t output_image_size = flattened_dimension(output_shape);
+    const int64_t kernel_size = flattened_dimension(kernel_shape);
 
-    std::vector<T> _col_data(col_buffer_size);
-    auto col_buffer_data = &_col_data[0];
- 
     const T* Xdata = X.data(0);
     T* Ydata = (T*)Y.data(0);
-    T* yptr;
-    size_t k2;
-
-    std::fill(Ydata, Ydata + y_size, (T)0);
-
-    // const size_t kernel_rank = kernel_shape.size();
-    
-    std::vector<int64_t> output_shape2(y_dims.begin() + 1, y_dims.end());
-    output_shape2[0] /= group_;
-    const int64_t output_shape2_size = flattened_dimension(output_shape2);
-
-    for (int image_id = 0; image_id < N; ++image_id) {
-        for (int group_id = 0; group_id < group_; ++group_id) {
-
-            gemm<T>(
-                true,
-                false,
-                (size_t)kernel_dim,  // m
-                (size_t)(input_shape_size),  // n
-                (size_t)(C / group_),  // k
-                (T)1, // alpha
-                (const T*)W.data(0) + group_id * W_offset, // *a
-                (const T*)Xdata + group_id * X_offset, // *b
-                (T)0,  // beta
-                col_buffer_data // *c
-            );
-
-            Im2colNd_NCHW<T>(
-                col_buffer_data,
-                &output_shape2[0],
-                col_buffer_shape.data(),
-                output_shape2_size,
-                col_buffer_size,
-                &kernel_shape[0],
-                strides.data(),
-                &dilations[0],
-                &pads[0],
-                static_cast<int>(kernel_shape.size()),
-                (T*)Ydata + group_id * Y_offset,
-                true);
+    const T* Wdata = W.data(0);
+    const T* Bdata = b_dims.size() != 0 && b_dims[0] != 0 ? B.data(0) : nullptr;
+
+    // Every output belongs to one phase, a kernel position to one phase
+    // per dimension.
+    std::vector<ConvTransposePhase> phases;
+    std::vector<int64_t> r(rank, 0), k(rank, 0);
+    int64_t weights_size = 0;
+    size_t d;
+    do {
+        ConvTransposePhase phase;
+        phase.offset = r;
+        phase.size = 1;
+        for (d = 0; d < rank; ++d) {
+            phase.shape.push_back(r[d] < output_shape[d]
+                ? (output_shape[d] - r[d] + strides[d] - 1) / strides[d] : 0);
+            phase.size *= phase.shape[d];
         }
-            
-        if (b_dims.size() != 0 && b_dims[0] != 0) {
-            // conv: output_image_size, M
-            // convt: output_image_size, num_output_channels
-            const T* ptrb = B.data(0);
-            for(size_t k = 0; k < (size_t)num_output_channels; ++k, ++ptrb) {
-                yptr = Ydata + output_image_size * k;
-                for(k2 = 0; k2 < (size_t)output_image_size; ++k2, ++yptr)
-                    *yptr += *ptrb;
+        if (phase.size == 0)
+            continue;
+        std::fill(k.begin(), k.end(), 0);
+        int64_t kernel_pos = 0;
+        do {
+            bool valid = true;
+            for (d = 0; d < rank; ++d)
+                valid &= (r[d] + pads[d] - k[d] * dilations[d]) % strides[d] == 0;
+            if (valid) {
+                phase.kernel.push_back(kernel_pos);
+                for (d = 0; d < rank; ++d)
+                    phase.base.push_back((r[d] + pads[d] - k[d] * dilations[d]) / strides[d]);
             }
-        }
+            ++kernel_pos;
+        } while (NextPosition(rank, kernel_shape.data(), k.data()));
+        int64_t kernel_dim = C_group * (int64_t)phase.kernel.size();
+        phase.tile = std::max((int64_t)1, std::min(
+            phase.size, CONV_TRANSPOSE_BUFFER / (kernel_dim + M_group)));
+        phase.weight_offset = weights_size;
+        weights_size += group_ * M_group * kernel_dim;
+        phases.push_back(phase);
+    } while (NextPosition(rank, strides.data(), r.data()));
+
+    // Weights of a phase and a group, [M_group][C_group][kernel of the phase].
+    std::vector<T> weights(weights_size);
+    for (auto& phase : phases) {
+        int64_t n_kernel = (int64_t)phase.kernel.size();
+        T* w = weights.data() + phase.weight_offset;
+        for (int64_t g = 0; g < group_; ++g)
+            for (int64_t m = 0; m < M_group; ++m)
+                for (int64_t c = 0; c < C_group; ++c)
+                    for (int64_t kv = 0; kv < n_kernel; ++kv, ++w)
+                        *w = Wdata[((g * C_group + c) * M_group + m) * kernel_size + phase.kernel[kv]];
+    }
+
+    // One task is one image, one group and one tile of a phase,
+    // every task writes its own outputs.
+    std::vector<std::pair<size_t, int64_t>> tiles;
+    int64_t buffer_size = 0;
+    for (size_t p = 0; p < phases.size(); ++p) {
+        for (int64_t start = 0; start < phases[p].size; start += phases[p].tile)
+            tiles.push_back(std::pair<size_t, int64_t>(p, start));
+        buffer_size = std::max(buffer_size,
+            (C_group * (int64_t)phases[p].kernel.size() + M_group) * phases[p].tile);
+    }
+    const int64_t n_tiles = (int64_t)tiles.size();
+    const int64_t n_tasks = N * group_ * n_tiles;
+
+    auto compute_task = [&](T* buffer, std::vector<int64_t>& j, int64_t task) {
+        int64_t image_group = task / n_tiles;
+        int64_t group_id = image_group % group_;
+        const ConvTransposePhase& phase = phases[tiles[task % n_tiles].first];
+        int64_t start = tiles[task % n_tiles].second;
+        int64_t count = std::min(phase.tile, phase.size - start);
+        int64_t n_kernel = (int64_t)phase.kernel.size();
+        int64_t kernel_dim = C_group * n_kernel;
+        const T* xdata = Xdata + image_group * C_group * input_image_size;
+        T* ydata = Ydata + image_group * M_group * output_image_size;
+        T* col_buffer = buffer;
+        T* gemm_output = buffer + kernel_dim * count;
+
+        // Gathers the inputs contributing to every output,
+        // [C_group][kernel of the phase][count].
+        ConvTransposeRuns(phase.shape, start, count, j,
+                          [&](const std::vector<int64_t>& jp, int64_t done, int64_t run) {
+            for (int64_t kv = 0; kv < n_kernel; ++kv) {
+                const int64_t* base = phase.base.data() + kv * rank;
+                bool inside = true;
+                int64_t offset = 0;
+                for (size_t dd = 0; dd < last; ++dd) {
+                    int64_t i = base[dd] + jp[dd];
+                    inside &= is_a_ge_zero_and_a_lt_b(i, input_shape[dd]);
+                    offset = offset * input_shape[dd] + i;
+                }
+                int64_t i0 = base[last] + jp[last];
+                int64_t lo = inside ? std::min(run, std::max((int64_t)0, -i0)) : run;
+                int64_t hi = inside ? std::max(lo, std::min(run, input_shape[last] - i0)) : run;
+                for (int64_t c = 0; c < C_group; ++c) {
+                    T* dst = col_buffer + (c * n_kernel + kv) * count + done;
+                    std::fill(dst, dst + lo, (T)0);
+                    if (hi > lo) {
+                        const T* src = xdata + c * input_image_size +
+                                       offset * input_shape[last] + i0;
+                        std::copy(src + lo, src + hi, dst + lo);
+                    }
+                    std::fill(dst + hi, dst + run, (T)0);
+                }
+            }
+        });
+
+        if (kernel_dim > 0)
+            gemm<T>(false, false, (size_t)M_group, (size_t)count, (size_t)kernel_dim,
+                    (T)1, weights.data() + phase.weight_offset + group_id * M_group * kernel_dim,
+                    col_buffer, (T)0, gemm_output);
+        else
+            std::fill(gemm_output, gemm_output + M_group * count, (T)0);
+
+        // Scatters the outputs of the phase and adds the bias.
+        const int64_t stride_last = strides[last];
+        ConvTransposeRuns(phase.shape, start, count, j,
+                          [&](const std::vector<int64_t>& jp, int64_t done, int64_t run) {
+            int64_t offset = 0;
+            for (size_t dd = 0; dd < rank; ++dd)
+                offset = offset * output_shape[dd] + phase.offset[dd] + jp[dd] * strides[dd];
+            for (int64_t m = 0; m < M_group; ++m) {
+                T bias = Bdata == nullptr ? (T)0 : Bdata[group_id * M_group + m];
+                const T* src = gemm_output + m * count + done;
+                T* dst = ydata + m * output_image_size + offset;
+                for (int64_t t = 0; t < run; ++t, dst += stride_last)
+                    *dst = src[t] + bias;
+            }
+        });
+    };
 
-        Xdata += X_offset * group_;
-        Ydata += Y_offset * group_;
+#if USE_OPENMP
+    // Tasks are distributed over threads if there are enough of them,
+    // otherwise gemm is parallelized.
+    if (n_tasks > 1 && n_tasks >= (int64_t)omp_get_max_threads()) {
+        #pragma omp parallel
+        {
+            std::vector<T> buffer(buffer_size);
+            std::vector<int64_t> j(rank);
+            #pragma omp for schedule(dynamic)
+            for (int64_t task = 0; task < n_tasks; ++task)
+                compute_task(buffer.data(), j, task);
+        }
+        return;
     }
+#endif
+    std::vector<T> buffer(buffer_size);
+    std::vector<int64_t> j(rank);
+    for (int64_t task = 0; task < n_tasks; ++task)
+        compute_task(buffer.data(), j, task);
 }
 
 
@@ -30,6 +30,7 @@ class MaxPool : ConvPoolCommon {
         int64_t ceil_mode_;
         int64_t storage_order_;
         bool global_pooling_;
+        bool channels_last_;
     
     public:
 
@@ -42,6 +43,10 @@ class MaxPool : ConvPoolCommon {
                   py::array_t<int64_t, py::array::c_style | py::array::forcecast> pads,
                   py::array_t<int64_t, py::array::c_style | py::array::forcecast> strides);
 
+        // Input and outputs are NHWC (channels last) instead of NCHW,
+        // indices are positions in the flattened NHWC input.
+        void set_channels_last(bool channels_last);
+
         py::tuple compute(py::array_t<T, py::array::c_style | py::array::forcecast> X) const;
     
     private:
@@ -89,6 +94,13 @@ class MaxPool : ConvPoolCommon {
 template<typename T>
 MaxPool<T>::MaxPool() : ConvPoolCommon() {
     global_pooling_ = false;
+    channels_last_ = false;
+}
+
+
+template<typename T>
+void MaxPool<T>::set_channels_last(bool channels_last) {
+    channels_last_ = channels_last;
 }
 
 
@@ -210,6 +222,11 @@ py::tuple MaxPool<T>::compute(py::array_t<T, py::array::c_style | py::array::for
 
     std::vector<int64_t> x_dims;
     arrayshape2vector(x_dims, X);
+    if (channels_last_ && x_dims.size() >= 3) {
+        // Shapes are computed as if the input was NCHW.
+        x_dims.insert(x_dims.begin() + 1, x_dims.back());
+        x_dims.pop_back();
+    }
 
     if (x_dims.size() < 3)
         throw std::invalid_argument("Number of dimensions for input should be >= 3.");
@@ -241,8 +258,14 @@ py::tuple MaxPool<T>::compute(py::array_t<T, py::array::c_style | py::array::for
     std::vector<int64_t> output_dims = SetOutputSize(x_dims, x_dims[1], &pads, &strides,
                                                      &kernel_shape, &dilations);
 
-    py::array_t<T, py::array::c_style | py::array::forcecast> Y(output_dims);
-    py::array_t<int64_t, py::array::c_style | py::array::forcecast> I(output_dims);
+    std::vector<int64_t> y_dims(output_dims);
+    if (channels_last_) {
+        y_dims.erase(y_dims.begin() + 1);
+        y_dims.push_back(output_dims[1]);
+    }
+
+    py::array_t<T, py::array::c_style | py::array::forcecast> Y(y_dims);
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> I(y_dims);
     {
         py::gil_scoped_release release;
         compute_gil_free(X, Y, &I, kernel_shape, pads, strides, dilations, x_dims, output_dims);
@@ -468,6 +491,100 @@ struct MaxPool3DTask {
 };
 
 
+// Pools a NHWC tensor, every output position is a vector of channels.
+// 1D and 2D pools are 3D pools with dimensions of size 1.
+template <typename T>
+struct MaxPoolNHWCTask final {
+    const T* X_data;
+    T* Y_data;
+    int64_t* I_data;
+    int64_t channels;
+    int64_t height;
+    int64_t width;
+    int64_t depth;
+    int64_t pooled_height;
+    int64_t pooled_width;
+    int64_t pooled_depth;
+    int64_t kernel_h;
+    int64_t kernel_w;
+    int64_t kernel_d;
+    int64_t stride_h;
+    int64_t stride_w;
+    int64_t stride_d;
+    int64_t dilation_h;
+    int64_t dilation_w;
+    int64_t dilation_d;
+    int64_t pad_h;
+    int64_t pad_w;
+    int64_t pad_d;
+    int64_t storage_order;
+
+    void operator()(std::ptrdiff_t begin, std::ptrdiff_t end) const {
+        #ifdef _OPENMP
+        #pragma omp parallel for
+        #endif
+        for (int64_t row = begin; row < end; ++row)
+            operator()(row);
+    }
+
+    // One row is one image and one pooled height.
+    void operator()(std::ptrdiff_t row) const {
+        const int64_t n = row / pooled_height;
+        const int64_t ph = row % pooled_height;
+        const int64_t x_step = height * width * depth * channels;
+        const int64_t y_step = pooled_width * pooled_depth * channels;
+        const T* x_d = X_data + n * x_step;
+        T* y_d = Y_data + row * y_step;
+        int64_t* i_d = I_data ? I_data + row * y_step : nullptr;
+        const int64_t hstart = ph * stride_h - pad_h;
+        const int64_t hend = hstart + kernel_h * dilation_h;
+        int64_t c;
+        for (int64_t pw = 0; pw < pooled_width; ++pw) {
+            int64_t wstart = pw * stride_w - pad_w;
+            int64_t wend = wstart + kernel_w * dilation_w;
+            for (int64_t pd = 0; pd < pooled_depth; ++pd) {
+                int64_t dstart = pd * stride_d - pad_d;
+                int64_t dend = dstart + kernel_d * dilation_d;
+                std::fill_n(y_d, channels, std::numeric_limits<T>::lowest());
+                if (i_d != nullptr)
+                    std::fill_n(i_d, channels, (int64_t)-1);
+                for (int64_t h = hstart; h < hend; h += dilation_h) {
+                    if (static_cast<uint64_t>(h) >= static_cast<uint64_t>(height))
+                        continue;
+                    for (int64_t w = wstart; w < wend; w += dilation_w) {
+                        if (static_cast<uint64_t>(w) >= static_cast<uint64_t>(width))
+                            continue;
+                        for (int64_t d = dstart; d < dend; d += dilation_d) {
+                            if (static_cast<uint64_t>(d) >= static_cast<uint64_t>(depth))
+                                continue;
+                            const T* x = x_d + ((h * width + w) * depth + d) * channels;
+                            if (i_d == nullptr) {
+                                for (c = 0; c < channels; ++c)
+                                    y_d[c] = x[c] > y_d[c] ? x[c] : y_d[c];
+                            }
+                            else {
+                                int64_t index = n * x_step + channels * (storage_order == 0
+                                    ? (h * width + w) * depth + d
+                                    : h + w * height + d * height * width);
+                                for (c = 0; c < channels; ++c) {
+                                    if (x[c] > y_d[c]) {
+                                        y_d[c] = x[c];
+                                        i_d[c] = index + c;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+                y_d += channels;
+                if (i_d != nullptr)
+                    i_d += channels;
+            }
+        }
+    }
+};
+
+
 template<typename T>
 void MaxPool<T>::compute_gil_free(
             py::array_t<T, py::array::c_style | py::array::forcecast> X,
@@ -497,6 +614,26 @@ void MaxPool<T>::compute_gil_free(
     int64_t stride_w = global_pooling_ ? 1 : strides[1];
     int64_t stride_d = global_pooling_ ? 1 : strides[2];
 
+    if (channels_last_) {
+        const size_t rank = kernel_shape.size();
+        if (rank > 3)
+            throw std::invalid_argument("MaxPool: not implemented error.");
+        MaxPoolNHWCTask<T> task {X_data, Y_data, I_data, channels,
+                                 height, width, depth,
+                                 pooled_height, pooled_width, pooled_depth,
+                                 kernel_shape[0],
+                                 rank > 1 ? kernel_shape[1] : 1,
+                                 rank > 2 ? kernel_shape[2] : 1,
+                                 stride_h, rank > 1 ? stride_w : 1, rank > 2 ? stride_d : 1,
+                                 dilations[0],
+                                 rank > 1 ? dilations[1] : 1,
+                                 rank > 2 ? dilations[2] : 1,
+                                 pads[0], rank > 1 ? pads[1] : 0, rank > 2 ? pads[2] : 0,
+                                 storage_order_};
+        task(0, x_dims[0] * pooled_height);
+        return;
+    }
+
     switch (kernel_shape.size()) {
         case 1: {
             int64_t x_step = height;
@@ -578,6 +715,8 @@ in :epkg:`onnxruntime`. Supports float only.)pbdoc");
     clf.def(py::init<>());
     clf.def("init", &MaxPoolFloat::init,
             "Initializes the runtime with the ONNX attributes.");
+    clf.def("set_channels_last", &MaxPoolFloat::set_channels_last,
+            "Switches input and outputs to NHWC (channels last).", py::arg("channels_last"));
     clf.def("compute", &MaxPoolFloat::compute,
             "Computes the output for operator MaxPool.");
 
@@ -589,6 +728,8 @@ in :epkg:`onnxruntime`. Supports double only.)pbdoc");
     cld.def(py::init<>());
     cld.def("init", &MaxPoolDouble::init,
             "Initializes the runtime with the ONNX attributes.");
+    cld.def("set_channels_last", &MaxPoolDouble::set_channels_last,
+            "Switches input and outputs to NHWC (channels last).", py::arg("channels_last"));
     cld.def("compute", &MaxPoolDouble::compute,
             "Computes the output for operator MaxPool.");
 }
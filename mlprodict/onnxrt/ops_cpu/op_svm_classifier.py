@@ -59,7 +59,12 @@ class SVMClassifierCommon(OpRunClassifierProb, _ClassifierCommon):
         See class :class:`RuntimeSVMClassifier
         <mlprodict.onnxrt.ops_cpu.op_svm_classifier_.RuntimeSVMClassifier>`.
         """
-        label, scores = self.rt_.compute(x)
+        if hasattr(x, 'tocsr') and hasattr(self.rt_, 'compute_csr'):
+            x = x.tocsr()
+            label, scores = self.rt_.compute_csr(
+                x.data, x.indices, x.indptr, x.shape[1])
+        else:
+            label, scores = self.rt_.compute(x)
         if scores.shape[0] != label.shape[0]:
             scores = scores.reshape(label.shape[0],
                                     scores.shape[0] // label.shape[0])
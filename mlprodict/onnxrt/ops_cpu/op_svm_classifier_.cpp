@@ -2,6 +2,31 @@
 // https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/svm_classifier.cc.
 
 #include "op_svm_common_.hpp"
+#include <mutex>
+
+
+// Number of rows the probabilities are estimated for at once.
+#define SVM_PROBA_BATCH 16
+
+
+// Scratch buffers needed to compute one row, every thread takes one
+// for the duration of a call so that the per-row path does not allocate.
+// The buffers used to estimate the probabilities hold SVM_PROBA_BATCH rows,
+// the row is the last dimension.
+template<typename NTYPE>
+struct SVMClassifierWorkspace {
+    std::vector<NTYPE> kernels;
+    std::vector<NTYPE> scores;
+    std::vector<int64_t> votes;
+    std::vector<NTYPE> probsp2;     // [class_count][class_count][batch]
+    std::vector<NTYPE> estimates;   // [class_count][batch]
+    std::vector<NTYPE> Q;           // [class_count][class_count][batch]
+    std::vector<NTYPE> Qp;          // [class_count][batch]
+    std::vector<NTYPE> pQp;         // [batch]
+    std::vector<NTYPE> diff;        // [batch]
+    std::vector<NTYPE> active;      // [batch], 0 once a row converged
+    std::vector<NTYPE> block_kernels;
+};
 
 
 template<typename NTYPE>
@@ -17,6 +42,12 @@ class RuntimeSVMClassifier : public RuntimeSVMCommon<NTYPE> {
         int64_t class_count_;
         std::vector<int64_t> vectors_per_class_;
         std::vector<int64_t> starting_vector_;
+
+    protected:
+
+        // workspaces not used by any thread, filled by Initialize
+        mutable std::mutex workspaces_mutex_;
+        mutable std::vector<std::unique_ptr<SVMClassifierWorkspace<NTYPE>>> workspaces_;
         
     public:
         
@@ -39,6 +70,12 @@ class RuntimeSVMClassifier : public RuntimeSVMCommon<NTYPE> {
         
         py::tuple compute(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X) const;
 
+        py::tuple compute_csr(
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+            int64_t n_features) const;
+
     private:
 
         void Initialize();
@@ -49,8 +86,50 @@ class RuntimeSVMClassifier : public RuntimeSVMCommon<NTYPE> {
                               py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
                               int64_t z_stride) const;
 
-        void compute_gil_free_loop(const NTYPE * x_data, 
-                                   int64_t* y_data, NTYPE * z_data) const;
+        void compute_gil_free_csr(int64_t N, const NTYPE* data, const int64_t* indices,
+                                  const int64_t* indptr,
+                                  py::array_t<int64_t, py::array::c_style | py::array::forcecast>& Y,
+                                  py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                  int64_t z_stride) const;
+
+        int64_t get_nb_columns() const;
+
+        // number of values computed for a row before the scores,
+        // kernels or products with the folded linear weights
+        int64_t get_nb_kernels() const;
+
+        void fold_linear_kernel_pairs();
+
+        std::unique_ptr<SVMClassifierWorkspace<NTYPE>> acquire_workspace() const;
+        std::unique_ptr<SVMClassifierWorkspace<NTYPE>> acquire_workspace_new() const;
+        void release_workspace(std::unique_ptr<SVMClassifierWorkspace<NTYPE>>& ws) const;
+
+        // x_indices is null for a dense row, otherwise x_data holds
+        // the x_nnz values of a sparse row. row_kernels, if not null,
+        // holds the kernels already computed for the row.
+        // If the model computes probabilities, the row only writes
+        // the label and its pairwise probabilities at position batch_row
+        // of the workspace, compute_gil_free_rows writes the probabilities.
+        void compute_gil_free_loop(SVMClassifierWorkspace<NTYPE>& ws,
+                                   const NTYPE * x_data, 
+                                   int64_t* y_data, NTYPE * z_data,
+                                   const int64_t* x_indices = nullptr,
+                                   int64_t x_nnz = 0,
+                                   const NTYPE* row_kernels = nullptr,
+                                   int64_t batch_row = 0) const;
+
+        // Calls compute_row(n, batch_row) for every row in [begin, end[
+        // and estimates the probabilities by batches of SVM_PROBA_BATCH rows.
+        template<typename ROW_FCT>
+        void compute_gil_free_rows(SVMClassifierWorkspace<NTYPE>& ws,
+                                   int64_t begin, int64_t end,
+                                   NTYPE* z_data, int64_t z_stride,
+                                   ROW_FCT compute_row) const;
+
+        void compute_gil_free_block(SVMClassifierWorkspace<NTYPE>& ws,
+                                    int64_t begin, int64_t n_rows, int64_t stride,
+                                    const NTYPE* x_data, int64_t* y_data, NTYPE* z_data,
+                                    int64_t z_stride) const;
 };
 
 
@@ -121,6 +200,92 @@ void RuntimeSVMClassifier<NTYPE>::Initialize() {
         weights_are_all_positive_ = false;
         break;
     }  
+    if (this->mode_ == SVM_TYPE::SVM_SVC) {
+        this->init_support_vectors();
+        if (this->kernel_type_ == KERNEL::LINEAR)
+            fold_linear_kernel_pairs();
+    }
+
+    std::lock_guard<std::mutex> lock(workspaces_mutex_);
+    workspaces_.clear();
+    int n_threads = this->omp_get_max_threads();
+    workspaces_.reserve(n_threads);
+    for (int i = 0; i < n_threads; ++i)
+        workspaces_.push_back(acquire_workspace_new());
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMClassifier<NTYPE>::fold_linear_kernel_pairs() {
+    // One weight vector per pair of classes. A row then costs
+    // n_pairs dot products instead of vector_count_ dot products
+    // followed by the weighted sums of the kernels for every pair.
+    int64_t n_pairs = class_count_ * (class_count_ - 1) / 2;
+    if (n_pairs * this->feature_count_ >=
+            this->vector_count_ * (this->feature_count_ + class_count_ - 1))
+        return;
+    int64_t vc = this->vector_count_;
+    if ((int64_t)this->coefficients_.size() < (class_count_ - 1) * vc)
+        throw std::invalid_argument(MakeString(
+            "Expecting at least ", (class_count_ - 1) * vc, " coefficients not ",
+            this->coefficients_.size(), "."));
+    std::vector<NTYPE> coefficients(n_pairs * vc, (NTYPE)0);
+    int64_t pair = 0;
+    for (int64_t i = 0; i < class_count_; ++i) {
+        for (int64_t j = i + 1; j < class_count_; ++j, ++pair) {
+            NTYPE* c = coefficients.data() + pair * vc;
+            for (int64_t m = starting_vector_[i]; m < starting_vector_[i] + vectors_per_class_[i]; ++m)
+                c[m] = this->coefficients_[(j - 1) * vc + m];
+            for (int64_t m = starting_vector_[j]; m < starting_vector_[j] + vectors_per_class_[j]; ++m)
+                c[m] = this->coefficients_[i * vc + m];
+        }
+    }
+    this->fold_linear_kernel(n_pairs, coefficients);
+}
+
+
+template<typename NTYPE>
+std::unique_ptr<SVMClassifierWorkspace<NTYPE>> RuntimeSVMClassifier<NTYPE>::acquire_workspace_new() const {
+    std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws(new SVMClassifierWorkspace<NTYPE>());
+    int64_t n_kernels = get_nb_kernels();
+    ws->kernels.resize(n_kernels);
+    ws->scores.resize(std::max(std::max(class_count_, class_count_ * (class_count_ - 1) / 2),
+                               (int64_t)2));
+    ws->votes.resize(class_count_);
+    if (proba_.size() > 0) {
+        ws->probsp2.resize(class_count_ * class_count_ * SVM_PROBA_BATCH);
+        ws->estimates.resize(class_count_ * SVM_PROBA_BATCH);
+        ws->Q.resize(class_count_ * class_count_ * SVM_PROBA_BATCH);
+        ws->Qp.resize(class_count_ * SVM_PROBA_BATCH);
+        ws->pQp.resize(SVM_PROBA_BATCH);
+        ws->diff.resize(SVM_PROBA_BATCH);
+        ws->active.resize(SVM_PROBA_BATCH);
+    }
+    ws->block_kernels.resize(this->kernel_block_rows_ * n_kernels);
+    return ws;
+}
+
+
+template<typename NTYPE>
+std::unique_ptr<SVMClassifierWorkspace<NTYPE>> RuntimeSVMClassifier<NTYPE>::acquire_workspace() const {
+    {
+        std::lock_guard<std::mutex> lock(workspaces_mutex_);
+        if (!workspaces_.empty()) {
+            std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws = std::move(workspaces_.back());
+            workspaces_.pop_back();
+            return ws;
+        }
+    }
+    // more concurrent callers than threads
+    return acquire_workspace_new();
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMClassifier<NTYPE>::release_workspace(
+        std::unique_ptr<SVMClassifierWorkspace<NTYPE>>& ws) const {
+    std::lock_guard<std::mutex> lock(workspaces_mutex_);
+    workspaces_.push_back(std::move(ws));
 }
 
 
@@ -166,86 +331,169 @@ py::tuple RuntimeSVMClassifier<NTYPE>::compute(py::array_t<NTYPE, py::array::c_s
     // Does not handle 3D tensors
     int64_t stride = x_dims.size() == 1 ? x_dims[0] : x_dims[1];  
     int64_t N = x_dims.size() == 1 ? 1 : x_dims[0];
-    
+    int64_t nb_columns = get_nb_columns();
+
+    std::vector<int64_t> dims{N, nb_columns};    
+                        
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Y(N); // one target only
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(N * nb_columns); // one target only
+    {
+        py::gil_scoped_release release;
+        compute_gil_free(x_dims, N, stride, X, Y, Z, nb_columns);
+    }
+    return py::make_tuple(Y, Z);
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeSVMClassifier<NTYPE>::get_nb_kernels() const {
+    return this->linear_count_ > 0 ? this->linear_count_ : this->vector_count_;
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeSVMClassifier<NTYPE>::get_nb_columns() const {
     int64_t nb_columns = class_count_;
     if (proba_.size() == 0 && this->vector_count_ > 0) {
         nb_columns = class_count_ > 2
                         ? class_count_ * (class_count_ - 1) / 2
                         : 2;
     }
+    return nb_columns;
+}
 
-    std::vector<int64_t> dims{N, nb_columns};    
-                        
-    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Y(N); // one target only
-    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(N * nb_columns); // one target only
+
+template<typename NTYPE>
+py::tuple RuntimeSVMClassifier<NTYPE>::compute_csr(
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+        int64_t n_features) const {
+    if (n_features != this->feature_count_)
+        throw std::invalid_argument(MakeString(
+            "The sparse matrix has ", n_features, " columns but the model expects ",
+            this->feature_count_, "."));
+    int64_t N = check_csr(data, indices, indptr, n_features);
+    int64_t nb_columns = get_nb_columns();
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Y(N);
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(N * nb_columns);
     {
         py::gil_scoped_release release;
-        compute_gil_free(x_dims, N, stride, X, Y, Z, nb_columns);
+        compute_gil_free_csr(N, data.data(0), indices.data(0), indptr.data(0), Y, Z, nb_columns);
     }
     return py::make_tuple(Y, Z);
 }
 
 
+// Pairwise coupling for n <= SVM_PROBA_BATCH rows at once, every buffer
+// is owned by the caller and stores the row in the last dimension
+// (see SVMClassifierWorkspace), the innermost loops go over the rows
+// and are vectorized. Every row follows the same iterations as
+// the algorithm applied to one row, it is left unchanged once it converged.
 template<typename NTYPE>
-void multiclass_probability(int64_t classcount, const std::vector<NTYPE>& r,
-                            std::vector<NTYPE>& p) {
-    int64_t sized2 = classcount * classcount;
-    std::vector<NTYPE> Q(sized2, 0);
-    std::vector<NTYPE> Qp(classcount, 0);
+void multiclass_probability_batch(int64_t classcount, int64_t n, const NTYPE* r,
+                                  NTYPE* p, NTYPE* Q, NTYPE* Qp,
+                                  NTYPE* pQp, NTYPE* diff, NTYPE* active) {
+    const int64_t B = SVM_PROBA_BATCH;
     NTYPE eps = 0.005f / static_cast<NTYPE>(classcount);
-    int64_t ii, ij, ji, j;
-    NTYPE t;
-    for (int64_t i = 0; i < classcount; i++) {
-        p[i] = 1.0f / static_cast<NTYPE>(classcount);  // Valid if k = 1
-        ii = i * classcount + i; 
-        ji = i;
-        ij = i * classcount; 
-        for (j = 0; j < i; ++j, ++ij, ji += classcount) {
-            t = r[ji];
-            Q[ii] += t * t;
-            Q[ij] = Q[ji];
+    NTYPE p0 = 1.0f / static_cast<NTYPE>(classcount);  // Valid if k = 1
+    int64_t b;
+    for (int64_t i = 0; i < classcount; ++i) {
+        NTYPE* Qii = Q + (i * classcount + i) * B;
+        for (b = 0; b < n; ++b) {
+            p[i * B + b] = p0;
+            Qii[b] = 0;
         }
-        ++j;
-        ++ij;
-        ji += classcount;
-        for (; j < classcount; ++j, ++ij, ji += classcount) {
-            t = r[ji];
-            Q[ii] += t * t;
-            Q[ij] = -t * r[ij];
+        for (int64_t j = 0; j < classcount; ++j) {
+            if (j == i)
+                continue;
+            const NTYPE* rji = r + (j * classcount + i) * B;
+            const NTYPE* rij = r + (i * classcount + j) * B;
+            NTYPE* Qij = Q + (i * classcount + j) * B;
+            const NTYPE* Qji = Q + (j * classcount + i) * B;
+            #ifdef USE_OPENMP
+            #pragma omp simd
+            #endif
+            for (b = 0; b < n; ++b) {
+                Qii[b] += rji[b] * rji[b];
+                Qij[b] = j < i ? Qji[b] : -rji[b] * rij[b];
+            }
         }
     }
-    NTYPE pQp, max_error, error, diff;
+    for (b = 0; b < n; ++b)
+        active[b] = 1;
+
+    int64_t n_active;
     for (int64_t loop = 0; loop < 100; loop++) {
         // stopping condition, recalculate QP,pQP for numerical accuracy
-        pQp = 0;
-        for (int64_t i = 0; i < classcount; i++) {
-            t = 0;
-            ij = i * classcount;
-            for (int64_t j = 0; j < classcount; ++j, ++ij) {
-              t += Q[ij] * p[j];
+        for (b = 0; b < n; ++b)
+            pQp[b] = 0;
+        for (int64_t i = 0; i < classcount; ++i) {
+            NTYPE* Qpi = Qp + i * B;
+            const NTYPE* pi = p + i * B;
+            for (b = 0; b < n; ++b)
+                Qpi[b] = 0;
+            for (int64_t j = 0; j < classcount; ++j) {
+                const NTYPE* Qij = Q + (i * classcount + j) * B;
+                const NTYPE* pj = p + j * B;
+                #ifdef USE_OPENMP
+                #pragma omp simd
+                #endif
+                for (b = 0; b < n; ++b)
+                    Qpi[b] += Qij[b] * pj[b];
             }
-            Qp[i] = t;
-            pQp += p[i] * t;
+            #ifdef USE_OPENMP
+            #pragma omp simd
+            #endif
+            for (b = 0; b < n; ++b)
+                pQp[b] += pi[b] * Qpi[b];
         }
-        max_error = 0;
-        for (int64_t i = 0; i < classcount; i++) {
-            error = std::fabs(Qp[i] - pQp);
-            if (error > max_error) {
-                max_error = error;
-            }
+        // diff holds the maximum error
+        for (b = 0; b < n; ++b)
+            diff[b] = 0;
+        for (int64_t i = 0; i < classcount; ++i) {
+            const NTYPE* Qpi = Qp + i * B;
+            #ifdef USE_OPENMP
+            #pragma omp simd
+            #endif
+            for (b = 0; b < n; ++b)
+                diff[b] = std::max(diff[b], (NTYPE)std::fabs(Qpi[b] - pQp[b]));
         }
-        if (max_error < eps)
+        n_active = 0;
+        for (b = 0; b < n; ++b) {
+            if (diff[b] < eps)
+                active[b] = 0;
+            n_active += active[b] != 0 ? 1 : 0;
+        }
+        if (n_active == 0)
             break;
-    
+
         for (int64_t i = 0; i < classcount; ++i) {
-            ii = i * classcount + i;
-            diff = (-Qp[i] + pQp) / Q[ii];
-            p[i] += diff;
-            pQp = (pQp + diff * (diff * Q[ii] + 2 * Qp[i])) / (1 + diff) / (1 + diff);
-            ij = i * classcount;
-            for (int64_t j = 0; j < classcount; ++j, ++ij) {
-                Qp[j] = (Qp[j] + diff * Q[ij]) / (1 + diff);
-                p[j] /= (1 + diff);
+            const NTYPE* Qii = Q + (i * classcount + i) * B;
+            const NTYPE* Qpi = Qp + i * B;
+            NTYPE* pi = p + i * B;
+            #ifdef USE_OPENMP
+            #pragma omp simd
+            #endif
+            for (b = 0; b < n; ++b) {
+                // diff is null for a row which converged, p and Qp do not change
+                NTYPE d = (-Qpi[b] + pQp[b]) / Qii[b];
+                diff[b] = active[b] != 0 ? d : (NTYPE)0;
+                pi[b] += diff[b];
+                pQp[b] = (pQp[b] + diff[b] * (diff[b] * Qii[b] + 2 * Qpi[b])) /
+                         (1 + diff[b]) / (1 + diff[b]);
+            }
+            for (int64_t j = 0; j < classcount; ++j) {
+                const NTYPE* Qij = Q + (i * classcount + j) * B;
+                NTYPE* Qpj = Qp + j * B;
+                NTYPE* pj = p + j * B;
+                #ifdef USE_OPENMP
+                #pragma omp simd
+                #endif
+                for (b = 0; b < n; ++b) {
+                    Qpj[b] = (Qpj[b] + diff[b] * Qij[b]) / (1 + diff[b]);
+                    pj[b] /= (1 + diff[b]);
+                }
             }
         }
     }
@@ -254,20 +502,31 @@ void multiclass_probability(int64_t classcount, const std::vector<NTYPE>& r,
 
 template<typename NTYPE>
 void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
-        const NTYPE * x_data, int64_t* y_data, NTYPE * z_data) const {
+        SVMClassifierWorkspace<NTYPE>& ws, const NTYPE * x_data, int64_t* y_data, NTYPE * z_data,
+        const int64_t* x_indices, int64_t x_nnz, const NTYPE* row_kernels,
+        int64_t batch_row) const {
     int64_t maxclass = -1;
-    std::vector<NTYPE> decisions;
-    std::vector<NTYPE> scores;
-    std::vector<NTYPE> kernels;
-    std::vector<int64_t> votes;
+    NTYPE* scores = ws.scores.data();
+    int64_t n_scores = 0;
+    bool has_votes = false;
+    double x_norm2 = 0;
+    if (row_kernels == nullptr && x_indices != nullptr && this->kernel_type_ == KERNEL::RBF) {
+        for (int64_t i = 0; i < x_nnz; ++i)
+            x_norm2 += (double)x_data[i] * x_data[i];
+    }
 
     if (this->vector_count_ == 0 && this->mode_ == SVM_TYPE::SVM_LINEAR) {
-        scores.resize(class_count_);
+        n_scores = class_count_;
         for (int64_t j = 0; j < class_count_; j++) {  //for each class
-            scores[j] = this->rho_[0] + this->kernel_dot_gil_free(
-                x_data, 0,
-                this->coefficients_, this->feature_count_ * j,
-                this->feature_count_, this->kernel_type_);
+            scores[j] = this->rho_[0] + (x_indices == nullptr
+                ? this->kernel_dot_gil_free(
+                    x_data, 0,
+                    this->coefficients_, this->feature_count_ * j,
+                    this->feature_count_, this->kernel_type_)
+                : this->kernel_dot_sparse_gil_free(
+                    x_data, x_indices, x_nnz, x_norm2,
+                    this->coefficients_, this->feature_count_ * j,
+                    (NTYPE)0, this->kernel_type_));
         }
     } 
     else {
@@ -275,48 +534,77 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
             throw std::invalid_argument("No support vectors.");
         int evals = 0;
        
-        kernels.resize(this->vector_count_);
-        for (int64_t j = 0; j < this->vector_count_; j++) {
-            kernels[j] = this->kernel_dot_gil_free(
-                x_data, 0,
-                this->support_vectors_, this->feature_count_ * j,
-                this->feature_count_, this->kernel_type_);
+        if (row_kernels == nullptr && this->linear_count_ > 0) {
+            NTYPE* kernels = ws.kernels.data();
+            for (int64_t j = 0; j < this->linear_count_; j++) {
+                kernels[j] = x_indices == nullptr
+                    ? this->kernel_dot_gil_free(
+                        x_data, 0,
+                        this->linear_weights_, this->feature_count_ * j,
+                        this->feature_count_, KERNEL::LINEAR)
+                    : this->kernel_dot_sparse_gil_free(
+                        x_data, x_indices, x_nnz, x_norm2,
+                        this->linear_weights_, this->feature_count_ * j,
+                        (NTYPE)0, KERNEL::LINEAR);
+            }
+            row_kernels = kernels;
+        }
+        else if (row_kernels == nullptr) {
+            NTYPE* kernels = ws.kernels.data();
+            for (int64_t j = 0; j < this->vector_count_; j++) {
+                kernels[j] = x_indices == nullptr
+                    ? this->kernel_dot_gil_free(
+                        x_data, 0,
+                        this->support_vectors_, this->feature_count_ * j,
+                        this->feature_count_, this->kernel_type_)
+                    : this->kernel_dot_sparse_gil_free(
+                        x_data, x_indices, x_nnz, x_norm2,
+                        this->support_vectors_, this->feature_count_ * j,
+                        this->support_vectors_norm2_[j], this->kernel_type_);
+            }
+            row_kernels = kernels;
         }
-        votes.resize(class_count_, 0);
-        scores.reserve(class_count_ * (class_count_ - 1) / 2);
+        has_votes = true;
+        std::fill(ws.votes.begin(), ws.votes.end(), 0);
         for (int64_t i = 0; i < class_count_; i++) {        // for each class
             int64_t start_index_i = starting_vector_[i];  // *feature_count_;
             int64_t class_i_support_count = vectors_per_class_[i];
             int64_t pos2 = (this->vector_count_) * (i);
             for (int64_t j = i + 1; j < class_count_; j++) {  // for each class
                 NTYPE sum = 0;
-                int64_t start_index_j = starting_vector_[j];  // *feature_count_;
-                int64_t class_j_support_count = vectors_per_class_[j];
-      
-                int64_t pos1 = (this->vector_count_) * (j - 1);
-                const NTYPE* val1 = &(this->coefficients_[pos1 + start_index_i]);
-                const NTYPE* val2 = &(kernels[start_index_i]);
-                for (int64_t m = 0; m < class_i_support_count; ++m, ++val1, ++val2)
-                    sum += *val1 * *val2;
-      
-                val1 = &(this->coefficients_[pos2 + start_index_j]);
-                val2 = &(kernels[start_index_j]);
-                for (int64_t m = 0; m < class_j_support_count; ++m, ++val1, ++val2)
-                    sum += *val1 * *val2;
+                if (this->linear_count_ > 0) {
+                    // one product per pair of classes
+                    sum = row_kernels[evals];
+                }
+                else {
+                    int64_t start_index_j = starting_vector_[j];  // *feature_count_;
+                    int64_t class_j_support_count = vectors_per_class_[j];
+          
+                    int64_t pos1 = (this->vector_count_) * (j - 1);
+                    const NTYPE* val1 = &(this->coefficients_[pos1 + start_index_i]);
+                    const NTYPE* val2 = row_kernels + start_index_i;
+                    for (int64_t m = 0; m < class_i_support_count; ++m, ++val1, ++val2)
+                        sum += *val1 * *val2;
+          
+                    val1 = &(this->coefficients_[pos2 + start_index_j]);
+                    val2 = row_kernels + start_index_j;
+                    for (int64_t m = 0; m < class_j_support_count; ++m, ++val1, ++val2)
+                        sum += *val1 * *val2;
+                }
       
                 sum += this->rho_[evals];
-                scores.push_back((NTYPE)sum);
-                ++(votes[sum > 0 ? i : j]);
+                scores[n_scores++] = (NTYPE)sum;
+                ++(ws.votes[sum > 0 ? i : j]);
                 ++evals;  //index into rho
             }
         }
     }
 
-    if (proba_.size() > 0 && this->mode_ == SVM_TYPE::SVM_SVC) {
-        //compute probabilities from the scores
-        int64_t num = class_count_ * class_count_;
-        std::vector<NTYPE> probsp2(num, 0.f);
-        std::vector<NTYPE> estimates(class_count_, 0.f);
+    bool has_proba = proba_.size() > 0 && this->mode_ == SVM_TYPE::SVM_SVC;
+    if (has_proba) {
+        // pairwise probabilities from the scores, the diagonal is not used,
+        // compute_gil_free_rows solves the coupling for the whole batch
+        NTYPE* probsp2 = ws.probsp2.data() + batch_row;
         int64_t index = 0;
         NTYPE val1, val2;
         for (int64_t i = 0; i < class_count_; ++i) {
@@ -326,24 +614,20 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
                 val1 = sigmoid_probability(scores[index], proba_[index], probb_[index]);
                 val2 = std::max(val1, (NTYPE)1.0e-7);
                 val2 = std::min(val2, (NTYPE)(1 - 1.0e-7));
-                probsp2[p1] = val2;
-                probsp2[p2] = 1 - val2;
+                probsp2[p1 * SVM_PROBA_BATCH] = val2;
+                probsp2[p2 * SVM_PROBA_BATCH] = 1 - val2;
             }
         }
-        multiclass_probability(class_count_, probsp2, estimates);
-        // copy probabilities back into scores
-        scores.resize(estimates.size());
-        std::copy(estimates.begin(), estimates.end(), scores.begin());
     }
 
     NTYPE max_weight = 0;
-    if (votes.size() > 0) {
-        auto it_maxvotes = std::max_element(votes.begin(), votes.end());
-        maxclass = std::distance(votes.begin(), it_maxvotes);
+    if (has_votes) {
+        auto it_maxvotes = std::max_element(ws.votes.begin(), ws.votes.end());
+        maxclass = std::distance(ws.votes.begin(), it_maxvotes);
     } 
     else {
-        auto it_max_weight = std::max_element(scores.begin(), scores.end());
-        maxclass = std::distance(scores.begin(), it_max_weight);
+        NTYPE* it_max_weight = std::max_element(scores, scores + n_scores);
+        maxclass = std::distance(scores, it_max_weight);
         max_weight = *it_max_weight;
     }
 
@@ -362,7 +646,46 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free_loop(
         *y_data = maxclass;
     }
 
-    write_scores(scores, this->post_transform_, z_data, write_additional_scores);
+    if (has_proba)
+        return;
+    // scores holds at least two values, write_scores may use the second one
+    write_scores((size_t)n_scores, scores, this->post_transform_, z_data, write_additional_scores);
+}
+
+
+template<typename NTYPE>
+template<typename ROW_FCT>
+void RuntimeSVMClassifier<NTYPE>::compute_gil_free_rows(
+        SVMClassifierWorkspace<NTYPE>& ws, int64_t begin, int64_t end,
+        NTYPE* z_data, int64_t z_stride, ROW_FCT compute_row) const {
+    if (proba_.size() == 0 || this->mode_ != SVM_TYPE::SVM_SVC) {
+        for (int64_t n = begin; n < end; ++n)
+            compute_row(n, 0);
+        return;
+    }
+    int64_t n_rows, b, i;
+    for (int64_t batch = begin; batch < end; batch += SVM_PROBA_BATCH) {
+        n_rows = std::min((int64_t)SVM_PROBA_BATCH, end - batch);
+        for (b = 0; b < n_rows; ++b)
+            compute_row(batch + b, b);
+        multiclass_probability_batch(class_count_, n_rows, ws.probsp2.data(),
+                                     ws.estimates.data(), ws.Q.data(), ws.Qp.data(),
+                                     ws.pQp.data(), ws.diff.data(), ws.active.data());
+        for (b = 0; b < n_rows; ++b) {
+            NTYPE* z = z_data + (batch + b) * z_stride;
+            const NTYPE* p = ws.estimates.data() + b;
+            if (this->post_transform_ == POST_EVAL_TRANSFORM::NONE) {
+                for (i = 0; i < class_count_; ++i, p += SVM_PROBA_BATCH)
+                    z[i] = *p;
+            }
+            else {
+                NTYPE* scores = ws.scores.data();
+                for (i = 0; i < class_count_; ++i, p += SVM_PROBA_BATCH)
+                    scores[i] = *p;
+                write_scores((size_t)class_count_, scores, this->post_transform_, z, -1);
+            }
+        }
+    }
 }
 
 
@@ -379,20 +702,140 @@ void RuntimeSVMClassifier<NTYPE>::compute_gil_free(
     int64_t* y_data = (int64_t*)Y_.data(0);
     NTYPE* z_data = (NTYPE*)Z_.data(0);  
 
+    if (this->mode_ == SVM_TYPE::SVM_SVC && this->vector_count_ > 0 &&
+            this->kernel_block_rows_ > 0) {
+        int64_t block = this->kernel_block_rows_;
+        int64_t n_blocks = (N + block - 1) / block;
+        if (N <= this->omp_N_) {
+            std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws = acquire_workspace();
+            for (int64_t b = 0; b < n_blocks; ++b)
+                compute_gil_free_block(*ws, b * block, std::min(block, N - b * block), x_dims[1],
+                                       x_data, y_data, z_data, z_stride);
+            release_workspace(ws);
+        }
+        else {
+            #ifdef USE_OPENMP
+            #pragma omp parallel
+            #endif
+            {
+                std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws = acquire_workspace();
+                #ifdef USE_OPENMP
+                #pragma omp for
+                #endif
+                for (int64_t b = 0; b < n_blocks; ++b)
+                    compute_gil_free_block(*ws, b * block, std::min(block, N - b * block), x_dims[1],
+                                           x_data, y_data, z_data, z_stride);
+                release_workspace(ws);
+            }
+        }
+        return;
+    }
+
     if (N <= this->omp_N_) {
-        for (int64_t n = 0; n < N; ++n)
-            compute_gil_free_loop(x_data + n * x_dims[1],
-                                  y_data + n,
-                                  z_data + z_stride * n);
+        std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws = acquire_workspace();
+        compute_gil_free_rows(*ws, 0, N, z_data, z_stride,
+            [&](int64_t n, int64_t batch_row) {
+                compute_gil_free_loop(*ws, x_data + n * x_dims[1],
+                                      y_data + n,
+                                      z_data + z_stride * n,
+                                      nullptr, 0, nullptr, batch_row);
+            });
+        release_workspace(ws);
     }
     else {
+        int64_t n_batches = (N + SVM_PROBA_BATCH - 1) / SVM_PROBA_BATCH;
         #ifdef USE_OPENMP
-        #pragma omp parallel for
+        #pragma omp parallel
         #endif
-        for (int64_t n = 0; n < N; ++n)
-            compute_gil_free_loop(x_data + n * x_dims[1],
-                                  y_data + n,
-                                  z_data + z_stride * n);
+        {
+            std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws = acquire_workspace();
+            auto compute_row = [&](int64_t n, int64_t batch_row) {
+                compute_gil_free_loop(*ws, x_data + n * x_dims[1],
+                                      y_data + n,
+                                      z_data + z_stride * n,
+                                      nullptr, 0, nullptr, batch_row);
+            };
+            #ifdef USE_OPENMP
+            #pragma omp for
+            #endif
+            for (int64_t b = 0; b < n_batches; ++b)
+                compute_gil_free_rows(*ws, b * SVM_PROBA_BATCH,
+                                      std::min(N, (b + 1) * SVM_PROBA_BATCH),
+                                      z_data, z_stride, compute_row);
+            release_workspace(ws);
+        }
+    }
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMClassifier<NTYPE>::compute_gil_free_block(
+                SVMClassifierWorkspace<NTYPE>& ws,
+                int64_t begin, int64_t n_rows, int64_t stride,
+                const NTYPE* x_data, int64_t* y_data, NTYPE* z_data,
+                int64_t z_stride) const {
+    // kernel_block_rows_ may have changed since the workspace was created
+    int64_t n_kernels = get_nb_kernels();
+    if ((int64_t)ws.block_kernels.size() < n_rows * n_kernels)
+        ws.block_kernels.resize(n_rows * n_kernels);
+    NTYPE* kernels = ws.block_kernels.data();
+    if (this->linear_count_ > 0)
+        this->compute_products_gil_free(x_data + begin * stride, n_rows, stride,
+                                        this->linear_weights_packed_.data(),
+                                        this->linear_count_, kernels);
+    else
+        this->compute_kernels_gil_free(x_data + begin * stride, n_rows, stride, kernels);
+    compute_gil_free_rows(ws, begin, begin + n_rows, z_data, z_stride,
+        [&](int64_t n, int64_t batch_row) {
+            compute_gil_free_loop(ws, x_data + n * stride, y_data + n, z_data + z_stride * n,
+                                  nullptr, 0, kernels + (n - begin) * n_kernels,
+                                  batch_row);
+        });
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMClassifier<NTYPE>::compute_gil_free_csr(
+                int64_t N, const NTYPE* data, const int64_t* indices, const int64_t* indptr,
+                py::array_t<int64_t, py::array::c_style | py::array::forcecast>& Y,
+                py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                int64_t z_stride) const {
+    auto Y_ = Y.mutable_unchecked<1>();
+    auto Z_ = _mutable_unchecked1(Z);
+    int64_t* y_data = (int64_t*)Y_.data(0);
+    NTYPE* z_data = (NTYPE*)Z_.data(0);
+
+    if (N <= this->omp_N_) {
+        std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws = acquire_workspace();
+        compute_gil_free_rows(*ws, 0, N, z_data, z_stride,
+            [&](int64_t n, int64_t batch_row) {
+                compute_gil_free_loop(*ws, data + indptr[n], y_data + n, z_data + z_stride * n,
+                                      indices + indptr[n], indptr[n + 1] - indptr[n],
+                                      nullptr, batch_row);
+            });
+        release_workspace(ws);
+    }
+    else {
+        int64_t n_batches = (N + SVM_PROBA_BATCH - 1) / SVM_PROBA_BATCH;
+        #ifdef USE_OPENMP
+        #pragma omp parallel
+        #endif
+        {
+            std::unique_ptr<SVMClassifierWorkspace<NTYPE>> ws = acquire_workspace();
+            auto compute_row = [&](int64_t n, int64_t batch_row) {
+                compute_gil_free_loop(*ws, data + indptr[n], y_data + n, z_data + z_stride * n,
+                                      indices + indptr[n], indptr[n + 1] - indptr[n],
+                                      nullptr, batch_row);
+            };
+            #ifdef USE_OPENMP
+            #pragma omp for
+            #endif
+            for (int64_t b = 0; b < n_batches; ++b)
+                compute_gil_free_rows(*ws, b * SVM_PROBA_BATCH,
+                                      std::min(N, (b + 1) * SVM_PROBA_BATCH),
+                                      z_data, z_stride, compute_row);
+            release_workspace(ws);
+        }
     }
 }
 
@@ -434,10 +877,19 @@ in :epkg:`onnxruntime`.
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     clf.def("compute", &RuntimeSVMClassifierFloat::compute,
             "Computes the predictions for the SVM classifier.");
+    clf.def("compute_csr", &RuntimeSVMClassifierFloat::compute_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
     clf.def("runtime_options", &RuntimeSVMClassifierFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeSVMClassifierFloat::omp_get_max_threads,
             "Returns omp_get_max_threads from openmp library.");
+    clf.def_readwrite("kernel_block_rows_", &RuntimeSVMClassifierFloat::kernel_block_rows_,
+            "Number of rows evaluated together against all support vectors "
+            "as a matrix multiplication, 0 evaluates every kernel independently.");
+    clf.def_readonly("linear_count_", &RuntimeSVMClassifierFloat::linear_count_,
+            "Number of weight vectors the linear kernel was folded into, "
+            "0 if the support vectors are used.");
 
     py::class_<RuntimeSVMClassifierDouble> cld (m, "RuntimeSVMClassifierDouble",
         R"pbdoc(Implements runtime for operator SVMClassifierDouble. The code is inspired from
@@ -452,10 +904,19 @@ in :epkg:`onnxruntime`.
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     cld.def("compute", &RuntimeSVMClassifierDouble::compute,
             "Computes the predictions for the SVM classifier.");
+    cld.def("compute_csr", &RuntimeSVMClassifierDouble::compute_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
     cld.def("runtime_options", &RuntimeSVMClassifierDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeSVMClassifierDouble::omp_get_max_threads,
             "Returns omp_get_max_threads from openmp library.");
+    cld.def_readwrite("kernel_block_rows_", &RuntimeSVMClassifierDouble::kernel_block_rows_,
+            "Number of rows evaluated together against all support vectors "
+            "as a matrix multiplication, 0 evaluates every kernel independently.");
+    cld.def_readonly("linear_count_", &RuntimeSVMClassifierDouble::linear_count_,
+            "Number of weight vectors the linear kernel was folded into, "
+            "0 if the support vectors are used.");
 }
 
 #endif
@@ -8,6 +8,8 @@
 #include <vector>
 #include <thread>
 #include <iterator>
+#include <cstring>
+#include <limits>
 
 #ifndef SKIP_PYTHON
 //#include <pybind11/iostream.h>
@@ -26,6 +28,10 @@ namespace py = pybind11;
 #include "op_common_.hpp"
 #include "op_common_num_.hpp"
 
+// Support vectors are packed by panels of SVM_PANEL vectors,
+// the blocked kernel evaluation computes SVM_ROWS rows at a time.
+#define SVM_PANEL 8
+#define SVM_ROWS 4
 
 template<typename NTYPE>
 class RuntimeSVMCommon {
@@ -42,13 +48,25 @@ class RuntimeSVMCommon {
         std::vector<NTYPE> rho_;
         std::vector<NTYPE> coefficients_;
         std::vector<NTYPE> support_vectors_;
+        std::vector<double> support_vectors_norm2_;  // squared norms, used by RBF
+        // support vectors transposed by panels: [panel][feature][SVM_PANEL]
+        std::vector<NTYPE> support_vectors_packed_;
+        // linear kernel: the decision functions are folded at init
+        // into linear_count_ weight vectors, the bias stays in rho_,
+        // linear_count_ is 0 if the support vectors are used
+        int64_t linear_count_;
+        std::vector<NTYPE> linear_weights_;
+        std::vector<NTYPE> linear_weights_packed_;
         POST_EVAL_TRANSFORM post_transform_;
         SVM_TYPE mode_;  //how are we computing SVM? 0=LibSVC, 1=LibLinear
         int omp_N_;
+        // number of rows evaluated together against all support vectors,
+        // 0 evaluates every kernel independently
+        int64_t kernel_block_rows_;
     
     public:
 
-        RuntimeSVMCommon(int omp_N) { omp_N_ = omp_N; }
+        RuntimeSVMCommon(int omp_N) { omp_N_ = omp_N; kernel_block_rows_ = 32; linear_count_ = 0; }
         ~RuntimeSVMCommon() { }
         
         void init(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> coefficients,
@@ -62,6 +80,30 @@ class RuntimeSVMCommon {
         NTYPE kernel_dot_gil_free(
                 const NTYPE* A, int64_t a, const std::vector<NTYPE>& B,
                 int64_t b, int64_t len, KERNEL k) const;
+
+        NTYPE kernel_dot_sparse_gil_free(
+                const NTYPE* values, const int64_t* indices, int64_t nnz, double x_norm2,
+                const std::vector<NTYPE>& B, int64_t b, double b_norm2, KERNEL k) const;
+
+        void init_support_vectors();
+
+        // coefficients is a dense matrix n_functions x vector_count_,
+        // decision function f becomes <x, sum_v coefficients[f, v] sv_v> + rho.
+        void fold_linear_kernel(int64_t n_functions, const std::vector<NTYPE>& coefficients);
+
+        void compute_kernels_gil_free(const NTYPE* X, int64_t n_rows, int64_t x_stride,
+                                      NTYPE* K) const;
+
+        // K = X . M^T, M (n_vectors x feature_count_) is packed by pack_panels.
+        void compute_products_gil_free(const NTYPE* X, int64_t n_rows, int64_t x_stride,
+                                       const NTYPE* packed, int64_t n_vectors,
+                                       NTYPE* K) const;
+
+    private:
+
+        void pack_panels(const NTYPE* M, int64_t n_vectors, std::vector<NTYPE>& packed) const;
+
+        NTYPE kernel_finalize_gil_free(double sum, KERNEL k) const;
     
     public:
         
@@ -82,6 +124,9 @@ void RuntimeSVMCommon<NTYPE>::init(
             py::array_t<NTYPE, py::array::c_style | py::array::forcecast> support_vectors
     ) {
     kernel_type_ = to_KERNEL(kernel_type);
+    linear_count_ = 0;
+    linear_weights_.clear();
+    linear_weights_packed_.clear();
     array2vector(support_vectors_, support_vectors, NTYPE);
     post_transform_ = to_POST_EVAL_TRANSFORM(post_transform);
     array2vector(rho_, rho, NTYPE);
@@ -104,17 +149,11 @@ void RuntimeSVMCommon<NTYPE>::init(
 
 
 template<typename NTYPE>
-NTYPE RuntimeSVMCommon<NTYPE>::kernel_dot_gil_free(
-        const NTYPE* A, int64_t a,
-        const std::vector<NTYPE>& B, int64_t b,
-        int64_t len, KERNEL k) const {
-    double sum = 0;
+NTYPE RuntimeSVMCommon<NTYPE>::kernel_finalize_gil_free(double sum, KERNEL k) const {
+    // sum is a dot product except for RBF where it is a squared distance.
     double val;
-    const NTYPE* pA = A + a;
-    const NTYPE* pB = B.data() + b;
     switch(k) {
         case KERNEL::POLY:
-            sum = vector_dot_product_pointer_sse(pA, pB, (size_t)len);
             sum = gamma_ * sum + coef0_;
             switch (degree_) {
                 case 2:
@@ -133,25 +172,227 @@ NTYPE RuntimeSVMCommon<NTYPE>::kernel_dot_gil_free(
             }
             break;
         case KERNEL::SIGMOID:
-            sum = vector_dot_product_pointer_sse(pA, pB, (size_t)len);
             sum = gamma_ * sum + coef0_;
             sum = std::tanh(sum);
             break;
         case KERNEL::RBF:
-            for (int64_t i = len; i > 0; --i, ++pA, ++pB) {
-                val = *pA - *pB;
-                sum += val * val;
-            }
             sum = std::exp(-gamma_ * sum);
             break;
         case KERNEL::LINEAR:
-            sum = vector_dot_product_pointer_sse(pA, pB, (size_t)len);
             break;
     }
     return (NTYPE)sum;
 }
 
 
+template<typename NTYPE>
+NTYPE RuntimeSVMCommon<NTYPE>::kernel_dot_gil_free(
+        const NTYPE* A, int64_t a,
+        const std::vector<NTYPE>& B, int64_t b,
+        int64_t len, KERNEL k) const {
+    double sum = 0;
+    double val;
+    const NTYPE* pA = A + a;
+    const NTYPE* pB = B.data() + b;
+    if (k == KERNEL::RBF) {
+        // The distance is accumulated in double, the vector
+        // kernels accumulate in NTYPE.
+        for (int64_t i = len; i > 0; --i, ++pA, ++pB) {
+            val = *pA - *pB;
+            sum += val * val;
+        }
+    }
+    else
+        sum = vector_dot_product_pointer_sse(pA, pB, (size_t)len);
+    return kernel_finalize_gil_free(sum, k);
+}
+
+
+template<typename NTYPE>
+NTYPE RuntimeSVMCommon<NTYPE>::kernel_dot_sparse_gil_free(
+        const NTYPE* values, const int64_t* indices, int64_t nnz, double x_norm2,
+        const std::vector<NTYPE>& B, int64_t b, double b_norm2, KERNEL k) const {
+    // Only the non null coordinates of the observation are visited,
+    // RBF relies on |x - b|^2 = |x|^2 + |b|^2 - 2 <x, b>.
+    double sum = 0;
+    const NTYPE* pB = B.data() + b;
+    for (int64_t i = 0; i < nnz; ++i)
+        sum += (double)values[i] * pB[indices[i]];
+    if (k == KERNEL::RBF)
+        sum = std::max(x_norm2 + b_norm2 - 2 * sum, (double)0);
+    return kernel_finalize_gil_free(sum, k);
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMCommon<NTYPE>::init_support_vectors() {
+    support_vectors_norm2_.resize(vector_count_);
+    const NTYPE* p = support_vectors_.data();
+    for (int64_t j = 0; j < vector_count_; ++j) {
+        double sum = 0;
+        for (int64_t i = 0; i < feature_count_; ++i, ++p)
+            sum += (double)*p * *p;
+        support_vectors_norm2_[j] = sum;
+    }
+    pack_panels(support_vectors_.data(), vector_count_, support_vectors_packed_);
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMCommon<NTYPE>::pack_panels(
+        const NTYPE* M, int64_t n_vectors, std::vector<NTYPE>& packed) const {
+    int64_t n_panels = (n_vectors + SVM_PANEL - 1) / SVM_PANEL;
+    packed.resize(n_panels * feature_count_ * SVM_PANEL);
+    std::fill(packed.begin(), packed.end(), (NTYPE)0);
+    const NTYPE* p;
+    for (int64_t j = 0; j < n_vectors; ++j) {
+        NTYPE* dest = packed.data() + (j / SVM_PANEL) * feature_count_ * SVM_PANEL + j % SVM_PANEL;
+        p = M + j * feature_count_;
+        for (int64_t i = 0; i < feature_count_; ++i, ++p, dest += SVM_PANEL)
+            *dest = *p;
+    }
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMCommon<NTYPE>::fold_linear_kernel(
+        int64_t n_functions, const std::vector<NTYPE>& coefficients) {
+    if ((int64_t)coefficients.size() != n_functions * vector_count_)
+        throw std::invalid_argument(MakeString(
+            "Unexpected number of coefficients ", coefficients.size(), " != ",
+            n_functions, "x", vector_count_, "."));
+    // accumulated in double, the result only differs from
+    // the evaluation of every kernel by the order of the additions
+    std::vector<double> acc(feature_count_);
+    linear_weights_.resize(n_functions * feature_count_);
+    for (int64_t f = 0; f < n_functions; ++f) {
+        std::fill(acc.begin(), acc.end(), (double)0);
+        for (int64_t v = 0; v < vector_count_; ++v) {
+            double c = coefficients[f * vector_count_ + v];
+            if (c == 0)
+                continue;
+            const NTYPE* sv = support_vectors_.data() + v * feature_count_;
+            for (int64_t i = 0; i < feature_count_; ++i)
+                acc[i] += c * sv[i];
+        }
+        NTYPE* w = linear_weights_.data() + f * feature_count_;
+        for (int64_t i = 0; i < feature_count_; ++i)
+            w[i] = (NTYPE)acc[i];
+    }
+    pack_panels(linear_weights_.data(), n_functions, linear_weights_packed_);
+    linear_count_ = n_functions;
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMCommon<NTYPE>::compute_products_gil_free(
+        const NTYPE* X, int64_t n_rows, int64_t x_stride,
+        const NTYPE* packed, int64_t n_vectors, NTYPE* K) const {
+    // X . M^T is computed by tiles of SVM_ROWS x SVM_PANEL, a panel stays
+    // in cache while it is multiplied by every row of the block.
+    NTYPE acc[SVM_ROWS][SVM_PANEL];
+    const NTYPE* x[SVM_ROWS];
+    int64_t n_panels = (n_vectors + SVM_PANEL - 1) / SVM_PANEL;
+    for (int64_t p = 0; p < n_panels; ++p) {
+        const NTYPE* panel = packed + p * feature_count_ * SVM_PANEL;
+        int64_t j0 = p * SVM_PANEL;
+        int64_t nj = std::min((int64_t)SVM_PANEL, n_vectors - j0);
+        for (int64_t i0 = 0; i0 < n_rows; i0 += SVM_ROWS) {
+            int64_t ni = std::min((int64_t)SVM_ROWS, n_rows - i0);
+            for (int64_t r = 0; r < SVM_ROWS; ++r)
+                x[r] = X + (i0 + (r < ni ? r : 0)) * x_stride;
+            memset(acc, 0, sizeof(acc));
+            const NTYPE* pk = panel;
+            for (int64_t k = 0; k < feature_count_; ++k, pk += SVM_PANEL) {
+                for (int64_t r = 0; r < SVM_ROWS; ++r) {
+                    NTYPE a = x[r][k];
+                    for (int64_t jj = 0; jj < SVM_PANEL; ++jj)
+                        acc[r][jj] += a * pk[jj];
+                }
+            }
+            for (int64_t r = 0; r < ni; ++r)
+                memcpy(K + (i0 + r) * n_vectors + j0, acc[r], nj * sizeof(NTYPE));
+        }
+    }
+}
+
+
+template<typename NTYPE>
+void RuntimeSVMCommon<NTYPE>::compute_kernels_gil_free(
+        const NTYPE* X, int64_t n_rows, int64_t x_stride, NTYPE* K) const {
+    // K[i, j] = kernel(X[i], support_vectors_[j]), K is n_rows x vector_count_.
+    compute_products_gil_free(X, n_rows, x_stride, support_vectors_packed_.data(),
+                              vector_count_, K);
+
+    // kernel function, one pass over the block
+    int64_t size = n_rows * vector_count_;
+    NTYPE gamma = gamma_, coef0 = coef0_, val;
+    switch(kernel_type_) {
+        case KERNEL::POLY:
+            for (int64_t i = 0; i < size; ++i)
+                K[i] = gamma * K[i] + coef0;
+            switch (degree_) {
+                case 2:
+                    for (int64_t i = 0; i < size; ++i)
+                        K[i] = K[i] * K[i];
+                    break;
+                case 3:
+                    for (int64_t i = 0; i < size; ++i)
+                        K[i] = K[i] * K[i] * K[i];
+                    break;
+                case 4:
+                    for (int64_t i = 0; i < size; ++i) {
+                        val = K[i] * K[i];
+                        K[i] = val * val;
+                    }
+                    break;
+                default:
+                    for (int64_t i = 0; i < size; ++i)
+                        K[i] = (NTYPE)std::pow(K[i], degree_);
+                    break;
+            }
+            break;
+        case KERNEL::SIGMOID:
+            for (int64_t i = 0; i < size; ++i)
+                K[i] = std::tanh(gamma * K[i] + coef0);
+            break;
+        case KERNEL::RBF: {
+            // |x - sv|^2 = |x|^2 + |sv|^2 - 2 <x, sv>, the product <x, sv>
+            // is accurate up to feature_count_ * epsilon * (|x|^2 + |sv|^2),
+            // the distance is computed directly when the cancellation
+            // leaves fewer than 10 bits (unscaled features).
+            const double cancellation = feature_count_ * 1024 *
+                                        (double)std::numeric_limits<NTYPE>::epsilon();
+            const double* sv_norm2 = support_vectors_norm2_.data();
+            for (int64_t i = 0; i < n_rows; ++i) {
+                const NTYPE* px = X + i * x_stride;
+                double x_norm2 = 0;
+                for (int64_t k = 0; k < feature_count_; ++k)
+                    x_norm2 += (double)px[k] * px[k];
+                NTYPE* row = K + i * vector_count_;
+                for (int64_t j = 0; j < vector_count_; ++j) {
+                    double dist = x_norm2 + sv_norm2[j] - 2 * (double)row[j];
+                    if (dist <= (x_norm2 + sv_norm2[j]) * cancellation) {
+                        const NTYPE* psv = support_vectors_.data() + j * feature_count_;
+                        dist = 0;
+                        for (int64_t k = 0; k < feature_count_; ++k) {
+                            double d = (double)px[k] - (double)psv[k];
+                            dist += d * d;
+                        }
+                    }
+                    row[j] = (NTYPE)(-gamma * dist);
+                }
+                for (int64_t j = 0; j < vector_count_; ++j)
+                    row[j] = std::exp(row[j]);
+            }
+            break;
+        }
+        case KERNEL::LINEAR:
+            break;
+    }
+}
+
+
 template<typename NTYPE>
 std::string RuntimeSVMCommon<NTYPE>::runtime_options() {
     std::string res;
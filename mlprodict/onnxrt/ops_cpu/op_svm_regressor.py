@@ -57,7 +57,12 @@ class SVMRegressorCommon(OpRunUnaryNum):
         See class :class:`RuntimeSVMRegressor
         <mlprodict.onnxrt.ops_cpu.op_svm_regressor_.RuntimeSVMRegressor>`.
         """
-        pred = self.rt_.compute(x)
+        if hasattr(x, 'tocsr') and hasattr(self.rt_, 'compute_csr'):
+            x = x.tocsr()
+            pred = self.rt_.compute_csr(
+                x.data, x.indices, x.indptr, x.shape[1])
+        else:
+            pred = self.rt_.compute(x)
         if pred.shape[0] != x.shape[0]:
             pred = pred.reshape(x.shape[0], pred.shape[0] // x.shape[0])
         return (pred, )
@@ -29,6 +29,12 @@ class RuntimeSVMRegressor : public RuntimeSVMCommon<NTYPE>
         
         py::array_t<NTYPE> compute(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X) const;
 
+        py::array_t<NTYPE> compute_csr(
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+            int64_t n_features) const;
+
     private:
 
         void Initialize();
@@ -36,6 +42,13 @@ class RuntimeSVMRegressor : public RuntimeSVMCommon<NTYPE>
         void compute_gil_free(const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
                               const py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& X,
                               py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z) const;
+
+        void compute_gil_free_block(int64_t begin, int64_t n_rows, int64_t stride,
+                                    const NTYPE* x_data, NTYPE* z_data, NTYPE* kernels) const;
+
+        void compute_gil_free_csr(int64_t N, const NTYPE* data, const int64_t* indices,
+                                  const int64_t* indptr,
+                                  py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z) const;
 };
 
 
@@ -81,6 +94,17 @@ void RuntimeSVMRegressor<NTYPE>::Initialize() {
         this->mode_ = SVM_TYPE::SVM_LINEAR;
         this->kernel_type_ = KERNEL::LINEAR;
     }
+    if (this->mode_ == SVM_TYPE::SVM_SVC) {
+        if ((int64_t)this->coefficients_.size() < this->vector_count_)
+            throw std::invalid_argument(MakeString(
+                "Expecting at least ", this->vector_count_, " coefficients not ",
+                this->coefficients_.size(), "."));
+        this->init_support_vectors();
+        // one weight vector replaces all the support vectors
+        if (this->kernel_type_ == KERNEL::LINEAR)
+            this->fold_linear_kernel(1, std::vector<NTYPE>(
+                this->coefficients_.begin(), this->coefficients_.begin() + this->vector_count_));
+    }
 }
 
 
@@ -105,10 +129,34 @@ py::array_t<NTYPE> RuntimeSVMRegressor<NTYPE>::compute(py::array_t<NTYPE, py::ar
 }
 
 
+template<typename NTYPE>
+py::array_t<NTYPE> RuntimeSVMRegressor<NTYPE>::compute_csr(
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+        int64_t n_features) const {
+    if (n_features != this->feature_count_)
+        throw std::invalid_argument(MakeString(
+            "The sparse matrix has ", n_features, " columns but the model expects ",
+            this->feature_count_, "."));
+    int64_t N = check_csr(data, indices, indptr, n_features);
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(N);
+    {
+        py::gil_scoped_release release;
+        compute_gil_free_csr(N, data.data(0), indices.data(0), indptr.data(0), Z);
+    }
+    return Z;
+}
+
+
 #define COMPUTE_LOOP() \
     current_weight_0 = n * stride; \
     sum = (NTYPE)0; \
-    if (this->mode_ == SVM_TYPE::SVM_SVC) { \
+    if (this->linear_count_ > 0) { \
+        sum = this->kernel_dot_gil_free(x_data, current_weight_0, this->linear_weights_, 0, \
+                                        this->feature_count_, KERNEL::LINEAR); \
+        sum += this->rho_[0]; \
+    } else if (this->mode_ == SVM_TYPE::SVM_SVC) { \
         for (j = 0; j < this->vector_count_; ++j) { \
             sum += this->coefficients_[j] * this->kernel_dot_gil_free( \
                 x_data, current_weight_0, this->support_vectors_, \
@@ -135,6 +183,34 @@ void RuntimeSVMRegressor<NTYPE>::compute_gil_free(
     int64_t current_weight_0, j;
     NTYPE sum;
 
+    // a folded linear kernel is a dot product per row, blocks do not help
+    if (this->mode_ == SVM_TYPE::SVM_SVC && this->kernel_block_rows_ > 0 &&
+            this->linear_count_ == 0) {
+        int64_t block = this->kernel_block_rows_;
+        int64_t n_blocks = (N + block - 1) / block;
+        if (N <= this->omp_N_) {
+            std::vector<NTYPE> kernels(block * this->vector_count_);
+            for (int64_t b = 0; b < n_blocks; ++b)
+                compute_gil_free_block(b * block, std::min(block, N - b * block),
+                                       stride, x_data, z_data, kernels.data());
+        }
+        else {
+#ifdef USE_OPENMP
+#pragma omp parallel
+#endif
+            {
+                std::vector<NTYPE> kernels(block * this->vector_count_);
+#ifdef USE_OPENMP
+#pragma omp for
+#endif
+                for (int64_t b = 0; b < n_blocks; ++b)
+                    compute_gil_free_block(b * block, std::min(block, N - b * block),
+                                           stride, x_data, z_data, kernels.data());
+            }
+        }
+        return;
+    }
+
     if (N <= this->omp_N_) {
         for (int64_t n = 0; n < N; ++n) {
             COMPUTE_LOOP()
@@ -150,6 +226,80 @@ void RuntimeSVMRegressor<NTYPE>::compute_gil_free(
     }
 }
 
+
+template<typename NTYPE>
+void RuntimeSVMRegressor<NTYPE>::compute_gil_free_block(
+                int64_t begin, int64_t n_rows, int64_t stride,
+                const NTYPE* x_data, NTYPE* z_data, NTYPE* kernels) const {
+    this->compute_kernels_gil_free(x_data + begin * stride, n_rows, stride, kernels);
+    const NTYPE* row = kernels;
+    NTYPE sum;
+    for (int64_t n = begin; n < begin + n_rows; ++n, row += this->vector_count_) {
+        sum = this->rho_[0];
+        for (int64_t j = 0; j < this->vector_count_; ++j)
+            sum += this->coefficients_[j] * row[j];
+        z_data[n] = one_class_ ? (sum > 0 ? 1 : -1) : sum;
+    }
+}
+
+
+#define COMPUTE_LOOP_CSR() \
+    values = data + indptr[n]; \
+    ids = indices + indptr[n]; \
+    nnz = indptr[n + 1] - indptr[n]; \
+    x_norm2 = 0; \
+    if (this->kernel_type_ == KERNEL::RBF) { \
+        for (j = 0; j < nnz; ++j) \
+            x_norm2 += (double)values[j] * values[j]; \
+    } \
+    sum = (NTYPE)0; \
+    if (this->linear_count_ > 0) { \
+        sum = this->kernel_dot_sparse_gil_free(values, ids, nnz, x_norm2, this->linear_weights_, 0, \
+                                               (NTYPE)0, KERNEL::LINEAR); \
+        sum += this->rho_[0]; \
+    } else if (this->mode_ == SVM_TYPE::SVM_SVC) { \
+        for (j = 0; j < this->vector_count_; ++j) { \
+            sum += this->coefficients_[j] * this->kernel_dot_sparse_gil_free( \
+                values, ids, nnz, x_norm2, this->support_vectors_, \
+                this->feature_count_ * j, this->support_vectors_norm2_[j], this->kernel_type_); \
+        } \
+        sum += this->rho_[0]; \
+    } else if (this->mode_ == SVM_TYPE::SVM_LINEAR) { \
+        sum = this->kernel_dot_sparse_gil_free(values, ids, nnz, x_norm2, this->coefficients_, 0, \
+                                               (NTYPE)0, this->kernel_type_); \
+        sum += this->rho_[0]; \
+    } \
+    z_data[n] = one_class_ ? (sum > 0 ? 1 : -1) : sum;
+
+
+template<typename NTYPE>
+void RuntimeSVMRegressor<NTYPE>::compute_gil_free_csr(
+                int64_t N, const NTYPE* data, const int64_t* indices, const int64_t* indptr,
+                py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z) const {
+
+    auto Z_ = _mutable_unchecked1(Z);
+    NTYPE* z_data = (NTYPE*)Z_.data(0);
+    const NTYPE* values;
+    const int64_t* ids;
+    int64_t nnz, j;
+    NTYPE sum;
+    double x_norm2;
+
+    if (N <= this->omp_N_) {
+        for (int64_t n = 0; n < N; ++n) {
+            COMPUTE_LOOP_CSR()
+        }
+    }
+    else {
+#ifdef USE_OPENMP
+#pragma omp parallel for private(values, ids, nnz, j, sum, x_norm2)
+#endif
+        for (int64_t n = 0; n < N; ++n) {
+            COMPUTE_LOOP_CSR()
+        }
+    }
+}
+
 class RuntimeSVMRegressorFloat : public RuntimeSVMRegressor<float>
 {
     public:
@@ -192,10 +342,19 @@ in :epkg:`onnxruntime`.
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     clf.def("compute", &RuntimeSVMRegressorFloat::compute,
             "Computes the predictions for the SVM regressor.");
+    clf.def("compute_csr", &RuntimeSVMRegressorFloat::compute_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
     clf.def("runtime_options", &RuntimeSVMRegressorFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeSVMRegressorFloat::omp_get_max_threads,
             "Returns omp_get_max_threads from openmp library.");
+    clf.def_readwrite("kernel_block_rows_", &RuntimeSVMRegressorFloat::kernel_block_rows_,
+            "Number of rows evaluated together against all support vectors "
+            "as a matrix multiplication, 0 evaluates every kernel independently.");
+    clf.def_readonly("linear_count_", &RuntimeSVMRegressorFloat::linear_count_,
+            "Number of weight vectors the linear kernel was folded into, "
+            "0 if the support vectors are used.");
 
     py::class_<RuntimeSVMRegressorDouble> cld (m, "RuntimeSVMRegressorDouble",
         R"pbdoc(Implements Double runtime for operator SVMRegressor. The code is inspired from
@@ -210,10 +369,19 @@ in :epkg:`onnxruntime`.
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
     cld.def("compute", &RuntimeSVMRegressorDouble::compute,
             "Computes the predictions for the SVM regressor.");
+    cld.def("compute_csr", &RuntimeSVMRegressorDouble::compute_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
     cld.def("runtime_options", &RuntimeSVMRegressorDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeSVMRegressorDouble::omp_get_max_threads,
             "Returns omp_get_max_threads from openmp library.");
+    cld.def_readwrite("kernel_block_rows_", &RuntimeSVMRegressorDouble::kernel_block_rows_,
+            "Number of rows evaluated together against all support vectors "
+            "as a matrix multiplication, 0 evaluates every kernel independently.");
+    cld.def_readonly("linear_count_", &RuntimeSVMRegressorDouble::linear_count_,
+            "Number of weight vectors the linear kernel was folded into, "
+            "0 if the support vectors are used.");
 }
 
 #endif
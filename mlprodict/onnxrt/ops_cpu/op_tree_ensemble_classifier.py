@@ -72,6 +72,33 @@ class TreeEnsembleClassifierCommon(OpRunClassifierProb, _ClassifierCommon):
             elif version == 3:
                 self.rt_ = RuntimeTreeEnsembleClassifierPFloat(
                     60, 20, True, True)
+            elif version == 4:
+                self.rt_ = RuntimeTreeEnsembleClassifierPFloat(
+                    60, 20, 2, True)
+            elif version == 5:
+                self.rt_ = RuntimeTreeEnsembleClassifierPFloat(
+                    60, 20, 2, True)
+                self.rt_.quickscorer_ = True
+            elif version == 6:
+                self.rt_ = RuntimeTreeEnsembleClassifierPFloat(
+                    60, 20, 2, True)
+                self.rt_.quantized_ = True
+            elif version == 7:
+                self.rt_ = RuntimeTreeEnsembleClassifierPFloat(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.tile_cache_size_ = 2 ** 20
+            elif version == 8:
+                # the cascade only applies to rt_.compute_label,
+                # the outputs of the operator are unchanged
+                self.rt_ = RuntimeTreeEnsembleClassifierPFloat(
+                    60, 20, 2, True)
+                self.rt_.cascade_ = True
+            elif version == 9:
+                self.rt_ = RuntimeTreeEnsembleClassifierPFloat(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.lookup_ = True
             else:
                 raise ValueError("Unknown version '{}'.".format(version))
         elif dtype == numpy.float64:
@@ -86,6 +113,33 @@ class TreeEnsembleClassifierCommon(OpRunClassifierProb, _ClassifierCommon):
             elif version == 3:
                 self.rt_ = RuntimeTreeEnsembleClassifierPDouble(
                     60, 20, True, True)
+            elif version == 4:
+                self.rt_ = RuntimeTreeEnsembleClassifierPDouble(
+                    60, 20, 2, True)
+            elif version == 5:
+                self.rt_ = RuntimeTreeEnsembleClassifierPDouble(
+                    60, 20, 2, True)
+                self.rt_.quickscorer_ = True
+            elif version == 6:
+                self.rt_ = RuntimeTreeEnsembleClassifierPDouble(
+                    60, 20, 2, True)
+                self.rt_.quantized_ = True
+            elif version == 7:
+                self.rt_ = RuntimeTreeEnsembleClassifierPDouble(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.tile_cache_size_ = 2 ** 20
+            elif version == 8:
+                # the cascade only applies to rt_.compute_label,
+                # the outputs of the operator are unchanged
+                self.rt_ = RuntimeTreeEnsembleClassifierPDouble(
+                    60, 20, 2, True)
+                self.rt_.cascade_ = True
+            elif version == 9:
+                self.rt_ = RuntimeTreeEnsembleClassifierPDouble(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.lookup_ = True
             else:
                 raise ValueError(  # pragma: no cover
                     "Unknown version '{}'.".format(version))
@@ -104,7 +158,12 @@ class TreeEnsembleClassifierCommon(OpRunClassifierProb, _ClassifierCommon):
         See class :class:`RuntimeTreeEnsembleClassifier
         <mlprodict.onnxrt.ops_cpu.op_tree_ensemble_classifier_.RuntimeTreeEnsembleClassifier>`.
         """
-        label, scores = self.rt_.compute(x)
+        if hasattr(x, 'tocsr') and hasattr(self.rt_, 'compute_csr'):
+            x = x.tocsr()
+            label, scores = self.rt_.compute_csr(
+                x.data, x.indices, x.indptr, x.shape[1])
+        else:
+            label, scores = self.rt_.compute(x)
         if scores.shape[0] != label.shape[0]:
             scores = scores.reshape(label.shape[0],
                                     scores.shape[0] // label.shape[0])
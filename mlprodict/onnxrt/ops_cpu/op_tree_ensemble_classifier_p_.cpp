@@ -15,7 +15,7 @@ class RuntimeTreeEnsembleClassifierP : public RuntimeTreeEnsembleCommonP<NTYPE>
 
     public:
         
-        RuntimeTreeEnsembleClassifierP(int omp_tree, int omp_N, bool array_structure, bool para_tree);
+        RuntimeTreeEnsembleClassifierP(int omp_tree, int omp_N, int array_structure, bool para_tree);
         ~RuntimeTreeEnsembleClassifierP();
 
         void init(
@@ -38,15 +38,41 @@ class RuntimeTreeEnsembleClassifierP : public RuntimeTreeEnsembleCommonP<NTYPE>
             const std::string& post_transform // 16
             );
 
+        void append_trees(
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> class_ids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> class_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> class_treeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> class_weights,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_falsenodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_featureids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_hitrates,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_treeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_truenodeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_values);
+
         py::tuple compute_cl(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X);
+        py::tuple compute_label(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X);
         py::array_t<NTYPE> compute_tree_outputs(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X);
+        py::tuple compute_cl_csr(
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+            int64_t n_features);
+
+        void save_binary(const std::string& filename) const;
+        void load_binary(const std::string& filename);
 };
 
 
 template<typename NTYPE>
 RuntimeTreeEnsembleClassifierP<NTYPE>::RuntimeTreeEnsembleClassifierP(
-        int omp_tree, int omp_N, bool array_structure, bool para_tree) :
+        int omp_tree, int omp_N, int array_structure, bool para_tree) :
    RuntimeTreeEnsembleCommonP<NTYPE>(omp_tree, omp_N, array_structure, para_tree) {
+    binary_case_ = false;
+    weights_are_all_positive_ = true;
 }
 
 
@@ -75,6 +101,8 @@ void RuntimeTreeEnsembleClassifierP<NTYPE>::init(
             py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_values, // 15
             const std::string& post_transform // 16
             ) {
+    // The common members and the classifier ones change at once.
+    std::lock_guard<TreeEnsembleLock> lock(this->lock_);
     RuntimeTreeEnsembleCommonP<NTYPE>::init(
             "SUM", base_values, classlabels_int64s.size(),
             nodes_falsenodeids, nodes_featureids, nodes_hitrates,
@@ -98,20 +126,111 @@ void RuntimeTreeEnsembleClassifierP<NTYPE>::init(
 }
 
 
+template<typename NTYPE>
+void RuntimeTreeEnsembleClassifierP<NTYPE>::append_trees(
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> class_ids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> class_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> class_treeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> class_weights,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_falsenodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_featureids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_hitrates,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_treeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_truenodeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_values) {
+    std::vector<int64_t> cids;
+    array2vector(cids, class_ids, int64_t);
+    std::vector<NTYPE> cweights;
+    array2vector(cweights, class_weights, NTYPE);
+    bool positive = true;
+    for (auto it = cweights.begin(); it != cweights.end(); ++it) {
+        if (*it < 0)
+            positive = false;
+    }
+    // The new trees are built without the lock, the checks and
+    // the update happen under the lock before the merge.
+    auto before_merge = [this, &cids, positive]() {
+        // binary_case_ changes the meaning of the scores,
+        // the new trees cannot modify it.
+        std::set<int64_t> weights_classes = this->weights_classes();
+        weights_classes.insert(cids.begin(), cids.end());
+        if (binary_case_ != (classlabels_int64s_.size() == 2 && weights_classes.size() == 1))
+            throw std::invalid_argument(
+                "append_trees cannot change the classes the weights refer to in the binary case.");
+        weights_are_all_positive_ = weights_are_all_positive_ && positive;
+    };
+    this->append_trees_checked(
+            nodes_falsenodeids, nodes_featureids, nodes_hitrates,
+            nodes_missing_value_tracks_true, nodes_modes,
+            nodes_nodeids, nodes_treeids, nodes_truenodeids,
+            nodes_values, class_ids, class_nodeids, class_treeids, class_weights,
+            before_merge);
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleClassifierP<NTYPE>::save_binary(const std::string& filename) const {
+    // extra: binary_case_, weights_are_all_positive_, classlabels_int64s_
+    std::vector<int64_t> extra(2 + classlabels_int64s_.size());
+    extra[0] = binary_case_ ? 1 : 0;
+    extra[1] = weights_are_all_positive_ ? 1 : 0;
+    std::copy(classlabels_int64s_.begin(), classlabels_int64s_.end(), extra.begin() + 2);
+    this->write_binary(filename, extra);
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleClassifierP<NTYPE>::load_binary(const std::string& filename) {
+    std::lock_guard<TreeEnsembleLock> lock(this->lock_);
+    // binary_case_, weights_are_all_positive_, one label per class.
+    std::vector<int64_t> extra = this->read_binary(filename, "classifier", 2, 1);
+    binary_case_ = extra[0] != 0;
+    weights_are_all_positive_ = extra[1] != 0;
+    classlabels_int64s_ = std::vector<int64_t>(extra.begin() + 2, extra.end());
+}
+
+
 template<typename NTYPE>
 py::tuple RuntimeTreeEnsembleClassifierP<NTYPE>::compute_cl(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X) {
     return this->compute_cl_agg(X, _AggregatorClassifier<NTYPE>(
-                                this->roots_.size(), this->n_targets_or_classes_,
+                                this->n_trees_, this->n_targets_or_classes_,
                                 this->post_transform_, &(this->base_values_),
                                 &classlabels_int64s_, binary_case_,
                                 weights_are_all_positive_));
 }
 
 
+template<typename NTYPE>
+py::tuple RuntimeTreeEnsembleClassifierP<NTYPE>::compute_label(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X) {
+    return this->compute_label_agg(X, _AggregatorClassifier<NTYPE>(
+                                   this->n_trees_, this->n_targets_or_classes_,
+                                   this->post_transform_, &(this->base_values_),
+                                   &classlabels_int64s_, binary_case_,
+                                   weights_are_all_positive_));
+}
+
+
+template<typename NTYPE>
+py::tuple RuntimeTreeEnsembleClassifierP<NTYPE>::compute_cl_csr(
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+        int64_t n_features) {
+    return this->compute_cl_csr_agg(data, indices, indptr, n_features, _AggregatorClassifier<NTYPE>(
+                                    this->n_trees_, this->n_targets_or_classes_,
+                                    this->post_transform_, &(this->base_values_),
+                                    &classlabels_int64s_, binary_case_,
+                                    weights_are_all_positive_));
+}
+
+
 template<typename NTYPE>
 py::array_t<NTYPE> RuntimeTreeEnsembleClassifierP<NTYPE>::compute_tree_outputs(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X) {
     return this->compute_tree_outputs_agg(X, _AggregatorClassifier<NTYPE>(
-                                          this->roots_.size(), this->n_targets_or_classes_,
+                                          this->n_trees_, this->n_targets_or_classes_,
                                           this->post_transform_, &(this->base_values_),
                                           &classlabels_int64s_, binary_case_,
                                           weights_are_all_positive_));
@@ -120,14 +239,14 @@ py::array_t<NTYPE> RuntimeTreeEnsembleClassifierP<NTYPE>::compute_tree_outputs(p
 
 class RuntimeTreeEnsembleClassifierPFloat : public RuntimeTreeEnsembleClassifierP<float> {
     public:
-        RuntimeTreeEnsembleClassifierPFloat(int omp_tree, int omp_N, bool array_structure, bool para_tree) :
+        RuntimeTreeEnsembleClassifierPFloat(int omp_tree, int omp_N, int array_structure, bool para_tree) :
             RuntimeTreeEnsembleClassifierP<float>(omp_tree, omp_N, array_structure, para_tree) {}
 };
 
 
 class RuntimeTreeEnsembleClassifierPDouble : public RuntimeTreeEnsembleClassifierP<double> {
     public:
-        RuntimeTreeEnsembleClassifierPDouble(int omp_tree, int omp_N, bool array_structure, bool para_tree) :
+        RuntimeTreeEnsembleClassifierPDouble(int omp_tree, int omp_N, int array_structure, bool para_tree) :
             RuntimeTreeEnsembleClassifierP<double>(omp_tree, omp_N, array_structure, para_tree) {}
 };
 
@@ -155,21 +274,90 @@ in :epkg:`onnxruntime`. Supports float only.
     to parallelize tree computation when the number of observations it 1
 :param omp_N: number of observations above which the runtime uses
     :epkg:`openmp` to parallelize the predictions
-:param array_structure: (bool) different implementation for better performance
+:param array_structure: (int) node layout, 0 for an array of structures,
+    1 for a structure of arrays, 2 for compact nodes with leaves weights
+    stored in a separate table
 :param para_tree: (bool) parallelize the computation per tree instead of observations
 )pbdoc");
 
-    clf.def(py::init<int, int, bool, bool>());
+    clf.def(py::init<int, int, int, bool>());
     clf.def_readwrite("omp_tree_", &RuntimeTreeEnsembleClassifierPFloat::omp_tree_,
         "Number of trees above which the computation is parallelized for one observation.");
     clf.def_readwrite("omp_N_", &RuntimeTreeEnsembleClassifierPFloat::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    clf.def_readonly("array_structure_", &RuntimeTreeEnsembleClassifierPFloat::array_structure_,
+        "Node layout (0: pointers, 1: structure of arrays, 2: compact nodes).");
+    clf.def_readwrite("complete_tree_ratio_", &RuntimeTreeEnsembleClassifierPFloat::complete_tree_ratio_,
+        "With array_structure=1, a tree is stored as a complete tree in level order "
+        "if its padded size is below this ratio times its size (0 disables it), "
+        "it must be set before *init*.");
+    clf.def_property("quickscorer_", &RuntimeTreeEnsembleClassifierPFloat::get_quickscorer, &RuntimeTreeEnsembleClassifierPFloat::set_quickscorer,
+        "Uses QuickScorer to evaluate the trees, *init* sets it to False if the model "
+        "is not supported. Set after *init*, it builds or releases the QuickScorer nodes.");
+    clf.def_property("avx2_", &RuntimeTreeEnsembleClassifierPFloat::get_avx2, &RuntimeTreeEnsembleClassifierPFloat::set_avx2,
+        "Uses the AVX2 kernel (float, array_structure=2, BRANCH_LEQ only), *init* "
+        "sets it to False if the model or the CPU is not supported. Set after *init*, "
+        "the model is checked again.");
+    clf.def_readwrite("quantized_", &RuntimeTreeEnsembleClassifierPFloat::quantized_,
+        "Bins every feature once per observation and compares bin indices instead of "
+        "thresholds (array_structure=2), it must be set before *init*, *init* sets it to "
+        "False if the model is not supported.");
+    clf.def_readwrite("csr_buffer_size_", &RuntimeTreeEnsembleClassifierPFloat::csr_buffer_size_,
+        "Size in bytes of the dense buffer the rows of a sparse input are copied into "
+        "by *compute_csr*, it only keeps the features the trees use.");
+    clf.def_readwrite("tile_cache_size_", &RuntimeTreeEnsembleClassifierPFloat::tile_cache_size_,
+        "Cache size in bytes (array_structure > 0), if not null, the trees are split into "
+        "chunks and the observations into blocks fitting in that cache, every thread "
+        "computes (chunk, block) tiles.");
+    clf.def_readwrite("cascade_", &RuntimeTreeEnsembleClassifierPFloat::cascade_,
+        "Evaluates the trees by stages and stops for every observation whose label "
+        "cannot be changed by the remaining trees (binary classifiers, array_structure=2), "
+        "only *compute_label* uses it, it must be set before *init*, *init* sets it "
+        "to False if the model is not supported.");
+    clf.def_readwrite("cascade_stages_", &RuntimeTreeEnsembleClassifierPFloat::cascade_stages_,
+        "Number of stages of the cascade evaluation, it must be set before *init*.");
+    clf.def_property("lookup_", &RuntimeTreeEnsembleClassifierPFloat::get_lookup, &RuntimeTreeEnsembleClassifierPFloat::set_lookup,
+        "Replaces the first levels of every tree comparing only low-cardinality features "
+        "(integer or half-integer thresholds) by a lookup table indexed by the combined "
+        "feature codes (array_structure=2), rows outside the codes follow the usual path, "
+        "*init* sets it to False if no tree can use it, set after *init*, the tables are built again.");
+    clf.def_property("lookup_max_cardinality_", &RuntimeTreeEnsembleClassifierPFloat::get_lookup_max_cardinality, &RuntimeTreeEnsembleClassifierPFloat::set_lookup_max_cardinality,
+        "Maximum number of codes of a low-cardinality feature (lookup), "
+        "set after *init*, the tables are built again.");
+    clf.def_property("lookup_max_size_", &RuntimeTreeEnsembleClassifierPFloat::get_lookup_max_size, &RuntimeTreeEnsembleClassifierPFloat::set_lookup_max_size,
+        "Maximum number of entries of a lookup table (lookup), "
+        "set after *init*, the tables are built again.");
+    clf.def_property("schedule_", &RuntimeTreeEnsembleClassifierPFloat::get_schedule, &RuntimeTreeEnsembleClassifierPFloat::set_schedule,
+        "Parallelization settings depending on the batch size, one row per bucket "
+        "*(max_N, omp_tree, omp_N, para_tree, tile_cache_size)*, a bucket applies "
+        "to batches up to *max_N* observations, the last one to bigger batches, "
+        "an empty list keeps the settings given to the constructor.");
+    clf.def("calibrate", &RuntimeTreeEnsembleClassifierPFloat::calibrate,
+        "Times every parallelization strategy on synthetic observations built from the "
+        "model thresholds for every batch size in *batch_sizes* (sorted, *repeat* runs), "
+        "stores the fastest settings in *schedule_* and returns them.");
     clf.def_readonly("roots_", &RuntimeTreeEnsembleClassifierPFloat::roots_,
                      "Returns the roots indices.");
     clf.def("init", &RuntimeTreeEnsembleClassifierPFloat::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
+    clf.def("append_trees", &RuntimeTreeEnsembleClassifierPFloat::append_trees,
+            "Appends trees to the model without initializing it again, it takes the ONNX "
+            "attributes describing the new trees in alphabetical order, the update waits "
+            "for the running computations, the next ones wait for the update.");
     clf.def("compute", &RuntimeTreeEnsembleClassifierPFloat::compute_cl,
             "Computes the predictions for the random forest.");
+    clf.def("compute_label", &RuntimeTreeEnsembleClassifierPFloat::compute_label,
+            "Computes only the labels, with the cascade evaluation if *cascade_* is enabled, "
+            "returns the labels, the number of evaluated (observation, tree) pairs and "
+            "the number of observations retired after every stage.");
+    clf.def("compute_csr", &RuntimeTreeEnsembleClassifierPFloat::compute_cl_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
+    clf.def("save_binary", &RuntimeTreeEnsembleClassifierPFloat::save_binary,
+            "Saves the compact nodes (array_structure=2) into a binary file.");
+    clf.def("load_binary", &RuntimeTreeEnsembleClassifierPFloat::load_binary,
+            "Maps a file created by *save_binary* in memory and uses it instead of *init*, "
+            "processes loading the same file share the same memory pages.");
     clf.def("runtime_options", &RuntimeTreeEnsembleClassifierPFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeTreeEnsembleClassifierPFloat::omp_get_max_threads,
@@ -189,6 +377,8 @@ in :epkg:`onnxruntime`. Supports float only.
         "Tells if the model handles missing values.");
     clf.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleClassifierPFloat::get_nodes_modes,
         "Returns the mode for every node.");
+    clf.def_property_readonly("dense_weights_", &RuntimeTreeEnsembleClassifierPFloat::has_dense_weights,
+        "Tells if every leaf stores one dense row of weights (array_structure=2).");
     clf.def("__sizeof__", &RuntimeTreeEnsembleClassifierPFloat::get_sizeof,
         "Returns the size of the object.");
 
@@ -202,21 +392,90 @@ in :epkg:`onnxruntime`. Supports double only.
     to parallelize tree computation when the number of observations it 1
 :param omp_N: number of observations above which the runtime uses
     :epkg:`openmp` to parallelize the predictions
-:param array_structure: (bool) different implementation for better performance
+:param array_structure: (int) node layout, 0 for an array of structures,
+    1 for a structure of arrays, 2 for compact nodes with leaves weights
+    stored in a separate table
 :param para_tree: (bool) parallelize the computation per tree instead of observations
 )pbdoc");
 
-    cld.def(py::init<int, int, bool, bool>());
+    cld.def(py::init<int, int, int, bool>());
     cld.def_readwrite("omp_tree_", &RuntimeTreeEnsembleClassifierPDouble::omp_tree_,
         "Number of trees above which the computation is parallelized for one observation.");
     cld.def_readwrite("omp_N_", &RuntimeTreeEnsembleClassifierPDouble::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    cld.def_readonly("array_structure_", &RuntimeTreeEnsembleClassifierPDouble::array_structure_,
+        "Node layout (0: pointers, 1: structure of arrays, 2: compact nodes).");
+    cld.def_readwrite("complete_tree_ratio_", &RuntimeTreeEnsembleClassifierPDouble::complete_tree_ratio_,
+        "With array_structure=1, a tree is stored as a complete tree in level order "
+        "if its padded size is below this ratio times its size (0 disables it), "
+        "it must be set before *init*.");
+    cld.def_property("quickscorer_", &RuntimeTreeEnsembleClassifierPDouble::get_quickscorer, &RuntimeTreeEnsembleClassifierPDouble::set_quickscorer,
+        "Uses QuickScorer to evaluate the trees, *init* sets it to False if the model "
+        "is not supported. Set after *init*, it builds or releases the QuickScorer nodes.");
+    cld.def_property("avx2_", &RuntimeTreeEnsembleClassifierPDouble::get_avx2, &RuntimeTreeEnsembleClassifierPDouble::set_avx2,
+        "Uses the AVX2 kernel (float, array_structure=2, BRANCH_LEQ only), *init* "
+        "sets it to False if the model or the CPU is not supported. Set after *init*, "
+        "the model is checked again.");
+    cld.def_readwrite("quantized_", &RuntimeTreeEnsembleClassifierPDouble::quantized_,
+        "Bins every feature once per observation and compares bin indices instead of "
+        "thresholds (array_structure=2), it must be set before *init*, *init* sets it to "
+        "False if the model is not supported.");
+    cld.def_readwrite("csr_buffer_size_", &RuntimeTreeEnsembleClassifierPDouble::csr_buffer_size_,
+        "Size in bytes of the dense buffer the rows of a sparse input are copied into "
+        "by *compute_csr*, it only keeps the features the trees use.");
+    cld.def_readwrite("tile_cache_size_", &RuntimeTreeEnsembleClassifierPDouble::tile_cache_size_,
+        "Cache size in bytes (array_structure > 0), if not null, the trees are split into "
+        "chunks and the observations into blocks fitting in that cache, every thread "
+        "computes (chunk, block) tiles.");
+    cld.def_readwrite("cascade_", &RuntimeTreeEnsembleClassifierPDouble::cascade_,
+        "Evaluates the trees by stages and stops for every observation whose label "
+        "cannot be changed by the remaining trees (binary classifiers, array_structure=2), "
+        "only *compute_label* uses it, it must be set before *init*, *init* sets it "
+        "to False if the model is not supported.");
+    cld.def_readwrite("cascade_stages_", &RuntimeTreeEnsembleClassifierPDouble::cascade_stages_,
+        "Number of stages of the cascade evaluation, it must be set before *init*.");
+    cld.def_property("lookup_", &RuntimeTreeEnsembleClassifierPDouble::get_lookup, &RuntimeTreeEnsembleClassifierPDouble::set_lookup,
+        "Replaces the first levels of every tree comparing only low-cardinality features "
+        "(integer or half-integer thresholds) by a lookup table indexed by the combined "
+        "feature codes (array_structure=2), rows outside the codes follow the usual path, "
+        "*init* sets it to False if no tree can use it, set after *init*, the tables are built again.");
+    cld.def_property("lookup_max_cardinality_", &RuntimeTreeEnsembleClassifierPDouble::get_lookup_max_cardinality, &RuntimeTreeEnsembleClassifierPDouble::set_lookup_max_cardinality,
+        "Maximum number of codes of a low-cardinality feature (lookup), "
+        "set after *init*, the tables are built again.");
+    cld.def_property("lookup_max_size_", &RuntimeTreeEnsembleClassifierPDouble::get_lookup_max_size, &RuntimeTreeEnsembleClassifierPDouble::set_lookup_max_size,
+        "Maximum number of entries of a lookup table (lookup), "
+        "set after *init*, the tables are built again.");
+    cld.def_property("schedule_", &RuntimeTreeEnsembleClassifierPDouble::get_schedule, &RuntimeTreeEnsembleClassifierPDouble::set_schedule,
+        "Parallelization settings depending on the batch size, one row per bucket "
+        "*(max_N, omp_tree, omp_N, para_tree, tile_cache_size)*, a bucket applies "
+        "to batches up to *max_N* observations, the last one to bigger batches, "
+        "an empty list keeps the settings given to the constructor.");
+    cld.def("calibrate", &RuntimeTreeEnsembleClassifierPDouble::calibrate,
+        "Times every parallelization strategy on synthetic observations built from the "
+        "model thresholds for every batch size in *batch_sizes* (sorted, *repeat* runs), "
+        "stores the fastest settings in *schedule_* and returns them.");
     cld.def_readonly("roots_", &RuntimeTreeEnsembleClassifierPDouble::roots_,
                      "Returns the roots indices.");
     cld.def("init", &RuntimeTreeEnsembleClassifierPDouble::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
+    cld.def("append_trees", &RuntimeTreeEnsembleClassifierPDouble::append_trees,
+            "Appends trees to the model without initializing it again, it takes the ONNX "
+            "attributes describing the new trees in alphabetical order, the update waits "
+            "for the running computations, the next ones wait for the update.");
     cld.def("compute", &RuntimeTreeEnsembleClassifierPDouble::compute_cl,
             "Computes the predictions for the random forest.");
+    cld.def("compute_label", &RuntimeTreeEnsembleClassifierPDouble::compute_label,
+            "Computes only the labels, with the cascade evaluation if *cascade_* is enabled, "
+            "returns the labels, the number of evaluated (observation, tree) pairs and "
+            "the number of observations retired after every stage.");
+    cld.def("compute_csr", &RuntimeTreeEnsembleClassifierPDouble::compute_cl_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
+    cld.def("save_binary", &RuntimeTreeEnsembleClassifierPDouble::save_binary,
+            "Saves the compact nodes (array_structure=2) into a binary file.");
+    cld.def("load_binary", &RuntimeTreeEnsembleClassifierPDouble::load_binary,
+            "Maps a file created by *save_binary* in memory and uses it instead of *init*, "
+            "processes loading the same file share the same memory pages.");
     cld.def("runtime_options", &RuntimeTreeEnsembleClassifierPDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeTreeEnsembleClassifierPDouble::omp_get_max_threads,
@@ -236,6 +495,8 @@ in :epkg:`onnxruntime`. Supports double only.
         "Tells if the model handles missing values.");
     cld.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleClassifierPDouble::get_nodes_modes,
         "Returns the mode for every node.");
+    cld.def_property_readonly("dense_weights_", &RuntimeTreeEnsembleClassifierPDouble::has_dense_weights,
+        "Tells if every leaf stores one dense row of weights (array_structure=2).");
     cld.def("__sizeof__", &RuntimeTreeEnsembleClassifierPDouble::get_sizeof,
         "Returns the size of the object.");
 }
@@ -4,6 +4,7 @@
 // https://github.com/microsoft/onnxruntime/blob/master/onnxruntime/core/providers/cpu/ml/tree_ensemble_regressor.cc.
 
 #include "op_tree_ensemble_common_p_agg_.hpp"
+#include "op_tree_ensemble_common_p_avx2_.hpp"
 
 #if USE_OPENMP
 #include <omp.h>
@@ -44,6 +45,8 @@ class RuntimeTreeEnsembleCommonP {
         TreeNodeElement<NTYPE>* nodes_;
         std::vector<TreeNodeElement<NTYPE>*> roots_;
         ArrayTreeNodeElement<NTYPE> array_nodes_;
+        CompleteTreeNodeElements<NTYPE> complete_nodes_;
+        PackedTreeNodeElements<NTYPE> packed_nodes_;
 
         int64_t max_tree_depth_;
         int64_t n_trees_;
@@ -52,12 +55,81 @@ class RuntimeTreeEnsembleCommonP {
         int omp_tree_;
         int omp_N_;
         int64_t sizeof_;
-        bool array_structure_;
+        // 0: array of structures TreeNodeElement linked with pointers,
+        // 1: structure of arrays ArrayTreeNodeElement,
+        // 2: compact nodes PackedTreeNodeElement, leaf weights stored apart.
+        int array_structure_;
         bool para_tree_;
+        // With array_structure=1, a tree is stored as a complete tree
+        // if its padded size is below complete_tree_ratio_ times its size
+        // (0 disables it), it must be set before init.
+        double complete_tree_ratio_;
+        // QuickScorer evaluation, init (or set_quickscorer after init)
+        // sets it to false if the model is not supported.
+        bool quickscorer_;
+        QuickScorerTreeNodeElements<NTYPE> qs_nodes_;
+        // AVX2 kernel for float models with array_structure=2 and
+        // only BRANCH_LEQ nodes, init (or set_avx2 after init) sets it
+        // to false if the model or the CPU is not supported.
+        bool avx2_;
+        // Bins the features of every row once and compares bin indices
+        // instead of thresholds (array_structure=2), it must be set before init,
+        // init sets it to false if the model is not supported.
+        bool quantized_;
+        QuantizedTreeNodeElements<NTYPE, uint8_t> quantized8_;
+        QuantizedTreeNodeElements<NTYPE, uint16_t> quantized16_;
+        // Memory mapped file packed_nodes_ refers to after read_binary.
+        std::shared_ptr<MemoryMappedFile> mapped_;
+        // Cache size (bytes) used to split the trees into chunks and the rows
+        // into blocks (array_structure > 0), threads compute (chunk, block)
+        // tiles, 0 disables tiling.
+        int64_t tile_cache_size_;
+        // Settings replacing omp_tree_, omp_N_, para_tree_, tile_cache_size_
+        // depending on the batch size, see calibrate.
+        std::vector<TreeEnsembleSchedule> schedule_;
+        // Cascade evaluation of binary classifiers (array_structure=2):
+        // the trees are evaluated by stages (cascade_stages_), a row stops
+        // once the remaining trees cannot change its label. Only
+        // compute_label_agg uses it, scores are not computed. It must be
+        // set before init, init sets it to false if the model is not supported.
+        bool cascade_;
+        int cascade_stages_;
+        int64_t cascade_class_;
+        std::vector<int64_t> cascade_stage_end_;
+        // bounds of the sum of the remaining trees after every stage
+        std::vector<NTYPE> cascade_lower_;
+        std::vector<NTYPE> cascade_upper_;
+        // Replaces the first levels of the trees comparing only
+        // low-cardinality features by a lookup table (array_structure=2),
+        // see TreeLookupTable. init sets it to false if no tree can use it,
+        // the setters build the tables again after init.
+        bool lookup_;
+        int lookup_max_cardinality_;
+        int64_t lookup_max_size_;
+        // index of the table of every tree in lookup_tables_ or -1
+        std::vector<int64_t> tree_lookup_;
+        std::vector<TreeLookupTable<NTYPE>> lookup_tables_;
+        // Stores thresholds and leaf values as bfloat16 (float models,
+        // array_structure=2, SUM or AVERAGE), see HalfTreeNodeElement.
+        // Comparisons are exact, leaf values are rounded and summed as
+        // floats. The packed nodes are kept (labels, tree outputs,
+        // append_trees, save_binary), the bfloat16 nodes are added to
+        // them. init (or set_bfloat16 after init) sets it to false if
+        // the model is not supported.
+        bool bfloat16_;
+        HalfTreeNodeElements<NTYPE> half_nodes_;
+        // Shared by the computations, taken exclusively by the methods
+        // modifying the model or the schedule.
+        mutable TreeEnsembleLock lock_;
+        // 1 + the highest feature index the trees use.
+        int64_t n_features_;
+        // Size (bytes) of the dense buffer the rows of a sparse
+        // input are copied into (compute_csr).
+        int64_t csr_buffer_size_;
 
     public:
 
-        RuntimeTreeEnsembleCommonP(int omp_tree, int omp_N, bool array_structure, bool para_tree);
+        RuntimeTreeEnsembleCommonP(int omp_tree, int omp_N, int array_structure, bool para_tree);
         ~RuntimeTreeEnsembleCommonP();
 
         void init(
@@ -101,9 +173,122 @@ class RuntimeTreeEnsembleCommonP {
         TreeNodeElement<NTYPE> * ProcessTreeNodeLeave(
             TreeNodeElement<NTYPE> * root, const NTYPE* x_data) const;
         size_t ProcessTreeNodeLeave(size_t root_id, const NTYPE* x_data) const;
+        inline size_t ProcessTreeNodeLeave(const ArrayTreeNodeElement<NTYPE>& array_nodes,
+                                           size_t root_id, const NTYPE* x_data) const {
+            return ProcessTreeNodeLeave(root_id, x_data);
+        }
+        size_t ProcessTreeNodeLeave(const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                    size_t root_id, const NTYPE* x_data) const;
+        size_t ProcessCompleteTreeLeave(size_t tree_id, const NTYPE* x_data) const;
+        template<typename BIN>
+        size_t ProcessTreeNodeLeave(const QuantizedTreeNodeElements<NTYPE, BIN>& quantized_nodes,
+                                    size_t root_id, const BIN* bins) const;
+        size_t ProcessTreeNodeLeave(const HalfTreeNodeElements<NTYPE>& half_nodes,
+                                    size_t root_id, const NTYPE* x_data) const;
+        inline size_t ProcessTreeLeave(const ArrayTreeNodeElement<NTYPE>& array_nodes,
+                                       size_t tree_id, const NTYPE* x_data) const {
+            return complete_nodes_.is_complete(tree_id)
+                ? ProcessCompleteTreeLeave(tree_id, x_data)
+                : ProcessTreeNodeLeave(array_nodes.root_id[tree_id], x_data);
+        }
+        inline size_t ProcessTreeLeave(const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                       size_t tree_id, const NTYPE* x_data) const {
+            size_t node;
+            if (lookup_ && tree_lookup_[tree_id] >= 0 &&
+                    lookup_tables_[tree_lookup_[tree_id]].find(x_data, node))
+                return packed_nodes.is_not_leaf(node)
+                    ? ProcessTreeNodeLeave(packed_nodes, node, x_data)
+                    : node;
+            return ProcessTreeNodeLeave(packed_nodes, packed_nodes.root_id[tree_id], x_data);
+        }
+
+        // Appends trees to the model without initializing it again,
+        // the new trees are built apart and merged once no computation
+        // runs anymore, derived kernels are then built again.
+        void append_trees(
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_falsenodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_featureids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_hitrates,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_treeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_truenodeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_values,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_ids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_treeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> target_class_weights);
+        // before_merge runs once the new trees are built, under the lock
+        // and before the current model changes, a subclass checks
+        // and updates its own members there.
+        void append_trees_checked(
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_falsenodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_featureids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_hitrates,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_treeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_truenodeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_values,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_ids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_treeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> target_class_weights,
+            const std::function<void()>& before_merge);
+        void append_trees_c(
+            const std::vector<int64_t>& nodes_falsenodeids,
+            const std::vector<int64_t>& nodes_featureids,
+            const std::vector<NTYPE>& nodes_hitrates,
+            const std::vector<int64_t>& nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            const std::vector<int64_t>& nodes_nodeids,
+            const std::vector<int64_t>& nodes_treeids,
+            const std::vector<int64_t>& nodes_truenodeids,
+            const std::vector<NTYPE>& nodes_values,
+            const std::vector<int64_t>& target_class_ids,
+            const std::vector<int64_t>& target_class_nodeids,
+            const std::vector<int64_t>& target_class_treeids,
+            const std::vector<NTYPE>& target_class_weights,
+            const std::function<void()>& before_merge = std::function<void()>());
+        // Classes (or targets) the leaf weights refer to.
+        std::set<int64_t> weights_classes() const;
+
+        // Saves the compact nodes (array_structure=2) into a binary file,
+        // extra holds values specific to a subclass.
+        void write_binary(const std::string& filename, const std::vector<int64_t>& extra) const;
+        // Maps a file created by write_binary, it replaces init,
+        // the nodes are not copied. Returns the extra values, the file
+        // is rejected before any change unless it holds
+        // n_extra + n_extra_per_target * n_targets_or_classes of them.
+        std::vector<int64_t> read_binary(const std::string& filename, const char* kind,
+                                         int64_t n_extra, int64_t n_extra_per_target);
+
+        // Times every parallelization strategy on synthetic observations
+        // for every batch size and keeps the fastest one in schedule_.
+        std::vector<std::vector<int64_t>> calibrate(const std::vector<int64_t>& batch_sizes, int repeat);
+        std::vector<std::vector<int64_t>> get_schedule() const;
+        void set_schedule(const std::vector<std::vector<int64_t>>& schedule);
+
+        // Kernels switched on or off after init, n_trees_ == 0
+        // means init was not called yet and the value is only stored.
+        bool get_quickscorer() const;
+        void set_quickscorer(bool value);
+        bool get_avx2() const;
+        void set_avx2(bool value);
+        bool get_lookup() const;
+        void set_lookup(bool value);
+        int get_lookup_max_cardinality() const;
+        void set_lookup_max_cardinality(int value);
+        int64_t get_lookup_max_size() const;
+        void set_lookup_max_size(int64_t value);
+        bool get_bfloat16() const;
+        void set_bfloat16(bool value);
 
         std::string runtime_options();
         std::vector<std::string> get_nodes_modes() const;
+        bool has_dense_weights() const;
 
         int omp_get_max_threads();
         int64_t get_sizeof();
@@ -122,35 +307,179 @@ class RuntimeTreeEnsembleCommonP {
         template<typename AGG>
         py::tuple compute_cl_agg(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X, const AGG &agg);
 
+        // Same methods for a sparse matrix in CSR format (data, indices, indptr)
+        // with n_features columns, missing values are null.
+        template<typename AGG>
+        py::array_t<NTYPE> compute_csr_agg(
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+            int64_t n_features, const AGG &agg);
+
+        template<typename AGG>
+        py::tuple compute_cl_csr_agg(
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+            int64_t n_features, const AGG &agg);
+
+        // Computes only the labels, with the cascade evaluation if enabled.
+        // Returns the labels, the number of evaluated (observation, tree)
+        // pairs and the number of observations retired after every stage.
+        template<typename AGG>
+        py::tuple compute_label_agg(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X, const AGG &agg);
+
     private:
 
+        template<typename AGG>
+        void compute_gil_free_dispatch(const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+                                       const NTYPE* x_data,
+                                       py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                       py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                                       const AGG &agg, const TreeEnsembleSchedule& schedule);
+
+        int64_t csr_block_rows(int64_t N) const;
+
+        template<typename AGG>
+        void compute_gil_free_csr(int64_t N, int64_t n_features, int64_t n_rows,
+                                  const NTYPE* data, const int64_t* indices, const int64_t* indptr,
+                                  py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                  py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                                  py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Zb,
+                                  py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Yb,
+                                  const AGG &agg, const TreeEnsembleSchedule& schedule);
+
         template<typename AGG>
         void compute_gil_free(const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
-                              const py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& X,
+                              const NTYPE* x_data,
                               py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
                               py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
-                              const AGG &agg);
+                              const AGG &agg, const TreeEnsembleSchedule& schedule);
+
+        template<typename AGG>
+        void compute_gil_free_quickscorer(const std::vector<int64_t>& x_dims,
+                                          int64_t N, int64_t stride,
+                                          const NTYPE* x_data,
+                                          py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                          py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                                          const AGG &agg, const TreeEnsembleSchedule& schedule);
 
         template<typename AGG>
+        void compute_gil_free_avx2(const std::vector<int64_t>& x_dims,
+                                   int64_t N, int64_t stride,
+                                   const NTYPE* x_data,
+                                   py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                   py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                                   const AGG &agg, const TreeEnsembleSchedule& schedule);
+
+        template<typename AGG, typename BIN>
+        void compute_gil_free_quantized(const std::vector<int64_t>& x_dims,
+                                        int64_t N, int64_t stride,
+                                        const NTYPE* x_data,
+                                        py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                        py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                                        const QuantizedTreeNodeElements<NTYPE, BIN>& quantized_nodes,
+                                        const AGG &agg, const TreeEnsembleSchedule& schedule);
+
+        template<typename AGG, typename NODES>
         void compute_gil_free_array_structure(const std::vector<int64_t>& x_dims,
                                               int64_t N, int64_t stride,
-                                              const py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& X,
+                                              const NTYPE* x_data,
                                               py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
                                               py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
-                                              const AGG &agg);
+                                              const NODES& nodes, const AGG &agg,
+                                              const TreeEnsembleSchedule& schedule);
+
+        template<typename AGG, typename NODES>
+        void compute_gil_free_tiled(const std::vector<int64_t>& x_dims,
+                                    int64_t N, int64_t stride,
+                                    const NTYPE* x_data,
+                                    py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                    py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                                    const NODES& nodes, const AGG &agg,
+                                    const TreeEnsembleSchedule& schedule);
+
+        template<typename AGG>
+        void compute_gil_free_bfloat16(const std::vector<int64_t>& x_dims,
+                                       int64_t N, int64_t stride,
+                                       const NTYPE* x_data,
+                                       py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                                       const AGG &agg, const TreeEnsembleSchedule& schedule);
+
+        template<typename AGG>
+        void compute_gil_free_cascade(const std::vector<int64_t>& x_dims,
+                                      int64_t N, int64_t stride,
+                                      const NTYPE* x_data,
+                                      py::array_t<int64_t, py::array::c_style | py::array::forcecast>& Y,
+                                      const AGG &agg, const TreeEnsembleSchedule& schedule,
+                                      int64_t& evaluated, std::vector<int64_t>& retired);
+        void compute_tile_sizes(const TreeEnsembleSchedule& schedule, int64_t N, int64_t stride,
+                                int64_t& chunk_size, int64_t& block_size);
+        // Settings used to compute a batch of N observations,
+        // schedule_ if calibrated, the members otherwise.
+        TreeEnsembleSchedule select_schedule(int64_t N) const;
+        void calibration_features(int64_t N, std::vector<NTYPE>& X, int64_t& n_features) const;
 
         void switch_to_array_structure();
+        void switch_to_packed_structure();
+        void switch_to_complete_trees();
+        bool complete_tree_size(size_t node_id, uint32_t level, uint32_t& depth, size_t& n_nodes) const;
+        void fill_complete_tree(size_t node_id, size_t pos, uint32_t level, uint32_t depth,
+                                size_t node_offset, size_t leaf_offset);
+        bool init_quickscorer();
+        void init_kernels();
+        int64_t get_sizeof_kernels();
+        int64_t get_n_features() const;
+        bool first_branch_mode(NODE_MODE& mode) const;
+        bool init_avx2() const;
+        bool init_dense_weights();
+        bool init_cascade();
+        bool init_lookup();
+        void rebuild_lookup(bool value);
+        bool init_bfloat16();
+        template<typename AGG>
+        bool cascade_is_decided(const AGG &agg, const NTYPE* scores,
+                                const unsigned char* has_scores, size_t stage) const;
+        template<typename BIN>
+        bool init_quantized(QuantizedTreeNodeElements<NTYPE, BIN>& quantized_nodes) const;
+        bool quickscorer_visit(TreeNodeElement<NTYPE> * node, uint32_t tree_id,
+                               std::vector<unsigned char>& visited,
+                               std::vector<TreeNodeElement<NTYPE>*>& leaves);
 };
 
 
 template<typename NTYPE>
 RuntimeTreeEnsembleCommonP<NTYPE>::RuntimeTreeEnsembleCommonP(
-        int omp_tree, int omp_N, bool array_structure, bool para_tree) {
+        int omp_tree, int omp_N, int array_structure, bool para_tree) {
     omp_tree_ = omp_tree;
     omp_N_ = omp_N;
     nodes_ = nullptr;
+    // init replaces these values, compute fails until then.
+    n_trees_ = 0;
+    n_nodes_ = 0;
+    n_targets_or_classes_ = 0;
+    max_tree_depth_ = 1000;
+    aggregate_function_ = AGGREGATE_FUNCTION::SUM;
+    post_transform_ = POST_EVAL_TRANSFORM::NONE;
+    same_mode_ = false;
+    has_missing_tracks_ = false;
+    sizeof_ = sizeof(RuntimeTreeEnsembleCommonP<NTYPE>);
     para_tree_ = para_tree;
     array_structure_ = array_structure;
+    complete_tree_ratio_ = 1.5;
+    quickscorer_ = false;
+    avx2_ = true;
+    quantized_ = false;
+    tile_cache_size_ = 0;
+    cascade_ = false;
+    cascade_stages_ = 5;
+    cascade_class_ = -1;
+    lookup_ = false;
+    lookup_max_cardinality_ = 16;
+    lookup_max_size_ = 256;
+    bfloat16_ = false;
+    n_features_ = 0;
+    csr_buffer_size_ = 1 << 22;
 }
 
 
@@ -276,6 +605,15 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
     if (nodes_values.size() == 0)
         throw std::runtime_error("nodes_values cannot be empty.");
 
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+
+    // Releases a file mapped by read_binary.
+    packed_nodes_.nodes.clear();
+    packed_nodes_.weights.clear();
+    packed_nodes_.root_id.clear();
+    packed_nodes_.dense_weights.clear();
+    mapped_.reset();
+
     sizeof_ = sizeof(RuntimeTreeEnsembleCommonP<NTYPE>);
     aggregate_function_ = to_AGGREGATE_FUNCTION(aggregate_function);
     post_transform_ = to_POST_EVAL_TRANSFORM(post_transform);
@@ -305,7 +643,14 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
     n_nodes_ = nodes_treeids.size();
     nodes_ = new TreeNodeElement<NTYPE>[(int)n_nodes_];
     roots_.clear();
-    std::map<TreeNodeElementId, TreeNodeElement<NTYPE>*> idi;
+    TreeNodeElementIndex idi;
+    int64_t duplicate = idi.init(nodes_treeids, nodes_nodeids);
+    if (duplicate != -1) {
+        char buffer[1000];
+        sprintf(buffer, "Node %d in tree %d is already there.",
+                (int)nodes_nodeids[duplicate], (int)nodes_treeids[duplicate]);
+        throw std::invalid_argument(buffer);
+    }
     size_t i;
 
     for (i = 0; i < nodes_treeids.size(); ++i) {
@@ -324,18 +669,12 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
                                             ? MissingTrack::TRUE : MissingTrack::FALSE)
                                     : MissingTrack::NONE;
         node->is_missing_track_true = node->missing_tracks == MissingTrack::TRUE;
-        if (idi.find(node->id) != idi.end()) {
-            char buffer[1000];
-            sprintf(buffer, "Node %d in tree %d is already there.",
-                    (int)node->id.node_id, (int)node->id.tree_id);
-            throw std::invalid_argument(buffer);
-        }
-        idi.insert(std::pair<TreeNodeElementId, TreeNodeElement<NTYPE>*>(node->id, node));
         sizeof_ += node->get_sizeof();
     }
 
     TreeNodeElementId coor;
     TreeNodeElement<NTYPE> * it;
+    int64_t found;
     for(i = 0; i < (size_t)n_nodes_; ++i) {
         it = nodes_ + i;
         if (it->mode == NODE_MODE::LEAF) // !it->is_not_leaf)
@@ -343,15 +682,15 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
         coor.tree_id = it->id.tree_id;
         coor.node_id = (int)nodes_truenodeids[i];
 
-        auto found = idi.find(coor);
-        if (found == idi.end()) {
+        found = idi.find(coor);
+        if (found == -1) {
             char buffer[1000];
             sprintf(buffer, "Unable to find node %d-%d (truenode).",
                     (int)coor.tree_id, (int)coor.node_id);
             throw std::invalid_argument(buffer);
         }
         if (coor.node_id >= 0 && coor.node_id < n_nodes_) {
-            it->truenode = found->second;
+            it->truenode = nodes_ + found;
             if ((it->truenode->id.tree_id != it->id.tree_id) ||
                 (it->truenode->id.node_id == it->id.node_id)) {
                 char buffer[1000];
@@ -367,14 +706,14 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
 
         coor.node_id = (int)nodes_falsenodeids[i];
         found = idi.find(coor);
-        if (found == idi.end()) {
+        if (found == -1) {
             char buffer[1000];
             sprintf(buffer, "Unable to find node %d-%d (falsenode).",
                     (int)coor.tree_id, (int)coor.node_id);
             throw std::invalid_argument(buffer);
         }
         if (coor.node_id >= 0 && coor.node_id < n_nodes_) {
-            it->falsenode = found->second;
+            it->falsenode = nodes_ + found;
             if ((it->falsenode->id.tree_id != it->id.tree_id) ||
                 (it->falsenode->id.node_id == it->id.node_id )) {
                 throw std::invalid_argument("One falsenode is pointing either to itself, either to another tree.");
@@ -395,21 +734,34 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
         previous = nodes_[i].id.tree_id;
     }
 
+    // Weights are counted first to allocate every weights_vect once.
     TreeNodeElementId ind;
     SparseValue<NTYPE> w;
+    std::vector<int64_t> weights_pos(target_class_nodeids.size());
+    std::vector<size_t> weights_count(n_nodes_, 0);
     for (i = 0; i < target_class_nodeids.size(); i++) {
         ind.tree_id = (int)target_class_treeids[i];
         ind.node_id = (int)target_class_nodeids[i];
-        if (idi.find(ind) == idi.end()) {
+        found = idi.find(ind);
+        if (found == -1) {
             char buffer[1000];
-            sprintf(buffer, "Unable to find node %d-%d (weights).", (int)coor.tree_id, (int)coor.node_id);
+            sprintf(buffer, "Unable to find node %d-%d (weights).", (int)ind.tree_id, (int)ind.node_id);
             throw std::invalid_argument(buffer);
         }
+        weights_pos[i] = found;
+        ++weights_count[found];
+    }
+    for(i = 0; i < (size_t)n_nodes_; ++i) {
+        if (weights_count[i] > 0)
+            nodes_[i].weights_vect.reserve(weights_count[i]);
+    }
+    for (i = 0; i < target_class_nodeids.size(); i++) {
+        TreeNodeElement<NTYPE>& node = nodes_[weights_pos[i]];
         w.i = target_class_ids[i];
         w.value = target_class_weights[i];
-        if (idi[ind]->weights_vect.size() == 0)
-            idi[ind]->weights0 = w;
-        idi[ind]->weights_vect.push_back(w);
+        if (node.weights_vect.size() == 0)
+            node.weights0 = w;
+        node.weights_vect.push_back(w);
     }
 
     n_trees_ = roots_.size();
@@ -423,10 +775,900 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::init_c(
     }
     sizeof_ += sizeof(TreeNodeElement<NTYPE>) * roots_.size();
 
-    if (array_structure_)
-        switch_to_array_structure();
-    else if (para_tree_)
-        throw std::invalid_argument("array_structure must be enabled for para_tree.");
+    if (quickscorer_) {
+        quickscorer_ = init_quickscorer();
+        if (quickscorer_)
+            sizeof_ += qs_nodes_.get_sizeof();
+    }
+
+    switch(array_structure_) {
+        case 0:
+            if (para_tree_)
+                throw std::invalid_argument("array_structure must be enabled for para_tree.");
+            break;
+        case 1:
+            switch_to_array_structure();
+            break;
+        case 2:
+            switch_to_packed_structure();
+            break;
+        default:
+            throw std::invalid_argument(MakeString(
+                "Unexpected value for array_structure=", array_structure_, "."));
+    }
+    init_kernels();
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::init_kernels() {
+    n_features_ = get_n_features();
+    if (init_dense_weights())
+        sizeof_ += packed_nodes_.dense_weights.size() * sizeof(NTYPE);
+    cascade_ = cascade_ && init_cascade();
+    if (bfloat16_) {
+        bfloat16_ = init_bfloat16();
+        if (bfloat16_)
+            sizeof_ += half_nodes_.get_sizeof();
+    }
+    if (lookup_) {
+        lookup_ = init_lookup();
+        for (auto it = lookup_tables_.begin(); it != lookup_tables_.end(); ++it)
+            sizeof_ += it->get_sizeof();
+    }
+    avx2_ = avx2_ && init_avx2();
+    if (quantized_) {
+        quantized8_.nodes.clear();
+        quantized16_.nodes.clear();
+        quantized_ = init_quantized(quantized8_) || init_quantized(quantized16_);
+        if (quantized_)
+            sizeof_ += quantized8_.nodes.empty() ? quantized16_.get_sizeof() : quantized8_.get_sizeof();
+    }
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::get_sizeof_kernels() {
+    // Memory added by init_kernels.
+    int64_t res = packed_nodes_.dense_weights.size() * sizeof(NTYPE);
+    if (bfloat16_)
+        res += half_nodes_.get_sizeof();
+    for (auto it = lookup_tables_.begin(); it != lookup_tables_.end(); ++it)
+        res += it->get_sizeof();
+    if (quantized_)
+        res += quantized8_.nodes.empty() ? quantized16_.get_sizeof() : quantized8_.get_sizeof();
+    return res;
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::get_n_features() const {
+    int64_t res = 0;
+    switch(array_structure_) {
+        case 0:
+            for(int64_t i = 0; i < n_nodes_; ++i)
+                if (nodes_[i].is_not_leaf())
+                    res = std::max(res, (int64_t)nodes_[i].feature_id + 1);
+            break;
+        case 1:
+            for(size_t i = 0; i < array_nodes_.feature_id.size(); ++i)
+                if (array_nodes_.is_not_leaf(i))
+                    res = std::max(res, (int64_t)array_nodes_.feature_id[i] + 1);
+            break;
+        default:
+            for(auto it = packed_nodes_.nodes.begin(); it != packed_nodes_.nodes.end(); ++it)
+                if (it->is_not_leaf())
+                    res = std::max(res, (int64_t)it->feature_id + 1);
+            break;
+    }
+    return res;
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::first_branch_mode(NODE_MODE& mode) const {
+    switch(array_structure_) {
+        case 0:
+            for(int64_t i = 0; i < n_nodes_; ++i) {
+                if (nodes_[i].is_not_leaf()) {
+                    mode = nodes_[i].mode;
+                    return true;
+                }
+            }
+            break;
+        case 1:
+            for(size_t i = 0; i < array_nodes_.mode.size(); ++i) {
+                if (array_nodes_.is_not_leaf(i)) {
+                    mode = array_nodes_.mode[i];
+                    return true;
+                }
+            }
+            break;
+        default:
+            for(auto it = packed_nodes_.nodes.begin(); it != packed_nodes_.nodes.end(); ++it) {
+                if (it->is_not_leaf()) {
+                    mode = (NODE_MODE)it->mode;
+                    return true;
+                }
+            }
+            break;
+    }
+    return false;
+}
+
+
+template<typename NTYPE>
+std::set<int64_t> RuntimeTreeEnsembleCommonP<NTYPE>::weights_classes() const {
+    std::set<int64_t> res;
+    switch(array_structure_) {
+        case 0:
+            for(int64_t i = 0; i < n_nodes_; ++i)
+                for(auto it = nodes_[i].weights_vect.begin(); it != nodes_[i].weights_vect.end(); ++it)
+                    res.insert(it->i);
+            break;
+        case 1:
+            for(auto w = array_nodes_.weights.begin(); w != array_nodes_.weights.end(); ++w)
+                for(auto it = w->begin(); it != w->end(); ++it)
+                    res.insert(it->i);
+            break;
+        default:
+            for(auto node = packed_nodes_.nodes.begin(); node != packed_nodes_.nodes.end(); ++node) {
+                if (node->is_not_leaf())
+                    continue;
+                for(uint32_t k = node->weights_begin; k < node->weights_end; ++k)
+                    res.insert(packed_nodes_.weights[k].i);
+            }
+            break;
+    }
+    return res;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::append_trees(
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_falsenodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_featureids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_hitrates,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_treeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_truenodeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_values,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_ids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_treeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> target_class_weights) {
+    append_trees_checked(nodes_falsenodeids, nodes_featureids, nodes_hitrates,
+                         nodes_missing_value_tracks_true, nodes_modes,
+                         nodes_nodeids, nodes_treeids, nodes_truenodeids,
+                         nodes_values, target_class_ids, target_class_nodeids,
+                         target_class_treeids, target_class_weights,
+                         std::function<void()>());
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::append_trees_checked(
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_falsenodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_featureids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_hitrates,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_treeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> nodes_truenodeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> nodes_values,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_ids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_nodeids,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> target_class_treeids,
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> target_class_weights,
+            const std::function<void()>& before_merge) {
+    std::vector<int64_t> tnodes_treeids;
+    std::vector<int64_t> tnodes_nodeids;
+    std::vector<int64_t> tnodes_featureids;
+    std::vector<NTYPE> tnodes_values;
+    std::vector<NTYPE> tnodes_hitrates;
+    std::vector<int64_t> tnodes_truenodeids;
+    std::vector<int64_t> tnodes_falsenodeids;
+    std::vector<int64_t> tmissing_tracks_true;
+
+    array2vector(tnodes_falsenodeids, nodes_falsenodeids, int64_t);
+    array2vector(tnodes_featureids, nodes_featureids, int64_t);
+    array2vector(tnodes_hitrates, nodes_hitrates, NTYPE);
+    array2vector(tmissing_tracks_true, nodes_missing_value_tracks_true, int64_t);
+    array2vector(tnodes_nodeids, nodes_nodeids, int64_t);
+    array2vector(tnodes_treeids, nodes_treeids, int64_t);
+    array2vector(tnodes_truenodeids, nodes_truenodeids, int64_t);
+    array2vector(tnodes_values, nodes_values, NTYPE);
+
+    std::vector<int64_t> ttarget_class_nodeids;
+    std::vector<int64_t> ttarget_class_treeids;
+    std::vector<int64_t> ttarget_class_ids;
+    std::vector<NTYPE> ttarget_class_weights;
+
+    array2vector(ttarget_class_ids, target_class_ids, int64_t);
+    array2vector(ttarget_class_nodeids, target_class_nodeids, int64_t);
+    array2vector(ttarget_class_treeids, target_class_treeids, int64_t);
+    array2vector(ttarget_class_weights, target_class_weights, NTYPE);
+
+    py::gil_scoped_release release;
+    append_trees_c(tnodes_falsenodeids, tnodes_featureids, tnodes_hitrates,
+                   tmissing_tracks_true, nodes_modes,
+                   tnodes_nodeids, tnodes_treeids, tnodes_truenodeids,
+                   tnodes_values, ttarget_class_ids,
+                   ttarget_class_nodeids, ttarget_class_treeids,
+                   ttarget_class_weights, before_merge);
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::append_trees_c(
+            const std::vector<int64_t>& nodes_falsenodeids,
+            const std::vector<int64_t>& nodes_featureids,
+            const std::vector<NTYPE>& nodes_hitrates,
+            const std::vector<int64_t>& nodes_missing_value_tracks_true,
+            const std::vector<std::string>& nodes_modes,
+            const std::vector<int64_t>& nodes_nodeids,
+            const std::vector<int64_t>& nodes_treeids,
+            const std::vector<int64_t>& nodes_truenodeids,
+            const std::vector<NTYPE>& nodes_values,
+            const std::vector<int64_t>& target_class_ids,
+            const std::vector<int64_t>& target_class_nodeids,
+            const std::vector<int64_t>& target_class_treeids,
+            const std::vector<NTYPE>& target_class_weights,
+            const std::function<void()>& before_merge) {
+    if (quickscorer_)
+        throw std::invalid_argument("append_trees is not implemented with quickscorer.");
+    if (n_trees_ == 0)
+        throw std::invalid_argument("append_trees must be called after init.");
+
+    // The new trees are converted into the same layout
+    // while the current model can still be used.
+    RuntimeTreeEnsembleCommonP<NTYPE> other(omp_tree_, omp_N_, array_structure_, para_tree_);
+    other.complete_tree_ratio_ = complete_tree_ratio_;
+    other.avx2_ = false;
+    other.init_c("SUM", base_values_, n_targets_or_classes_,
+                 nodes_falsenodeids, nodes_featureids, nodes_hitrates,
+                 nodes_missing_value_tracks_true, nodes_modes,
+                 nodes_nodeids, nodes_treeids, nodes_truenodeids,
+                 nodes_values, "NONE", target_class_ids,
+                 target_class_nodeids, target_class_treeids,
+                 target_class_weights);
+
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    if (array_structure_ == 2 &&
+            packed_nodes_.nodes.size() + other.packed_nodes_.nodes.size() >= (size_t)ID_LEAF_TRUE_NODE)
+        throw std::invalid_argument(MakeString(
+            "Too many nodes (", packed_nodes_.nodes.size() + other.packed_nodes_.nodes.size(),
+            ") for array_structure=2."));
+    if (before_merge)
+        before_merge();
+
+    NODE_MODE mode, other_mode;
+    bool has_mode = first_branch_mode(mode);
+    bool other_has_mode = other.first_branch_mode(other_mode);
+    same_mode_ = same_mode_ && other.same_mode_ &&
+                 (!has_mode || !other_has_mode || mode == other_mode);
+    has_missing_tracks_ = has_missing_tracks_ || other.has_missing_tracks_;
+    sizeof_ -= get_sizeof_kernels();
+    sizeof_ += other.sizeof_ - other.get_sizeof_kernels() -
+               (int64_t)sizeof(RuntimeTreeEnsembleCommonP<NTYPE>) -
+               (int64_t)(sizeof(NTYPE) * base_values_.size());
+
+    switch(array_structure_) {
+        case 0: {
+            TreeNodeElement<NTYPE> * merged = new TreeNodeElement<NTYPE>[(int)(n_nodes_ + other.n_nodes_)];
+            for(int64_t i = 0; i < n_nodes_; ++i) {
+                merged[i] = std::move(nodes_[i]);
+                if (merged[i].truenode != nullptr)
+                    merged[i].truenode = merged + (merged[i].truenode - nodes_);
+                if (merged[i].falsenode != nullptr)
+                    merged[i].falsenode = merged + (merged[i].falsenode - nodes_);
+            }
+            TreeNodeElement<NTYPE> * first = merged + n_nodes_;
+            for(int64_t i = 0; i < other.n_nodes_; ++i) {
+                first[i] = std::move(other.nodes_[i]);
+                if (first[i].truenode != nullptr)
+                    first[i].truenode = first + (first[i].truenode - other.nodes_);
+                if (first[i].falsenode != nullptr)
+                    first[i].falsenode = first + (first[i].falsenode - other.nodes_);
+            }
+            for(auto it = roots_.begin(); it != roots_.end(); ++it)
+                *it = merged + (*it - nodes_);
+            roots_.reserve(roots_.size() + other.roots_.size());
+            for(auto it = other.roots_.begin(); it != other.roots_.end(); ++it)
+                roots_.push_back(first + (*it - other.nodes_));
+            delete [] nodes_;
+            nodes_ = merged;
+            break;
+        }
+        case 1: {
+            size_t offset = array_nodes_.id.size();
+            const ArrayTreeNodeElement<NTYPE>& nodes = other.array_nodes_;
+            _append_vector_(array_nodes_.id, nodes.id);
+            _append_vector_(array_nodes_.feature_id, nodes.feature_id);
+            _append_vector_(array_nodes_.value, nodes.value);
+            _append_vector_(array_nodes_.hitrates, nodes.hitrates);
+            _append_vector_(array_nodes_.mode, nodes.mode);
+            _append_vector_(array_nodes_.missing_tracks, nodes.missing_tracks);
+            _append_vector_(array_nodes_.weights0, nodes.weights0);
+            _append_vector_(array_nodes_.weights, nodes.weights);
+            _append_vector_(array_nodes_.is_missing_track_true, nodes.is_missing_track_true);
+            array_nodes_.truenode.reserve(array_nodes_.truenode.size() + nodes.truenode.size());
+            array_nodes_.falsenode.reserve(array_nodes_.falsenode.size() + nodes.falsenode.size());
+            for(size_t i = 0; i < nodes.truenode.size(); ++i) {
+                array_nodes_.truenode.push_back(nodes.truenode[i] == ID_LEAF_TRUE_NODE
+                    ? ID_LEAF_TRUE_NODE : nodes.truenode[i] + offset);
+                array_nodes_.falsenode.push_back(nodes.falsenode[i] == ID_LEAF_TRUE_NODE
+                    ? ID_LEAF_TRUE_NODE : nodes.falsenode[i] + offset);
+            }
+            for(auto it = nodes.root_id.begin(); it != nodes.root_id.end(); ++it)
+                array_nodes_.root_id.push_back(*it + offset);
+
+            // Every tree keeps a single mode, complete trees remain valid.
+            const CompleteTreeNodeElements<NTYPE>& complete = other.complete_nodes_;
+            size_t node_offset = complete_nodes_.value.size();
+            size_t leaf_offset = complete_nodes_.leaf_id.size();
+            for(size_t j = 0; j < complete.node_offset.size(); ++j) {
+                complete_nodes_.node_offset.push_back(complete.is_complete(j)
+                    ? complete.node_offset[j] + node_offset : NOT_COMPLETE_TREE);
+                complete_nodes_.leaf_offset.push_back(complete.leaf_offset[j] + leaf_offset);
+            }
+            _append_vector_(complete_nodes_.depth, complete.depth);
+            _append_vector_(complete_nodes_.feature_id, complete.feature_id);
+            _append_vector_(complete_nodes_.value, complete.value);
+            _append_vector_(complete_nodes_.is_missing_track_true, complete.is_missing_track_true);
+            for(auto it = complete.leaf_id.begin(); it != complete.leaf_id.end(); ++it)
+                complete_nodes_.leaf_id.push_back(*it + offset);
+            break;
+        }
+        default: {
+            if (packed_nodes_.nodes.is_mapped())
+                // The mapped pages are copied into memory.
+                sizeof_ += packed_nodes_.get_sizeof() - (int64_t)sizeof(PackedTreeNodeElements<NTYPE>);
+            const PackedTreeNodeElements<NTYPE>& packed = other.packed_nodes_;
+            uint32_t offset = (uint32_t)packed_nodes_.nodes.size();
+            uint32_t weights_offset = (uint32_t)packed_nodes_.weights.size();
+            packed_nodes_.nodes.reserve(packed_nodes_.nodes.size() + packed.nodes.size());
+            packed_nodes_.weights.reserve(packed_nodes_.weights.size() + packed.weights.size());
+            packed_nodes_.root_id.reserve(packed_nodes_.root_id.size() + packed.root_id.size());
+            for(auto it = packed.nodes.begin(); it != packed.nodes.end(); ++it) {
+                PackedTreeNodeElement<NTYPE> node = *it;
+                if (node.is_not_leaf()) {
+                    node.truenode += offset;
+                    if (node.falsenode != ID_LEAF_TRUE_NODE)
+                        node.falsenode += offset;
+                }
+                else {
+                    node.weights_begin += weights_offset;
+                    node.weights_end += weights_offset;
+                }
+                packed_nodes_.nodes.push_back(node);
+            }
+            for(auto it = packed.weights.begin(); it != packed.weights.end(); ++it)
+                packed_nodes_.weights.push_back(*it);
+            for(auto it = packed.root_id.begin(); it != packed.root_id.end(); ++it)
+                packed_nodes_.root_id.push_back(*it + offset);
+            mapped_.reset();
+            break;
+        }
+    }
+
+    n_nodes_ += other.n_nodes_;
+    n_trees_ += other.n_trees_;
+    init_kernels();
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::init_dense_weights() {
+    packed_nodes_.dense_weights.clear();
+    if (array_structure_ != 2 || n_targets_or_classes_ <= 1)
+        return false;
+    // Every leaf must have exactly one weight per target,
+    // the dense row then replaces the sparse weights without
+    // changing the predictions.
+    std::vector<NTYPE> dense(packed_nodes_.weights.size(), (NTYPE)0);
+    std::vector<unsigned char> seen(n_targets_or_classes_);
+    for(size_t i = 0; i < packed_nodes_.nodes.size(); ++i) {
+        const PackedTreeNodeElement<NTYPE>& node = packed_nodes_.nodes[i];
+        if (node.is_not_leaf())
+            continue;
+        if ((int64_t)node.weights_end - (int64_t)node.weights_begin != n_targets_or_classes_)
+            return false;
+        std::fill(seen.begin(), seen.end(), 0);
+        for(uint32_t k = node.weights_begin; k < node.weights_end; ++k) {
+            const SparseValue<NTYPE>& w = packed_nodes_.weights[k];
+            if (w.i < 0 || w.i >= n_targets_or_classes_ || seen[w.i])
+                return false;
+            seen[w.i] = 1;
+            dense[node.weights_begin + w.i] = w.value;
+        }
+    }
+    packed_nodes_.dense_weights = dense;
+    return true;
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::init_bfloat16() {
+    half_nodes_.nodes.clear();
+    half_nodes_.leaf_values.clear();
+    half_nodes_.exact_thresholds.clear();
+    half_nodes_.inexact_bits.clear();
+    half_nodes_.inexact_rank.clear();
+    half_nodes_.mode = NODE_MODE::LEAF;
+    const MappedVector<PackedTreeNodeElement<NTYPE>>& nodes = packed_nodes_.nodes;
+    if (!std::is_same<NTYPE, float>::value || array_structure_ != 2 || !same_mode_ ||
+            (aggregate_function_ != AGGREGATE_FUNCTION::SUM &&
+             aggregate_function_ != AGGREGATE_FUNCTION::AVERAGE) ||
+            nodes.size() >= (size_t)std::numeric_limits<uint32_t>::max())
+        return false;
+
+    std::vector<float> row(n_targets_or_classes_);
+    half_nodes_.nodes.resize(nodes.size());
+    half_nodes_.inexact_bits.resize((nodes.size() + 63) / 64, 0);
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        const PackedTreeNodeElement<NTYPE>& node = nodes[i];
+        HalfTreeNodeElement& half = half_nodes_.nodes[i];
+        if (!node.is_not_leaf()) {
+            std::fill(row.begin(), row.end(), 0.f);
+            for(uint32_t w = node.weights_begin; w < node.weights_end; ++w)
+                row[packed_nodes_.weights[w].i] += (float)packed_nodes_.weights[w].value;
+            half.threshold = 0;
+            half.feature = HALF_LEAF;
+            half.next = (uint32_t)(half_nodes_.leaf_values.size() / n_targets_or_classes_);
+            for(auto it = row.begin(); it != row.end(); ++it)
+                half_nodes_.leaf_values.push_back(_float_to_bfloat16_(*it));
+            continue;
+        }
+        if (node.truenode != i + 1 || node.falsenode == ID_LEAF_TRUE_NODE ||
+                node.feature_id > HALF_FEATURE_MASK || _isnan_(node.value)) {
+            half_nodes_.nodes.clear();
+            return false;
+        }
+        half_nodes_.mode = (NODE_MODE)node.mode;
+        half.threshold = _float_to_bfloat16_truncated_((float)node.value);
+        half.feature = (uint16_t)(node.feature_id |
+                                  (node.is_missing_track_true ? HALF_MISSING_TRACK_TRUE : 0));
+        half.next = node.falsenode;
+        if (_bfloat16_to_float_(half.threshold) == (float)node.value)
+            continue;
+        // -0 and 0 have different truncations.
+        if ((half.threshold & 0x7FFF) == 0) {
+            half_nodes_.nodes.clear();
+            return false;
+        }
+        half.feature |= HALF_INEXACT;
+        half_nodes_.inexact_bits[i >> 6] |= ((uint64_t)1) << (i & 63);
+        half_nodes_.exact_thresholds.push_back((float)node.value);
+
+        // Every comparison must give the same result for the values
+        // around the threshold and its truncation.
+        float threshold = (float)node.value;
+        float lower = _bfloat16_to_float_(half.threshold);
+        float upper = _bfloat16_to_float_(half.threshold + 1);
+        float values[] = {
+            threshold, lower, upper,
+            std::nextafter(threshold, -std::numeric_limits<float>::infinity()),
+            std::nextafter(threshold, std::numeric_limits<float>::infinity()),
+            std::nextafter(lower, -std::numeric_limits<float>::infinity()),
+            std::nextafter(lower, std::numeric_limits<float>::infinity()),
+            std::nextafter(upper, -std::numeric_limits<float>::infinity()),
+            std::nextafter(upper, std::numeric_limits<float>::infinity())};
+        for(size_t k = 0; k < sizeof(values) / sizeof(float); ++k) {
+            bool exact = _float_to_bfloat16_truncated_(values[k]) == half.threshold;
+            if (_compare_threshold_(half_nodes_.mode, values[k], exact ? threshold : lower) !=
+                    _compare_threshold_(half_nodes_.mode, values[k], threshold)) {
+                half_nodes_.nodes.clear();
+                return false;
+            }
+        }
+    }
+    half_nodes_.inexact_rank.resize(half_nodes_.inexact_bits.size());
+    uint32_t rank = 0;
+    for(size_t b = 0; b < half_nodes_.inexact_bits.size(); ++b) {
+        half_nodes_.inexact_rank[b] = rank;
+        rank += _popcount64_(half_nodes_.inexact_bits[b]);
+    }
+    return true;
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::init_lookup() {
+    tree_lookup_.clear();
+    lookup_tables_.clear();
+    if (array_structure_ != 2 || lookup_max_cardinality_ < 2)
+        return false;
+
+    // A feature has a low cardinality if all its thresholds are integers
+    // or half-integers, codes 0, 1, ..., cardinality - 1 reach every branch.
+    const MappedVector<PackedTreeNodeElement<NTYPE>>& nodes = packed_nodes_.nodes;
+    int64_t n_features = 0;
+    for(size_t i = 0; i < nodes.size(); ++i)
+        if (nodes[i].is_not_leaf())
+            n_features = std::max(n_features, (int64_t)nodes[i].feature_id + 1);
+    std::vector<int64_t> cardinality(n_features, 0);
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].is_not_leaf() || cardinality[nodes[i].feature_id] < 0)
+            continue;
+        NTYPE threshold = nodes[i].value;
+        if (!(threshold >= -1) || threshold * 2 != std::floor(threshold * 2) ||
+                std::floor(threshold) + 2 > lookup_max_cardinality_) {
+            cardinality[nodes[i].feature_id] = -1;
+            continue;
+        }
+        cardinality[nodes[i].feature_id] = std::max(
+            cardinality[nodes[i].feature_id], (int64_t)std::floor(threshold) + 2);
+    }
+
+    // The first levels of a tree are the nodes reached from the root
+    // through low-cardinality features as long as the table is not
+    // bigger than lookup_max_size_.
+    std::vector<unsigned char> in_table(nodes.size(), 0);
+    std::vector<size_t> queue;
+    std::vector<NTYPE> row(n_features, 0);
+    tree_lookup_.resize(n_trees_, -1);
+    for(int64_t j = 0; j < n_trees_; ++j) {
+        TreeLookupTable<NTYPE> table;
+        size_t size = 1, n_replaced = 0;
+        queue.clear();
+        queue.push_back(packed_nodes_.root_id[j]);
+        for(size_t q = 0; q < queue.size(); ++q) {
+            const PackedTreeNodeElement<NTYPE>& node = nodes[queue[q]];
+            if (!node.is_not_leaf() || cardinality[node.feature_id] <= 0)
+                continue;
+            if (std::find(table.features.begin(), table.features.end(),
+                          node.feature_id) == table.features.end()) {
+                if (size * cardinality[node.feature_id] > (size_t)lookup_max_size_)
+                    continue;
+                size *= cardinality[node.feature_id];
+                table.features.push_back(node.feature_id);
+                table.cardinalities.push_back((uint32_t)cardinality[node.feature_id]);
+            }
+            in_table[queue[q]] = 1;
+            ++n_replaced;
+            queue.push_back(node.truenode);
+            queue.push_back(node.falsenode);
+        }
+        // A single comparison is faster than the table.
+        if (n_replaced < 2)
+            continue;
+
+        table.nodes.resize(size);
+        for(size_t code = 0; code < size; ++code) {
+            size_t c = code;
+            for(size_t i = table.features.size(); i > 0; --i) {
+                row[table.features[i - 1]] = (NTYPE)(c % table.cardinalities[i - 1]);
+                c /= table.cardinalities[i - 1];
+            }
+            size_t id = packed_nodes_.root_id[j];
+            while (in_table[id]) {
+                const PackedTreeNodeElement<NTYPE>& node = nodes[id];
+                id = _compare_threshold_((NODE_MODE)node.mode, row[node.feature_id], node.value)
+                    ? node.truenode : node.falsenode;
+            }
+            table.nodes[code] = (uint32_t)id;
+        }
+        tree_lookup_[j] = (int64_t)lookup_tables_.size();
+        lookup_tables_.push_back(table);
+    }
+    return !lookup_tables_.empty();
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::init_cascade() {
+    cascade_stage_end_.clear();
+    cascade_lower_.clear();
+    cascade_upper_.clear();
+    cascade_class_ = -1;
+    if (array_structure_ != 2 || n_targets_or_classes_ != 2 ||
+            aggregate_function_ != AGGREGATE_FUNCTION::SUM ||
+            cascade_stages_ < 2 || n_trees_ < 2)
+        return false;
+
+    // Every leaf must hold one weight for the same class, the label
+    // is then a monotonic function of a single score.
+    std::vector<NTYPE> tree_min(n_trees_), tree_max(n_trees_);
+    for(int64_t j = 0; j < n_trees_; ++j) {
+        size_t end = j + 1 < n_trees_ ? packed_nodes_.root_id[j + 1] : packed_nodes_.nodes.size();
+        bool first = true;
+        for(size_t i = packed_nodes_.root_id[j]; i < end; ++i) {
+            const PackedTreeNodeElement<NTYPE>& node = packed_nodes_.nodes[i];
+            if (node.is_not_leaf())
+                continue;
+            if (node.weights_end != node.weights_begin + 1)
+                return false;
+            const SparseValue<NTYPE>& w = packed_nodes_.weights[node.weights_begin];
+            if (cascade_class_ == -1)
+                cascade_class_ = w.i;
+            else if (w.i != cascade_class_)
+                return false;
+            tree_min[j] = first ? w.value : std::min(tree_min[j], w.value);
+            tree_max[j] = first ? w.value : std::max(tree_max[j], w.value);
+            first = false;
+        }
+        if (first)
+            return false;
+    }
+    if (cascade_class_ < 0 || cascade_class_ >= n_targets_or_classes_)
+        return false;
+
+    int64_t n_stages = std::min((int64_t)cascade_stages_, n_trees_);
+    cascade_stage_end_.resize(n_stages);
+    cascade_lower_.resize(n_stages);
+    cascade_upper_.resize(n_stages);
+    for(int64_t s = 0; s < n_stages; ++s) {
+        cascade_stage_end_[s] = n_trees_ * (s + 1) / n_stages;
+        NTYPE lower = 0, upper = 0;
+        for(int64_t j = cascade_stage_end_[s]; j < n_trees_; ++j) {
+            lower += tree_min[j];
+            upper += tree_max[j];
+        }
+        cascade_lower_[s] = lower;
+        cascade_upper_[s] = upper;
+    }
+    return true;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::write_binary(
+        const std::string& filename, const std::vector<int64_t>& extra) const {
+    if (array_structure_ != 2)
+        throw std::invalid_argument(MakeString(
+            "Only array_structure=2 can be saved not ", array_structure_, "."));
+
+    TreeEnsembleBinaryHeader header;
+    memset(&header, 0, sizeof(TreeEnsembleBinaryHeader));
+    memcpy(header.magic, TREE_ENSEMBLE_BINARY_MAGIC, sizeof(header.magic));
+    header.version = TREE_ENSEMBLE_BINARY_VERSION;
+    header.endianness = TREE_ENSEMBLE_BINARY_ENDIANNESS;
+    header.sizeof_ntype = sizeof(NTYPE);
+    header.sizeof_size_t = sizeof(size_t);
+    header.sizeof_node = sizeof(PackedTreeNodeElement<NTYPE>);
+    header.sizeof_weight = sizeof(SparseValue<NTYPE>);
+    header.aggregate_function = (int32_t)aggregate_function_;
+    header.post_transform = (int32_t)post_transform_;
+    header.same_mode = same_mode_ ? 1 : 0;
+    header.has_missing_tracks = has_missing_tracks_ ? 1 : 0;
+    header.n_targets_or_classes = n_targets_or_classes_;
+    header.n_trees = n_trees_;
+    header.max_tree_depth = max_tree_depth_;
+
+    uint64_t offset = sizeof(TreeEnsembleBinaryHeader);
+    uint64_t* sections[] = {header.base_values, header.root_id, header.nodes,
+                            header.weights, header.extra};
+    const void* data[] = {base_values_.data(), packed_nodes_.root_id.data(),
+                          packed_nodes_.nodes.data(), packed_nodes_.weights.data(),
+                          extra.data()};
+    uint64_t sizes[] = {base_values_.size(), packed_nodes_.root_id.size(),
+                        packed_nodes_.nodes.size(), packed_nodes_.weights.size(),
+                        extra.size()};
+    uint64_t itemsizes[] = {sizeof(NTYPE), sizeof(size_t), sizeof(PackedTreeNodeElement<NTYPE>),
+                            sizeof(SparseValue<NTYPE>), sizeof(int64_t)};
+    for(size_t i = 0; i < 5; ++i) {
+        offset = (offset + TREE_ENSEMBLE_BINARY_ALIGNMENT - 1) /
+                 TREE_ENSEMBLE_BINARY_ALIGNMENT * TREE_ENSEMBLE_BINARY_ALIGNMENT;
+        sections[i][0] = sizes[i];
+        sections[i][1] = offset;
+        offset += sizes[i] * itemsizes[i];
+    }
+
+    std::ofstream f(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!f.is_open())
+        throw std::invalid_argument(MakeString("Unable to create file '", filename, "'."));
+    f.write((const char*)&header, sizeof(TreeEnsembleBinaryHeader));
+    char padding[TREE_ENSEMBLE_BINARY_ALIGNMENT];
+    memset(padding, 0, TREE_ENSEMBLE_BINARY_ALIGNMENT);
+    offset = sizeof(TreeEnsembleBinaryHeader);
+    for(size_t i = 0; i < 5; ++i) {
+        f.write(padding, sections[i][1] - offset);
+        f.write((const char*)data[i], sizes[i] * itemsizes[i]);
+        offset = sections[i][1] + sizes[i] * itemsizes[i];
+    }
+    if (!f.good())
+        throw std::runtime_error(MakeString("Unable to write file '", filename, "'."));
+}
+
+
+template<typename NTYPE>
+std::vector<int64_t> RuntimeTreeEnsembleCommonP<NTYPE>::read_binary(
+        const std::string& filename, const char* kind, int64_t n_extra, int64_t n_extra_per_target) {
+    if (array_structure_ != 2)
+        throw std::invalid_argument(MakeString(
+            "A binary file can only be loaded with array_structure=2 not ",
+            array_structure_, "."));
+    std::shared_ptr<MemoryMappedFile> mapped = std::make_shared<MemoryMappedFile>(filename);
+    if (mapped->size() < sizeof(TreeEnsembleBinaryHeader))
+        throw std::invalid_argument(MakeString("File '", filename, "' is too small."));
+    const TreeEnsembleBinaryHeader* header = (const TreeEnsembleBinaryHeader*)mapped->data();
+    if (memcmp(header->magic, TREE_ENSEMBLE_BINARY_MAGIC, sizeof(header->magic)) != 0)
+        throw std::invalid_argument(MakeString("File '", filename, "' is not a tree ensemble."));
+    if (header->version != TREE_ENSEMBLE_BINARY_VERSION)
+        throw std::invalid_argument(MakeString(
+            "Unexpected version ", header->version, " for file '", filename,
+            "', version ", TREE_ENSEMBLE_BINARY_VERSION, " is expected."));
+    if (header->endianness != TREE_ENSEMBLE_BINARY_ENDIANNESS ||
+            header->sizeof_size_t != sizeof(size_t) ||
+            header->sizeof_node != sizeof(PackedTreeNodeElement<NTYPE>) ||
+            header->sizeof_weight != sizeof(SparseValue<NTYPE>))
+        throw std::invalid_argument(MakeString(
+            "File '", filename, "' was created on a different architecture."));
+    if (header->sizeof_ntype != sizeof(NTYPE))
+        throw std::invalid_argument(MakeString(
+            "File '", filename, "' stores ", header->sizeof_ntype * 8,
+            " bits floats but ", sizeof(NTYPE) * 8, " bits floats are expected."));
+    const uint64_t* sections[] = {header->base_values, header->root_id, header->nodes,
+                                  header->weights, header->extra};
+    uint64_t itemsizes[] = {sizeof(NTYPE), sizeof(size_t), sizeof(PackedTreeNodeElement<NTYPE>),
+                            sizeof(SparseValue<NTYPE>), sizeof(int64_t)};
+    for(size_t i = 0; i < 5; ++i) {
+        if (sections[i][1] % TREE_ENSEMBLE_BINARY_ALIGNMENT != 0 ||
+                sections[i][1] > mapped->size() ||
+                sections[i][0] > (mapped->size() - sections[i][1]) / itemsizes[i])
+            throw std::invalid_argument(MakeString("File '", filename, "' is corrupted."));
+    }
+    if (header->nodes[0] == 0 || header->nodes[0] >= (uint64_t)ID_LEAF_TRUE_NODE ||
+            header->weights[0] == 0 || header->weights[0] >= (uint64_t)ID_LEAF_TRUE_NODE ||
+            header->n_trees <= 0 || header->root_id[0] != (uint64_t)header->n_trees ||
+            header->max_tree_depth <= 0 ||
+            header->n_targets_or_classes <= 0 ||
+            header->base_values[0] > (uint64_t)std::max((int64_t)2, header->n_targets_or_classes) ||
+            header->aggregate_function < (int32_t)AGGREGATE_FUNCTION::AVERAGE ||
+            header->aggregate_function > (int32_t)AGGREGATE_FUNCTION::MAX ||
+            header->post_transform < (int32_t)POST_EVAL_TRANSFORM::NONE ||
+            header->post_transform > (int32_t)POST_EVAL_TRANSFORM::PROBIT)
+        throw std::invalid_argument(MakeString("File '", filename, "' is corrupted."));
+    const size_t* root_id = (const size_t*)(mapped->data() + header->root_id[1]);
+    for(uint64_t i = 0; i < header->root_id[0]; ++i) {
+        if (root_id[i] >= header->nodes[0] || (i == 0 ? root_id[i] != 0 : root_id[i] <= root_id[i - 1]))
+            throw std::invalid_argument(MakeString("File '", filename, "' is corrupted."));
+    }
+    // Children must follow their parent so that every walk ends on a leaf,
+    // leaves must refer to a valid range of weights.
+    const PackedTreeNodeElement<NTYPE>* nodes =
+        (const PackedTreeNodeElement<NTYPE>*)(mapped->data() + header->nodes[1]);
+    uint64_t n_nodes = header->nodes[0], n_weights = header->weights[0];
+    for(uint64_t i = 0; i < n_nodes; ++i) {
+        const PackedTreeNodeElement<NTYPE>& node = nodes[i];
+        if (node.mode > (uint8_t)NODE_MODE::LEAF)
+            throw std::invalid_argument(MakeString("File '", filename, "' is corrupted."));
+        if (node.is_not_leaf()) {
+            if (node.truenode <= i || node.truenode >= n_nodes ||
+                    node.falsenode <= i || node.falsenode >= n_nodes)
+                throw std::invalid_argument(MakeString("File '", filename, "' is corrupted."));
+        }
+        else if (node.weights_begin > node.weights_end || node.weights_begin >= n_weights ||
+                 node.weights_end > n_weights)
+            throw std::invalid_argument(MakeString("File '", filename, "' is corrupted."));
+    }
+    const SparseValue<NTYPE>* weights =
+        (const SparseValue<NTYPE>*)(mapped->data() + header->weights[1]);
+    for(uint64_t i = 0; i < n_weights; ++i) {
+        if (weights[i].i < 0 || weights[i].i >= header->n_targets_or_classes)
+            throw std::invalid_argument(MakeString("File '", filename, "' is corrupted."));
+    }
+    if (header->extra[0] != (uint64_t)(n_extra + n_extra_per_target * header->n_targets_or_classes))
+        throw std::invalid_argument(MakeString(
+            "File '", filename, "' does not contain a ", kind, "."));
+
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    if (nodes_ != nullptr) {
+        delete [] nodes_;
+        nodes_ = nullptr;
+    }
+    roots_.clear();
+    aggregate_function_ = (AGGREGATE_FUNCTION)header->aggregate_function;
+    post_transform_ = (POST_EVAL_TRANSFORM)header->post_transform;
+    same_mode_ = header->same_mode != 0;
+    has_missing_tracks_ = header->has_missing_tracks != 0;
+    n_targets_or_classes_ = header->n_targets_or_classes;
+    n_trees_ = header->n_trees;
+    n_nodes_ = (int64_t)header->nodes[0];
+    max_tree_depth_ = header->max_tree_depth;
+    const NTYPE* base_values = (const NTYPE*)(mapped->data() + header->base_values[1]);
+    base_values_ = std::vector<NTYPE>(base_values, base_values + header->base_values[0]);
+    packed_nodes_.root_id.map(root_id, header->root_id[0]);
+    packed_nodes_.nodes.map(nodes, n_nodes);
+    packed_nodes_.weights.map(weights, n_weights);
+    const int64_t* extra = (const int64_t*)(mapped->data() + header->extra[1]);
+    std::vector<int64_t> res(extra, extra + header->extra[0]);
+    mapped_ = mapped;
+
+    // The mapped pages are not owned by this instance.
+    sizeof_ = sizeof(RuntimeTreeEnsembleCommonP<NTYPE>) + sizeof(NTYPE) * base_values_.size();
+    // QuickScorer needs the original nodes.
+    quickscorer_ = false;
+    init_kernels();
+    return res;
+}
+
+
+template<typename NTYPE> template<typename BIN>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::init_quantized(
+        QuantizedTreeNodeElements<NTYPE, BIN>& quantized_nodes) const {
+    if (array_structure_ != 2 || !same_mode_)
+        return false;
+    const MappedVector<PackedTreeNodeElement<NTYPE>>& nodes = packed_nodes_.nodes;
+
+    // Sorted unique thresholds for every feature.
+    std::vector<std::vector<NTYPE>> thresholds;
+    quantized_nodes.mode = NODE_MODE::LEAF;
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].is_not_leaf())
+            continue;
+        // The true child must follow its parent and a missing
+        // false child cannot be distinguished from a leaf.
+        if (nodes[i].truenode != i + 1 || nodes[i].falsenode == ID_LEAF_TRUE_NODE ||
+                _isnan_(nodes[i].value))
+            return false;
+        quantized_nodes.mode = (NODE_MODE)nodes[i].mode;
+        if (nodes[i].feature_id >= thresholds.size())
+            thresholds.resize(nodes[i].feature_id + 1);
+        thresholds[nodes[i].feature_id].push_back(nodes[i].value);
+    }
+    quantized_nodes.n_features = (int64_t)thresholds.size();
+    quantized_nodes.feature_begin.resize(thresholds.size() + 1);
+    quantized_nodes.feature_begin[0] = 0;
+    quantized_nodes.thresholds.clear();
+    for(size_t f = 0; f < thresholds.size(); ++f) {
+        std::sort(thresholds[f].begin(), thresholds[f].end());
+        thresholds[f].erase(std::unique(thresholds[f].begin(), thresholds[f].end()),
+                            thresholds[f].end());
+        // The largest bin is 2n+1, it must remain below nan_bin.
+        if (thresholds[f].size() * 2 + 2 > (size_t)std::numeric_limits<BIN>::max())
+            return false;
+        quantized_nodes.thresholds.insert(quantized_nodes.thresholds.end(),
+                                          thresholds[f].begin(), thresholds[f].end());
+        quantized_nodes.feature_begin[f + 1] = quantized_nodes.thresholds.size();
+    }
+    // A missing value must fail the test for every rule but BRANCH_NEQ.
+    quantized_nodes.nan_bin = (quantized_nodes.mode == NODE_MODE::BRANCH_GT ||
+                               quantized_nodes.mode == NODE_MODE::BRANCH_GTE)
+        ? 0 : std::numeric_limits<BIN>::max();
+
+    quantized_nodes.nodes.resize(nodes.size());
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        QuantizedTreeNodeElement<BIN>& node = quantized_nodes.nodes[i];
+        node.is_missing_track_true = nodes[i].is_missing_track_true;
+        if (!nodes[i].is_not_leaf()) {
+            node.feature_id = 0;
+            node.falsenode = ID_LEAF_TRUE_NODE;
+            node.threshold = 0;
+            continue;
+        }
+        node.feature_id = nodes[i].feature_id;
+        node.falsenode = nodes[i].falsenode;
+        const NTYPE* begin = quantized_nodes.thresholds.data() +
+                             quantized_nodes.feature_begin[node.feature_id];
+        const NTYPE* end = quantized_nodes.thresholds.data() +
+                           quantized_nodes.feature_begin[node.feature_id + 1];
+        node.threshold = (BIN)((std::lower_bound(begin, end, nodes[i].value) - begin) * 2 + 2);
+    }
+    return true;
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::init_avx2() const {
+    if (!std::is_same<NTYPE, float>::value || array_structure_ != 2 ||
+            !same_mode_ || !tree_avx2_kernel_available())
+        return false;
+    // Node offsets are 32 bits integers in the kernel.
+    if ((uint64_t)packed_nodes_.nodes.size() * sizeof(PackedTreeNodeElement<NTYPE>) >=
+            (uint64_t)std::numeric_limits<int32_t>::max())
+        return false;
+    for(auto it = packed_nodes_.nodes.begin(); it != packed_nodes_.nodes.end(); ++it) {
+        if (!it->is_not_leaf())
+            continue;
+        if (it->mode != (uint8_t)NODE_MODE::BRANCH_LEQ || it->falsenode == ID_LEAF_TRUE_NODE)
+            return false;
+    }
+    return true;
 }
 
 
@@ -476,15 +1718,475 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::switch_to_array_structure() {
                 " leaf: ", nodes_[i].is_not_leaf() ? 1 : 0));
     }
 
+    switch_to_complete_trees();
+
     if (nodes_ != nullptr) {
         for(int64_t i = 0; i < n_nodes_; ++i)
-            sizeof_ -= get_sizeof();
+            sizeof_ -= nodes_[i].get_sizeof();
         delete [] nodes_;
         nodes_ = nullptr;
     }
 }
 
 
+#define MAX_COMPLETE_TREE_DEPTH 24
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::complete_tree_size(
+        size_t node_id, uint32_t level, uint32_t& depth, size_t& n_nodes) const {
+    ++n_nodes;
+    if (!array_nodes_.is_not_leaf(node_id)) {
+        depth = std::max(depth, level);
+        return true;
+    }
+    if (level >= MAX_COMPLETE_TREE_DEPTH || array_nodes_.falsenode[node_id] == ID_LEAF_TRUE_NODE)
+        return false;
+    return complete_tree_size(array_nodes_.truenode[node_id], level + 1, depth, n_nodes) &&
+           complete_tree_size(array_nodes_.falsenode[node_id], level + 1, depth, n_nodes);
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::fill_complete_tree(
+        size_t node_id, size_t pos, uint32_t level, uint32_t depth,
+        size_t node_offset, size_t leaf_offset) {
+    if (level == depth) {
+        complete_nodes_.leaf_id[leaf_offset + pos - ((((size_t)1) << depth) - 1)] = node_id;
+        return;
+    }
+    if (array_nodes_.is_not_leaf(node_id)) {
+        complete_nodes_.feature_id[node_offset + pos] = (uint32_t)array_nodes_.feature_id[node_id];
+        complete_nodes_.value[node_offset + pos] = array_nodes_.value[node_id];
+        complete_nodes_.is_missing_track_true[node_offset + pos] =
+            array_nodes_.is_missing_track_true[node_id] ? 1 : 0;
+        fill_complete_tree(array_nodes_.truenode[node_id], pos * 2 + 1, level + 1, depth,
+                           node_offset, leaf_offset);
+        fill_complete_tree(array_nodes_.falsenode[node_id], pos * 2 + 2, level + 1, depth,
+                           node_offset, leaf_offset);
+    }
+    else {
+        // Padding, both children lead to the same leaf.
+        complete_nodes_.feature_id[node_offset + pos] = 0;
+        complete_nodes_.value[node_offset + pos] = 0;
+        complete_nodes_.is_missing_track_true[node_offset + pos] = 0;
+        fill_complete_tree(node_id, pos * 2 + 1, level + 1, depth, node_offset, leaf_offset);
+        fill_complete_tree(node_id, pos * 2 + 2, level + 1, depth, node_offset, leaf_offset);
+    }
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::switch_to_complete_trees() {
+    complete_nodes_.node_offset.resize(array_nodes_.root_id.size());
+    complete_nodes_.leaf_offset.resize(array_nodes_.root_id.size());
+    complete_nodes_.depth.resize(array_nodes_.root_id.size());
+    std::fill(complete_nodes_.node_offset.begin(), complete_nodes_.node_offset.end(), NOT_COMPLETE_TREE);
+    complete_nodes_.feature_id.clear();
+    complete_nodes_.value.clear();
+    complete_nodes_.is_missing_track_true.clear();
+    complete_nodes_.leaf_id.clear();
+    if (same_mode_ && complete_tree_ratio_ > 0) {
+        for(size_t j = 0; j < array_nodes_.root_id.size(); ++j) {
+            uint32_t depth = 0;
+            size_t n_nodes = 0;
+            if (!complete_tree_size(array_nodes_.root_id[j], 0, depth, n_nodes))
+                continue;
+            size_t n_leaves = ((size_t)1) << depth;
+            if ((double)(n_leaves * 2 - 1) > complete_tree_ratio_ * n_nodes)
+                continue;
+            complete_nodes_.depth[j] = depth;
+            complete_nodes_.node_offset[j] = complete_nodes_.value.size();
+            complete_nodes_.leaf_offset[j] = complete_nodes_.leaf_id.size();
+            complete_nodes_.feature_id.resize(complete_nodes_.feature_id.size() + n_leaves - 1);
+            complete_nodes_.value.resize(complete_nodes_.value.size() + n_leaves - 1);
+            complete_nodes_.is_missing_track_true.resize(
+                complete_nodes_.is_missing_track_true.size() + n_leaves - 1);
+            complete_nodes_.leaf_id.resize(complete_nodes_.leaf_id.size() + n_leaves);
+            fill_complete_tree(array_nodes_.root_id[j], 0, 0, depth,
+                               complete_nodes_.node_offset[j], complete_nodes_.leaf_offset[j]);
+        }
+    }
+    sizeof_ += complete_nodes_.get_sizeof();
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::switch_to_packed_structure() {
+    if (n_nodes_ >= (int64_t)ID_LEAF_TRUE_NODE)
+        throw std::invalid_argument(MakeString(
+            "Too many nodes (", n_nodes_, ") for array_structure=2."));
+
+    // Every tree is renumbered in depth-first order, the true child
+    // of a node is stored right after it.
+    TreeNodeElement<NTYPE> * first = &nodes_[0];
+    std::vector<uint32_t> new_id(n_nodes_, ID_LEAF_TRUE_NODE);
+    std::vector<TreeNodeElement<NTYPE>*> order;
+    std::vector<TreeNodeElement<NTYPE>*> stack;
+    order.reserve(n_nodes_);
+    packed_nodes_.root_id.resize(roots_.size());
+    for(size_t j = 0; j < roots_.size(); ++j) {
+        packed_nodes_.root_id[j] = order.size();
+        stack.push_back(roots_[j]);
+        while (!stack.empty()) {
+            TreeNodeElement<NTYPE> * node = stack.back();
+            stack.pop_back();
+            if (new_id[std::distance(first, node)] != ID_LEAF_TRUE_NODE)
+                continue;
+            new_id[std::distance(first, node)] = (uint32_t)order.size();
+            order.push_back(node);
+            if (node->is_not_leaf()) {
+                if (node->falsenode != nullptr)
+                    stack.push_back(node->falsenode);
+                stack.push_back(node->truenode);
+            }
+        }
+    }
+
+    packed_nodes_.nodes.resize(order.size());
+    packed_nodes_.weights.clear();
+    std::vector<size_t> no_weights;
+    for(size_t i = 0; i < order.size(); ++i) {
+        TreeNodeElement<NTYPE> * node = order[i];
+        PackedTreeNodeElement<NTYPE>& packed = packed_nodes_.nodes[i];
+        packed.value = node->value;
+        // Leaves keep feature 0, the AVX2 kernel still gathers x for them.
+        packed.feature_id = node->is_not_leaf() ? (uint32_t)node->feature_id : 0;
+        packed.mode = (uint8_t)node->mode;
+        packed.is_missing_track_true = node->is_missing_track_true ? 1 : 0;
+        if (node->is_not_leaf()) {
+            packed.truenode = new_id[std::distance(first, node->truenode)];
+            packed.falsenode = node->falsenode == nullptr
+                ? ID_LEAF_TRUE_NODE : new_id[std::distance(first, node->falsenode)];
+            packed.weights_begin = packed.weights_end = 0;
+        }
+        else {
+            packed.truenode = packed.falsenode = ID_LEAF_TRUE_NODE;
+            if (node->weights_vect.empty()) {
+                no_weights.push_back(i);
+                continue;
+            }
+            packed.weights_begin = (uint32_t)packed_nodes_.weights.size();
+            packed_nodes_.weights.insert(packed_nodes_.weights.end(),
+                                         node->weights_vect.begin(),
+                                         node->weights_vect.end());
+            packed.weights_end = (uint32_t)packed_nodes_.weights.size();
+        }
+    }
+    if (!no_weights.empty()) {
+        // Leaves without weights point to an empty range
+        // starting with a null weight.
+        SparseValue<NTYPE> w;
+        w.i = 0;
+        w.value = 0;
+        uint32_t sentinel = (uint32_t)packed_nodes_.weights.size();
+        packed_nodes_.weights.push_back(w);
+        for(auto it = no_weights.begin(); it != no_weights.end(); ++it)
+            packed_nodes_.nodes[*it].weights_begin = packed_nodes_.nodes[*it].weights_end = sentinel;
+    }
+
+    sizeof_ += packed_nodes_.get_sizeof();
+    for(int64_t i = 0; i < n_nodes_; ++i)
+        sizeof_ -= nodes_[i].get_sizeof();
+    delete [] nodes_;
+    nodes_ = nullptr;
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::quickscorer_visit(
+        TreeNodeElement<NTYPE> * node, uint32_t tree_id,
+        std::vector<unsigned char>& visited,
+        std::vector<TreeNodeElement<NTYPE>*>& leaves) {
+    size_t pos = std::distance(nodes_, node);
+    if (visited[pos])
+        return false;
+    visited[pos] = 1;
+    if (!node->is_not_leaf()) {
+        leaves.push_back(node);
+        return leaves.size() <= 64;
+    }
+    // NaN missing values are replaced by +inf when the trees are evaluated,
+    // the result would be different for a NaN or an infinite threshold.
+    if (node->falsenode == nullptr || _isnan_(node->value) ||
+            node->value == std::numeric_limits<NTYPE>::infinity())
+        return false;
+    size_t lo = leaves.size();
+    if (!quickscorer_visit(node->truenode, tree_id, visited, leaves))
+        return false;
+    size_t hi = leaves.size();
+    if (!quickscorer_visit(node->falsenode, tree_id, visited, leaves))
+        return false;
+    uint64_t true_leaves = hi - lo == 64
+        ? ~((uint64_t)0) : ((((uint64_t)1) << (hi - lo)) - 1) << lo;
+    qs_nodes_.thresholds.push_back(node->value);
+    qs_nodes_.tree_id.push_back(tree_id);
+    qs_nodes_.masks.push_back(~true_leaves);
+    qs_nodes_.feature_begin.push_back(node->feature_id);
+    return true;
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::init_quickscorer() {
+    // The original nodes are released by array_structure > 0.
+    if (nodes_ == nullptr || !same_mode_ || has_missing_tracks_ ||
+            (int64_t)roots_.size() != n_trees_)
+        return false;
+    qs_nodes_.strict = false;
+    for(int64_t i = 0; i < n_nodes_; ++i) {
+        if (!nodes_[i].is_not_leaf())
+            continue;
+        if (nodes_[i].mode == NODE_MODE::BRANCH_LT)
+            qs_nodes_.strict = true;
+        else if (nodes_[i].mode != NODE_MODE::BRANCH_LEQ)
+            return false;
+        break;
+    }
+
+    // feature_begin temporarily holds the feature of every node.
+    qs_nodes_.feature_begin.clear();
+    qs_nodes_.thresholds.clear();
+    qs_nodes_.tree_id.clear();
+    qs_nodes_.masks.clear();
+    qs_nodes_.leaf_offset.resize(n_trees_ + 1);
+    std::vector<unsigned char> visited(n_nodes_, 0);
+    std::vector<TreeNodeElement<NTYPE>*> leaves, tree_leaves;
+    for(size_t j = 0; j < roots_.size(); ++j) {
+        qs_nodes_.leaf_offset[j] = (uint32_t)leaves.size();
+        tree_leaves.clear();
+        if (!quickscorer_visit(roots_[j], (uint32_t)j, visited, tree_leaves))
+            return false;
+        leaves.insert(leaves.end(), tree_leaves.begin(), tree_leaves.end());
+    }
+    qs_nodes_.leaf_offset[n_trees_] = (uint32_t)leaves.size();
+
+    // Sorts the nodes by feature and threshold.
+    std::vector<size_t> order(qs_nodes_.thresholds.size());
+    for(size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    const std::vector<size_t>& features = qs_nodes_.feature_begin;
+    const std::vector<NTYPE>& thresholds = qs_nodes_.thresholds;
+    std::stable_sort(order.begin(), order.end(), [&features, &thresholds](size_t a, size_t b) {
+        return features[a] < features[b] ||
+               (features[a] == features[b] && thresholds[a] < thresholds[b]);
+    });
+    qs_nodes_.n_features = order.empty() ? 0 : (int64_t)features[order.back()] + 1;
+    std::vector<size_t> feature_begin(qs_nodes_.n_features + 1, 0);
+    std::vector<NTYPE> sorted_thresholds(order.size());
+    std::vector<uint32_t> sorted_tree_id(order.size());
+    std::vector<uint64_t> sorted_masks(order.size());
+    for(size_t i = 0; i < order.size(); ++i) {
+        ++feature_begin[features[order[i]] + 1];
+        sorted_thresholds[i] = thresholds[order[i]];
+        sorted_tree_id[i] = qs_nodes_.tree_id[order[i]];
+        sorted_masks[i] = qs_nodes_.masks[order[i]];
+    }
+    for(int64_t f = 0; f < qs_nodes_.n_features; ++f)
+        feature_begin[f + 1] += feature_begin[f];
+    qs_nodes_.feature_begin = feature_begin;
+    qs_nodes_.thresholds = sorted_thresholds;
+    qs_nodes_.tree_id = sorted_tree_id;
+    qs_nodes_.masks = sorted_masks;
+
+    // Leaves weights.
+    PackedTreeNodeElements<NTYPE>& pleaves = qs_nodes_.leaves;
+    pleaves.nodes.resize(leaves.size());
+    pleaves.weights.clear();
+    pleaves.root_id.clear();
+    std::vector<size_t> no_weights;
+    for(size_t i = 0; i < leaves.size(); ++i) {
+        PackedTreeNodeElement<NTYPE>& leaf = pleaves.nodes[i];
+        leaf.value = 0;
+        leaf.feature_id = 0;
+        leaf.mode = (uint8_t)NODE_MODE::LEAF;
+        leaf.is_missing_track_true = 0;
+        leaf.truenode = leaf.falsenode = ID_LEAF_TRUE_NODE;
+        if (leaves[i]->weights_vect.empty()) {
+            no_weights.push_back(i);
+            continue;
+        }
+        leaf.weights_begin = (uint32_t)pleaves.weights.size();
+        pleaves.weights.insert(pleaves.weights.end(),
+                               leaves[i]->weights_vect.begin(),
+                               leaves[i]->weights_vect.end());
+        leaf.weights_end = (uint32_t)pleaves.weights.size();
+    }
+    if (!no_weights.empty()) {
+        SparseValue<NTYPE> w;
+        w.i = 0;
+        w.value = 0;
+        uint32_t sentinel = (uint32_t)pleaves.weights.size();
+        pleaves.weights.push_back(w);
+        for(auto it = no_weights.begin(); it != no_weights.end(); ++it)
+            pleaves.nodes[*it].weights_begin = pleaves.nodes[*it].weights_end = sentinel;
+    }
+    return true;
+}
+
+
+template<typename NTYPE>
+TreeEnsembleSchedule RuntimeTreeEnsembleCommonP<NTYPE>::select_schedule(int64_t N) const {
+    for(auto it = schedule_.begin(); it != schedule_.end(); ++it) {
+        if (N <= it->max_N)
+            return *it;
+    }
+    if (!schedule_.empty())
+        return schedule_.back();
+    TreeEnsembleSchedule schedule = {N, omp_tree_, omp_N_, para_tree_, tile_cache_size_};
+    return schedule;
+}
+
+
+template<typename NTYPE>
+std::vector<std::vector<int64_t>> RuntimeTreeEnsembleCommonP<NTYPE>::get_schedule() const {
+    std::vector<std::vector<int64_t>> res(schedule_.size());
+    for(size_t i = 0; i < schedule_.size(); ++i)
+        res[i] = {schedule_[i].max_N, schedule_[i].omp_tree, schedule_[i].omp_N,
+                  schedule_[i].para_tree ? 1 : 0, schedule_[i].tile_cache_size};
+    return res;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_schedule(const std::vector<std::vector<int64_t>>& schedule) {
+    std::vector<TreeEnsembleSchedule> res(schedule.size());
+    for(size_t i = 0; i < schedule.size(); ++i) {
+        if (schedule[i].size() != 5)
+            throw std::invalid_argument(MakeString(
+                "Every schedule must have 5 values (max_N, omp_tree, omp_N, para_tree, "
+                "tile_cache_size) not ", schedule[i].size(), "."));
+        if (i > 0 && schedule[i][0] <= schedule[i - 1][0])
+            throw std::invalid_argument("Schedules must be sorted by increasing max_N.");
+        if (schedule[i][3] && array_structure_ == 0)
+            throw std::invalid_argument("array_structure must be enabled for para_tree.");
+        res[i].max_N = schedule[i][0];
+        res[i].omp_tree = (int)schedule[i][1];
+        res[i].omp_N = (int)schedule[i][2];
+        res[i].para_tree = schedule[i][3] != 0;
+        res[i].tile_cache_size = schedule[i][4];
+    }
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    schedule_ = res;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::calibration_features(
+        int64_t N, std::vector<NTYPE>& X, int64_t& n_features) const {
+    // Every feature is drawn around the thresholds the model compares it to
+    // so that the synthetic observations follow every branch.
+    std::vector<std::vector<NTYPE>> thresholds;
+    auto add = [&thresholds](size_t feature_id, NTYPE value) {
+        if (feature_id >= thresholds.size())
+            thresholds.resize(feature_id + 1);
+        thresholds[feature_id].push_back(value);
+    };
+    switch(array_structure_) {
+        case 0:
+            for(int64_t i = 0; i < n_nodes_; ++i)
+                if (nodes_[i].is_not_leaf())
+                    add(nodes_[i].feature_id, nodes_[i].value);
+            break;
+        case 1:
+            for(size_t i = 0; i < array_nodes_.feature_id.size(); ++i)
+                if (array_nodes_.is_not_leaf(i))
+                    add(array_nodes_.feature_id[i], array_nodes_.value[i]);
+            break;
+        default:
+            for(size_t i = 0; i < packed_nodes_.nodes.size(); ++i)
+                if (packed_nodes_.nodes[i].is_not_leaf())
+                    add(packed_nodes_.nodes[i].feature_id, packed_nodes_.nodes[i].value);
+            break;
+    }
+    n_features = std::max((int64_t)1, (int64_t)thresholds.size());
+    X.resize(N * n_features);
+    std::mt19937 gen(0);
+    std::uniform_real_distribution<double> noise(-1, 1);
+    for(int64_t i = 0; i < N; ++i) {
+        for(int64_t f = 0; f < n_features; ++f) {
+            if (f >= (int64_t)thresholds.size() || thresholds[f].empty()) {
+                X[i * n_features + f] = (NTYPE)noise(gen);
+                continue;
+            }
+            NTYPE t = thresholds[f][gen() % thresholds[f].size()];
+            X[i * n_features + f] = (NTYPE)(t + noise(gen) * (std::abs(t) * 1e-2 + 1e-2));
+        }
+    }
+}
+
+
+template<typename NTYPE>
+std::vector<std::vector<int64_t>> RuntimeTreeEnsembleCommonP<NTYPE>::calibrate(
+        const std::vector<int64_t>& batch_sizes, int repeat) {
+    if (batch_sizes.empty())
+        throw std::invalid_argument("batch_sizes cannot be empty.");
+    for(size_t i = 1; i < batch_sizes.size(); ++i)
+        if (batch_sizes[i] <= batch_sizes[i - 1])
+            throw std::invalid_argument("batch_sizes must be sorted by increasing size.");
+    if (batch_sizes[0] <= 0)
+        throw std::invalid_argument("batch_sizes must be strictly positive.");
+    repeat = std::max(repeat, 1);
+
+    int64_t n_features;
+    std::vector<NTYPE> features;
+    calibration_features(batch_sizes.back(), features, n_features);
+
+    const int never = std::numeric_limits<int>::max();
+    std::vector<TreeEnsembleSchedule> candidates;
+    // sequential
+    candidates.push_back({0, never, never, false, 0});
+    // parallelized over observations
+    candidates.push_back({0, never, 0, false, 0});
+    // parallelized over trees
+    candidates.push_back({0, 0, never, array_structure_ != 0, 0});
+    if (array_structure_ != 0) {
+        // tiles (tree chunks, observation blocks)
+        candidates.push_back({0, never, 0, false, 1 << 18});
+        candidates.push_back({0, never, 0, false, 1 << 20});
+    }
+
+    // Every candidate is given to the computation, the members are left unchanged.
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(
+        batch_sizes.back() * n_targets_or_classes_);
+    std::vector<TreeEnsembleSchedule> schedule;
+    {
+        py::gil_scoped_release release;
+        TreeEnsembleSharedLock lock(lock_);
+        _AggregatorSum<NTYPE> agg(n_trees_, n_targets_or_classes_, post_transform_, &base_values_);
+        for(auto N : batch_sizes) {
+            std::vector<int64_t> x_dims{N, n_features};
+            double best_time = std::numeric_limits<double>::max();
+            TreeEnsembleSchedule best = candidates[0];
+            for(auto it = candidates.begin(); it != candidates.end(); ++it) {
+                if (N == 1 && it->tile_cache_size > 0)
+                    continue;
+                compute_gil_free_dispatch(x_dims, N, n_features, features.data(), Z, nullptr, agg, *it);
+                double duration = std::numeric_limits<double>::max();
+                for(int r = 0; r < repeat; ++r) {
+                    auto begin = std::chrono::high_resolution_clock::now();
+                    compute_gil_free_dispatch(x_dims, N, n_features, features.data(), Z, nullptr,
+                                              agg, *it);
+                    duration = std::min(duration, std::chrono::duration<double>(
+                        std::chrono::high_resolution_clock::now() - begin).count());
+                }
+                if (duration < best_time) {
+                    best_time = duration;
+                    best = *it;
+                }
+            }
+            best.max_N = N;
+            schedule.push_back(best);
+        }
+    }
+    {
+        std::lock_guard<TreeEnsembleLock> lock(lock_);
+        schedule_ = schedule;
+    }
+    return get_schedule();
+}
+
+
 template<typename NTYPE>
 std::vector<std::string> RuntimeTreeEnsembleCommonP<NTYPE>::get_nodes_modes() const {
     std::vector<std::string> res;
@@ -494,6 +2196,132 @@ std::vector<std::string> RuntimeTreeEnsembleCommonP<NTYPE>::get_nodes_modes() co
 }
 
 
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::has_dense_weights() const {
+    return !packed_nodes_.dense_weights.empty();
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::get_quickscorer() const {
+    return quickscorer_;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_quickscorer(bool value) {
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    if (n_trees_ == 0) {
+        quickscorer_ = value;
+        return;
+    }
+    if (quickscorer_)
+        sizeof_ -= qs_nodes_.get_sizeof();
+    quickscorer_ = value && init_quickscorer();
+    if (quickscorer_)
+        sizeof_ += qs_nodes_.get_sizeof();
+    else
+        qs_nodes_ = QuickScorerTreeNodeElements<NTYPE>();
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::get_avx2() const {
+    return avx2_;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_avx2(bool value) {
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    // The kernel walks the packed nodes, it needs nothing else.
+    avx2_ = n_trees_ == 0 ? value : value && init_avx2();
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::rebuild_lookup(bool value) {
+    // The caller holds the exclusive lock.
+    if (n_trees_ == 0) {
+        lookup_ = value;
+        return;
+    }
+    for (auto it = lookup_tables_.begin(); it != lookup_tables_.end(); ++it)
+        sizeof_ -= it->get_sizeof();
+    lookup_ = value && init_lookup();
+    if (!lookup_) {
+        tree_lookup_.clear();
+        lookup_tables_.clear();
+    }
+    for (auto it = lookup_tables_.begin(); it != lookup_tables_.end(); ++it)
+        sizeof_ += it->get_sizeof();
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::get_lookup() const {
+    return lookup_;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_lookup(bool value) {
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    rebuild_lookup(value);
+}
+
+
+template<typename NTYPE>
+int RuntimeTreeEnsembleCommonP<NTYPE>::get_lookup_max_cardinality() const {
+    return lookup_max_cardinality_;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_lookup_max_cardinality(int value) {
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    lookup_max_cardinality_ = value;
+    rebuild_lookup(lookup_);
+}
+
+
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::get_lookup_max_size() const {
+    return lookup_max_size_;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_lookup_max_size(int64_t value) {
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    lookup_max_size_ = value;
+    rebuild_lookup(lookup_);
+}
+
+
+template<typename NTYPE>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::get_bfloat16() const {
+    return bfloat16_;
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::set_bfloat16(bool value) {
+    std::lock_guard<TreeEnsembleLock> lock(lock_);
+    if (n_trees_ == 0) {
+        bfloat16_ = value;
+        return;
+    }
+    if (bfloat16_)
+        sizeof_ -= half_nodes_.get_sizeof();
+    bfloat16_ = value && init_bfloat16();
+    if (bfloat16_)
+        sizeof_ += half_nodes_.get_sizeof();
+    else
+        half_nodes_ = HalfTreeNodeElements<NTYPE>();
+}
+
+
 template<typename NTYPE> template<typename AGG>
 py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::compute_agg(
         py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X, const AGG &agg) {
@@ -511,10 +2339,12 @@ py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::compute_agg(
 
     {
         py::gil_scoped_release release;
-        if (array_structure_)
-            compute_gil_free_array_structure(x_dims, N, stride, X, Z, nullptr, agg);
-        else
-            compute_gil_free(x_dims, N, stride, X, Z, nullptr, agg);
+        TreeEnsembleSharedLock lock(lock_);
+        // append_trees may have been called since agg was created.
+        AGG agg_model(agg);
+        agg_model.set_n_trees(n_trees_);
+        compute_gil_free_dispatch(x_dims, N, stride, X.data(0), Z, nullptr, agg_model,
+                                  select_schedule(N));
     }
     return Z;
 }
@@ -533,22 +2363,144 @@ py::tuple RuntimeTreeEnsembleCommonP<NTYPE>::compute_cl_agg(
     int64_t stride = xdims1 ? x_dims[0] : x_dims[1];  
     int64_t N = xdims1 ? 1 : x_dims[0];
 
-    // Tensor* Y = context->Output(0, TensorShape({N}));
-    // auto* Z = context->Output(1, TensorShape({N, class_count_}));
-    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(x_dims[0] * n_targets_or_classes_);
-    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Y(x_dims[0]);
+    // Tensor* Y = context->Output(0, TensorShape({N}));
+    // auto* Z = context->Output(1, TensorShape({N, class_count_}));
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(x_dims[0] * n_targets_or_classes_);
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Y(x_dims[0]);
+
+    {
+        py::gil_scoped_release release;
+        TreeEnsembleSharedLock lock(lock_);
+        // append_trees may have been called since agg was created.
+        AGG agg_model(agg);
+        agg_model.set_n_trees(n_trees_);
+        compute_gil_free_dispatch(x_dims, N, stride, X.data(0), Z, &Y, agg_model,
+                                  select_schedule(N));
+    }
+    return py::make_tuple(Y, Z);
+}
+
+
+template<typename NTYPE> template<typename AGG>
+py::tuple RuntimeTreeEnsembleCommonP<NTYPE>::compute_label_agg(
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X, const AGG &agg) {
+    std::vector<int64_t> x_dims;
+    arrayshape2vector(x_dims, X);
+    if (x_dims.size() != 2)
+        throw std::invalid_argument("X must have 2 dimensions.");
+    int64_t stride = x_dims[1];
+    int64_t N = x_dims[0];
+
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Y(N);
+    // The scores are only needed without the cascade.
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(
+        cascade_ ? 0 : N * n_targets_or_classes_);
+    int64_t evaluated;
+    std::vector<int64_t> retired;
+
+    {
+        py::gil_scoped_release release;
+        TreeEnsembleSharedLock lock(lock_);
+        AGG agg_model(agg);
+        agg_model.set_n_trees(n_trees_);
+        if (cascade_)
+            compute_gil_free_cascade(x_dims, N, stride, X.data(0), Y, agg_model,
+                                     select_schedule(N), evaluated, retired);
+        else {
+            evaluated = N * n_trees_;
+            compute_gil_free_dispatch(x_dims, N, stride, X.data(0), Z, &Y, agg_model,
+                                      select_schedule(N));
+        }
+    }
+    return py::make_tuple(Y, evaluated, retired);
+}
+
+
+template<typename NTYPE> template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_dispatch(
+        const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+        const NTYPE* x_data,
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+        const AGG &agg, const TreeEnsembleSchedule& schedule) {
+    // The average and the tiles divide by the number of trees.
+    if (n_trees_ == 0)
+        throw std::invalid_argument("The model has no tree, init must be called first.");
+    // Labels (Y) are only computed for classifiers.
+    if (quickscorer_)
+        compute_gil_free_quickscorer(x_dims, N, stride, x_data, Z, Y, agg, schedule);
+    else if (quantized_ && !quantized8_.nodes.empty())
+        compute_gil_free_quantized(x_dims, N, stride, x_data, Z, Y, quantized8_, agg, schedule);
+    else if (quantized_)
+        compute_gil_free_quantized(x_dims, N, stride, x_data, Z, Y, quantized16_, agg, schedule);
+    else if (Y == nullptr && bfloat16_)
+        compute_gil_free_bfloat16(x_dims, N, stride, x_data, Z, agg, schedule);
+    else if (avx2_)
+        compute_gil_free_avx2(x_dims, N, stride, x_data, Z, Y, agg, schedule);
+    else if (array_structure_ == 2)
+        compute_gil_free_array_structure(x_dims, N, stride, x_data, Z, Y, packed_nodes_,
+                                         agg, schedule);
+    else if (array_structure_)
+        compute_gil_free_array_structure(x_dims, N, stride, x_data, Z, Y, array_nodes_,
+                                         agg, schedule);
+    else
+        compute_gil_free(x_dims, N, stride, x_data, Z, Y, agg, schedule);
+}
+
+
+template<typename NTYPE> template<typename AGG>
+py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::compute_csr_agg(
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+        int64_t n_features, const AGG &agg) {
+    int64_t N = check_csr(data, indices, indptr, n_features);
+    int64_t n_rows = csr_block_rows(N);
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(N * n_targets_or_classes_);
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Zb(n_rows * n_targets_or_classes_);
+    {
+        py::gil_scoped_release release;
+        TreeEnsembleSharedLock lock(lock_);
+        AGG agg_model(agg);
+        agg_model.set_n_trees(n_trees_);
+        compute_gil_free_csr(N, n_features, n_rows, data.data(0), indices.data(0), indptr.data(0),
+                             Z, nullptr, Zb, nullptr, agg_model, select_schedule(N));
+    }
+    return Z;
+}
+
 
+template<typename NTYPE> template<typename AGG>
+py::tuple RuntimeTreeEnsembleCommonP<NTYPE>::compute_cl_csr_agg(
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+        int64_t n_features, const AGG &agg) {
+    int64_t N = check_csr(data, indices, indptr, n_features);
+    int64_t n_rows = csr_block_rows(N);
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Z(N * n_targets_or_classes_);
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Y(N);
+    py::array_t<NTYPE, py::array::c_style | py::array::forcecast> Zb(n_rows * n_targets_or_classes_);
+    py::array_t<int64_t, py::array::c_style | py::array::forcecast> Yb(n_rows);
     {
         py::gil_scoped_release release;
-        if (array_structure_)
-            compute_gil_free_array_structure(x_dims, N, stride, X, Z, &Y, agg);
-        else
-            compute_gil_free(x_dims, N, stride, X, Z, &Y, agg);
+        TreeEnsembleSharedLock lock(lock_);
+        AGG agg_model(agg);
+        agg_model.set_n_trees(n_trees_);
+        compute_gil_free_csr(N, n_features, n_rows, data.data(0), indices.data(0), indptr.data(0),
+                             Z, &Y, Zb, &Yb, agg_model, select_schedule(N));
     }
     return py::make_tuple(Y, Z);
 }
 
 
+template<typename NTYPE>
+int64_t RuntimeTreeEnsembleCommonP<NTYPE>::csr_block_rows(int64_t N) const {
+    int64_t row_size = std::max((int64_t)1, n_features_) * (int64_t)sizeof(NTYPE);
+    return std::max((int64_t)1, std::min(N, csr_buffer_size_ / row_size));
+}
+
+
 py::detail::unchecked_mutable_reference<float, 1> _mutable_unchecked1(py::array_t<float, py::array::c_style | py::array::forcecast>& Z) {
     return Z.mutable_unchecked<1>();
 }
@@ -564,20 +2516,70 @@ py::detail::unchecked_mutable_reference<double, 1> _mutable_unchecked1(py::array
 }
 
 
+template<typename NTYPE> template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_csr(
+        int64_t N, int64_t n_features, int64_t n_rows,
+        const NTYPE* data, const int64_t* indices, const int64_t* indptr,
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Zb,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Yb,
+        const AGG &agg, const TreeEnsembleSchedule& schedule) {
+    // Blocks of rows are copied into a dense buffer which only keeps
+    // the features the trees use, the other values are null.
+    if (n_features < n_features_)
+        throw std::invalid_argument(MakeString(
+            "The sparse matrix has ", n_features, " columns but the model expects at least ",
+            n_features_, "."));
+    int64_t stride = std::max((int64_t)1, n_features_);
+    std::vector<NTYPE> buffer(n_rows * stride, (NTYPE)0);
+    NTYPE* z_data = (NTYPE*)_mutable_unchecked1(Z).data(0);
+    const NTYPE* zb_data = (const NTYPE*)_mutable_unchecked1(Zb).data(0);
+    for (int64_t begin = 0; begin < N; begin += n_rows) {
+        int64_t end = std::min(N, begin + n_rows);
+        NTYPE* row = buffer.data();
+        for (int64_t i = begin; i < end; ++i, row += stride) {
+            for (int64_t k = indptr[i]; k < indptr[i + 1]; ++k) {
+                // duplicated indices are summed as scipy does
+                if (indices[k] < stride)
+                    row[indices[k]] += data[k];
+            }
+        }
+
+        std::vector<int64_t> x_dims{end - begin, stride};
+        compute_gil_free_dispatch(x_dims, end - begin, stride, buffer.data(), Zb, Yb, agg, schedule);
+        std::copy(zb_data, zb_data + (end - begin) * n_targets_or_classes_,
+                  z_data + begin * n_targets_or_classes_);
+        if (Y != nullptr) {
+            const int64_t* yb_data = (const int64_t*)_mutable_unchecked1(*Yb).data(0);
+            std::copy(yb_data, yb_data + (end - begin),
+                      (int64_t*)_mutable_unchecked1(*Y).data(0) + begin);
+        }
+
+        row = buffer.data();
+        for (int64_t i = begin; i < end; ++i, row += stride) {
+            for (int64_t k = indptr[i]; k < indptr[i + 1]; ++k) {
+                if (indices[k] < stride)
+                    row[indices[k]] = 0;
+            }
+        }
+    }
+}
+
+
 template<typename NTYPE> template<typename AGG>
 void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free(
                 const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
-                const py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& X,
+                const NTYPE* x_data,
                 py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
                 py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
-                const AGG &agg) {
+                const AGG &agg, const TreeEnsembleSchedule& schedule) {
 
     // expected primary-expression before ')' token
     auto Z_ = _mutable_unchecked1(Z); // Z.mutable_unchecked<(size_t)1>();
-    const NTYPE* x_data = X.data(0);
 
     if (n_targets_or_classes_ == 1) {
-        if ((N == 1) && (n_trees_ <= omp_tree_)) { DEBUGPRINT("A")
+        if ((N == 1) && (n_trees_ <= schedule.omp_tree)) { DEBUGPRINT("A")
             NTYPE scores = 0;
             unsigned char has_scores = 0;
             for (int64_t j = 0; j < n_trees_; ++j)
@@ -611,7 +2613,7 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free(
             agg.FinalizeScores1((NTYPE*)Z_.data(0), scores, has_scores,
                                 Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(0));
         }
-        else if (N <= omp_N_) { DEBUGPRINT("C")
+        else if (N <= schedule.omp_N) { DEBUGPRINT("C")
             NTYPE scores;
             unsigned char has_scores;
             size_t j;
@@ -651,7 +2653,7 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free(
         }
     }
     else {
-        if ((N == 1) && (n_trees_ <= omp_tree_)) { DEBUGPRINT("E")
+        if ((N == 1) && (n_trees_ <= schedule.omp_tree)) { DEBUGPRINT("E")
             std::vector<NTYPE> scores(n_targets_or_classes_, (NTYPE)0);
             std::vector<unsigned char> has_scores(scores.size(), 0);
 
@@ -692,7 +2694,7 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free(
             agg.FinalizeScores(scores.data(), has_scores.data(), (NTYPE*)Z_.data(0), -1,
                                Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(0));
         }
-        else if (N <= omp_N_) { DEBUGPRINT("H")
+        else if (N <= schedule.omp_N) { DEBUGPRINT("H")
             std::vector<NTYPE> scores(n_targets_or_classes_);
             std::vector<unsigned char> has_scores(scores.size());
             size_t j;
@@ -741,26 +2743,30 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free(
 
 #define BATCHSIZE 128
 
-template<typename NTYPE> template<typename AGG>
+template<typename NTYPE> template<typename AGG, typename NODES>
 void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
-                const py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& X,
+                const NTYPE* x_data,
                 py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
                 py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
-                const AGG &agg) {
+                const NODES& nodes, const AGG &agg, const TreeEnsembleSchedule& schedule) {
+
+    if ((schedule.tile_cache_size > 0) && (N > 1)) { DEBUGPRINT("L")
+        compute_gil_free_tiled(x_dims, N, stride, x_data, Z, Y, nodes, agg, schedule);
+        return;
+    }
 
     // expected primary-expression before ')' token
     auto Z_ = _mutable_unchecked1(Z); // Z.mutable_unchecked<(size_t)1>();
-    const NTYPE* x_data = X.data(0);
                     
     if (n_targets_or_classes_ == 1) {
-        if ((N == 1)  && ((omp_get_max_threads() <= 1) || (n_trees_ <= omp_tree_))) { DEBUGPRINT("M")
+        if ((N == 1)  && ((omp_get_max_threads() <= 1) || (n_trees_ <= schedule.omp_tree))) { DEBUGPRINT("M")
             NTYPE scores = 0;
             unsigned char has_scores = 0;
             for (int64_t j = 0; j < n_trees_; ++j)
                 agg.ProcessTreeNodePrediction1(
-                    &scores, array_nodes_,
-                    ProcessTreeNodeLeave(array_nodes_.root_id[j], x_data),
+                    &scores, nodes,
+                    ProcessTreeLeave(nodes, j, x_data),
                     &has_scores);
 
             agg.FinalizeScores1((NTYPE*)Z_.data(0), scores, has_scores,
@@ -776,8 +2782,8 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
             #endif
             for (int64_t j = 0; j < n_trees_; ++j) {
                 agg.ProcessTreeNodePrediction1(
-                    &(scores_t_tree[j]), array_nodes_,
-                    ProcessTreeNodeLeave(array_nodes_.root_id[j], x_data),
+                    &(scores_t_tree[j]), nodes,
+                    ProcessTreeLeave(nodes, j, x_data),
                     &(has_scores_t_tree[j]));
             }
             auto it = scores_t_tree.cbegin();
@@ -788,7 +2794,7 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
             agg.FinalizeScores1((NTYPE*)Z_.data(0), scores, has_scores,
                                 Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(0));
         }
-        else if ((omp_get_max_threads() > 1) && para_tree_ && (n_trees_ > omp_tree_)) { DEBUGPRINT("O")
+        else if ((omp_get_max_threads() > 1) && schedule.para_tree && (n_trees_ > schedule.omp_tree)) { DEBUGPRINT("O")
             auto nth = omp_get_max_threads();
             std::vector<NTYPE> local_scores(N * nth, 0);
             std::vector<unsigned char> local_has_scores(local_scores.size(), 0);
@@ -802,8 +2808,8 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 unsigned char* p_has_score = &local_has_scores[th * N];
                 for(int64_t i = 0; i < N; ++i, local_x_data += stride, ++p_score, ++p_has_score) {
                     agg.ProcessTreeNodePrediction1(
-                        p_score, array_nodes_,
-                        ProcessTreeNodeLeave(array_nodes_.root_id[j], local_x_data),
+                        p_score, nodes,
+                        ProcessTreeLeave(nodes, j, local_x_data),
                         p_has_score);
                 }
             }            
@@ -822,7 +2828,7 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                                     Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i));
             }
         }
-        else if ((omp_get_max_threads() <= 1) || (N <= omp_N_)) { DEBUGPRINT("P")
+        else if ((omp_get_max_threads() <= 1) || (N <= schedule.omp_N)) { DEBUGPRINT("P")
             NTYPE scores;
             unsigned char has_scores;
             size_t j;
@@ -832,8 +2838,8 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 has_scores = 0;
                 for (j = 0; j < (size_t)n_trees_; ++j)
                     agg.ProcessTreeNodePrediction1(
-                        &scores, array_nodes_,
-                        ProcessTreeNodeLeave(array_nodes_.root_id[j], x_data + i * stride),
+                        &scores, nodes,
+                        ProcessTreeLeave(nodes, j, x_data + i * stride),
                         &has_scores);
                 agg.FinalizeScores1((NTYPE*)Z_.data(i), scores, has_scores,
                                     Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i));
@@ -853,8 +2859,8 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 has_scores[th] = 0;
                 for (size_t j = 0; j < (size_t)n_trees_; ++j)
                     agg.ProcessTreeNodePrediction1(
-                        &scores[th], array_nodes_,
-                        ProcessTreeNodeLeave(array_nodes_.root_id[j], x_data + i * stride),
+                        &scores[th], nodes,
+                        ProcessTreeLeave(nodes, j, x_data + i * stride),
                         &has_scores[th]);
                 agg.FinalizeScores1((NTYPE*)Z_.data(i), scores[th], has_scores[th],
                                     Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i));
@@ -873,9 +2879,8 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 for (size_t j = 0; j < (size_t)n_trees_; ++j) {
                     for (size_t k = 0; k < BATCHSIZE; ++k) {
                         agg.ProcessTreeNodePrediction1(
-                            &scores[k], array_nodes_,
-                            ProcessTreeNodeLeave(
-                                array_nodes_.root_id[j], x_data + (i + k) * stride),
+                            &scores[k], nodes,
+                            ProcessTreeLeave(nodes, j, x_data + (i + k) * stride),
                             &has_scores[k]);
                     }
                 }
@@ -890,8 +2895,8 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 unsigned char has_scores = 0;
                 for (size_t j = 0; j < (size_t)n_trees_; ++j)
                     agg.ProcessTreeNodePrediction1(
-                        &scores, array_nodes_,
-                        ProcessTreeNodeLeave(array_nodes_.root_id[j], x_data + i * stride),
+                        &scores, nodes,
+                        ProcessTreeLeave(nodes, j, x_data + i * stride),
                         &has_scores);
                 agg.FinalizeScores1((NTYPE*)Z_.data(i), scores, has_scores,
                                     Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i));
@@ -899,20 +2904,20 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
         }
     }
     else {
-        if ((N == 1) && ((omp_get_max_threads() <= 1) || (n_trees_ <= omp_tree_))) { DEBUGPRINT("S")
+        if ((N == 1) && ((omp_get_max_threads() <= 1) || (n_trees_ <= schedule.omp_tree))) { DEBUGPRINT("S")
             std::vector<NTYPE> scores(n_targets_or_classes_, (NTYPE)0);
             std::vector<unsigned char> has_scores(n_targets_or_classes_, 0);
 
             for (int64_t j = 0; j < n_trees_; ++j) {
                 agg.ProcessTreeNodePrediction(
-                    scores.data(), array_nodes_,
-                    ProcessTreeNodeLeave(array_nodes_.root_id[j], x_data),
+                    scores.data(), nodes,
+                    ProcessTreeLeave(nodes, j, x_data),
                     has_scores.data());
             }
             agg.FinalizeScores(scores.data(), has_scores.data(), (NTYPE*)Z_.data(0), -1,
                                Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(0));
         }
-        else if (para_tree_ && (omp_get_max_threads() > 1) && (n_trees_ > omp_tree_)) { DEBUGPRINT("T")
+        else if (schedule.para_tree && (omp_get_max_threads() > 1) && (n_trees_ > schedule.omp_tree)) { DEBUGPRINT("T")
             auto nth = omp_get_max_threads();
             if (nth <= 0)
                 throw std::invalid_argument("nth must strictly positive.");
@@ -929,14 +2934,13 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 NTYPE* p_score = &local_scores[d];
                 unsigned char* p_has_score = &local_has_scores[d];
                 const NTYPE* local_x_data = x_data;
-                auto node = array_nodes_.root_id[j];
                 for(int64_t i = 0; i < N; ++i,
                         local_x_data += stride,
                         p_score += n_targets_or_classes_,
                         p_has_score += n_targets_or_classes_) {
                     agg.ProcessTreeNodePrediction(
-                        p_score, array_nodes_,
-                        ProcessTreeNodeLeave(node, local_x_data),
+                        p_score, nodes,
+                        ProcessTreeLeave(nodes, j, local_x_data),
                         p_has_score);
                 }
             }
@@ -959,7 +2963,7 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                                    Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i));
             }
         }
-        else if ((omp_get_max_threads() <= 1) || (N <= omp_N_)) { DEBUGPRINT("U")
+        else if ((omp_get_max_threads() <= 1) || (N <= schedule.omp_N)) { DEBUGPRINT("U")
             std::vector<NTYPE> scores(n_targets_or_classes_);
             std::vector<unsigned char> has_scores(n_targets_or_classes_);
             size_t j;
@@ -967,10 +2971,10 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
             for (int64_t i = 0; i < N; ++i) {
                 std::fill(scores.begin(), scores.end(), (NTYPE)0);
                 std::fill(has_scores.begin(), has_scores.end(), 0);
-                for (j = 0; j < roots_.size(); ++j)
+                for (j = 0; j < (size_t)n_trees_; ++j)
                     agg.ProcessTreeNodePrediction(
-                        scores.data(), array_nodes_,
-                        ProcessTreeNodeLeave(array_nodes_.root_id[j], x_data + i * stride),
+                        scores.data(), nodes,
+                        ProcessTreeLeave(nodes, j, x_data + i * stride),
                         has_scores.data());
                 agg.FinalizeScores(scores.data(), has_scores.data(),
                                    (NTYPE*)Z_.data(i * n_targets_or_classes_), -1,
@@ -991,10 +2995,10 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
                 const NTYPE * local_x_data = x_data + i * stride;
                 std::fill(p_score, p_score + n_targets_or_classes_, (NTYPE)0);
                 std::fill(p_has_score, p_has_score + n_targets_or_classes_, 0);
-                for (size_t j = 0; j < roots_.size(); ++j)
+                for (size_t j = 0; j < (size_t)n_trees_; ++j)
                     agg.ProcessTreeNodePrediction(
-                        p_score, array_nodes_,
-                        ProcessTreeNodeLeave(array_nodes_.root_id[j], local_x_data),
+                        p_score, nodes,
+                        ProcessTreeLeave(nodes, j, local_x_data),
                         p_has_score);
                 agg.FinalizeScores(p_score, p_has_score,
                                    (NTYPE*)Z_.data(i * n_targets_or_classes_), -1,
@@ -1005,6 +3009,516 @@ void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_array_structure(
 }
 
 
+template<typename NTYPE> template<typename AGG>
+bool RuntimeTreeEnsembleCommonP<NTYPE>::cascade_is_decided(
+        const AGG &agg, const NTYPE* scores, const unsigned char* has_scores, size_t stage) const {
+    // The label is a monotonic function of the score of class cascade_class_,
+    // the row is decided if the label is the same for both bounds of the
+    // remaining trees. The margin covers the rounding errors of the sums.
+    NTYPE lower = cascade_lower_[stage];
+    NTYPE upper = cascade_upper_[stage];
+    NTYPE margin = (std::abs(scores[cascade_class_]) + std::abs(lower) + std::abs(upper)) *
+                   std::numeric_limits<NTYPE>::epsilon() * (NTYPE)(n_trees_ + 1);
+    NTYPE scores_low[2] = {scores[0], scores[1]};
+    NTYPE scores_high[2] = {scores[0], scores[1]};
+    unsigned char has_low[2] = {has_scores[0], has_scores[1]};
+    unsigned char has_high[2] = {has_scores[0], has_scores[1]};
+    scores_low[cascade_class_] += lower - margin;
+    scores_high[cascade_class_] += upper + margin;
+    NTYPE Z[4];
+    int64_t label_low = 0, label_high = 1;
+    agg.FinalizeScores(scores_low, has_low, Z, -1, &label_low);
+    agg.FinalizeScores(scores_high, has_high, Z, -1, &label_high);
+    return label_low == label_high;
+}
+
+
+template<typename NTYPE> template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_cascade(
+                const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+                const NTYPE* x_data,
+                py::array_t<int64_t, py::array::c_style | py::array::forcecast>& Y,
+                const AGG &agg, const TreeEnsembleSchedule& schedule,
+                int64_t& evaluated, std::vector<int64_t>& retired) {
+    if (n_trees_ == 0)
+        throw std::invalid_argument("The model has no tree, init must be called first.");
+    auto Y_ = _mutable_unchecked1(Y);
+    int64_t n_stages = (int64_t)cascade_stage_end_.size();
+    int64_t n_blocks = (N + BATCHSIZE - 1) / BATCHSIZE;
+    std::vector<int64_t> block_retired(n_blocks * n_stages, 0);
+    std::vector<int64_t> block_evaluated(n_blocks, 0);
+
+    #ifdef USE_OPENMP
+    #pragma omp parallel for if(N > schedule.omp_N)
+    #endif
+    for (int64_t block = 0; block < n_blocks; ++block) {
+        int64_t begin = block * BATCHSIZE;
+        int64_t nb = std::min((int64_t)BATCHSIZE, N - begin);
+        // n_targets_or_classes_ is 2
+        NTYPE scores[BATCHSIZE * 2];
+        unsigned char has_scores[BATCHSIZE * 2];
+        int64_t active[BATCHSIZE];
+        memset(scores, 0, sizeof(NTYPE) * nb * 2);
+        memset(has_scores, 0, nb * 2);
+        int64_t n_active = nb;
+        for (int64_t k = 0; k < nb; ++k)
+            active[k] = k;
+
+        int64_t j = 0;
+        for (int64_t s = 0; s < n_stages && n_active > 0; ++s) {
+            block_evaluated[block] += n_active * (cascade_stage_end_[s] - j);
+            for (; j < cascade_stage_end_[s]; ++j) {
+                for (int64_t a = 0; a < n_active; ++a) {
+                    int64_t k = active[a];
+                    agg.ProcessTreeNodePrediction(
+                        scores + k * 2, packed_nodes_,
+                        ProcessTreeLeave(packed_nodes_, j, x_data + (begin + k) * stride),
+                        has_scores + k * 2);
+                }
+            }
+            if (s + 1 == n_stages)
+                break;
+            int64_t n_keep = 0;
+            for (int64_t a = 0; a < n_active; ++a) {
+                int64_t k = active[a];
+                if (cascade_is_decided(agg, scores + k * 2, has_scores + k * 2, s))
+                    ++block_retired[block * n_stages + s];
+                else
+                    active[n_keep++] = k;
+            }
+            n_active = n_keep;
+        }
+
+        // Scores of retired rows are partial, only the labels are kept.
+        NTYPE Z[4];
+        for (int64_t k = 0; k < nb; ++k)
+            agg.FinalizeScores(scores + k * 2, has_scores + k * 2, Z, -1,
+                               (int64_t*)Y_.data(begin + k));
+    }
+
+    evaluated = 0;
+    for (int64_t block = 0; block < n_blocks; ++block)
+        evaluated += block_evaluated[block];
+    retired.assign(n_stages, 0);
+    for (int64_t block = 0; block < n_blocks; ++block)
+        for (int64_t s = 0; s < n_stages; ++s)
+            retired[s] += block_retired[block * n_stages + s];
+}
+
+
+// Upper bound (bytes) for the partial scores of the tiled evaluation,
+// rows are processed by slices if it is exceeded.
+#define TILEBUFFERSIZE (1 << 24)
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_tile_sizes(
+        const TreeEnsembleSchedule& schedule, int64_t N, int64_t stride,
+        int64_t& chunk_size, int64_t& block_size) {
+    // Half of the cache holds a chunk of trees, the other half a block of rows
+    // and their scores.
+    int64_t half = std::max((int64_t)1, schedule.tile_cache_size / 2);
+    int64_t tree_size = std::max((int64_t)1, sizeof_ / std::max((int64_t)1, n_trees_));
+    chunk_size = std::min(n_trees_, std::max((int64_t)1, half / tree_size));
+    int64_t n_chunks = (n_trees_ + chunk_size - 1) / chunk_size;
+
+    int64_t row_size = stride * sizeof(NTYPE) + n_targets_or_classes_ * (sizeof(NTYPE) + 1);
+    block_size = std::min(N, std::max((int64_t)1, half / row_size));
+    // Every thread should get a few tiles.
+    int64_t min_tiles = (int64_t)omp_get_max_threads() * 4;
+    int64_t n_blocks = (N + block_size - 1) / block_size;
+    if (n_chunks * n_blocks < min_tiles) {
+        n_blocks = std::min(N, (min_tiles + n_chunks - 1) / n_chunks);
+        block_size = (N + n_blocks - 1) / n_blocks;
+    }
+}
+
+
+template<typename NTYPE> template<typename AGG, typename NODES>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_tiled(
+                const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+                const NTYPE* x_data,
+                py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                const NODES& nodes, const AGG &agg, const TreeEnsembleSchedule& schedule) {
+    auto Z_ = _mutable_unchecked1(Z);
+
+    int64_t chunk_size, block_size;
+    compute_tile_sizes(schedule, N, stride, chunk_size, block_size);
+    int64_t n_chunks = (n_trees_ + chunk_size - 1) / chunk_size;
+
+    // Every chunk of trees owns its partial scores, tiles never write
+    // in the same place and the result does not depend on the scheduling.
+    int64_t slice = std::max(block_size,
+        (int64_t)(TILEBUFFERSIZE / (n_chunks * n_targets_or_classes_ * (sizeof(NTYPE) + 1))) /
+        block_size * block_size);
+    slice = std::min(slice, N);
+    int64_t size_chunk = slice * n_targets_or_classes_;
+    std::vector<NTYPE> local_scores(n_chunks * size_chunk);
+    std::vector<unsigned char> local_has_scores(local_scores.size());
+
+    for (int64_t begin = 0; begin < N; begin += slice) {
+        int64_t n_rows = std::min(slice, N - begin);
+        int64_t n_blocks = (n_rows + block_size - 1) / block_size;
+        std::fill(local_scores.begin(), local_scores.end(), (NTYPE)0);
+        std::fill(local_has_scores.begin(), local_has_scores.end(), 0);
+
+        // Consecutive tiles share the same chunk of trees.
+        #ifdef USE_OPENMP
+        #pragma omp parallel for schedule(dynamic)
+        #endif
+        for (int64_t t = 0; t < n_chunks * n_blocks; ++t) {
+            int64_t c = t / n_blocks;
+            int64_t b = t % n_blocks;
+            int64_t j_end = std::min(n_trees_, (c + 1) * chunk_size);
+            int64_t i_begin = b * block_size;
+            int64_t i_end = std::min(n_rows, i_begin + block_size);
+            NTYPE* p_score = &local_scores[c * size_chunk];
+            unsigned char* p_has_score = &local_has_scores[c * size_chunk];
+            const NTYPE* local_x_data = x_data + begin * stride;
+            if (n_targets_or_classes_ == 1) {
+                for (int64_t j = c * chunk_size; j < j_end; ++j)
+                    for (int64_t i = i_begin; i < i_end; ++i)
+                        agg.ProcessTreeNodePrediction1(
+                            p_score + i, nodes,
+                            ProcessTreeLeave(nodes, j, local_x_data + i * stride),
+                            p_has_score + i);
+            }
+            else {
+                for (int64_t j = c * chunk_size; j < j_end; ++j)
+                    for (int64_t i = i_begin; i < i_end; ++i)
+                        agg.ProcessTreeNodePrediction(
+                            p_score + i * n_targets_or_classes_, nodes,
+                            ProcessTreeLeave(nodes, j, local_x_data + i * stride),
+                            p_has_score + i * n_targets_or_classes_);
+            }
+        }
+
+        #ifdef USE_OPENMP
+        #pragma omp parallel for
+        #endif
+        for (int64_t i = 0; i < n_rows; ++i) {
+            NTYPE* p_score = &local_scores[i * n_targets_or_classes_];
+            unsigned char* p_has_score = &local_has_scores[i * n_targets_or_classes_];
+            NTYPE* pp_score = p_score + size_chunk;
+            unsigned char* pp_has_score = p_has_score + size_chunk;
+            if (n_targets_or_classes_ == 1) {
+                for (int64_t c = 1; c < n_chunks; ++c, pp_score += size_chunk, pp_has_score += size_chunk)
+                    agg.MergePrediction1(p_score, p_has_score, pp_score, pp_has_score);
+                agg.FinalizeScores1((NTYPE*)Z_.data(begin + i), *p_score, *p_has_score,
+                                    Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(begin + i));
+            }
+            else {
+                for (int64_t c = 1; c < n_chunks; ++c, pp_score += size_chunk, pp_has_score += size_chunk)
+                    agg.MergePrediction(n_targets_or_classes_, p_score, p_has_score, pp_score, pp_has_score);
+                agg.FinalizeScores(p_score, p_has_score,
+                                   (NTYPE*)Z_.data((begin + i) * n_targets_or_classes_), -1,
+                                   Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(begin + i));
+            }
+        }
+    }
+}
+
+
+template<typename NTYPE> template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_avx2(
+                const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+                const NTYPE* x_data,
+                py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                const AGG &agg, const TreeEnsembleSchedule& schedule) {
+    if (N < AVX2_TREE_ROWS || stride >= std::numeric_limits<int32_t>::max() / AVX2_TREE_ROWS) {
+        compute_gil_free_array_structure(x_dims, N, stride, x_data, Z, Y, packed_nodes_, agg, schedule);
+        return;
+    }
+
+    auto Z_ = _mutable_unchecked1(Z);
+    const PackedTreeNodeElement<NTYPE>* nodes = packed_nodes_.nodes.data();
+    int64_t NB = N - N % AVX2_TREE_ROWS;
+
+    #ifdef USE_OPENMP
+    #pragma omp parallel for if(N > schedule.omp_N)
+    #endif
+    for (int64_t i = 0; i < NB; i += AVX2_TREE_ROWS) {
+        uint32_t leaves[AVX2_TREE_ROWS];
+        std::vector<NTYPE> scores(AVX2_TREE_ROWS * n_targets_or_classes_, (NTYPE)0);
+        std::vector<unsigned char> has_scores(AVX2_TREE_ROWS * n_targets_or_classes_, 0);
+        for (size_t j = 0; j < (size_t)n_trees_; ++j) {
+            tree_leaves_leq_avx2(nodes, (uint32_t)packed_nodes_.root_id[j],
+                                 x_data + i * stride, stride,
+                                 has_missing_tracks_, leaves);
+            if (n_targets_or_classes_ == 1) {
+                for (size_t k = 0; k < AVX2_TREE_ROWS; ++k)
+                    agg.ProcessTreeNodePrediction1(&scores[k], packed_nodes_, leaves[k], &has_scores[k]);
+            }
+            else {
+                for (size_t k = 0; k < AVX2_TREE_ROWS; ++k)
+                    agg.ProcessTreeNodePrediction(&scores[k * n_targets_or_classes_], packed_nodes_,
+                                                  leaves[k], &has_scores[k * n_targets_or_classes_]);
+            }
+        }
+        for (size_t k = 0; k < AVX2_TREE_ROWS; ++k) {
+            if (n_targets_or_classes_ == 1)
+                agg.FinalizeScores1((NTYPE*)Z_.data(i + k), scores[k], has_scores[k],
+                                    Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i + k));
+            else
+                agg.FinalizeScores(&scores[k * n_targets_or_classes_],
+                                   &has_scores[k * n_targets_or_classes_],
+                                   (NTYPE*)Z_.data((i + k) * n_targets_or_classes_), -1,
+                                   Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i + k));
+        }
+    }
+
+    // Remaining rows.
+    std::vector<NTYPE> scores(n_targets_or_classes_);
+    std::vector<unsigned char> has_scores(n_targets_or_classes_);
+    for (int64_t i = NB; i < N; ++i) {
+        std::fill(scores.begin(), scores.end(), (NTYPE)0);
+        std::fill(has_scores.begin(), has_scores.end(), 0);
+        for (size_t j = 0; j < (size_t)n_trees_; ++j) {
+            size_t leaf = ProcessTreeLeave(packed_nodes_, j, x_data + i * stride);
+            if (n_targets_or_classes_ == 1)
+                agg.ProcessTreeNodePrediction1(scores.data(), packed_nodes_, leaf, has_scores.data());
+            else
+                agg.ProcessTreeNodePrediction(scores.data(), packed_nodes_, leaf, has_scores.data());
+        }
+        if (n_targets_or_classes_ == 1)
+            agg.FinalizeScores1((NTYPE*)Z_.data(i), scores[0], has_scores[0],
+                                Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i));
+        else
+            agg.FinalizeScores(scores.data(), has_scores.data(),
+                               (NTYPE*)Z_.data(i * n_targets_or_classes_), -1,
+                               Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(i));
+    }
+}
+
+
+template<typename NTYPE> template<typename AGG, typename BIN>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_quantized(
+                const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+                const NTYPE* x_data,
+                py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                const QuantizedTreeNodeElements<NTYPE, BIN>& quantized_nodes,
+                const AGG &agg, const TreeEnsembleSchedule& schedule) {
+    if ((N == 1) && (omp_get_max_threads() > 1) && (n_trees_ > schedule.omp_tree)) {
+        // Parallelization over trees is better for one observation.
+        compute_gil_free_array_structure(x_dims, N, stride, x_data, Z, Y, packed_nodes_, agg, schedule);
+        return;
+    }
+    int64_t n_features = quantized_nodes.n_features;
+    if (n_features > stride)
+        throw std::invalid_argument(MakeString(
+            "X has ", stride, " features but the model requires ", n_features, "."));
+
+    auto Z_ = _mutable_unchecked1(Z);
+    int64_t n_blocks = (N + BATCHSIZE - 1) / BATCHSIZE;
+
+    #ifdef USE_OPENMP
+    #pragma omp parallel for if(N > schedule.omp_N)
+    #endif
+    for (int64_t block = 0; block < n_blocks; ++block) {
+        int64_t begin = block * BATCHSIZE;
+        int64_t nb = std::min((int64_t)BATCHSIZE, N - begin);
+        // Every row is binned once, the bins of a block stay in cache
+        // while every tree is evaluated.
+        std::vector<BIN> bins(nb * n_features);
+        for (int64_t k = 0; k < nb; ++k)
+            quantized_nodes.bin_row(x_data + (begin + k) * stride, bins.data() + k * n_features);
+
+        std::vector<NTYPE> scores(nb * n_targets_or_classes_, (NTYPE)0);
+        std::vector<unsigned char> has_scores(scores.size(), 0);
+        for (size_t j = 0; j < (size_t)n_trees_; ++j) {
+            size_t root_id = packed_nodes_.root_id[j];
+            if (n_targets_or_classes_ == 1) {
+                for (int64_t k = 0; k < nb; ++k)
+                    agg.ProcessTreeNodePrediction1(
+                        &scores[k], packed_nodes_,
+                        ProcessTreeNodeLeave(quantized_nodes, root_id, bins.data() + k * n_features),
+                        &has_scores[k]);
+            }
+            else {
+                for (int64_t k = 0; k < nb; ++k)
+                    agg.ProcessTreeNodePrediction(
+                        &scores[k * n_targets_or_classes_], packed_nodes_,
+                        ProcessTreeNodeLeave(quantized_nodes, root_id, bins.data() + k * n_features),
+                        &has_scores[k * n_targets_or_classes_]);
+            }
+        }
+        for (int64_t k = 0; k < nb; ++k) {
+            if (n_targets_or_classes_ == 1)
+                agg.FinalizeScores1((NTYPE*)Z_.data(begin + k), scores[k], has_scores[k],
+                                    Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(begin + k));
+            else
+                agg.FinalizeScores(&scores[k * n_targets_or_classes_],
+                                   &has_scores[k * n_targets_or_classes_],
+                                   (NTYPE*)Z_.data((begin + k) * n_targets_or_classes_), -1,
+                                   Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(begin + k));
+        }
+    }
+}
+
+
+template<typename NTYPE> template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_bfloat16(
+                const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+                const NTYPE* x_data,
+                py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                const AGG &agg, const TreeEnsembleSchedule& schedule) {
+    auto Z_ = _mutable_unchecked1(Z);
+    int64_t n_blocks = (N + BATCHSIZE - 1) / BATCHSIZE;
+    const HalfTreeNodeElement* nodes = half_nodes_.nodes.data();
+    const uint16_t* leaf_values = half_nodes_.leaf_values.data();
+
+    // One buffer per thread, allocated once per call, the aggregators
+    // (SUM, AVERAGE) only read has_scores, it is shared.
+    auto nth = omp_get_max_threads();
+    const int64_t scores_size = BATCHSIZE * n_targets_or_classes_;
+    std::vector<NTYPE> scores_buffer(nth * scores_size);
+    std::vector<unsigned char> has_scores(scores_size, 1);
+
+    #ifdef USE_OPENMP
+    #pragma omp parallel for if(N > schedule.omp_N)
+    #endif
+    for (int64_t block = 0; block < n_blocks; ++block) {
+        int64_t begin = block * BATCHSIZE;
+        int64_t nb = std::min((int64_t)BATCHSIZE, N - begin);
+        NTYPE* scores = scores_buffer.data() + omp_get_thread_num() * scores_size;
+        std::fill(scores, scores + nb * n_targets_or_classes_, (NTYPE)0);
+        for (size_t j = 0; j < (size_t)n_trees_; ++j) {
+            size_t root_id = packed_nodes_.root_id[j];
+            if (n_targets_or_classes_ == 1) {
+                for (int64_t k = 0; k < nb; ++k)
+                    scores[k] += _bfloat16_to_float_(leaf_values[nodes[
+                        ProcessTreeNodeLeave(half_nodes_, root_id, x_data + (begin + k) * stride)].next]);
+            }
+            else {
+                for (int64_t k = 0; k < nb; ++k) {
+                    const uint16_t* row = leaf_values + nodes[
+                        ProcessTreeNodeLeave(half_nodes_, root_id, x_data + (begin + k) * stride)].next *
+                        n_targets_or_classes_;
+                    NTYPE* pscores = scores + k * n_targets_or_classes_;
+                    for (int64_t t = 0; t < n_targets_or_classes_; ++t)
+                        pscores[t] += _bfloat16_to_float_(row[t]);
+                }
+            }
+        }
+        for (int64_t k = 0; k < nb; ++k) {
+            if (n_targets_or_classes_ == 1)
+                agg.FinalizeScores1((NTYPE*)Z_.data(begin + k), scores[k], has_scores[k]);
+            else
+                agg.FinalizeScores(&scores[k * n_targets_or_classes_],
+                                   &has_scores[k * n_targets_or_classes_],
+                                   (NTYPE*)Z_.data((begin + k) * n_targets_or_classes_), -1);
+        }
+    }
+}
+
+
+#define QSBATCHSIZE 16
+
+template<typename NTYPE> template<typename AGG>
+void RuntimeTreeEnsembleCommonP<NTYPE>::compute_gil_free_quickscorer(
+                const std::vector<int64_t>& x_dims, int64_t N, int64_t stride,
+                const NTYPE* x_data,
+                py::array_t<NTYPE, py::array::c_style | py::array::forcecast>& Z,
+                py::array_t<int64_t, py::array::c_style | py::array::forcecast>* Y,
+                const AGG &agg, const TreeEnsembleSchedule& schedule) {
+    auto Z_ = _mutable_unchecked1(Z);
+    const uint64_t all_leaves = ~((uint64_t)0);
+    const NTYPE inf = std::numeric_limits<NTYPE>::infinity();
+    int64_t n_blocks = (N + QSBATCHSIZE - 1) / QSBATCHSIZE;
+    int64_t n_features = qs_nodes_.n_features;
+    if (n_features > stride)
+        throw std::invalid_argument(MakeString(
+            "X has ", stride, " features but the model requires ", qs_nodes_.n_features, "."));
+
+    // One buffer per thread, allocated once per call.
+    auto nth = omp_get_max_threads();
+    const int64_t leaves_size = n_trees_ * QSBATCHSIZE;
+    std::vector<uint64_t> leaves_buffer(nth * leaves_size);
+    std::vector<NTYPE> scores_buffer(n_targets_or_classes_ > 1 ? nth * n_targets_or_classes_ : 0);
+    std::vector<unsigned char> has_scores_buffer(scores_buffer.size());
+
+    #ifdef USE_OPENMP
+    #pragma omp parallel for if(N > schedule.omp_N)
+    #endif
+    for (int64_t block = 0; block < n_blocks; ++block) {
+        auto th = omp_get_thread_num();
+        int64_t begin = block * QSBATCHSIZE;
+        int64_t nb = std::min((int64_t)QSBATCHSIZE, N - begin);
+        uint64_t* leaves = leaves_buffer.data() + th * leaves_size;
+        std::fill(leaves, leaves + leaves_size, all_leaves);
+        NTYPE xb[QSBATCHSIZE];
+
+        for (int64_t f = 0; f < n_features; ++f) {
+            size_t k = qs_nodes_.feature_begin[f];
+            size_t end = qs_nodes_.feature_begin[f + 1];
+            if (k == end)
+                continue;
+            // A missing value follows every false branch.
+            NTYPE xmax = -inf;
+            for (int64_t b = 0; b < nb; ++b) {
+                xb[b] = x_data[(begin + b) * stride + f];
+                if (_isnan_(xb[b]))
+                    xb[b] = inf;
+                if (xb[b] > xmax)
+                    xmax = xb[b];
+            }
+            // Nodes are sorted by threshold, the loop stops when
+            // the condition is true for every row of the block.
+            if (qs_nodes_.strict) {
+                for (; k < end && qs_nodes_.thresholds[k] <= xmax; ++k) {
+                    NTYPE th = qs_nodes_.thresholds[k];
+                    uint64_t mask = qs_nodes_.masks[k];
+                    uint64_t* pv = &leaves[qs_nodes_.tree_id[k] * QSBATCHSIZE];
+                    for (int64_t b = 0; b < nb; ++b)
+                        pv[b] &= xb[b] >= th ? mask : all_leaves;
+                }
+            }
+            else {
+                for (; k < end && qs_nodes_.thresholds[k] < xmax; ++k) {
+                    NTYPE th = qs_nodes_.thresholds[k];
+                    uint64_t mask = qs_nodes_.masks[k];
+                    uint64_t* pv = &leaves[qs_nodes_.tree_id[k] * QSBATCHSIZE];
+                    for (int64_t b = 0; b < nb; ++b)
+                        pv[b] &= xb[b] > th ? mask : all_leaves;
+                }
+            }
+        }
+
+        if (n_targets_or_classes_ == 1) {
+            for (int64_t b = 0; b < nb; ++b) {
+                NTYPE score = 0;
+                unsigned char has_score = 0;
+                for (int64_t j = 0; j < n_trees_; ++j)
+                    agg.ProcessTreeNodePrediction1(
+                        &score, qs_nodes_.leaves,
+                        qs_nodes_.leaf_offset[j] + _ctz64_(leaves[j * QSBATCHSIZE + b]),
+                        &has_score);
+                agg.FinalizeScores1((NTYPE*)Z_.data(begin + b), score, has_score,
+                                    Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(begin + b));
+            }
+        }
+        else {
+            NTYPE* scores = scores_buffer.data() + th * n_targets_or_classes_;
+            unsigned char* has_scores = has_scores_buffer.data() + th * n_targets_or_classes_;
+            for (int64_t b = 0; b < nb; ++b) {
+                std::fill(scores, scores + n_targets_or_classes_, (NTYPE)0);
+                std::fill(has_scores, has_scores + n_targets_or_classes_, 0);
+                for (int64_t j = 0; j < n_trees_; ++j)
+                    agg.ProcessTreeNodePrediction(
+                        scores, qs_nodes_.leaves,
+                        qs_nodes_.leaf_offset[j] + _ctz64_(leaves[j * QSBATCHSIZE + b]),
+                        has_scores);
+                agg.FinalizeScores(scores, has_scores,
+                                   (NTYPE*)Z_.data((begin + b) * n_targets_or_classes_), -1,
+                                   Y == nullptr ? nullptr : (int64_t*)_mutable_unchecked1(*Y).data(begin + b));
+            }
+        }
+    }
+}
+
+
 #define TREE_FIND_VALUE(CMP) \
     if (has_missing_tracks_) { \
         while (root->is_not_leaf()) { \
@@ -1239,6 +3753,266 @@ size_t RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreeNodeLeave(
 }
 
 
+#define TREE_FIND_VALUE_COMPLETE(CMP) \
+    if (has_missing_tracks_) { \
+        const unsigned char* missing = &complete_nodes_.is_missing_track_true[node_offset]; \
+        NTYPE val; \
+        for (uint32_t level = 0; level < depth; ++level) { \
+            val = x_data[feature_id[pos]]; \
+            pos = pos * 2 + 2 - (size_t)(val CMP value[pos] || (missing[pos] && _isnan_(val))); \
+        } \
+    } \
+    else { \
+        for (uint32_t level = 0; level < depth; ++level) \
+            pos = pos * 2 + 2 - (size_t)(x_data[feature_id[pos]] CMP value[pos]); \
+    }
+
+
+template<typename NTYPE>
+size_t RuntimeTreeEnsembleCommonP<NTYPE>::ProcessCompleteTreeLeave(
+            size_t tree_id, const NTYPE* x_data) const {
+    size_t node_offset = complete_nodes_.node_offset[tree_id];
+    uint32_t depth = complete_nodes_.depth[tree_id];
+    const uint32_t* feature_id = complete_nodes_.feature_id.data() + node_offset;
+    const NTYPE* value = complete_nodes_.value.data() + node_offset;
+    size_t pos = 0;
+    // Only trees with the same mode for every node are stored as complete trees.
+    switch(array_nodes_.mode[array_nodes_.root_id[tree_id]]) {
+        case NODE_MODE::BRANCH_LEQ:
+            TREE_FIND_VALUE_COMPLETE(<=)
+            break;
+        case NODE_MODE::BRANCH_LT:
+            TREE_FIND_VALUE_COMPLETE(<)
+            break;
+        case NODE_MODE::BRANCH_GTE:
+            TREE_FIND_VALUE_COMPLETE(>=)
+            break;
+        case NODE_MODE::BRANCH_GT:
+            TREE_FIND_VALUE_COMPLETE(>)
+            break;
+        case NODE_MODE::BRANCH_EQ:
+            TREE_FIND_VALUE_COMPLETE(==)
+            break;
+        case NODE_MODE::BRANCH_NEQ:
+            TREE_FIND_VALUE_COMPLETE(!=)
+            break;
+        case NODE_MODE::LEAF:
+            break;
+        default: {
+            std::ostringstream err_msg;
+            err_msg << "Invalid mode of value(4): "
+                    << static_cast<std::underlying_type<NODE_MODE>::type>(
+                        array_nodes_.mode[array_nodes_.root_id[tree_id]]);
+            throw std::invalid_argument(err_msg.str());
+        }
+    }
+    return complete_nodes_.leaf_id[complete_nodes_.leaf_offset[tree_id] + pos - ((((size_t)1) << depth) - 1)];
+}
+
+
+#define TREE_FIND_VALUE_PACKED(CMP) \
+    if (has_missing_tracks_) { \
+        NTYPE val; \
+        while (node->is_not_leaf()) { \
+            val = x_data[node->feature_id]; \
+            node = first + ((val CMP node->value || \
+                             (node->is_missing_track_true && _isnan_(val))) \
+                                ? node->truenode : node->falsenode); \
+        } \
+    } \
+    else { \
+        while (node->is_not_leaf()) { \
+            node = first + (x_data[node->feature_id] CMP node->value \
+                                ? node->truenode : node->falsenode); \
+        } \
+    }
+
+
+template<typename NTYPE>
+size_t RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreeNodeLeave(
+            const PackedTreeNodeElements<NTYPE>& packed_nodes,
+            size_t root_id, const NTYPE* x_data) const {
+    const PackedTreeNodeElement<NTYPE>* first = packed_nodes.nodes.data();
+    const PackedTreeNodeElement<NTYPE>* node = first + root_id;
+    if (same_mode_) {
+        switch((NODE_MODE)node->mode) {
+            case NODE_MODE::BRANCH_LEQ:
+                TREE_FIND_VALUE_PACKED(<=)
+                break;
+            case NODE_MODE::BRANCH_LT:
+                TREE_FIND_VALUE_PACKED(<)
+                break;
+            case NODE_MODE::BRANCH_GTE:
+                TREE_FIND_VALUE_PACKED(>=)
+                break;
+            case NODE_MODE::BRANCH_GT:
+                TREE_FIND_VALUE_PACKED(>)
+                break;
+            case NODE_MODE::BRANCH_EQ:
+                TREE_FIND_VALUE_PACKED(==)
+                break;
+            case NODE_MODE::BRANCH_NEQ:
+                TREE_FIND_VALUE_PACKED(!=)
+                break;
+            case NODE_MODE::LEAF:
+                break;
+            default: {
+                std::ostringstream err_msg;
+                err_msg << "Invalid mode of value(3): " << (int)node->mode;
+                throw std::invalid_argument(err_msg.str());
+            }
+        }
+    }
+    else {  // Different rules to compare to node thresholds.
+        NTYPE threshold, val;
+        bool cond;
+        while (node->is_not_leaf()) {
+            val = x_data[node->feature_id];
+            threshold = node->value;
+            switch ((NODE_MODE)node->mode) {
+                case NODE_MODE::BRANCH_LEQ:
+                    cond = val <= threshold;
+                    break;
+                case NODE_MODE::BRANCH_LT:
+                    cond = val < threshold;
+                    break;
+                case NODE_MODE::BRANCH_GTE:
+                    cond = val >= threshold;
+                    break;
+                case NODE_MODE::BRANCH_GT:
+                    cond = val > threshold;
+                    break;
+                case NODE_MODE::BRANCH_EQ:
+                    cond = val == threshold;
+                    break;
+                case NODE_MODE::BRANCH_NEQ:
+                    cond = val != threshold;
+                    break;
+                default: {
+                    std::ostringstream err_msg;
+                    err_msg << "Invalid mode of value: " << (int)node->mode;
+                    throw std::invalid_argument(err_msg.str());
+                }
+            }
+            node = first + (cond || (node->is_missing_track_true && _isnan_(val))
+                                ? node->truenode : node->falsenode);
+        }
+    }
+    return (size_t)(node - first);
+}
+
+
+#define TREE_FIND_VALUE_HALF(CMP) \
+    while (!(node->feature & HALF_LEAF)) { \
+        val = x_data[node->feature & HALF_FEATURE_MASK]; \
+        cond = ((node->feature & HALF_INEXACT) && \
+                _float_to_bfloat16_truncated_((float)val) == node->threshold) \
+            ? val CMP (NTYPE)half_nodes.exact_threshold(node - first) \
+            : val CMP (NTYPE)_bfloat16_to_float_(node->threshold); \
+        node = (cond || ((node->feature & HALF_MISSING_TRACK_TRUE) && _isnan_(val))) \
+                    ? node + 1 : first + node->next; \
+    }
+
+
+template<typename NTYPE>
+size_t RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreeNodeLeave(
+            const HalfTreeNodeElements<NTYPE>& half_nodes,
+            size_t root_id, const NTYPE* x_data) const {
+    const HalfTreeNodeElement* first = half_nodes.nodes.data();
+    const HalfTreeNodeElement* node = first + root_id;
+    NTYPE val;
+    bool cond;
+    // Only models with the same mode for every node are stored as bfloat16.
+    switch(half_nodes.mode) {
+        case NODE_MODE::BRANCH_LEQ:
+            TREE_FIND_VALUE_HALF(<=)
+            break;
+        case NODE_MODE::BRANCH_LT:
+            TREE_FIND_VALUE_HALF(<)
+            break;
+        case NODE_MODE::BRANCH_GTE:
+            TREE_FIND_VALUE_HALF(>=)
+            break;
+        case NODE_MODE::BRANCH_GT:
+            TREE_FIND_VALUE_HALF(>)
+            break;
+        case NODE_MODE::BRANCH_EQ:
+            TREE_FIND_VALUE_HALF(==)
+            break;
+        case NODE_MODE::BRANCH_NEQ:
+            TREE_FIND_VALUE_HALF(!=)
+            break;
+        case NODE_MODE::LEAF:
+            break;
+        default: {
+            std::ostringstream err_msg;
+            err_msg << "Invalid mode of value(7): "
+                    << static_cast<std::underlying_type<NODE_MODE>::type>(half_nodes.mode);
+            throw std::invalid_argument(err_msg.str());
+        }
+    }
+    return (size_t)(node - first);
+}
+
+
+#define TREE_FIND_VALUE_QUANTIZED(CMP) \
+    if (has_missing_tracks_) { \
+        BIN val; \
+        while (node->is_not_leaf()) { \
+            val = bins[node->feature_id]; \
+            node = (val CMP node->threshold || \
+                    (node->is_missing_track_true && val == nan_bin)) \
+                        ? node + 1 : first + node->falsenode; \
+        } \
+    } \
+    else { \
+        while (node->is_not_leaf()) { \
+            node = bins[node->feature_id] CMP node->threshold \
+                        ? node + 1 : first + node->falsenode; \
+        } \
+    }
+
+
+template<typename NTYPE> template<typename BIN>
+size_t RuntimeTreeEnsembleCommonP<NTYPE>::ProcessTreeNodeLeave(
+            const QuantizedTreeNodeElements<NTYPE, BIN>& quantized_nodes,
+            size_t root_id, const BIN* bins) const {
+    const QuantizedTreeNodeElement<BIN>* first = quantized_nodes.nodes.data();
+    const QuantizedTreeNodeElement<BIN>* node = first + root_id;
+    const BIN nan_bin = quantized_nodes.nan_bin;
+    // Only models with the same mode for every node are quantized.
+    switch(quantized_nodes.mode) {
+        case NODE_MODE::BRANCH_LEQ:
+            TREE_FIND_VALUE_QUANTIZED(<=)
+            break;
+        case NODE_MODE::BRANCH_LT:
+            TREE_FIND_VALUE_QUANTIZED(<)
+            break;
+        case NODE_MODE::BRANCH_GTE:
+            TREE_FIND_VALUE_QUANTIZED(>=)
+            break;
+        case NODE_MODE::BRANCH_GT:
+            TREE_FIND_VALUE_QUANTIZED(>)
+            break;
+        case NODE_MODE::BRANCH_EQ:
+            TREE_FIND_VALUE_QUANTIZED(==)
+            break;
+        case NODE_MODE::BRANCH_NEQ:
+            TREE_FIND_VALUE_QUANTIZED(!=)
+            break;
+        case NODE_MODE::LEAF:
+            break;
+        default: {
+            std::ostringstream err_msg;
+            err_msg << "Invalid mode of value(5): "
+                    << static_cast<std::underlying_type<NODE_MODE>::type>(quantized_nodes.mode);
+            throw std::invalid_argument(err_msg.str());
+        }
+    }
+    return (size_t)(node - first);
+}
+
+
 template<typename NTYPE>
 py::array_t<int> RuntimeTreeEnsembleCommonP<NTYPE>::debug_threshold(
         py::array_t<NTYPE, py::array::c_style | py::array::forcecast> values) const {
@@ -1282,6 +4056,7 @@ py::array_t<NTYPE> RuntimeTreeEnsembleCommonP<NTYPE>::compute_tree_outputs_agg(
     int64_t stride = x_dims.size() == 1 ? x_dims[0] : x_dims[1];  
     int64_t N = x_dims.size() == 1 ? 1 : x_dims[0];
 
+    TreeEnsembleSharedLock lock(lock_);
     std::vector<NTYPE> result(N * roots_.size());
     const NTYPE* x_data = X.data(0);
     auto itb = result.begin();
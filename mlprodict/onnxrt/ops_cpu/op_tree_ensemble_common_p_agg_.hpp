@@ -11,6 +11,19 @@
 #include <thread>
 #include <iterator>
 #include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <fstream>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <set>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #ifndef SKIP_PYTHON
 //#include <pybind11/iostream.h>
@@ -38,6 +51,106 @@ struct TreeNodeElementId {
 };
 
 
+// Maps a node identifier to its position in the list of nodes.
+// When tree and node ids are almost contiguous (the usual case),
+// a position is found with two array lookups: the first one gives
+// the offset of the tree in a dense table, the second one the position
+// of the node. Otherwise, identifiers are sorted once and a position
+// is found with a binary search.
+class TreeNodeElementIndex {
+    protected:
+        bool dense_;
+        int min_tree_id_;
+        std::vector<int64_t> tree_offset_;
+        std::vector<int> tree_min_node_id_;
+        std::vector<int64_t> table_;
+        std::vector<std::pair<TreeNodeElementId, int64_t>> sorted_;
+
+    public:
+
+        TreeNodeElementIndex() : dense_(true), min_tree_id_(0) {}
+
+        // Returns -1 if ids are unique or the position of the first duplicated id.
+        int64_t init(const std::vector<int64_t>& tree_ids, const std::vector<int64_t>& node_ids) {
+            tree_offset_.clear();
+            tree_min_node_id_.clear();
+            table_.clear();
+            sorted_.clear();
+            if (tree_ids.empty())
+                return -1;
+
+            int min_tree_id = (int)tree_ids[0], max_tree_id = (int)tree_ids[0];
+            for(auto it = tree_ids.begin(); it != tree_ids.end(); ++it) {
+                min_tree_id = std::min(min_tree_id, (int)*it);
+                max_tree_id = std::max(max_tree_id, (int)*it);
+            }
+            int64_t n_tree_ids = (int64_t)max_tree_id - (int64_t)min_tree_id + 1;
+            dense_ = n_tree_ids <= (int64_t)tree_ids.size();
+            if (dense_) {
+                min_tree_id_ = min_tree_id;
+                std::vector<int> max_node_id(n_tree_ids, std::numeric_limits<int>::min());
+                tree_min_node_id_.resize(n_tree_ids, std::numeric_limits<int>::max());
+                for(size_t i = 0; i < tree_ids.size(); ++i) {
+                    int64_t t = (int)tree_ids[i] - min_tree_id_;
+                    tree_min_node_id_[t] = std::min(tree_min_node_id_[t], (int)node_ids[i]);
+                    max_node_id[t] = std::max(max_node_id[t], (int)node_ids[i]);
+                }
+                tree_offset_.resize(n_tree_ids + 1);
+                tree_offset_[0] = 0;
+                for(int64_t t = 0; t < n_tree_ids; ++t)
+                    tree_offset_[t + 1] = tree_offset_[t] + (
+                        max_node_id[t] < tree_min_node_id_[t]
+                            ? 0 : (int64_t)max_node_id[t] - (int64_t)tree_min_node_id_[t] + 1);
+                dense_ = tree_offset_[n_tree_ids] <= 2 * (int64_t)tree_ids.size() + n_tree_ids;
+            }
+            if (dense_) {
+                table_.resize(tree_offset_.back(), -1);
+                for(size_t i = 0; i < tree_ids.size(); ++i) {
+                    int64_t t = (int)tree_ids[i] - min_tree_id_;
+                    int64_t& pos = table_[tree_offset_[t] + ((int64_t)(int)node_ids[i] - tree_min_node_id_[t])];
+                    if (pos != -1)
+                        return (int64_t)i;
+                    pos = (int64_t)i;
+                }
+                return -1;
+            }
+
+            tree_offset_.clear();
+            tree_min_node_id_.clear();
+            sorted_.resize(tree_ids.size());
+            for(size_t i = 0; i < tree_ids.size(); ++i) {
+                sorted_[i].first.tree_id = (int)tree_ids[i];
+                sorted_[i].first.node_id = (int)node_ids[i];
+                sorted_[i].second = (int64_t)i;
+            }
+            std::sort(sorted_.begin(), sorted_.end());
+            int64_t duplicate = -1;
+            for(size_t i = 1; i < sorted_.size(); ++i) {
+                if (sorted_[i].first == sorted_[i - 1].first && (
+                        duplicate == -1 || sorted_[i].second < duplicate))
+                    duplicate = sorted_[i].second;
+            }
+            return duplicate;
+        }
+
+        // Returns the position of a node or -1 if it does not exist.
+        inline int64_t find(const TreeNodeElementId& id) const {
+            if (dense_) {
+                int64_t t = (int64_t)id.tree_id - min_tree_id_;
+                if (t < 0 || t + 1 >= (int64_t)tree_offset_.size())
+                    return -1;
+                int64_t n = (int64_t)id.node_id - tree_min_node_id_[t];
+                if (n < 0 || n >= tree_offset_[t + 1] - tree_offset_[t])
+                    return -1;
+                return table_[tree_offset_[t] + n];
+            }
+            auto it = std::lower_bound(
+                sorted_.begin(), sorted_.end(), std::pair<TreeNodeElementId, int64_t>(id, -1));
+            return (it == sorted_.end() || !(it->first == id)) ? -1 : it->second;
+        }
+};
+
+
 template<typename NTYPE>
 struct SparseValue {
     int64_t i;
@@ -78,6 +191,7 @@ struct TreeNodeElement {
 #define UINT_MAX 4294967295
 #endif
 #define ID_LEAF_TRUE_NODE UINT_MAX
+#define NOT_COMPLETE_TREE ((size_t)-1)
 
 template<typename NTYPE>
 struct ArrayTreeNodeElement {
@@ -117,6 +231,543 @@ struct ArrayTreeNodeElement {
     }
 };
 
+/**
+* Trees which can be padded to a complete binary tree without
+* too much memory overhead (*array_structure* is 1). A tree of depth *d*
+* stores its 2^d - 1 nodes level by level, the children of node *i* are
+* *2i+1* and *2i+2*, and its 2^d leaves refer to the leaves of
+* *ArrayTreeNodeElement*. A leaf above the last level becomes
+* a node whose children both lead to the same leaf.
+*/
+template<typename NTYPE>
+struct CompleteTreeNodeElements {
+    // One value per tree, node_offset is NOT_COMPLETE_TREE
+    // if the tree is not stored in this structure.
+    std::vector<size_t> node_offset;
+    std::vector<size_t> leaf_offset;
+    std::vector<uint32_t> depth;
+    // One value per node.
+    std::vector<uint32_t> feature_id;
+    std::vector<NTYPE> value;
+    std::vector<unsigned char> is_missing_track_true;
+    // One value per leaf.
+    std::vector<size_t> leaf_id;
+
+    inline bool is_complete(size_t tree_id) const {
+        return node_offset[tree_id] != NOT_COMPLETE_TREE;
+    }
+
+    int64_t get_sizeof() {
+        return sizeof(CompleteTreeNodeElements<NTYPE>) +
+            (node_offset.size() + leaf_offset.size() + leaf_id.size()) * sizeof(size_t) +
+            (depth.size() + feature_id.size()) * sizeof(uint32_t) +
+            value.size() * sizeof(NTYPE) +
+            is_missing_track_true.size() * sizeof(unsigned char);
+    }
+};
+
+/**
+* Behaves like a std::vector but it can also refer to a read-only
+* buffer it does not own (a memory mapped file). Any modification
+* of the container releases that buffer first.
+*/
+template<typename T>
+class MappedVector {
+    protected:
+        std::vector<T> vect_;
+        const T* mapped_;
+        size_t mapped_size_;
+
+    public:
+        typedef T value_type;
+        typedef T* iterator;
+        typedef const T* const_iterator;
+
+        MappedVector() : vect_(), mapped_(nullptr), mapped_size_(0) {}
+
+        inline void map(const T* data, size_t size) {
+            vect_ = std::vector<T>();
+            mapped_ = data;
+            mapped_size_ = size;
+        }
+        inline bool is_mapped() const { return mapped_ != nullptr; }
+
+        inline size_t size() const { return mapped_ == nullptr ? vect_.size() : mapped_size_; }
+        inline bool empty() const { return size() == 0; }
+        // The mapped buffer is never modified.
+        inline T* data() { return mapped_ == nullptr ? vect_.data() : const_cast<T*>(mapped_); }
+        inline const T* data() const { return mapped_ == nullptr ? vect_.data() : mapped_; }
+        inline T& operator[](size_t i) { return data()[i]; }
+        inline const T& operator[](size_t i) const { return data()[i]; }
+        inline iterator begin() { return data(); }
+        inline iterator end() { return data() + size(); }
+        inline const_iterator begin() const { return data(); }
+        inline const_iterator end() const { return data() + size(); }
+        inline const_iterator cbegin() const { return data(); }
+        inline const_iterator cend() const { return data() + size(); }
+
+        inline void clear() { unmap(); vect_.clear(); }
+        // Copies the mapped buffer before the container grows.
+        inline void reserve(size_t n) {
+            if (mapped_ != nullptr) {
+                vect_.assign(mapped_, mapped_ + mapped_size_);
+                unmap();
+            }
+            vect_.reserve(n);
+        }
+        inline void resize(size_t n) { unmap(); vect_.resize(n); }
+        inline void push_back(const T& value) { unmap(); vect_.push_back(value); }
+        template<typename IT>
+        inline void insert(iterator pos, IT first, IT last) {
+            if (mapped_ != nullptr)
+                throw std::runtime_error("A mapped buffer cannot be modified.");
+            vect_.insert(vect_.begin() + (pos - vect_.data()), first, last);
+        }
+
+    private:
+        inline void unmap() {
+            mapped_ = nullptr;
+            mapped_size_ = 0;
+        }
+};
+
+/**
+* Compact node used when *array_structure* is 2. It only keeps what
+* the traversal needs (threshold, feature, children, mode) so that two nodes
+* fit in a cache line. A leaf refers to a range of *PackedTreeNodeElements::weights*.
+*/
+template<typename NTYPE>
+struct PackedTreeNodeElement {
+    NTYPE value;
+    uint32_t feature_id;
+    uint32_t truenode;
+    uint32_t falsenode;
+    uint32_t weights_begin;
+    uint32_t weights_end;
+    uint8_t mode;
+    uint8_t is_missing_track_true;
+
+    inline bool is_not_leaf() const { 
+        return truenode != ID_LEAF_TRUE_NODE; 
+    }
+};
+
+static_assert(sizeof(PackedTreeNodeElement<double>) <= 32, "PackedTreeNodeElement must fit in 32 bytes.");
+
+template<typename NTYPE>
+struct PackedTreeNodeElements {
+    MappedVector<PackedTreeNodeElement<NTYPE>> nodes;
+    MappedVector<SparseValue<NTYPE>> weights;
+    MappedVector<size_t> root_id;
+    // Leaf weights stored as dense rows, a leaf row starts at
+    // dense_weights[weights_begin] and holds one value per target.
+    // It is empty unless every leaf has exactly one weight per target.
+    std::vector<NTYPE> dense_weights;
+
+    inline bool is_not_leaf(size_t i) const { 
+        return nodes[i].is_not_leaf(); 
+    }
+
+    // dense_weights is built by init_kernels which counts it.
+    int64_t get_sizeof() {
+        return sizeof(PackedTreeNodeElements<NTYPE>) +
+            nodes.size() * sizeof(PackedTreeNodeElement<NTYPE>) +
+            weights.size() * sizeof(SparseValue<NTYPE>) +
+            root_id.size() * sizeof(size_t);
+    }
+};
+
+/**
+* Lock shared by the computations and taken exclusively by
+* the updates of a model (init, append_trees, load_binary, schedule),
+* a pending update blocks the new computations (std::shared_mutex
+* requires C++17). The thread holding the exclusive lock can take it
+* again so that a subclass can update its own members and the
+* common ones at once.
+*/
+class TreeEnsembleLock {
+    private:
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        int readers_;
+        int writer_;
+        std::thread::id owner_;
+
+    public:
+        TreeEnsembleLock() : readers_(0), writer_(0) {}
+
+        void lock_shared() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return writer_ == 0; });
+            ++readers_;
+        }
+        void unlock_shared() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--readers_ == 0)
+                cond_.notify_all();
+        }
+        void lock() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (writer_ > 0 && owner_ == std::this_thread::get_id()) {
+                ++writer_;
+                return;
+            }
+            cond_.wait(lock, [this] { return writer_ == 0; });
+            writer_ = 1;
+            owner_ = std::this_thread::get_id();
+            cond_.wait(lock, [this] { return readers_ == 0; });
+        }
+        void unlock() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--writer_ == 0) {
+                owner_ = std::thread::id();
+                cond_.notify_all();
+            }
+        }
+};
+
+class TreeEnsembleSharedLock {
+    private:
+        TreeEnsembleLock& lock_;
+    public:
+        TreeEnsembleSharedLock(TreeEnsembleLock& lock) : lock_(lock) { lock_.lock_shared(); }
+        ~TreeEnsembleSharedLock() { lock_.unlock_shared(); }
+};
+
+template<typename T>
+inline void _append_vector_(std::vector<T>& dest, const std::vector<T>& src) {
+    dest.insert(dest.end(), src.begin(), src.end());
+}
+
+/**
+* Parallelization settings used for batches of at most *max_N*
+* observations, the fields follow the members of the runtime
+* with the same names.
+*/
+struct TreeEnsembleSchedule {
+    int64_t max_N;
+    int omp_tree;
+    int omp_N;
+    bool para_tree;
+    int64_t tile_cache_size;
+};
+
+#define TREE_ENSEMBLE_BINARY_MAGIC "MLPDTREE"
+#define TREE_ENSEMBLE_BINARY_VERSION 2
+#define TREE_ENSEMBLE_BINARY_ENDIANNESS 0x01020304
+#define TREE_ENSEMBLE_BINARY_ALIGNMENT 64
+
+/**
+* Header of the binary format storing the compact nodes
+* (*array_structure* is 2). Every section is aligned on 64 bytes,
+* its offset is relative to the beginning of the file.
+* The file is mapped in memory and the nodes are used without any copy.
+*/
+struct TreeEnsembleBinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endianness;
+    uint32_t sizeof_ntype;
+    uint32_t sizeof_size_t;
+    uint32_t sizeof_node;
+    uint32_t sizeof_weight;
+    int32_t aggregate_function;
+    int32_t post_transform;
+    int32_t same_mode;
+    int32_t has_missing_tracks;
+    int64_t n_targets_or_classes;
+    int64_t n_trees;
+    // number of elements, offset
+    uint64_t base_values[2];
+    uint64_t root_id[2];
+    uint64_t nodes[2];
+    uint64_t weights[2];
+    // int64 values specific to a subclass
+    uint64_t extra[2];
+    int64_t max_tree_depth;
+};
+
+/**
+* Structure used by the QuickScorer evaluation
+* (see `QuickScorer: a Fast Algorithm to Rank Documents with Additive
+* Ensembles of Regression Trees <http://pages.di.unipi.it/rossano/wp-content/
+* uploads/sites/7/2015/11/sigir15.pdf>`_).
+* Every tree has at most 64 leaves numbered from left (true branch) to right.
+* Every node is stored with a bitmask removing the leaves of its true branch,
+* nodes are sorted by feature then by threshold. The exit leaf of a tree
+* is the lowest bit still set once every false condition was applied.
+*/
+template<typename NTYPE>
+struct QuickScorerTreeNodeElements {
+    int64_t n_features;
+    bool strict;  // BRANCH_LT instead of BRANCH_LEQ
+    std::vector<size_t> feature_begin;
+    std::vector<NTYPE> thresholds;
+    std::vector<uint32_t> tree_id;
+    std::vector<uint64_t> masks;
+    std::vector<uint32_t> leaf_offset;
+    // Only the weights of the leaves are used.
+    PackedTreeNodeElements<NTYPE> leaves;
+
+    int64_t get_sizeof() {
+        return sizeof(QuickScorerTreeNodeElements<NTYPE>) +
+            feature_begin.size() * sizeof(size_t) +
+            thresholds.size() * sizeof(NTYPE) +
+            tree_id.size() * sizeof(uint32_t) +
+            masks.size() * sizeof(uint64_t) +
+            leaf_offset.size() * sizeof(uint32_t) +
+            leaves.get_sizeof();
+    }
+};
+
+/**
+* Quantized node used when *quantized_* is set (*array_structure* is 2).
+* The threshold is replaced by its bin index (see QuantizedTreeNodeElements),
+* nodes keep the position they have in *PackedTreeNodeElements*,
+* the true child of a node is stored right after it.
+*/
+template<typename BIN>
+struct QuantizedTreeNodeElement {
+    uint32_t feature_id;
+    uint32_t falsenode;
+    BIN threshold;
+    uint8_t is_missing_track_true;
+
+    inline bool is_not_leaf() const {
+        return falsenode != ID_LEAF_TRUE_NODE;
+    }
+};
+
+/**
+* Every feature is compared to a few sorted unique thresholds
+* *t_0 < ... < t_{n-1}*. A value *x* is mapped once per row
+* to the bin *1 + #{t_k < x} + #{t_k <= x}* and threshold *t_k* becomes
+* *2k+2*. Comparing both integers gives the same result as comparing
+* *x* and *t_k* whatever the rule is. A missing value is mapped
+* to *nan_bin*, every comparison with it is false except for BRANCH_NEQ.
+*/
+template<typename NTYPE, typename BIN>
+struct QuantizedTreeNodeElements {
+    NODE_MODE mode;
+    BIN nan_bin;
+    int64_t n_features;
+    std::vector<QuantizedTreeNodeElement<BIN>> nodes;
+    // thresholds of feature f are in [feature_begin[f], feature_begin[f+1]).
+    std::vector<size_t> feature_begin;
+    std::vector<NTYPE> thresholds;
+
+    inline void bin_row(const NTYPE* x_data, BIN* bins) const {
+        const NTYPE* begin;
+        const NTYPE* end;
+        const NTYPE* it;
+        for (int64_t f = 0; f < n_features; ++f) {
+            begin = thresholds.data() + feature_begin[f];
+            end = thresholds.data() + feature_begin[f + 1];
+            if (_isnan_(x_data[f])) {
+                bins[f] = nan_bin;
+                continue;
+            }
+            it = std::lower_bound(begin, end, x_data[f]);
+            bins[f] = (BIN)((it - begin) * 2 + ((it != end && *it == x_data[f]) ? 2 : 1));
+        }
+    }
+
+    int64_t get_sizeof() {
+        return sizeof(QuantizedTreeNodeElements<NTYPE, BIN>) +
+            nodes.size() * sizeof(QuantizedTreeNodeElement<BIN>) +
+            feature_begin.size() * sizeof(size_t) +
+            thresholds.size() * sizeof(NTYPE);
+    }
+};
+
+// Compares a value to a threshold following the rule of a node,
+// a missing value is not handled.
+template<typename NTYPE>
+inline bool _compare_threshold_(NODE_MODE mode, NTYPE val, NTYPE threshold) {
+    switch (mode) {
+        case NODE_MODE::BRANCH_LEQ:
+            return val <= threshold;
+        case NODE_MODE::BRANCH_LT:
+            return val < threshold;
+        case NODE_MODE::BRANCH_GTE:
+            return val >= threshold;
+        case NODE_MODE::BRANCH_GT:
+            return val > threshold;
+        case NODE_MODE::BRANCH_EQ:
+            return val == threshold;
+        case NODE_MODE::BRANCH_NEQ:
+            return val != threshold;
+        default:
+            throw std::invalid_argument(MakeString(
+                "Invalid mode of value(6): ", (int)mode));
+    }
+}
+
+// bfloat16 is the upper half of a float.
+inline uint16_t _float_to_bfloat16_truncated_(float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(float));
+    return (uint16_t)(bits >> 16);
+}
+
+inline uint16_t _float_to_bfloat16_(float v) {
+    // rounds to the nearest, ties to even
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(float));
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+
+inline float _bfloat16_to_float_(uint16_t v) {
+    uint32_t bits = (uint32_t)v << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
+
+#define HALF_LEAF 0x8000
+#define HALF_INEXACT 0x4000
+#define HALF_MISSING_TRACK_TRUE 0x2000
+#define HALF_FEATURE_MASK 0x1FFF
+
+inline uint32_t _popcount64_(uint64_t v) {
+#if defined(_MSC_VER)
+    return (uint32_t)__popcnt64(v);
+#else
+    return (uint32_t)__builtin_popcountll(v);
+#endif
+}
+
+/**
+* Node of 8 bytes storing its threshold as a bfloat16 (float models,
+* array_structure=2). A threshold *t* which is not a bfloat16 is
+* truncated into *t'* (flag HALF_INEXACT), a value *x* compares
+* the same way to *t* and *t'* unless both have the same truncation,
+* the comparison then uses the exact threshold stored aside
+* (HalfTreeNodeElements::exact_threshold).
+* The true child follows the node, *next* is the false child or
+* the leaf index for a leaf.
+*/
+struct HalfTreeNodeElement {
+    uint16_t threshold;
+    uint16_t feature;  // feature index and flags HALF_*
+    uint32_t next;
+};
+
+static_assert(sizeof(HalfTreeNodeElement) == 8, "HalfTreeNodeElement must fit in 8 bytes.");
+
+template<typename NTYPE>
+struct HalfTreeNodeElements {
+    NODE_MODE mode;
+    std::vector<HalfTreeNodeElement> nodes;
+    // bfloat16 leaf values, one row of n_targets values per leaf
+    std::vector<uint16_t> leaf_values;
+    // Exact thresholds of the nodes flagged HALF_INEXACT in node order,
+    // inexact_bits flags these nodes, inexact_rank[b] counts the flagged
+    // nodes before the block b of 64 nodes.
+    std::vector<float> exact_thresholds;
+    std::vector<uint64_t> inexact_bits;
+    std::vector<uint32_t> inexact_rank;
+
+    inline float exact_threshold(size_t i) const {
+        uint64_t before = inexact_bits[i >> 6] & ((((uint64_t)1) << (i & 63)) - 1);
+        return exact_thresholds[inexact_rank[i >> 6] + _popcount64_(before)];
+    }
+
+    int64_t get_sizeof() const {
+        return sizeof(HalfTreeNodeElements<NTYPE>) +
+            nodes.size() * sizeof(HalfTreeNodeElement) +
+            leaf_values.size() * sizeof(uint16_t) +
+            exact_thresholds.size() * sizeof(float) +
+            inexact_bits.size() * sizeof(uint64_t) +
+            inexact_rank.size() * sizeof(uint32_t);
+    }
+};
+
+/**
+* Lookup table replacing the first levels of a tree when they only
+* compare low-cardinality features (categorical or integer coded).
+* A value of such a feature is a code if it is an integer in
+* *[0, cardinality)*, the codes of *features* are combined into
+* *sum_i code_i prod_{k>i} cardinality_k* and *nodes* gives the
+* first node reached outside these levels (a leaf or a node where
+* the usual traversal continues).
+*/
+template<typename NTYPE>
+struct TreeLookupTable {
+    std::vector<uint32_t> features;
+    std::vector<uint32_t> cardinalities;
+    std::vector<uint32_t> nodes;
+
+    // Returns false if a value is outside the domain.
+    inline bool find(const NTYPE* x_data, size_t& node) const {
+        size_t code = 0;
+        NTYPE val;
+        uint32_t c;
+        for (size_t i = 0; i < features.size(); ++i) {
+            val = x_data[features[i]];
+            if (!(val >= 0) || val >= (NTYPE)cardinalities[i])
+                return false;
+            c = (uint32_t)val;
+            if ((NTYPE)c != val)
+                return false;
+            code = code * cardinalities[i] + c;
+        }
+        node = nodes[code];
+        return true;
+    }
+
+    int64_t get_sizeof() const {
+        return sizeof(TreeLookupTable<NTYPE>) +
+            (features.size() + cardinalities.size() + nodes.size()) * sizeof(uint32_t);
+    }
+};
+
+inline uint32_t _ctz64_(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctzll(v);
+#endif
+}
+
+// Accumulates a dense row of leaf weights into the scores,
+// these loops are vectorized.
+template<typename NTYPE>
+inline void _add_dense_row_(NTYPE* predictions, unsigned char* has_predictions,
+                            const NTYPE* row, int64_t n) {
+    #ifdef USE_OPENMP
+    #pragma omp simd
+    #endif
+    for (int64_t i = 0; i < n; ++i)
+        predictions[i] += row[i];
+    memset(has_predictions, 1, n);
+}
+
+template<typename NTYPE>
+inline void _min_dense_row_(NTYPE* predictions, unsigned char* has_predictions,
+                            const NTYPE* row, int64_t n) {
+    #ifdef USE_OPENMP
+    #pragma omp simd
+    #endif
+    for (int64_t i = 0; i < n; ++i)
+        predictions[i] = (!has_predictions[i] || row[i] < predictions[i]) ? row[i] : predictions[i];
+    memset(has_predictions, 1, n);
+}
+
+template<typename NTYPE>
+inline void _max_dense_row_(NTYPE* predictions, unsigned char* has_predictions,
+                            const NTYPE* row, int64_t n) {
+    #ifdef USE_OPENMP
+    #pragma omp simd
+    #endif
+    for (int64_t i = 0; i < n; ++i)
+        predictions[i] = (!has_predictions[i] || row[i] > predictions[i]) ? row[i] : predictions[i];
+    memset(has_predictions, 1, n);
+}
+
 template<typename NTYPE>
 class _Aggregator {
     protected:
@@ -135,6 +786,7 @@ class _Aggregator {
         inline size_t n_trees() const { return n_trees_; }
         inline size_t n_targets_or_classes() const { return n_targets_or_classes_; }
         inline NTYPE origin() const { return origin_; }
+        inline void set_n_trees(size_t n_trees) { n_trees_ = n_trees; }
 
     public:
 
@@ -158,6 +810,9 @@ class _Aggregator {
         inline void ProcessTreeNodePrediction1(NTYPE* predictions, const ArrayTreeNodeElement<NTYPE>& array_nodes,
                                                size_t node_id, unsigned char* has_predictions) const {}
 
+        inline void ProcessTreeNodePrediction1(NTYPE* predictions, const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                               size_t node_id, unsigned char* has_predictions) const {}
+
         inline void MergePrediction1(NTYPE* predictions, unsigned char* has_predictions,
                                      NTYPE* predictions2, unsigned char* has_predictions2) const {}
 
@@ -177,6 +832,9 @@ class _Aggregator {
         void ProcessTreeNodePrediction(NTYPE* predictions, const ArrayTreeNodeElement<NTYPE>& array_nodes,
                                        size_t node_id, unsigned char* has_predictions) const {}
 
+        void ProcessTreeNodePrediction(NTYPE* predictions, const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                       size_t node_id, unsigned char* has_predictions) const {}
+
         void MergePrediction(int64_t n,
                              NTYPE* predictions, unsigned char* has_predictions,
                              NTYPE* predictions2, unsigned char* has_predictions2) const {}
@@ -230,6 +888,13 @@ class _AggregatorSum : public _Aggregator<NTYPE> {
             *predictions += array_nodes.weights0[node_id].value;
         }
 
+        inline void ProcessTreeNodePrediction1(NTYPE* predictions,
+                                               const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                               size_t node_id,
+                                               unsigned char* has_predictions) const {
+            *predictions += packed_nodes.weights[packed_nodes.nodes[node_id].weights_begin].value;
+        }
+
         inline void MergePrediction1(NTYPE* predictions, unsigned char* has_predictions,
                                      const NTYPE* predictions2, const unsigned char* has_predictions2) const {
             *predictions += *predictions2;
@@ -261,6 +926,22 @@ class _AggregatorSum : public _Aggregator<NTYPE> {
             }
         }
 
+        void ProcessTreeNodePrediction(NTYPE* predictions, const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                       size_t node_id, unsigned char* has_predictions) const {
+            const PackedTreeNodeElement<NTYPE>& node = packed_nodes.nodes[node_id];
+            if (!packed_nodes.dense_weights.empty()) {
+                _add_dense_row_(predictions, has_predictions,
+                                packed_nodes.dense_weights.data() + node.weights_begin,
+                                this->n_targets_or_classes_);
+                return;
+            }
+            auto end = packed_nodes.weights.cbegin() + node.weights_end;
+            for(auto it = packed_nodes.weights.cbegin() + node.weights_begin; it != end; ++it) {
+                predictions[it->i] += it->value;
+                has_predictions[it->i] = 1;
+            }
+        }
+
         void MergePrediction(int64_t n, NTYPE* predictions, unsigned char* has_predictions,
                              const NTYPE* predictions2, const unsigned char* has_predictions2) const {
             for(int64_t i = 0; i < n; ++i) {
@@ -362,6 +1043,16 @@ class _AggregatorMin : public _Aggregator<NTYPE> {
             *has_predictions = 1;
         }
 
+        inline void ProcessTreeNodePrediction1(NTYPE* predictions,
+                                               const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                               size_t node_id,
+                                               unsigned char* has_predictions) const {
+            auto val = packed_nodes.weights[packed_nodes.nodes[node_id].weights_begin].value;
+            *predictions = (!(*has_predictions) || val < *predictions) 
+                                    ? val : *predictions;
+            *has_predictions = 1;
+        }
+
         inline void MergePrediction1(NTYPE* predictions, unsigned char* has_predictions,
                                        const NTYPE* predictions2, const unsigned char* has_predictions2) const {
             if (*has_predictions2) {
@@ -392,6 +1083,23 @@ class _AggregatorMin : public _Aggregator<NTYPE> {
             }
         }
 
+        void ProcessTreeNodePrediction(NTYPE* predictions, const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                       size_t node_id, unsigned char* has_predictions) const {
+            const PackedTreeNodeElement<NTYPE>& node = packed_nodes.nodes[node_id];
+            if (!packed_nodes.dense_weights.empty()) {
+                _min_dense_row_(predictions, has_predictions,
+                                packed_nodes.dense_weights.data() + node.weights_begin,
+                                this->n_targets_or_classes_);
+                return;
+            }
+            auto end = packed_nodes.weights.cbegin() + node.weights_end;
+            for(auto it = packed_nodes.weights.cbegin() + node.weights_begin; it != end; ++it) {
+                predictions[it->i] = (!has_predictions[it->i] || it->value < predictions[it->i]) 
+                                        ? it->value : predictions[it->i];
+                has_predictions[it->i] = 1;
+            }
+        }
+
         void MergePrediction(int64_t n, NTYPE* predictions, unsigned char* has_predictions,
                              const NTYPE* predictions2, const unsigned char* has_predictions2) const {
             for(int64_t i = 0; i < n; ++i) {
@@ -439,6 +1147,16 @@ class _AggregatorMax : public _Aggregator<NTYPE> {
             *has_predictions = 1;
         }
 
+        inline void ProcessTreeNodePrediction1(NTYPE* predictions,
+                                               const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                               size_t node_id,
+                                               unsigned char* has_predictions) const {
+            auto val = packed_nodes.weights[packed_nodes.nodes[node_id].weights_begin].value;
+            *predictions = (!(*has_predictions) || val > *predictions) 
+                                    ? val : *predictions;
+            *has_predictions = 1;
+        }
+
         inline void MergePrediction1(NTYPE* predictions, unsigned char* has_predictions,
                                      const NTYPE* predictions2, const unsigned char* has_predictions2) const {
             if (*has_predictions2) {
@@ -469,6 +1187,23 @@ class _AggregatorMax : public _Aggregator<NTYPE> {
             }
         }
 
+        void ProcessTreeNodePrediction(NTYPE* predictions, const PackedTreeNodeElements<NTYPE>& packed_nodes,
+                                       size_t node_id, unsigned char* has_predictions) const {
+            const PackedTreeNodeElement<NTYPE>& node = packed_nodes.nodes[node_id];
+            if (!packed_nodes.dense_weights.empty()) {
+                _max_dense_row_(predictions, has_predictions,
+                                packed_nodes.dense_weights.data() + node.weights_begin,
+                                this->n_targets_or_classes_);
+                return;
+            }
+            auto end = packed_nodes.weights.cbegin() + node.weights_end;
+            for(auto it = packed_nodes.weights.cbegin() + node.weights_begin; it != end; ++it) {
+                predictions[it->i] = (!has_predictions[it->i] || it->value > predictions[it->i]) 
+                                        ? it->value : predictions[it->i];
+                has_predictions[it->i] = 1;
+            }
+        }
+
         void MergePrediction(int64_t n, NTYPE* predictions, unsigned char* has_predictions,
                              NTYPE* predictions2, unsigned char* has_predictions2) const {
             for(int64_t i = 0; i < n; ++i) {
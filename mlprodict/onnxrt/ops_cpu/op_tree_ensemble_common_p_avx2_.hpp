@@ -0,0 +1,107 @@
+#pragma once
+
+// AVX2 kernel walking 8 rows through the same tree in lockstep.
+// The extensions are compiled without -mavx2, the kernel is compiled
+// for AVX2 with a function attribute and only called
+// if cpu_supports_avx2() is true.
+
+#include "op_tree_ensemble_common_p_agg_.hpp"
+#include <cstddef>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TREE_AVX2_KERNEL
+#include <immintrin.h>
+#endif
+
+#if defined(TREE_AVX2_KERNEL) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#endif
+
+#define AVX2_TREE_ROWS 8
+
+
+inline bool tree_avx2_kernel_available() {
+#if defined(TREE_AVX2_KERNEL)
+    return cpu_supports_avx2();
+#else
+    return false;
+#endif
+}
+
+
+/**
+* Walks rows x, x + stride, ..., x + 7 * stride through the tree starting
+* at node *root* and stores the reached leaves into *leaves*.
+* Every node must be BRANCH_LEQ. Thresholds, features and children are
+* gathered for the 8 rows at once, lanes which reached a leaf keep their
+* index until every lane is done. A missing value follows the false branch
+* unless the node tracks missing values (*has_missing_tracks*).
+*/
+#if defined(TREE_AVX2_KERNEL)
+TARGET_AVX2
+inline void tree_leaves_leq_avx2(const PackedTreeNodeElement<float>* nodes, uint32_t root,
+                                 const float* x, int64_t stride, bool has_missing_tracks,
+                                 uint32_t* leaves) {
+    typedef PackedTreeNodeElement<float> node_type;
+    const int* base = reinterpret_cast<const int*>(nodes);
+    const int* base_feature = base + offsetof(node_type, feature_id) / sizeof(int);
+    const int* base_true = base + offsetof(node_type, truenode) / sizeof(int);
+    const int* base_false = base + offsetof(node_type, falsenode) / sizeof(int);
+    // mode and is_missing_track_true share the same 32 bits.
+    const int* base_mode = base + offsetof(node_type, mode) / sizeof(int);
+    const __m256i missing_bit = _mm256_set1_epi32(
+        1 << (8 * (offsetof(node_type, is_missing_track_true) % sizeof(int))));
+
+    const __m256i node_stride = _mm256_set1_epi32((int)(sizeof(node_type) / sizeof(int)));
+    const __m256i leaf_id = _mm256_set1_epi32((int)ID_LEAF_TRUE_NODE);
+    const __m256i row_offset = _mm256_mullo_epi32(
+        _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)stride));
+
+    __m256i index = _mm256_set1_epi32((int)root);
+    __m256i offset, truenode, falsenode, feature, is_leaf, next;
+    __m256 th, val, cond;
+    for (;;) {
+        offset = _mm256_mullo_epi32(index, node_stride);
+        truenode = _mm256_i32gather_epi32(base_true, offset, 4);
+        is_leaf = _mm256_cmpeq_epi32(truenode, leaf_id);
+        if (_mm256_movemask_epi8(is_leaf) == -1)
+            break;
+        falsenode = _mm256_i32gather_epi32(base_false, offset, 4);
+        // Lanes already on a leaf read feature 0 of their row.
+        feature = _mm256_andnot_si256(is_leaf, _mm256_i32gather_epi32(base_feature, offset, 4));
+        th = _mm256_i32gather_ps(reinterpret_cast<const float*>(base), offset, 4);
+        val = _mm256_i32gather_ps(x, _mm256_add_epi32(row_offset, feature), 4);
+        // Ordered comparison, false if val is NaN.
+        cond = _mm256_cmp_ps(val, th, _CMP_LE_OQ);
+        if (has_missing_tracks) {
+            __m256i track = _mm256_and_si256(
+                _mm256_i32gather_epi32(base_mode, offset, 4), missing_bit);
+            __m256 track_true = _mm256_castsi256_ps(_mm256_cmpeq_epi32(track, missing_bit));
+            cond = _mm256_or_ps(cond, _mm256_and_ps(
+                track_true, _mm256_cmp_ps(val, val, _CMP_UNORD_Q)));
+        }
+        next = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(falsenode), _mm256_castsi256_ps(truenode), cond));
+        index = _mm256_castps_si256(_mm256_blendv_ps(
+            _mm256_castsi256_ps(next), _mm256_castsi256_ps(index),
+            _mm256_castsi256_ps(is_leaf)));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(leaves), index);
+}
+#else
+inline void tree_leaves_leq_avx2(const PackedTreeNodeElement<float>* nodes, uint32_t root,
+                                 const float* x, int64_t stride, bool has_missing_tracks,
+                                 uint32_t* leaves) {
+    throw std::runtime_error("AVX2 kernel is not available on this platform.");
+}
+#endif
+
+
+inline void tree_leaves_leq_avx2(const PackedTreeNodeElement<double>* nodes, uint32_t root,
+                                 const double* x, int64_t stride, bool has_missing_tracks,
+                                 uint32_t* leaves) {
+    throw std::runtime_error("AVX2 kernel is only implemented for float.");
+}
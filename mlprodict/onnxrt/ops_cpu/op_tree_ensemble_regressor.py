@@ -66,6 +66,31 @@ class TreeEnsembleRegressorCommon(OpRunUnaryNum):
             elif version == 3:
                 self.rt_ = RuntimeTreeEnsembleRegressorPFloat(
                     60, 20, True, True)
+            elif version == 4:
+                self.rt_ = RuntimeTreeEnsembleRegressorPFloat(
+                    60, 20, 2, True)
+            elif version == 5:
+                self.rt_ = RuntimeTreeEnsembleRegressorPFloat(
+                    60, 20, 2, True)
+                self.rt_.quickscorer_ = True
+            elif version == 6:
+                self.rt_ = RuntimeTreeEnsembleRegressorPFloat(
+                    60, 20, 2, True)
+                self.rt_.quantized_ = True
+            elif version == 7:
+                self.rt_ = RuntimeTreeEnsembleRegressorPFloat(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.tile_cache_size_ = 2 ** 20
+            elif version == 9:
+                self.rt_ = RuntimeTreeEnsembleRegressorPFloat(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.lookup_ = True
+            elif version == 10:
+                self.rt_ = RuntimeTreeEnsembleRegressorPFloat(
+                    60, 20, 2, True)
+                self.rt_.bfloat16_ = True
             else:
                 raise ValueError("Unknown version '{}'.".format(version))
         elif dtype == numpy.float64:
@@ -80,6 +105,31 @@ class TreeEnsembleRegressorCommon(OpRunUnaryNum):
             elif version == 3:
                 self.rt_ = RuntimeTreeEnsembleRegressorPDouble(
                     60, 20, True, True)
+            elif version == 4:
+                self.rt_ = RuntimeTreeEnsembleRegressorPDouble(
+                    60, 20, 2, True)
+            elif version == 5:
+                self.rt_ = RuntimeTreeEnsembleRegressorPDouble(
+                    60, 20, 2, True)
+                self.rt_.quickscorer_ = True
+            elif version == 6:
+                self.rt_ = RuntimeTreeEnsembleRegressorPDouble(
+                    60, 20, 2, True)
+                self.rt_.quantized_ = True
+            elif version == 7:
+                self.rt_ = RuntimeTreeEnsembleRegressorPDouble(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.tile_cache_size_ = 2 ** 20
+            elif version == 9:
+                self.rt_ = RuntimeTreeEnsembleRegressorPDouble(
+                    60, 20, 2, True)
+                self.rt_.avx2_ = False
+                self.rt_.lookup_ = True
+            elif version == 10:
+                self.rt_ = RuntimeTreeEnsembleRegressorPDouble(
+                    60, 20, 2, True)
+                self.rt_.bfloat16_ = True
             else:
                 raise ValueError("Unknown version '{}'.".format(version))
         else:
@@ -98,9 +148,14 @@ class TreeEnsembleRegressorCommon(OpRunUnaryNum):
         class :class:`RuntimeTreeEnsembleRegressorDouble
         <mlprodict.onnxrt.ops_cpu.op_tree_ensemble_regressor_.RuntimeTreeEnsembleRegressorDouble>`.
         """
-        if hasattr(x, 'todense'):
-            x = x.todense()
-        pred = self.rt_.compute(x)
+        if hasattr(x, 'tocsr') and hasattr(self.rt_, 'compute_csr'):
+            x = x.tocsr()
+            pred = self.rt_.compute_csr(
+                x.data, x.indices, x.indptr, x.shape[1])
+        else:
+            if hasattr(x, 'todense'):
+                x = x.todense()
+            pred = self.rt_.compute(x)
         if pred.shape[0] != x.shape[0]:
             pred = pred.reshape(x.shape[0], pred.shape[0] // x.shape[0])
         return (pred, )
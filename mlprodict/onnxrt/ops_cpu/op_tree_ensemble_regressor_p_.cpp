@@ -8,7 +8,7 @@ template<typename NTYPE>
 class RuntimeTreeEnsembleRegressorP : public RuntimeTreeEnsembleCommonP<NTYPE> {
     public:
 
-        RuntimeTreeEnsembleRegressorP(int omp_tree, int omp_N, bool array_structure, bool para_tree);
+        RuntimeTreeEnsembleRegressorP(int omp_tree, int omp_N, int array_structure, bool para_tree);
         ~RuntimeTreeEnsembleRegressorP();
 
         void init(
@@ -32,12 +32,20 @@ class RuntimeTreeEnsembleRegressorP : public RuntimeTreeEnsembleCommonP<NTYPE> {
         
         py::array_t<NTYPE> compute(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X);
         py::array_t<NTYPE> compute_tree_outputs(py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X);
+        py::array_t<NTYPE> compute_csr(
+            py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+            py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+            int64_t n_features);
+
+        void save_binary(const std::string& filename) const;
+        void load_binary(const std::string& filename);
 };
 
 
 template<typename NTYPE>
 RuntimeTreeEnsembleRegressorP<NTYPE>::RuntimeTreeEnsembleRegressorP(
-        int omp_tree, int omp_N, bool array_structure, bool para_tree) :
+        int omp_tree, int omp_N, int array_structure, bool para_tree) :
    RuntimeTreeEnsembleCommonP<NTYPE>(omp_tree, omp_N, array_structure, para_tree) {
 }
 
@@ -76,25 +84,65 @@ void RuntimeTreeEnsembleRegressorP<NTYPE>::init(
 }
 
 
+template<typename NTYPE>
+void RuntimeTreeEnsembleRegressorP<NTYPE>::save_binary(const std::string& filename) const {
+    this->write_binary(filename, std::vector<int64_t>());
+}
+
+
+template<typename NTYPE>
+void RuntimeTreeEnsembleRegressorP<NTYPE>::load_binary(const std::string& filename) {
+    this->read_binary(filename, "regressor", 0, 0);
+}
+
+
 template<typename NTYPE>
 py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE>::compute(
         py::array_t<NTYPE, py::array::c_style | py::array::forcecast> X) {
     switch(this->aggregate_function_) {
         case AGGREGATE_FUNCTION::AVERAGE:
             return this->compute_agg(X, _AggregatorAverage<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::SUM:
             return this->compute_agg(X, _AggregatorSum<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MIN:
             return this->compute_agg(X, _AggregatorMin<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MAX:
             return this->compute_agg(X, _AggregatorMax<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+    }        
+    throw std::invalid_argument("Unknown aggregation function in TreeEnsemble.");
+}
+
+
+template<typename NTYPE>
+py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE>::compute_csr(
+        py::array_t<NTYPE, py::array::c_style | py::array::forcecast> data,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indices,
+        py::array_t<int64_t, py::array::c_style | py::array::forcecast> indptr,
+        int64_t n_features) {
+    switch(this->aggregate_function_) {
+        case AGGREGATE_FUNCTION::AVERAGE:
+            return this->compute_csr_agg(data, indices, indptr, n_features, _AggregatorAverage<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+        case AGGREGATE_FUNCTION::SUM:
+            return this->compute_csr_agg(data, indices, indptr, n_features, _AggregatorSum<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+        case AGGREGATE_FUNCTION::MIN:
+            return this->compute_csr_agg(data, indices, indptr, n_features, _AggregatorMin<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
+                        this->post_transform_, &(this->base_values_)));
+        case AGGREGATE_FUNCTION::MAX:
+            return this->compute_csr_agg(data, indices, indptr, n_features, _AggregatorMax<NTYPE>(
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
     }        
     throw std::invalid_argument("Unknown aggregation function in TreeEnsemble.");
@@ -107,19 +155,19 @@ py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE>::compute_tree_outputs(
     switch(this->aggregate_function_) {
         case AGGREGATE_FUNCTION::AVERAGE:
             return this->compute_tree_outputs_agg(X, _AggregatorAverage<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::SUM:
             return this->compute_tree_outputs_agg(X, _AggregatorSum<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MIN:
             return this->compute_tree_outputs_agg(X, _AggregatorMin<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
         case AGGREGATE_FUNCTION::MAX:
             return this->compute_tree_outputs_agg(X, _AggregatorMax<NTYPE>(
-                        this->roots_.size(), this->n_targets_or_classes_,
+                        this->n_trees_, this->n_targets_or_classes_,
                         this->post_transform_, &(this->base_values_)));
     }        
     throw std::invalid_argument("Unknown aggregation function in TreeEnsemble.");
@@ -128,19 +176,19 @@ py::array_t<NTYPE> RuntimeTreeEnsembleRegressorP<NTYPE>::compute_tree_outputs(
 
 class RuntimeTreeEnsembleRegressorPFloat : public RuntimeTreeEnsembleRegressorP<float> {
     public:
-        RuntimeTreeEnsembleRegressorPFloat(int omp_tree, int omp_N, bool array_structure, bool para_tree) :
+        RuntimeTreeEnsembleRegressorPFloat(int omp_tree, int omp_N, int array_structure, bool para_tree) :
             RuntimeTreeEnsembleRegressorP<float>(omp_tree, omp_N, array_structure, para_tree) {}
 };
 
 
 class RuntimeTreeEnsembleRegressorPDouble : public RuntimeTreeEnsembleRegressorP<double> {
     public:
-        RuntimeTreeEnsembleRegressorPDouble(int omp_tree, int omp_N, bool array_structure, bool para_tree) :
+        RuntimeTreeEnsembleRegressorPDouble(int omp_tree, int omp_N, int array_structure, bool para_tree) :
             RuntimeTreeEnsembleRegressorP<double>(omp_tree, omp_N, array_structure, para_tree) {}
 };
 
 
-void test_tree_ensemble_regressor(int omp_tree, int omp_N, bool array_structure, bool para_tree,
+void test_tree_ensemble_regressor(int omp_tree, int omp_N, int array_structure, bool para_tree,
                                   const std::vector<float>& X,
                                   const std::vector<float>& base_values,
                                   const std::vector<float>& results,
@@ -220,7 +268,7 @@ void test_tree_ensemble_regressor(int omp_tree, int omp_N, bool array_structure,
                         (double)results[i],
                         (int)omp_tree,
                         (int)omp_N, (int)X.size()/3,
-                        (int)array_structure ? 1 : 0,
+                        (int)array_structure,
                         (int)para_tree ? 1 : 0,
                         (int)(one_obs ? 1 : 0),
                         (int)n_targets,
@@ -245,7 +293,7 @@ void test_tree_ensemble_regressor(int omp_tree, int omp_N, bool array_structure,
 
 
 void test_tree_regressor_multitarget_average(
-        int omp_tree, int omp_N, bool array_structure, bool para_tree,
+        int omp_tree, int omp_N, int array_structure, bool para_tree,
         bool oneobs, bool compute, bool check) {
     std::vector<float> X = {1.f, 0.0f, 0.4f, 3.0f, 44.0f, -3.f, 12.0f, 12.9f, -312.f, 23.0f, 11.3f, -222.f, 23.0f, 11.3f, -222.f, 23.0f, 3311.3f, -222.f, 23.0f, 11.3f, -222.f, 43.0f, 413.3f, -114.f};
     std::vector<float> results = {1.33333333f, 29.f, 3.f, 14.f, 2.f, 23.f, 2.f, 23.f, 2.f, 23.f, 2.66666667f, 17.f, 2.f, 23.f, 3.f, 14.f};
@@ -256,7 +304,7 @@ void test_tree_regressor_multitarget_average(
 
 
 void test_tree_regressor_multitarget_sum(
-        int omp_tree, int omp_N, bool array_structure, bool para_tree,
+        int omp_tree, int omp_N, int array_structure, bool para_tree,
         bool oneobs, bool compute, bool check) {
     std::vector<float> X = {1.f, 0.0f, 0.4f, 3.0f, 44.0f, -3.f, 12.0f, 12.9f, -312.f, 23.0f, 11.3f, -222.f, 23.0f, 11.3f, -222.f, 23.0f, 3311.3f, -222.f, 23.0f, 11.3f, -222.f, 43.0f, 413.3f, -114.f};
     std::vector<float> results = {1.33333333f, 29.f, 3.f, 14.f, 2.f, 23.f, 2.f, 23.f, 2.f, 23.f, 2.66666667f, 17.f, 2.f, 23.f, 3.f, 14.f};
@@ -269,7 +317,7 @@ void test_tree_regressor_multitarget_sum(
 
 
 void test_tree_regressor_multitarget_min(
-        int omp_tree, int omp_N, bool array_structure, bool para_tree,
+        int omp_tree, int omp_N, int array_structure, bool para_tree,
         bool oneobs, bool compute, bool check) {
     std::vector<float> X = {1.f, 0.0f, 0.4f, 3.0f, 44.0f, -3.f, 12.0f, 12.9f, -312.f, 23.0f, 11.3f, -222.f, 23.0f, 11.3f, -222.f, 23.0f, 3311.3f, -222.f, 23.0f, 11.3f, -222.f, 43.0f, 413.3f, -114.f};
     std::vector<float> results = {5.f, 28.f, 8.f, 19.f, 7.f, 28.f, 7.f, 28.f, 7.f, 28.f, 7.f, 19.f, 7.f, 28.f, 8.f, 19.f};
@@ -280,7 +328,7 @@ void test_tree_regressor_multitarget_min(
 
 
 void test_tree_regressor_multitarget_max(
-        int omp_tree, int omp_N, bool array_structure, bool para_tree,
+        int omp_tree, int omp_N, int array_structure, bool para_tree,
         bool oneobs, bool compute, bool check) {
     std::vector<float> X = {1.f, 0.0f, 0.4f, 3.0f, 44.0f, -3.f, 12.0f, 12.9f, -312.f, 23.0f, 11.3f, -222.f, 23.0f, 11.3f, -222.f, 23.0f, 3311.3f, -222.f, 23.0f, 11.3f, -222.f, 43.0f, 413.3f, -114.f};
     std::vector<float> results = {2.f, 41.f, 3.f, 14.f, 2.f, 23.f, 2.f, 23.f, 2.f, 23.f, 3.f, 23.f, 2.f, 23.f, 3.f, 14.f};
@@ -323,21 +371,86 @@ in :epkg:`onnxruntime`. Supports float only.
     to parallelize tree computation when the number of observations it 1
 :param omp_N: number of observations above which the runtime uses
     :epkg:`openmp` to parallelize the predictions
-:param array_structure: (bool) different implementation for better performance
+:param array_structure: (int) node layout, 0 for an array of structures,
+    1 for a structure of arrays, 2 for compact nodes with leaves weights
+    stored in a separate table
 :param para_tree: (bool) parallelize the computation per tree instead of observations
 )pbdoc");
 
-    clf.def(py::init<int, int, bool, bool>());
+    clf.def(py::init<int, int, int, bool>());
     clf.def_readwrite("omp_tree_", &RuntimeTreeEnsembleRegressorPFloat::omp_tree_,
         "Number of trees above which the computation is parallelized for one observation.");
     clf.def_readwrite("omp_N_", &RuntimeTreeEnsembleRegressorPFloat::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    clf.def_readonly("array_structure_", &RuntimeTreeEnsembleRegressorPFloat::array_structure_,
+        "Node layout (0: pointers, 1: structure of arrays, 2: compact nodes).");
+    clf.def_readwrite("complete_tree_ratio_", &RuntimeTreeEnsembleRegressorPFloat::complete_tree_ratio_,
+        "With array_structure=1, a tree is stored as a complete tree in level order "
+        "if its padded size is below this ratio times its size (0 disables it), "
+        "it must be set before *init*.");
+    clf.def_property("quickscorer_", &RuntimeTreeEnsembleRegressorPFloat::get_quickscorer, &RuntimeTreeEnsembleRegressorPFloat::set_quickscorer,
+        "Uses QuickScorer to evaluate the trees, *init* sets it to False if the model "
+        "is not supported. Set after *init*, it builds or releases the QuickScorer nodes.");
+    clf.def_property("avx2_", &RuntimeTreeEnsembleRegressorPFloat::get_avx2, &RuntimeTreeEnsembleRegressorPFloat::set_avx2,
+        "Uses the AVX2 kernel (float, array_structure=2, BRANCH_LEQ only), *init* "
+        "sets it to False if the model or the CPU is not supported. Set after *init*, "
+        "the model is checked again.");
+    clf.def_readwrite("quantized_", &RuntimeTreeEnsembleRegressorPFloat::quantized_,
+        "Bins every feature once per observation and compares bin indices instead of "
+        "thresholds (array_structure=2), it must be set before *init*, *init* sets it to "
+        "False if the model is not supported.");
+    clf.def_readwrite("csr_buffer_size_", &RuntimeTreeEnsembleRegressorPFloat::csr_buffer_size_,
+        "Size in bytes of the dense buffer the rows of a sparse input are copied into "
+        "by *compute_csr*, it only keeps the features the trees use.");
+    clf.def_readwrite("tile_cache_size_", &RuntimeTreeEnsembleRegressorPFloat::tile_cache_size_,
+        "Cache size in bytes (array_structure > 0), if not null, the trees are split into "
+        "chunks and the observations into blocks fitting in that cache, every thread "
+        "computes (chunk, block) tiles.");
+    clf.def_property("lookup_", &RuntimeTreeEnsembleRegressorPFloat::get_lookup, &RuntimeTreeEnsembleRegressorPFloat::set_lookup,
+        "Replaces the first levels of every tree comparing only low-cardinality features "
+        "(integer or half-integer thresholds) by a lookup table indexed by the combined "
+        "feature codes (array_structure=2), rows outside the codes follow the usual path, "
+        "*init* sets it to False if no tree can use it, set after *init*, the tables are built again.");
+    clf.def_property("lookup_max_cardinality_", &RuntimeTreeEnsembleRegressorPFloat::get_lookup_max_cardinality, &RuntimeTreeEnsembleRegressorPFloat::set_lookup_max_cardinality,
+        "Maximum number of codes of a low-cardinality feature (lookup), "
+        "set after *init*, the tables are built again.");
+    clf.def_property("lookup_max_size_", &RuntimeTreeEnsembleRegressorPFloat::get_lookup_max_size, &RuntimeTreeEnsembleRegressorPFloat::set_lookup_max_size,
+        "Maximum number of entries of a lookup table (lookup), "
+        "set after *init*, the tables are built again.");
+    clf.def_property("bfloat16_", &RuntimeTreeEnsembleRegressorPFloat::get_bfloat16, &RuntimeTreeEnsembleRegressorPFloat::set_bfloat16,
+        "Stores thresholds and leaf values as bfloat16 (float, array_structure=2, "
+        "SUM or AVERAGE, same rule for every node), comparisons stay exact, "
+        "leaf values are rounded and summed as floats, the nodes are added to "
+        "the packed ones which the other computations use (the memory grows), "
+        "*init* sets it to False if the model is not supported, set after *init*, "
+        "the bfloat16 nodes are built or released.");
+    clf.def_property("schedule_", &RuntimeTreeEnsembleRegressorPFloat::get_schedule, &RuntimeTreeEnsembleRegressorPFloat::set_schedule,
+        "Parallelization settings depending on the batch size, one row per bucket "
+        "*(max_N, omp_tree, omp_N, para_tree, tile_cache_size)*, a bucket applies "
+        "to batches up to *max_N* observations, the last one to bigger batches, "
+        "an empty list keeps the settings given to the constructor.");
+    clf.def("calibrate", &RuntimeTreeEnsembleRegressorPFloat::calibrate,
+        "Times every parallelization strategy on synthetic observations built from the "
+        "model thresholds for every batch size in *batch_sizes* (sorted, *repeat* runs), "
+        "stores the fastest settings in *schedule_* and returns them.");
     clf.def_readonly("roots_", &RuntimeTreeEnsembleRegressorPFloat::roots_,
                      "Returns the roots indices.");
     clf.def("init", &RuntimeTreeEnsembleRegressorPFloat::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
+    clf.def("append_trees", &RuntimeTreeEnsembleRegressorPFloat::append_trees,
+            "Appends trees to the model without initializing it again, it takes the ONNX "
+            "attributes describing the new trees in alphabetical order, the update waits "
+            "for the running computations, the next ones wait for the update.");
     clf.def("compute", &RuntimeTreeEnsembleRegressorPFloat::compute,
             "Computes the predictions for the random forest.");
+    clf.def("compute_csr", &RuntimeTreeEnsembleRegressorPFloat::compute_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
+    clf.def("save_binary", &RuntimeTreeEnsembleRegressorPFloat::save_binary,
+            "Saves the compact nodes (array_structure=2) into a binary file.");
+    clf.def("load_binary", &RuntimeTreeEnsembleRegressorPFloat::load_binary,
+            "Maps a file created by *save_binary* in memory and uses it instead of *init*, "
+            "processes loading the same file share the same memory pages.");
     clf.def("runtime_options", &RuntimeTreeEnsembleRegressorPFloat::runtime_options,
             "Returns indications about how the runtime was compiled.");
     clf.def("omp_get_max_threads", &RuntimeTreeEnsembleRegressorPFloat::omp_get_max_threads,
@@ -357,6 +470,8 @@ in :epkg:`onnxruntime`. Supports float only.
         "Tells if the model handles missing values.");
     clf.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleRegressorPFloat::get_nodes_modes,
         "Returns the mode for every node.");
+    clf.def_property_readonly("dense_weights_", &RuntimeTreeEnsembleRegressorPFloat::has_dense_weights,
+        "Tells if every leaf stores one dense row of weights (array_structure=2).");
     clf.def("__sizeof__", &RuntimeTreeEnsembleRegressorPFloat::get_sizeof,
         "Returns the size of the object.");
 
@@ -370,21 +485,86 @@ in :epkg:`onnxruntime`. Supports double only.
     to parallelize tree computation when the number of observations it 1
 :param omp_N: number of observations above which the runtime uses
     :epkg:`openmp` to parallelize the predictions
-:param array_structure: (bool) different implementation for better performance
+:param array_structure: (int) node layout, 0 for an array of structures,
+    1 for a structure of arrays, 2 for compact nodes with leaves weights
+    stored in a separate table
 :param para_tree: (bool) parallelize the computation per tree instead of observations
 )pbdoc");
 
-    cld.def(py::init<int, int, bool, bool>());
+    cld.def(py::init<int, int, int, bool>());
     cld.def_readwrite("omp_tree_", &RuntimeTreeEnsembleRegressorPDouble::omp_tree_,
         "Number of trees above which the computation is parallelized for one observation.");
     cld.def_readwrite("omp_N_", &RuntimeTreeEnsembleRegressorPDouble::omp_N_,
         "Number of observations above which the computation is parallelized.");
+    cld.def_readonly("array_structure_", &RuntimeTreeEnsembleRegressorPDouble::array_structure_,
+        "Node layout (0: pointers, 1: structure of arrays, 2: compact nodes).");
+    cld.def_readwrite("complete_tree_ratio_", &RuntimeTreeEnsembleRegressorPDouble::complete_tree_ratio_,
+        "With array_structure=1, a tree is stored as a complete tree in level order "
+        "if its padded size is below this ratio times its size (0 disables it), "
+        "it must be set before *init*.");
+    cld.def_property("quickscorer_", &RuntimeTreeEnsembleRegressorPDouble::get_quickscorer, &RuntimeTreeEnsembleRegressorPDouble::set_quickscorer,
+        "Uses QuickScorer to evaluate the trees, *init* sets it to False if the model "
+        "is not supported. Set after *init*, it builds or releases the QuickScorer nodes.");
+    cld.def_property("avx2_", &RuntimeTreeEnsembleRegressorPDouble::get_avx2, &RuntimeTreeEnsembleRegressorPDouble::set_avx2,
+        "Uses the AVX2 kernel (float, array_structure=2, BRANCH_LEQ only), *init* "
+        "sets it to False if the model or the CPU is not supported. Set after *init*, "
+        "the model is checked again.");
+    cld.def_readwrite("quantized_", &RuntimeTreeEnsembleRegressorPDouble::quantized_,
+        "Bins every feature once per observation and compares bin indices instead of "
+        "thresholds (array_structure=2), it must be set before *init*, *init* sets it to "
+        "False if the model is not supported.");
+    cld.def_readwrite("csr_buffer_size_", &RuntimeTreeEnsembleRegressorPDouble::csr_buffer_size_,
+        "Size in bytes of the dense buffer the rows of a sparse input are copied into "
+        "by *compute_csr*, it only keeps the features the trees use.");
+    cld.def_readwrite("tile_cache_size_", &RuntimeTreeEnsembleRegressorPDouble::tile_cache_size_,
+        "Cache size in bytes (array_structure > 0), if not null, the trees are split into "
+        "chunks and the observations into blocks fitting in that cache, every thread "
+        "computes (chunk, block) tiles.");
+    cld.def_property("lookup_", &RuntimeTreeEnsembleRegressorPDouble::get_lookup, &RuntimeTreeEnsembleRegressorPDouble::set_lookup,
+        "Replaces the first levels of every tree comparing only low-cardinality features "
+        "(integer or half-integer thresholds) by a lookup table indexed by the combined "
+        "feature codes (array_structure=2), rows outside the codes follow the usual path, "
+        "*init* sets it to False if no tree can use it, set after *init*, the tables are built again.");
+    cld.def_property("lookup_max_cardinality_", &RuntimeTreeEnsembleRegressorPDouble::get_lookup_max_cardinality, &RuntimeTreeEnsembleRegressorPDouble::set_lookup_max_cardinality,
+        "Maximum number of codes of a low-cardinality feature (lookup), "
+        "set after *init*, the tables are built again.");
+    cld.def_property("lookup_max_size_", &RuntimeTreeEnsembleRegressorPDouble::get_lookup_max_size, &RuntimeTreeEnsembleRegressorPDouble::set_lookup_max_size,
+        "Maximum number of entries of a lookup table (lookup), "
+        "set after *init*, the tables are built again.");
+    cld.def_property("bfloat16_", &RuntimeTreeEnsembleRegressorPDouble::get_bfloat16, &RuntimeTreeEnsembleRegressorPDouble::set_bfloat16,
+        "Stores thresholds and leaf values as bfloat16 (float, array_structure=2, "
+        "SUM or AVERAGE, same rule for every node), comparisons stay exact, "
+        "leaf values are rounded and summed as floats, the nodes are added to "
+        "the packed ones which the other computations use (the memory grows), "
+        "*init* sets it to False if the model is not supported, set after *init*, "
+        "the bfloat16 nodes are built or released.");
+    cld.def_property("schedule_", &RuntimeTreeEnsembleRegressorPDouble::get_schedule, &RuntimeTreeEnsembleRegressorPDouble::set_schedule,
+        "Parallelization settings depending on the batch size, one row per bucket "
+        "*(max_N, omp_tree, omp_N, para_tree, tile_cache_size)*, a bucket applies "
+        "to batches up to *max_N* observations, the last one to bigger batches, "
+        "an empty list keeps the settings given to the constructor.");
+    cld.def("calibrate", &RuntimeTreeEnsembleRegressorPDouble::calibrate,
+        "Times every parallelization strategy on synthetic observations built from the "
+        "model thresholds for every batch size in *batch_sizes* (sorted, *repeat* runs), "
+        "stores the fastest settings in *schedule_* and returns them.");
     cld.def_readonly("roots_", &RuntimeTreeEnsembleRegressorPDouble::roots_,
                      "Returns the roots indices.");
     cld.def("init", &RuntimeTreeEnsembleRegressorPDouble::init,
             "Initializes the runtime with the ONNX attributes in alphabetical order.");
+    cld.def("append_trees", &RuntimeTreeEnsembleRegressorPDouble::append_trees,
+            "Appends trees to the model without initializing it again, it takes the ONNX "
+            "attributes describing the new trees in alphabetical order, the update waits "
+            "for the running computations, the next ones wait for the update.");
     cld.def("compute", &RuntimeTreeEnsembleRegressorPDouble::compute,
             "Computes the predictions for the random forest.");
+    cld.def("compute_csr", &RuntimeTreeEnsembleRegressorPDouble::compute_csr,
+            "Computes the predictions for a sparse matrix in CSR format "
+            "(*data*, *indices*, *indptr*, *n_features*), missing values are null.");
+    cld.def("save_binary", &RuntimeTreeEnsembleRegressorPDouble::save_binary,
+            "Saves the compact nodes (array_structure=2) into a binary file.");
+    cld.def("load_binary", &RuntimeTreeEnsembleRegressorPDouble::load_binary,
+            "Maps a file created by *save_binary* in memory and uses it instead of *init*, "
+            "processes loading the same file share the same memory pages.");
     cld.def("runtime_options", &RuntimeTreeEnsembleRegressorPDouble::runtime_options,
             "Returns indications about how the runtime was compiled.");
     cld.def("omp_get_max_threads", &RuntimeTreeEnsembleRegressorPDouble::omp_get_max_threads,
@@ -404,6 +584,8 @@ in :epkg:`onnxruntime`. Supports double only.
         "Tells if the model handles missing values.");
     cld.def_property_readonly("nodes_modes_", &RuntimeTreeEnsembleRegressorPDouble::get_nodes_modes,
         "Returns the mode for every node.");
+    cld.def_property_readonly("dense_weights_", &RuntimeTreeEnsembleRegressorPDouble::has_dense_weights,
+        "Tells if every leaf stores one dense row of weights (array_structure=2).");
     cld.def("__sizeof__", &RuntimeTreeEnsembleRegressorPDouble::get_sizeof,
         "Returns the size of the object.");
 }
@@ -301,7 +301,8 @@ def get_extensions():
         'mlprodict.onnxrt.ops_cpu.op_conv_',
         [os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_conv_.cpp'),
          os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_conv_matrices_.cpp'),
-         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp')],
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp'),
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_num_.cpp')],
         extra_compile_args=extra_compile_args,
         extra_link_args=extra_link_args,
         include_dirs=[
@@ -351,7 +352,8 @@ def get_extensions():
         'mlprodict.onnxrt.ops_cpu.op_conv_transpose_',
         [os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_conv_transpose_.cpp'),
          os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_conv_matrices_.cpp'),
-         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp')],
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_.cpp'),
+         os.path.join(root, 'mlprodict/onnxrt/ops_cpu/op_common_num_.cpp')],
         extra_compile_args=extra_compile_args,
         extra_link_args=extra_link_args,
         include_dirs=[